@@ -0,0 +1,50 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "../Source/Types.h"
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Streams a file across a simulated multi-hop path. </summary>
+
+int BenchStream (int argc, char** argv);
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Compares cold and precomputed RSA operations. </summary>
+
+int BenchRsa (int argc, char** argv);
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Measures the hot-path primitives and prints JSON results. </summary>
+
+int BenchMicro (int argc, char** argv);
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Compares I/O engines streaming frames between interfaces. </summary>
+
+int BenchEngine (int argc, char** argv);
+
+#endif // BENCH_H
@@ -0,0 +1,253 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Bench.h"
+#include "../Source/Clock.h"
+#include "../Source/Packet.h"
+#include "../Source/Transport.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> State shared with the sending thread. </summary>
+
+struct EngineSender
+{
+	Transport*		Sender;		// Transport frames are sent on
+	uint32			Frames;		// Number of frames to send
+	uint32			Size;		// Length of every frame
+	volatile bool	Done;		// Every frame was sent
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> State shared with the receiving thread. </summary>
+
+struct EngineReceiver
+{
+	Transport*		Receiver;	// Transport frames arrive on
+	EngineSender*	Sender;		// State of the sending thread
+	uint64			Last;		// Microsecond the last frame arrived
+	uint32			Received;	// Number of frames received
+	volatile bool	Listening;	// Receiver started listening
+};
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sends every frame in bursts, flushing after each one like the
+///           router does. </summary>
+
+static void* EngineSend (void* data)
+{
+	EngineSender* state = (EngineSender*) data;
+	Transport* sender = state->Sender;
+
+	uint8* frame = new uint8[state->Size];
+	memset (frame, 0, state->Size);
+	memset (frame, 0xFF, Address::Length);
+	memcpy (frame + Address::Length, sender->GetAddress().Data, Address::Length);
+
+	uint16 type = htons (Packet::TYPE_BEACON);
+	memcpy (frame + 2 * Address::Length, &type, sizeof (uint16));
+
+	for (uint32 i = 0; i < state->Frames; ++i)
+	{
+		uint8* buffer = sender->Acquire (state->Size);
+		if (buffer != null)
+		{
+			memcpy (buffer, frame, state->Size);
+			sender->Send (Address::Broadcast, state->Size, buffer);
+		}
+
+		else sender->Send (Address::Broadcast, state->Size, frame);
+
+		if ((i + 1) % Transport::MaxBatch == 0)
+			sender->Flush();
+	}
+
+	sender->Flush();
+	state->Done = true;
+
+	delete[] frame;
+	return null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Receives frames on a thread other than the one which opened
+///           the transport, like the router does. </summary>
+/// <remarks> Stops once every frame arrived or nothing arrived for a
+///           while after the last one was sent. </remarks>
+
+static void* EngineReceive (void* data)
+{
+	EngineReceiver* state = (EngineReceiver*) data;
+	Transport* receiver = state->Receiver;
+
+	// Let the receiver start listening before anything is sent
+	Transport::Frame batch[Transport::MaxBatch];
+	receiver->Receive (Transport::MaxBatch, batch);
+
+	state->Last = Clock::Micro();
+	state->Listening = true;
+
+	while (state->Received < state->Sender->Frames)
+	{
+		uint32 count = receiver->Receive (Transport::MaxBatch, batch);
+		for (uint32 i = 0; i < count; ++i)
+			if (!batch[i].Outgoing) ++state->Received;
+
+		if (count > 0) state->Last = Clock::Micro();
+		elif (state->Sender->Done && Clock::Micro() - state->Last > 200000) break;
+		else usleep (10);
+	}
+
+	return null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the processor time used by the process in microseconds. </summary>
+
+static uint64 EngineCpu (void)
+{
+	rusage usage;
+	getrusage (RUSAGE_SELF, &usage);
+
+	return (uint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+					 usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Streams frames between two interfaces through one engine. </summary>
+
+static bool EngineRun (const char* engine, const std::string& from,
+					   const std::string& to, uint32 frames, uint32 size)
+{
+	std::string prefix = strcmp (engine, "raw") == 0 ? "" : std::string (engine) + ":";
+	Transport::Error error;
+
+	Transport* sender = Transport::Open (prefix + from, error);
+	if (sender == null)
+	{
+		printf ("  %-6s: %s\n", engine, Transport::ErrorString (error).c_str());
+		return false;
+	}
+
+	Transport* receiver = Transport::Open (prefix + to, error);
+	if (receiver == null)
+	{
+		printf ("  %-6s: %s\n", engine, Transport::ErrorString (error).c_str());
+		delete sender; return false;
+	}
+
+	EngineSender state;
+	state.Sender = sender;
+	state.Frames = frames;
+	state.Size   = size;
+	state.Done   = false;
+
+	EngineReceiver receiving;
+	receiving.Receiver  = receiver;
+	receiving.Sender    = &state;
+	receiving.Last      = 0;
+	receiving.Received  = 0;
+	receiving.Listening = false;
+
+	pthread_t receiveThread;
+	pthread_create (&receiveThread, null, EngineReceive, &receiving);
+	while (!receiving.Listening) usleep (1000);
+
+	uint64 cpu   = EngineCpu();
+	uint64 start = Clock::Micro();
+
+	pthread_t sendThread;
+	pthread_create (&sendThread, null, EngineSend, &state);
+
+	pthread_join (sendThread,    null);
+	pthread_join (receiveThread, null);
+
+	// Nothing may have arrived since the receiver started listening
+	uint64 last     = receiving.Last > start ? receiving.Last : start;
+	uint32 received = receiving.Received;
+
+	real64 elapsed = (real64) (last - start) / 1000000;
+	cpu = EngineCpu() - cpu;
+
+	printf ("  %-6s: %10.0f frames/s, %6.2f%% loss, %7.3f us CPU per frame\n",
+		engine, elapsed > 0 ? received / elapsed : 0.0,
+		(real64) (frames - received) * 100 / frames,
+		received > 0 ? (real64) cpu / received : 0.0);
+
+	delete receiver;
+	delete sender;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Compares I/O engines by streaming frames from one interface
+///           to another, such as the two ends of a veth pair. </summary>
+
+int BenchEngine (int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf ("Usage: Engine [From] [To] (Frames) (Size) (Engine,...)\n");
+		return 1;
+	}
+
+	uint32 frames = argc >= 3 ? atoi (argv[2]) : 1000000;
+	uint32 size   = argc >= 4 ? atoi (argv[3]) : 128;
+	std::string engines = argc >= 5 ? argv[4] : "raw,uring";
+
+	if (frames == 0 || size < 2 * Address::Length + sizeof (uint16) || size > 1500)
+		{ printf ("Invalid arguments\n"); return 1; }
+
+	printf ("  Frames      : %u of %u bytes\n", frames, size);
+
+	int result = 0;
+	std::string::size_type begin = 0;
+
+	forever
+	{
+		std::string::size_type end = engines.find (',', begin);
+		std::string engine = engines.substr (begin, end - begin);
+
+		if (!EngineRun (engine.c_str(), argv[0], argv[1], frames, size))
+			result = 1;
+
+		if (end == std::string::npos) break;
+		begin = end + 1;
+	}
+
+	printf ("\n");
+	return result;
+}
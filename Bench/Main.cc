@@ -0,0 +1,91 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Bench.h"
+
+#include <cstdio>
+#include <cstring>
+
+
+
+//----------------------------------------------------------------------------//
+// Types                                                                      //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Represents a single runnable benchmark. </summary>
+
+struct Benchmark
+{
+	const char* Name;					// Name used on the command line
+	const char* Description;			// Short description
+	int (*Run) (int argc, char** argv);	// Entry point
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> List of every available benchmark. </summary>
+
+static const Benchmark Benchmarks[] =
+{
+	{ "Stream", "Streams a file across a simulated multi-hop path", BenchStream },
+	{ "Rsa",    "Compares cold and precomputed RSA operations",     BenchRsa    },
+	{ "Micro",  "Measures the hot-path primitives as JSON",         BenchMicro  },
+	{ "Engine", "Compares I/O engines across an interface pair",    BenchEngine },
+};
+
+static const uint32 BenchmarkCount = sizeof (Benchmarks) / sizeof (Benchmark);
+
+
+
+//----------------------------------------------------------------------------//
+// Main                                                                       //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Runs the benchmark named by the first argument, or every
+///           benchmark if no name was specified. Any remaining arguments
+///           are passed on to the benchmark. </summary>
+
+int main (int argc, char** argv)
+{
+	int result = 0;
+	bool found = false;
+
+	for (uint32 i = 0; i < BenchmarkCount; ++i)
+	{
+		if (argc >= 2 && strcasecmp (argv[1], Benchmarks[i].Name) != 0)
+			continue;
+
+		// Keep standard output machine-readable
+		found = true;
+		fprintf (stderr, "%s - %s\n", Benchmarks[i].Name, Benchmarks[i].Description);
+
+		if (Benchmarks[i].Run (argc >= 2 ? argc - 2 : 0, argv + 2) != 0)
+			result = 1;
+	}
+
+	if (!found)
+	{
+		printf ("Unknown benchmark, available benchmarks:\n");
+		for (uint32 i = 0; i < BenchmarkCount; ++i)
+			printf ("  %-10s - %s\n", Benchmarks[i].Name, Benchmarks[i].Description);
+		return 1;
+	}
+
+	return result;
+}
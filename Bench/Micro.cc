@@ -0,0 +1,432 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Bench.h"
+#include "../Source/Clock.h"
+#include "../Source/CRC32.h"
+#include "../Source/OnionRouter.h"
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <arpa/inet.h>
+
+using std::string;
+using std::vector;
+
+
+
+//----------------------------------------------------------------------------//
+// Types                                                                      //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Minimum time spent measuring each benchmark in nanoseconds. </summary>
+
+#define MIN_TIME 250000000ULL
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Maximum number of hops measured for layered encryption. </summary>
+
+#define MAX_HOPS 8
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Length of the message used for the router benchmarks. </summary>
+
+#define PAYLOAD_LENGTH 64
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Drives the internals of a router without opening a socket. </summary>
+
+class RouterBench
+{
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Uses the identity for decryption and prepares the inbox. </summary>
+
+	static void Attach (OnionRouter& router, Identity* identity)
+	{
+		// The pool holds as many buffers as the router inbox
+		router.mIdentity = identity;
+		router.mPool = new BufferPool (identity->RsaState.len, 128);
+		router.mFramePool = new BufferPool (2048, 128);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Adds a neighbor using the public part of the identity. </summary>
+
+	static OnionRouter::Node* AddNode (OnionRouter& router,
+		const Address& address, const Identity& identity)
+	{
+		OnionRouter::Node* node = new OnionRouter::Node;
+		node->Addr     = address;
+		node->Seen     = Clock::Micro();
+		node->Link     = 0;
+
+		mpi_copy (&node->Idnt.N, &identity.RsaState.N);
+		mpi_lset (&node->Idnt.E, EXPONENT);
+		node->Idnt.len = identity.RsaState.len;
+		Identity::PrecomputePublic (node->Idnt);
+
+		node->Entry = router.Network.insert (router.Network.end(), node);
+		return node;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Removes and deletes every neighbor. </summary>
+
+	static void ClearNodes (OnionRouter& router)
+	{
+		while (!router.Network.empty())
+		{
+			delete router.Network.back();
+			router.Network.pop_back();
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Encrypts the input in layers along the path of the destination. </summary>
+
+	static bool Encrypt (OnionRouter& router, const Address&
+		destination, const Message& input, Packet& packet)
+	{
+		Address next;
+		return router.EncryptLayered (destination, input, packet, next);
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Decrypts, verifies and delivers or relays a message. </summary>
+
+	static void Process (OnionRouter& router, Packet& packet)
+	{
+		router.ProcessMessage (packet, Clock::Now());
+	}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Represents the result of a single benchmark. </summary>
+
+class Result
+{
+public:
+	string		Name;			// Benchmark name
+	uint64		Operations;		// Number of operations measured
+	real64		NsPerOp;		// Nanoseconds per operation
+};
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Repeats an operation until MIN_TIME has been measured. </summary>
+/// <remarks> The operation runs count times and returns the nanoseconds
+///           it measured, so setup work can be excluded from the time. </remarks>
+
+static void Measure (vector<Result>& results, const string& name,
+					 std::function<uint64 (uint32 count)> operation)
+{
+	uint64 elapsed = 0;
+	uint64 operations = 0;
+	uint32 count = 1;
+
+	// Warm up caches and branch predictors
+	operation (1);
+
+	while (elapsed < MIN_TIME)
+	{
+		elapsed += operation (count);
+		operations += count;
+
+		// Grow the batch while it is short
+		if (count < (1 << 20)) count <<= 1;
+	}
+
+	Result result;
+	result.Name       = name;
+	result.Operations = operations;
+	result.NsPerOp    = (real64) elapsed / operations;
+	results.push_back (result);
+
+	fprintf (stderr, "  %-28s %14.1f ns/op\n", name.c_str(), result.NsPerOp);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Writes every result as a JSON document. </summary>
+
+static void WriteJson (FILE* file, const vector<Result>& results)
+{
+	fprintf (file, "{\n  \"benchmarks\": [\n");
+
+	for (uint32 i = 0; i < results.size(); ++i)
+	{
+		fprintf (file, "    { \"name\": \"%s\", \"operations\": %llu, "
+			"\"ns_per_op\": %.3f, \"ops_per_sec\": %.3f }%s\n",
+			results[i].Name.c_str(), results[i].Operations, results[i].NsPerOp,
+			1000000000.0 / results[i].NsPerOp, i + 1 < results.size() ? "," : "");
+	}
+
+	fprintf (file, "  ]\n}\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Measures CRC32 over several buffer sizes. </summary>
+
+static void BenchCRC32 (vector<Result>& results)
+{
+	static const uint32 sizes[] = { 16, 64, 256, 1500, 65536 };
+	static uint8 data[65536];
+
+	for (uint32 i = 0; i < sizeof (data); ++i)
+		data[i] = (uint8) (i * 31);
+
+	for (uint32 s = 0; s < sizeof (sizes) / sizeof (uint32); ++s)
+	{
+		uint32 size = sizes[s];
+		char name[64]; sprintf (name, "CRC32.Add/%u", size);
+
+		Measure (results, name, [size] (uint32 count) -> uint64
+		{
+			volatile uint32 sink;
+			uint64 start = Clock::Now();
+
+			for (uint32 i = 0; i < count; ++i)
+			{
+				CRC32 crc;
+				crc.Add (size, data);
+				sink = crc.Value;
+			}
+
+			(void) sink;
+			return Clock::Now() - start;
+		});
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Measures packet serialization over several path lengths. </summary>
+
+static void BenchPacket (vector<Result>& results, uint32 keyLength)
+{
+	static const uint32 paths[] = { 0, 1, 2, 4, 8 };
+
+	for (uint32 p = 0; p < sizeof (paths) / sizeof (uint32); ++p)
+	{
+		// Build a message carrying the path
+		Packet packet;
+		packet.Target = Address (2, 0, 0, 0, 0, 1);
+		packet.Source = Address (2, 0, 0, 0, 0, 2);
+		packet.IPType = htons (Packet::TYPE_MESSAGE);
+		packet.Msg.Create (keyLength);
+		memset (packet.Msg.GetData(), 0x5A, keyLength);
+
+		for (uint32 i = 0; i < paths[p]; ++i)
+			packet.Addresses.push_back (Address (2, 0, 0, 0, 1, i));
+
+		for (uint32 i = 0; i <= paths[p]; ++i)
+			packet.Hashes.push_back (i * 0x9E3779B9);
+
+		uint32 length = packet.ComputeSize();
+		uint8* buffer = new uint8[length];
+		packet.Serialize (length, buffer);
+
+		char name[64]; sprintf (name, "Packet.Serialize/%u", paths[p]);
+		Measure (results, name, [&] (uint32 count) -> uint64
+		{
+			uint64 start = Clock::Now();
+			for (uint32 i = 0; i < count; ++i)
+				packet.Serialize (length, buffer);
+			return Clock::Now() - start;
+		});
+
+		sprintf (name, "Packet.Deserialize/%u", paths[p]);
+		Measure (results, name, [&] (uint32 count) -> uint64
+		{
+			uint64 start = Clock::Now();
+			for (uint32 i = 0; i < count; ++i)
+			{
+				Packet output;
+				output.Deserialize (length, buffer);
+			}
+			return Clock::Now() - start;
+		});
+
+		delete[] buffer;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Measures address string conversions. </summary>
+
+static void BenchAddress (vector<Result>& results)
+{
+	Address address (0x02, 0x1B, 0x2C, 0x3D, 0x4E, 0x5F);
+	string text = address.ToString();
+
+	Measure (results, "Address.ToString", [&] (uint32 count) -> uint64
+	{
+		uint64 start = Clock::Now();
+		for (uint32 i = 0; i < count; ++i)
+			text = address.ToString();
+		return Clock::Now() - start;
+	});
+
+	Measure (results, "Address.FromString", [&] (uint32 count) -> uint64
+	{
+		uint64 start = Clock::Now();
+		for (uint32 i = 0; i < count; ++i)
+			address.FromString (text);
+		return Clock::Now() - start;
+	});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Measures layered encryption and message decryption. </summary>
+
+static bool BenchRouter (vector<Result>& results, uint16 bits)
+{
+	Identity identity;
+	if (identity.Create (bits) != Identity::ERROR_NONE)
+		{ fprintf (stderr, "Unable to create a %u bit identity\n", bits); return false; }
+
+	OnionRouter router;
+	RouterBench::Attach (router, &identity);
+
+	// Every hop shares the key, which does not change the cost
+	Address addresses[MAX_HOPS];
+	OnionRouter::Node* nodes[MAX_HOPS];
+
+	for (uint32 i = 0; i < MAX_HOPS; ++i)
+	{
+		addresses[i] = Address (2, 0, 0, 0, 0, i + 1);
+		nodes[i] = RouterBench::AddNode (router, addresses[i], identity);
+	}
+
+	Message input;
+	input.Create (PAYLOAD_LENGTH);
+	memset (input.GetData(), 0x42, PAYLOAD_LENGTH);
+
+	for (uint32 hops = 1; hops <= MAX_HOPS; ++hops)
+	{
+		// Route to the last hop through every hop before it
+		OnionRouter::Node* destination = nodes[hops - 1];
+		destination->Addresses.clear();
+
+		for (uint32 i = hops - 1; i > 0; --i)
+			destination->Addresses.push_back (addresses[i - 1]);
+
+		char name[64]; sprintf (name, "EncryptLayered/%u/%u", bits, hops);
+		Measure (results, name, [&] (uint32 count) -> uint64
+		{
+			uint64 start = Clock::Now();
+			for (uint32 i = 0; i < count; ++i)
+			{
+				Packet packet;
+				RouterBench::Encrypt (router, destination->Addr, input, packet);
+			}
+			return Clock::Now() - start;
+		});
+	}
+
+	// Build a frame that decrypts to a delivered message
+	Packet packet;
+	packet.Target = Address::Null;
+	packet.Source = addresses[0];
+	packet.IPType = htons (Packet::TYPE_MESSAGE);
+	RouterBench::Encrypt (router, addresses[0], input, packet);
+
+	uint32 length = packet.ComputeSize();
+	uint8* frame = new uint8[length];
+	packet.Serialize (length, frame);
+
+	char name[64]; sprintf (name, "ProcessMessage/%u", bits);
+	Measure (results, name, [&] (uint32 count) -> uint64
+	{
+		uint64 elapsed = 0;
+		for (uint32 i = 0; i < count; ++i)
+		{
+			// Parsing is measured separately
+			Packet received;
+			received.Deserialize (length, frame);
+
+			uint64 start = Clock::Now();
+			RouterBench::Process (router, received);
+			elapsed += Clock::Now() - start;
+		}
+		return elapsed;
+	});
+
+	delete[] frame;
+	RouterBench::ClearNodes (router);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Measures the hot-path primitives and prints JSON results. </summary>
+/// <remarks> Arguments are a comma separated list of key lengths and an
+///           optional file which also receives the JSON results. </remarks>
+
+int BenchMicro (int argc, char** argv)
+{
+	string keys = argc >= 1 ? argv[0] : "1024,2048";
+	const char* output = argc >= 2 ? argv[1] : null;
+
+	vector<uint16> lengths;
+	for (const char* k = keys.c_str(); *k != 0; )
+	{
+		uint16 bits = (uint16) strtoul (k, (char**) &k, 10);
+		if (bits < 128 || bits >= 4088)
+			{ printf ("Invalid arguments\n"); return 1; }
+
+		lengths.push_back (bits);
+		if (*k == ',') ++k;
+		elif (*k != 0) { printf ("Invalid arguments\n"); return 1; }
+	}
+
+	vector<Result> results;
+	BenchCRC32   (results);
+	BenchPacket  (results, lengths.back() / 8);
+	BenchAddress (results);
+
+	for (uint32 i = 0; i < lengths.size(); ++i)
+		if (!BenchRouter (results, lengths[i])) return 1;
+
+	WriteJson (stdout, results);
+
+	if (output != null)
+	{
+		FILE* file = fopen (output, "w");
+		if (file == null)
+			{ fprintf (stderr, "Unable to open %s\n", output); return 1; }
+
+		WriteJson (file, results);
+		fclose (file);
+	}
+
+	return 0;
+}
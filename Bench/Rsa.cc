@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Bench.h"
+#include "../Source/Clock.h"
+#include "../Source/Identity.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Times RSA operations with and without cached Montgomery values. </summary>
+/// <remarks> A cold operation discards the cache first, which is what every
+///           operation cost before the contexts were precomputed. </remarks>
+
+static real64 TimeOperation (rsa_context& context, bool isPrivate,
+							 bool cold, uint32 iterations, uint8* buffer)
+{
+	uint64 elapsed = 0;
+
+	for (uint32 i = 0; i < iterations; ++i)
+	{
+		if (cold)
+		{
+			mpi_free (&context.RN);
+			mpi_free (&context.RP);
+			mpi_free (&context.RQ);
+		}
+
+		uint64 start = Clock::Now();
+
+		if (isPrivate)
+			rsa_private (&context, buffer, buffer);
+		else rsa_public (&context, buffer, buffer);
+
+		elapsed += Clock::Now() - start;
+	}
+
+	return (real64) elapsed / iterations;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Compares cold and precomputed RSA public and private operations. </summary>
+
+int BenchRsa (int argc, char** argv)
+{
+	uint16 bits       = argc >= 1 ? atoi (argv[0]) : 1024;
+	uint32 iterations = argc >= 2 ? atoi (argv[1]) :  200;
+
+	if (bits < 128 || bits >= 4088 || iterations == 0)
+		{ printf ("Invalid arguments\n"); return 1; }
+
+	Identity identity;
+	if (identity.Create (bits) != Identity::ERROR_NONE)
+		{ printf ("Unable to create identity\n"); return 1; }
+
+	// A neighbor key only carries the public values
+	rsa_context neighbor;
+	rsa_init (&neighbor, RSA_PKCS_V15, 0);
+	mpi_copy (&neighbor.N, &identity.RsaState.N);
+	mpi_lset (&neighbor.E, EXPONENT);
+	neighbor.len = identity.RsaState.len;
+
+	uint8* buffer = new uint8[identity.RsaState.len];
+	memset (buffer, 0, identity.RsaState.len);
+	buffer[identity.RsaState.len - 1] = 1;
+
+	real64 publicCold  = TimeOperation (neighbor, false, true, iterations, buffer);
+	Identity::PrecomputePublic (neighbor);
+	real64 publicWarm  = TimeOperation (neighbor, false, false, iterations, buffer);
+
+	real64 privateCold = TimeOperation (identity.RsaState, true, true, iterations, buffer);
+	identity.Precompute();
+	real64 privateWarm = TimeOperation (identity.RsaState, true, false, iterations, buffer);
+
+	printf ("  Key         : %u bits, %u iterations\n", bits, iterations);
+	printf ("  Public      : %10.0f ns cold, %10.0f ns precomputed (%.1f%% saved)\n",
+		publicCold, publicWarm, (publicCold - publicWarm) * 100 / publicCold);
+	printf ("  Private     : %10.0f ns cold, %10.0f ns precomputed (%.1f%% saved)\n\n",
+		privateCold, privateWarm, (privateCold - privateWarm) * 100 / privateCold);
+
+	rsa_free (&neighbor);
+	delete[] buffer;
+	return 0;
+}
@@ -0,0 +1,291 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Bench.h"
+#include "../Source/Clock.h"
+#include "../Source/Stream.h"
+
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+using std::multimap;
+using std::make_pair;
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Simulates a chain of store and forward links between two
+///           endpoints. Every link has a rate, a propagation latency,
+///           a loss probability and a bounded queue. Random jitter on
+///           arrival reorders segments and acknowledgements. </summary>
+
+class SimulatedPath : public Stream::Channel
+{
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single frame travelling along the path. </summary>
+
+	class Frame
+	{
+	public:
+		Address	Dest;		// Destination endpoint
+		Message	Data;		// Segment data
+	};
+
+public:
+	// Constructors
+	SimulatedPath (const Address& receiver, uint32 hops, uint64 latency,
+				   real64 rate, real64 loss, uint32 segment, uint64 jitter)
+	{
+		mReceiver = receiver;
+		mHops     = hops;
+		mLatency  = latency;
+		mRate     = rate;
+		mLoss     = loss;
+		mSegment  = segment;
+		mJitter   = jitter;
+		Frames    = 0;
+		Lost      = 0;
+		Reordered = 0;
+
+		mLast[0] = 0;
+		mLast[1] = 0;
+
+		mForward = new uint64[hops];
+		mReverse = new uint64[hops];
+		memset (mForward, 0, sizeof (uint64) * hops);
+		memset (mReverse, 0, sizeof (uint64) * hops);
+	}
+
+	~SimulatedPath (void)
+	{
+		for (multimap<uint64, Frame*>::iterator i = mQueue.
+			begin(); i != mQueue.end(); ++i) delete i->second;
+
+		delete[] mForward;
+		delete[] mReverse;
+	}
+
+public:
+	// Channel
+	uint32 GetSegmentLength (const Address& destination)
+	{
+		return mSegment;
+	}
+
+	bool Transmit (const Address& destination, const Message& segment)
+	{
+		uint64* links = destination == mReceiver ? mForward : mReverse;
+		uint64  time  = Clock::Micro();
+		++Frames;
+
+		// Serialization delay of this frame on a single link
+		uint64 serial = (uint64) (segment.GetLength() * 8 / mRate);
+
+		for (uint32 i = 0; i < mHops; ++i)
+		{
+			// Random loss and tail drop on a full queue
+			if (drand48() < mLoss || (links[i] > time &&
+				links[i] - time > 50000)) { ++Lost; return true; }
+
+			uint64 start = links[i] > time ? links[i] : time;
+			links[i] = start + serial;
+			time = links[i] + mLatency;
+		}
+
+		// Jitter lets later frames overtake this one
+		time += (uint64) (drand48() * mJitter);
+
+		uint64& last = mLast[links == mForward ? 0 : 1];
+		if (time < last) ++Reordered; else last = time;
+
+		Frame* frame = new Frame;
+		frame->Dest = destination;
+		frame->Data = segment;
+		mQueue.insert (make_pair (time, frame));
+		return true;
+	}
+
+public:
+	// Methods
+	Frame* Next (uint64 now)
+	{
+		if (mQueue.empty() || mQueue.begin()->first > now)
+			return null;
+
+		Frame* result = mQueue.begin()->second;
+		mQueue.erase (mQueue.begin());
+		return result;
+	}
+
+	uint64 Wait (uint64 now) const
+	{
+		return mQueue.empty() ? 1000 : mQueue.
+			begin()->first > now ? mQueue.begin()->first - now : 0;
+	}
+
+public:
+	// Properties
+	uint64		Frames;		// Frames transmitted
+	uint64		Lost;		// Frames dropped
+	uint64		Reordered;	// Frames overtaken by a later frame
+
+private:
+	// Fields
+	Address		mReceiver;	// Address of the receiver
+	uint32		mHops;		// Number of links
+	uint64		mLatency;	// Propagation latency per link
+	real64		mRate;		// Link rate in bits per microsecond
+	real64		mLoss;		// Loss probability per link
+	uint32		mSegment;	// Segment length
+	uint64		mJitter;	// Largest extra delay on arrival
+	uint64		mLast[2];	// Latest arrival in each direction
+
+	uint64*		mForward;	// Time each forward link is free
+	uint64*		mReverse;	// Time each reverse link is free
+
+	multimap<uint64, Frame*> mQueue;	// Frames in flight
+};
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Streams a file across a simulated multi-hop path. </summary>
+/// <remarks> Arguments: (Megabytes) (Hops) (Latency us) (Mbit/s)
+///           (Loss %) (Segment length) (Jitter us). Fails if the stream
+///           stops making progress, as it would if a lost segment were
+///           wrongly taken as selectively acknowledged. </remarks>
+
+int BenchStream (int argc, char** argv)
+{
+	uint64 megabytes = argc >= 1 ? atoi (argv[0]) :  100;
+	uint32 hops      = argc >= 2 ? atoi (argv[1]) :    4;
+	uint64 latency   = argc >= 3 ? atoi (argv[2]) : 1000;
+	real64 rate      = argc >= 4 ? atof (argv[3]) :  100;
+	real64 loss      = argc >= 5 ? atof (argv[4]) : 0.01;
+	uint32 segment   = argc >= 6 ? atoi (argv[5]) : 1400;
+	uint64 jitter    = argc >= 7 ? atoi (argv[6]) :  500;
+
+	if (hops == 0 || rate <= 0 || segment <= Stream::Header::Length)
+		{ printf ("Invalid arguments\n"); return 1; }
+
+	Address sender  (2, 0, 0, 0, 0, 1);
+	Address receiver(2, 0, 0, 0, 0, 2);
+
+	SimulatedPath path (receiver, hops, latency, rate, loss / 100, segment, jitter);
+	Stream source (&path, sender, receiver, 1, true );
+	Stream sink   (&path, receiver, sender, 1, false);
+
+	uint64 total   = megabytes << 20;
+	uint64 written = 0;
+	uint64 read    = 0;
+	bool   closed  = false;
+	bool   valid   = true;
+
+	// The file contents follow a simple pattern
+	static uint8 input [65536 + 251];
+	static uint8 output[65536];
+	for (uint32 i = 0; i < sizeof (input); ++i)
+		input[i] = (uint8) (i % 251);
+
+	uint64 start    = Clock::Micro();
+	uint64 timer    = start;
+	uint64 progress = start;
+
+	while (!sink.IsEof())
+	{
+		uint64 now = Clock::Micro();
+
+		// Write as much as the sender accepts
+		if (written < total)
+		{
+			uint64 length = total - written < 65536 ? total - written : 65536;
+			written += source.Write ((uint32) length, input + written % 251);
+		}
+
+		elif (!closed) { source.Close(); closed = true; }
+
+		// Deliver frames that have arrived
+		SimulatedPath::Frame* frame;
+		while ((frame = path.Next (now)) != null)
+		{
+			Stream::Header header;
+			if (header.Read (frame->Data.GetLength(), frame->Data.GetData()))
+			{
+				Stream& stream = frame->Dest == receiver ? sink : source;
+				stream.Deliver (header, frame->Data.GetLength() - Stream::Header::
+					Length, frame->Data.GetData() + Stream::Header::Length);
+			}
+
+			delete frame;
+		}
+
+		// Read and verify the received bytes
+		uint32 length;
+		while ((length = sink.Read (sizeof (output), output)) > 0)
+		{
+			if (memcmp (output, input + read % 251, length) != 0)
+				valid = false;
+			read += length;
+			progress = now;
+		}
+
+		if (now - progress > 10000000)
+			{ printf ("Stream stalled at %llu bytes\n", read); return 1; }
+
+		// Drive the retransmission timers
+		if (now - timer >= 1000)
+		{
+			source.Update();
+			sink  .Update();
+			timer = now;
+		}
+
+		if (source.GetState() == Stream::STATE_FAILED)
+			{ printf ("Stream failed\n"); return 1; }
+
+		// Sleep until the next frame arrives
+		uint64 wait = path.Wait (Clock::Micro());
+		if (wait > 1000) wait = 1000;
+		if (wait > 50 && written >= total) usleep (wait);
+	}
+
+	real64 seconds  = (Clock::Micro() - start) / 1000000.0;
+	real64 goodput  = read * 8 / seconds / 1000000.0;
+	real64 capacity = rate * (segment - Stream::Header::Length) / segment;
+
+	printf ("  Transferred : %llu bytes (%s)\n", read, valid && read == total ? "verified" : "CORRUPT");
+	printf ("  Path        : %u hops, %llu us latency, %.1f Mbit/s, %.2f%% loss, %llu us jitter\n", hops, latency, rate, loss, jitter);
+	printf ("  Elapsed     : %.3f s\n", seconds);
+	printf ("  Goodput     : %.2f Mbit/s (%.1f%% of %.2f Mbit/s capacity)\n", goodput, goodput * 100 / capacity, capacity);
+	printf ("  Frames      : %llu sent, %llu lost, %llu reordered, %u retransmitted\n", path.Frames, path.Lost, path.Reordered, source.GetRetransmits());
+	printf ("  RTT         : %llu us, window %u segments\n\n", source.GetRTT(), source.GetWindow());
+
+	return valid && read == total ? 0 : 1;
+}
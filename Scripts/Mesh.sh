@@ -0,0 +1,312 @@
+#!/bin/bash
+################################################################################
+## -------------------------------------------------------------------------- ##
+##                                                                            ##
+##                          Copyright (C) 2012-2013                           ##
+##                            github.com/dkrutsko                             ##
+##                            github.com/Harrold                              ##
+##                            github.com/AbsMechanik                          ##
+##                                                                            ##
+##                        See LICENSE.md for copyright                        ##
+##                                                                            ##
+## -------------------------------------------------------------------------- ##
+################################################################################
+
+##----------------------------------------------------------------------------##
+## Description                                                                ##
+##----------------------------------------------------------------------------##
+
+# Runs a mesh of MacAttack nodes on one Linux machine. Every node lives in
+# its own network namespace and is attached through a veth pair to a shared
+# bridge. A bridge filter only forwards frames between ports which are
+# adjacent in the chosen topology, so broadcasts reach exactly the direct
+# neighbors, as they would over the air.
+#
+# Nodes are driven through their terminal: traffic is sent with the Send
+# command and results are collected with the Stats and Latency commands.
+#
+# Usage: sudo Scripts/Mesh.sh [-n Nodes] [-t line|grid|random] [-d Seconds]
+#                             [-r Messages per second per node] [-k Key Bits]
+#                             [-w Warm-up Seconds] [-b Binary]
+#
+# Requires: iproute2, nftables and root privileges
+
+
+
+##----------------------------------------------------------------------------##
+## Variables                                                                  ##
+##----------------------------------------------------------------------------##
+
+NODES=9
+TOPOLOGY=line
+DURATION=30
+RATE=10
+KEYBITS=512
+WARMUP=10
+BINARY=./MacAttack
+
+while getopts "n:t:d:r:k:w:b:h" option; do
+	case $option in
+		n) NODES=$OPTARG    ;;
+		t) TOPOLOGY=$OPTARG ;;
+		d) DURATION=$OPTARG ;;
+		r) RATE=$OPTARG     ;;
+		k) KEYBITS=$OPTARG  ;;
+		w) WARMUP=$OPTARG   ;;
+		b) BINARY=$OPTARG   ;;
+		*) sed -n '/^# Usage/,/^# Requires/p' "$0"; exit 1 ;;
+	esac
+done
+
+PREFIX=mac
+BRIDGE=${PREFIX}br0
+TABLE=${PREFIX}mesh
+WORK=$(mktemp -d /tmp/MacMesh.XXXXXX)
+TICKS=$(getconf CLK_TCK)
+
+declare -a EDGES
+
+
+
+##----------------------------------------------------------------------------##
+## Helpers                                                                    ##
+##----------------------------------------------------------------------------##
+
+# Prints the MAC address assigned to a node
+Address()
+{
+	printf "02:00:00:00:%02X:%02X" $(($1 >> 8)) $(($1 & 255))
+}
+
+# Sends terminal commands to a node
+Command()
+{
+	local node=$1; shift
+	printf "%s\n" "$@" >&"${FIFOS[$node]}"
+}
+
+# Prints the last value of a statistic from a node log
+Statistic()
+{
+	awk -v name="$2" 'index ($0, name) == 1 { value = $NF } END { print value + 0 }' "$WORK/node$1.log"
+}
+
+# Prints the most recent latency row of a stage from a node log
+Latency()
+{
+	awk -v name="$2" '$1 == name { row = $0 } END { print row }' "$WORK/node$1.log"
+}
+
+# Prints the CPU time of a process in clock ticks
+CpuTicks()
+{
+	awk '{ print $14 + $15 }' "/proc/$1/stat" 2> /dev/null || echo 0
+}
+
+# Adds an undirected edge between two nodes
+Connect()
+{
+	[ "$1" -ne "$2" ] && EDGES+=("$1 $2")
+}
+
+Cleanup()
+{
+	for pid in "${PIDS[@]}"; do kill "$pid" 2> /dev/null; done
+	wait 2> /dev/null
+
+	for ((i = 1; i <= NODES; ++i)); do
+		ip netns del "$PREFIX$i" 2> /dev/null
+		ip link del "${PREFIX}h$i" 2> /dev/null
+	done
+
+	ip link del "$BRIDGE" 2> /dev/null
+	nft delete table bridge "$TABLE" 2> /dev/null
+	rm -rf "$WORK"
+}
+
+
+
+##----------------------------------------------------------------------------##
+## Topology                                                                   ##
+##----------------------------------------------------------------------------##
+
+[ "$(id -u)" -eq 0 ] || { echo "Must be run as root"; exit 1; }
+command -v nft > /dev/null || { echo "nftables is required"; exit 1; }
+[ -x "$BINARY" ] || { echo "Build $BINARY first"; exit 1; }
+[ "$NODES" -ge 2 ] && [ "$NODES" -le 250 ] || { echo "Nodes must be 2 to 250"; exit 1; }
+
+case $TOPOLOGY in
+	line)
+		for ((i = 1; i < NODES; ++i)); do Connect $i $((i + 1)); done
+		;;
+
+	grid)
+		SIDE=$(awk -v n="$NODES" 'BEGIN { s = int (sqrt (n)); if (s * s < n) ++s; print s }')
+		for ((i = 1; i <= NODES; ++i)); do
+			(( i % SIDE != 0 && i + 1 <= NODES )) && Connect $i $((i + 1))
+			(( i + SIDE <= NODES )) && Connect $i $((i + SIDE))
+		done
+		;;
+
+	random)
+		# A random tree keeps the mesh connected, extra edges add loops
+		for ((i = 2; i <= NODES; ++i)); do Connect $i $((RANDOM % (i - 1) + 1)); done
+		for ((i = 0; i < NODES / 2; ++i)); do
+			Connect $((RANDOM % NODES + 1)) $((RANDOM % NODES + 1))
+		done
+		;;
+
+	*)
+		echo "Topology must be line, grid or random"; exit 1
+		;;
+esac
+
+trap Cleanup EXIT INT TERM
+
+
+
+##----------------------------------------------------------------------------##
+## Identities                                                                 ##
+##----------------------------------------------------------------------------##
+
+echo "Creating $NODES identities of $KEYBITS bits..."
+
+NAMES=()
+for ((i = 1; i <= NODES; ++i)); do NAMES+=("node$i"); done
+
+"$BINARY" -Create $((KEYBITS * 2)) "$WORK/authority.id" > /dev/null &&
+"$BINARY" -Create "$KEYBITS" -Bundle "$WORK/mesh.mab" "${NAMES[@]}" > /dev/null &&
+"$BINARY" -Sign "$WORK/authority.id" "$WORK/mesh.mab" > /dev/null ||
+	{ echo "Unable to provision identities"; exit 1; }
+
+
+
+##----------------------------------------------------------------------------##
+## Network                                                                    ##
+##----------------------------------------------------------------------------##
+
+echo "Building a $TOPOLOGY mesh with ${#EDGES[@]} links..."
+
+ip link add "$BRIDGE" type bridge
+ip link set "$BRIDGE" up
+
+for ((i = 1; i <= NODES; ++i)); do
+	ip netns add "$PREFIX$i"
+	ip link add "${PREFIX}h$i" type veth peer name eth0 netns "$PREFIX$i"
+	ip link set "${PREFIX}h$i" master "$BRIDGE" up
+
+	ip netns exec "$PREFIX$i" sysctl -qw net.ipv6.conf.all.disable_ipv6=1
+	ip netns exec "$PREFIX$i" ip link set eth0 address "$(Address $i)"
+	ip netns exec "$PREFIX$i" ip link set eth0 up
+	ip netns exec "$PREFIX$i" ip link set lo up
+done
+
+# Only forward frames between adjacent nodes
+nft add table bridge "$TABLE"
+nft add chain bridge "$TABLE" forward "{ type filter hook forward priority 0; policy drop; }"
+
+for edge in "${EDGES[@]}"; do
+	read -r a b <<< "$edge"
+	nft add rule bridge "$TABLE" forward iifname "${PREFIX}h$a" oifname "${PREFIX}h$b" accept
+	nft add rule bridge "$TABLE" forward iifname "${PREFIX}h$b" oifname "${PREFIX}h$a" accept
+done
+
+
+
+##----------------------------------------------------------------------------##
+## Nodes                                                                      ##
+##----------------------------------------------------------------------------##
+
+declare -a PIDS FIFOS
+
+for ((i = 1; i <= NODES; ++i)); do
+	mkfifo "$WORK/node$i.in"
+
+	TERM=dumb ip netns exec "$PREFIX$i" "$BINARY" -Join eth0 "$WORK/mesh.mab:node$i" \
+		< "$WORK/node$i.in" > "$WORK/node$i.log" 2>&1 &
+	PIDS[$i]=$!
+
+	# Keep the terminal input open for the lifetime of the node
+	exec {descriptor}> "$WORK/node$i.in"
+	FIFOS[$i]=$descriptor
+done
+
+echo "Waiting $WARMUP seconds for neighbor discovery..."
+sleep "$WARMUP"
+
+for ((i = 1; i <= NODES; ++i)); do
+	Command $i Stats Reset
+	CPU_START[$i]=$(CpuTicks "${PIDS[$i]}")
+done
+
+sleep 1
+for ((i = 1; i <= NODES; ++i)); do
+	DELIVERED_START[$i]=$(Statistic $i Delivered)
+	SENT_START[$i]=$(Statistic $i "TX Messages")
+	FRAMES_START[$i]=$(Statistic $i "TX Frames")
+	BEACONS_START[$i]=$(( $(Statistic $i "TX Beacons") + $(Statistic $i "Beacon Rebroadcasts") ))
+done
+
+
+
+##----------------------------------------------------------------------------##
+## Traffic                                                                    ##
+##----------------------------------------------------------------------------##
+
+echo "Sending $RATE messages per second from every node for $DURATION seconds..."
+
+INTERVAL=$(awk -v r="$RATE" 'BEGIN { printf "%.4f", 1 / r }')
+END=$((SECONDS + DURATION))
+
+while (( SECONDS < END )); do
+	for ((i = 1; i <= NODES; ++i)); do
+		j=$((RANDOM % (NODES - 1) + 1)); (( j >= i )) && ((++j))
+		Command $i Send "$(Address $j)" "mesh $i to $j at $SECONDS"
+	done
+	sleep "$INTERVAL"
+done
+
+# Let queued messages drain before sampling
+sleep 2
+for ((i = 1; i <= NODES; ++i)); do
+	Command $i Stats Latency
+	CPU_END[$i]=$(CpuTicks "${PIDS[$i]}")
+done
+sleep 1
+
+
+
+##----------------------------------------------------------------------------##
+## Report                                                                     ##
+##----------------------------------------------------------------------------##
+
+TOTAL_SENT=0
+TOTAL_DELIVERED=0
+
+printf "\n%-6s %9s %9s %10s %10s %10s %10s %8s\n" Node Sent Delivered Beacons% \
+	"Hop p50" "Hop p99" "Hop p999" CPU%
+
+for ((i = 1; i <= NODES; ++i)); do
+	sent=$(( $(Statistic $i "TX Messages") - SENT_START[i] ))
+	delivered=$(( $(Statistic $i Delivered) - DELIVERED_START[i] ))
+	frames=$(( $(Statistic $i "TX Frames") - FRAMES_START[i] ))
+	beacons=$(( $(Statistic $i "TX Beacons") + $(Statistic $i "Beacon Rebroadcasts") - BEACONS_START[i] ))
+	cpu=$(awk -v t=$((CPU_END[i] - CPU_START[i])) -v h="$TICKS" -v d="$DURATION" \
+		'BEGIN { printf "%.1f", t * 100 / h / (d + 2) }')
+
+	# Forward latency is the time a relay holds a message (one hop)
+	read -r _ _ _ p50 p99 p999 <<< "$(Latency $i Forward)"
+
+	printf "%-6s %9d %9d %10s %10s %10s %10s %8s\n" "node$i" "$sent" "$delivered" \
+		"$(awk -v b=$beacons -v f=$frames 'BEGIN { printf "%.1f", f ? b * 100 / f : 0 }')" \
+		"${p50:-0}" "${p99:-0}" "${p999:-0}" "$cpu"
+
+	TOTAL_SENT=$((TOTAL_SENT + sent))
+	TOTAL_DELIVERED=$((TOTAL_DELIVERED + delivered))
+done
+
+awk -v s=$TOTAL_SENT -v d=$TOTAL_DELIVERED -v t="$DURATION" 'BEGIN {
+	printf "\nSent %d, delivered %d (%.1f%%), %.1f messages/sec delivered\n",
+		s, d, s ? d * 100 / s : 0, d / t
+	print "Hop latencies are in microseconds, Beacons% is the share of sent frames"
+}'
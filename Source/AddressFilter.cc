@@ -0,0 +1,276 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "AddressFilter.h"
+
+#include <cstdio>
+#include <utility>
+
+using std::string;
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                 AddressFilter //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new filter which ignores nothing. </summary>
+
+AddressFilter::AddressFilter (void)
+{
+	mBlockAll = false;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                      AddressFilter //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Replaces the rules with those of the file. </summary>
+/// <remarks>
+///   Every line holds one rule, a full address or a vendor prefix such as
+///   00:1A:2B or 00:1A:2B:*, blocked by default or allowed when prefixed
+///   with a plus sign, or an asterisk which blocks every address. Text
+///   after a hash sign is a comment. The rules are left unchanged if the
+///   file cannot be read or holds an invalid rule.
+/// </remarks>
+
+AddressFilter::Error AddressFilter::Load (const string& filename)
+{
+	// Attempt to open the file
+	FILE* file = fopen (filename.c_str(), "rb");
+	if (file == null) return ERROR_FILE_OPEN;
+
+	AddressFilter filter;
+	Error result = ERROR_NONE;
+	char line[256];
+
+	// Read rules line by line
+	while (fgets (line, sizeof (line), file))
+	{
+		if (!filter.AddRule (line))
+			{ result = ERROR_BAD_RULE; break; }
+	}
+
+	// Close the file
+	fclose (file);
+
+	if (result == ERROR_NONE)
+		std::swap (*this, filter);
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Adds a single rule in the format of the file. </summary>
+/// <remarks> Returns false if the rule is invalid, blank lines and
+///           comments are valid and add nothing. </remarks>
+
+bool AddressFilter::AddRule (const string& rule)
+{
+	bool allow    = false;
+	bool wildcard = false;
+	bool start    = true;
+
+	Address address = Address::Null;
+	uint32 digits = 0;
+
+	for (uint32 i = 0; i < rule.length(); ++i)
+	{
+		char c = rule[i];
+		if (c == '#') break;
+
+		// Whitespace surrounds the rule
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n') continue;
+
+		// The sign comes before anything else
+		if (start && (c == '+' || c == '-'))
+			{ allow = c == '+'; start = false; continue; }
+
+		start = false;
+
+		uint8 value;
+		  if (c >= '0' && c <= '9') value = c - '0';
+		elif (c >= 'a' && c <= 'f') value = c - 'a' + 10;
+		elif (c >= 'A' && c <= 'F') value = c - 'A' + 10;
+		elif (c == '*' && !wildcard) { wildcard = true; continue; }
+		elif ((c == ':' || c == '-' || c == '.') && !wildcard) continue;
+		else return false;
+
+		// Nothing follows the wildcard
+		if (wildcard || digits == 2 * Address::Length) return false;
+
+		address.Data[digits / 2] |= digits % 2 ? value : value << 4;
+		++digits;
+	}
+
+	// Every address or a whole vendor prefix
+	if (digits == 0 && wildcard) BlockAll (!allow);
+
+	elif (digits == 6)
+		allow ? AllowVendor (address) : BlockVendor (address);
+
+	elif (digits == 2 * Address::Length && !wildcard)
+		allow ? Allow (address) : Block (address);
+
+	else return digits == 0 && start;
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Removes every rule. </summary>
+
+void AddressFilter::Clear (void)
+{
+	mBlocked.clear();
+	mAllowed.clear();
+	mBlockedVendors.clear();
+	mAllowedVendors.clear();
+	mBlockAll = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Blocks the address. </summary>
+
+void AddressFilter::Block (const Address& address)
+{
+	mAllowed.erase  (Key (address));
+	mBlocked.insert (Key (address));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Allows the address, even if its vendor is blocked. </summary>
+
+void AddressFilter::Allow (const Address& address)
+{
+	mBlocked.erase  (Key (address));
+	mAllowed.insert (Key (address));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Blocks every address sharing the vendor prefix of the address. </summary>
+
+void AddressFilter::BlockVendor (const Address& address)
+{
+	mAllowedVendors.erase  (VendorKey (address));
+	mBlockedVendors.insert (VendorKey (address));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Allows every address sharing the vendor prefix of the address,
+///           even if every address is blocked. </summary>
+
+void AddressFilter::AllowVendor (const Address& address)
+{
+	mBlockedVendors.erase  (VendorKey (address));
+	mAllowedVendors.insert (VendorKey (address));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Blocks every address which no rule allows. </summary>
+
+void AddressFilter::BlockAll (bool enable)
+{
+	mBlockAll = enable;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if the most specific matching rule blocks the
+///           address. </summary>
+
+bool AddressFilter::IsBlocked (const Address& address) const
+{
+	if (IsEmpty()) return false;
+
+	uint64 key = Key (address);
+	if (mAllowed.count (key)) return false;
+	if (mBlocked.count (key)) return true;
+
+	uint32 vendor = VendorKey (address);
+	if (mAllowedVendors.count (vendor)) return false;
+	if (mBlockedVendors.count (vendor)) return true;
+
+	return mBlockAll;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if the filter blocks nothing. </summary>
+
+bool AddressFilter::IsEmpty (void) const
+{
+	return !mBlockAll && mBlocked.empty() && mBlockedVendors.empty();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of rules. </summary>
+
+uint32 AddressFilter::GetRuleCount (void) const
+{
+	return mBlocked.size() + mAllowed.size() + mBlockedVendors.
+		size() + mAllowedVendors.size() + (mBlockAll ? 1 : 0);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Static                                                       AddressFilter //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the string representation of a specified error. </summary>
+
+string AddressFilter::ErrorString (Error error)
+{
+	switch (error)
+	{
+		case ERROR_NONE			: return "";
+		case ERROR_FILE_OPEN	: return "Failed to open the ignore list";
+		case ERROR_BAD_RULE		: return "The ignore list holds an invalid rule";
+		default					: return "Unknown error occurred";
+	}
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                     AddressFilter //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the address packed into an integer. </summary>
+
+uint64 AddressFilter::Key (const Address& address)
+{
+	const uint8* d = address.Data;
+	return (uint64) d[0] << 40 | (uint64) d[1] << 32 |
+		   (uint64) d[2] << 24 | (uint64) d[3] << 16 |
+		   (uint64) d[4] <<  8 | (uint64) d[5];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the vendor prefix of the address packed into an
+///           integer. </summary>
+
+uint32 AddressFilter::VendorKey (const Address& address)
+{
+	const uint8* d = address.Data;
+	return (uint32) d[0] << 16 | (uint32) d[1] << 8 | d[2];
+}
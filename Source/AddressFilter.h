@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef ADDRESS_FILTER_H
+#define ADDRESS_FILTER_H
+
+#include "Address.h"
+
+#include <string>
+#include <unordered_set>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Decides which source addresses a router ignores. </summary>
+/// <remarks>
+///   Rules block or allow a whole address or a vendor prefix (OUI), and
+///   a single asterisk blocks every address. The most specific rule
+///   wins, so an allowed address passes a blocked vendor and an allowed
+///   vendor passes a blocked wildcard. Every lookup hashes the address
+///   and its prefix once, however many rules there are. The filter is
+///   not synchronized, its owner must serialize changes with lookups.
+/// </remarks>
+
+class AddressFilter
+{
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of possible errors. </summary>
+
+	enum Error
+	{
+		ERROR_NONE = 0,
+		ERROR_FILE_OPEN,
+		ERROR_BAD_RULE,
+	};
+
+public:
+	// Constructors
+	AddressFilter					(void);
+
+public:
+	// Methods
+	Error		Load				(const std::string& filename);
+	bool		AddRule				(const std::string& rule);
+	void		Clear				(void);
+
+	void		Block				(const Address& address);
+	void		Allow				(const Address& address);
+	void		BlockVendor			(const Address& address);
+	void		AllowVendor			(const Address& address);
+	void		BlockAll			(bool enable);
+
+	bool		IsBlocked			(const Address& address) const;
+	bool		IsEmpty				(void) const;
+	uint32		GetRuleCount		(void) const;
+
+public:
+	// Static
+	static std::string ErrorString	(Error error);
+
+private:
+	// Internal
+	static uint64	Key				(const Address& address);
+	static uint32	VendorKey		(const Address& address);
+
+private:
+	// Fields
+	std::unordered_set<uint64> mBlocked;		// Blocked addresses
+	std::unordered_set<uint64> mAllowed;		// Allowed addresses
+	std::unordered_set<uint32> mBlockedVendors;	// Blocked prefixes
+	std::unordered_set<uint32> mAllowedVendors;	// Allowed prefixes
+	bool		mBlockAll;						// Block unmatched addresses
+};
+
+#endif // ADDRESS_FILTER_H
@@ -0,0 +1,228 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Buffer.h"
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                        Buffer //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new empty buffer. </summary>
+
+Buffer::Buffer (void)
+{
+	mPool     = null;
+	mData     = null;
+	mLength   = 0;
+	mCapacity = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Takes the data of the specified buffer, leaving it empty. </summary>
+
+Buffer::Buffer (Buffer&& buffer)
+{
+	mPool     = buffer.mPool;
+	mData     = buffer.mData;
+	mLength   = buffer.mLength;
+	mCapacity = buffer.mCapacity;
+
+	buffer.mPool     = null;
+	buffer.mData     = null;
+	buffer.mLength   = 0;
+	buffer.mCapacity = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the data to its pool. </summary>
+
+Buffer::~Buffer (void)
+{
+	Release();
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                             Buffer //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the data to its pool, leaving this buffer empty. </summary>
+
+void Buffer::Release (void)
+{
+	if (mPool != null)
+		mPool->Recycle (mData);
+	else delete[] mData;
+
+	mPool     = null;
+	mData     = null;
+	mLength   = 0;
+	mCapacity = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the used length, which may not exceed the capacity. </summary>
+
+void Buffer::SetLength (uint32 length)
+{
+	mLength = length < mCapacity ? length : mCapacity;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Operators                                                           Buffer //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Takes the data of the specified buffer, leaving it empty. </summary>
+
+Buffer& Buffer::operator = (Buffer&& buffer)
+{
+	// Handling of self assignment
+	if (this == &buffer) return *this;
+
+	// Release previous data
+	Release();
+
+	mPool     = buffer.mPool;
+	mData     = buffer.mData;
+	mLength   = buffer.mLength;
+	mCapacity = buffer.mCapacity;
+
+	buffer.mPool     = null;
+	buffer.mData     = null;
+	buffer.mLength   = 0;
+	buffer.mCapacity = 0;
+
+	return *this;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                    BufferPool //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a pool of blocks with the specified size, keeping
+///           at most maximum free blocks around for reuse. </summary>
+
+BufferPool::BufferPool (uint32 capacity, uint32 maximum)
+{
+	mCapacity    = capacity;
+	mMaximum     = maximum;
+	mOutstanding = 0;
+	mDestroyed   = false;
+
+	pthread_mutex_init (&mMutex, null);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Deletes this pool and deallocates all free blocks. </summary>
+
+BufferPool::~BufferPool (void)
+{
+	for (uint32 i = 0; i < mFree.size(); ++i)
+		delete[] mFree[i];
+
+	pthread_mutex_destroy (&mMutex);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                         BufferPool //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns a buffer with the specified length. </summary>
+
+Buffer BufferPool::Acquire (uint32 length)
+{
+	Buffer result;
+	result.mLength = length;
+
+	// Oversized requests are not pooled
+	if (length > mCapacity)
+	{
+		result.mData     = new uint8[length];
+		result.mCapacity = length;
+		return result;
+	}
+
+	pthread_mutex_lock (&mMutex);
+
+	if (mFree.empty())
+		result.mData = new uint8[mCapacity];
+
+	else
+	{
+		result.mData = mFree.back();
+		mFree.pop_back();
+	}
+
+	++mOutstanding;
+	pthread_mutex_unlock (&mMutex);
+
+	result.mPool     = this;
+	result.mCapacity = mCapacity;
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Releases the pool, it is deleted once every buffer returns. </summary>
+/// <remarks> The pool must not be used after calling this function. </remarks>
+
+void BufferPool::Destroy (void)
+{
+	pthread_mutex_lock (&mMutex);
+	mDestroyed = true;
+	bool unused = mOutstanding == 0;
+	pthread_mutex_unlock (&mMutex);
+
+	if (unused) delete this;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                        BufferPool //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns a block to the free list. </summary>
+
+void BufferPool::Recycle (uint8* data)
+{
+	pthread_mutex_lock (&mMutex);
+
+	if (mFree.size() < mMaximum && !mDestroyed)
+		mFree.push_back (data);
+	else delete[] data;
+
+	bool unused = --mOutstanding == 0 && mDestroyed;
+	pthread_mutex_unlock (&mMutex);
+
+	if (unused) delete this;
+}
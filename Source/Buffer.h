@@ -0,0 +1,114 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include "Types.h"
+
+#include <vector>
+#include <pthread.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+class BufferPool;
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Represents a move-only block of data taken from a pool. </summary>
+/// <remarks> The data is returned to its pool once the buffer is
+///           released or destroyed. Buffers may outlive the pool's
+///           owner, the pool is deleted once every buffer returns. </remarks>
+
+class Buffer
+{
+	friend class BufferPool;
+
+public:
+	// Constructors
+	 Buffer					(void);
+	 Buffer					(Buffer&& buffer);
+	~Buffer					(void);
+
+private:
+	Buffer					(const Buffer& buffer);
+	Buffer& operator =		(const Buffer& buffer);
+
+public:
+	// Methods
+	void	Release			(void);
+
+	uint32	GetLength		(void) const { return mLength;   }
+	uint32	GetCapacity		(void) const { return mCapacity; }
+	uint8*	GetData			(void) const { return mData;     }
+
+	void	SetLength		(uint32 length);
+
+public:
+	// Operators
+	Buffer& operator =		(Buffer&& buffer);
+
+private:
+	// Fields
+	BufferPool*	mPool;		// Owning pool
+	uint8*		mData;		// Buffer data
+	uint32		mLength;	// Used length
+	uint32		mCapacity;	// Allocated length
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Recycles fixed size blocks of data for buffers. </summary>
+/// <remarks> Requests larger than the block size are allocated and freed
+///           individually. This class is thread safe. </remarks>
+
+class BufferPool
+{
+	friend class Buffer;
+
+public:
+	// Constructors
+	BufferPool				(uint32 capacity, uint32 maximum);
+
+private:
+	~BufferPool				(void);
+	 BufferPool				(const BufferPool& pool) { }
+
+public:
+	// Methods
+	Buffer	Acquire			(uint32 length);
+	void	Destroy			(void);
+
+private:
+	// Internal
+	void	Recycle			(uint8* data);
+
+private:
+	// Fields
+	uint32	mCapacity;		// Size of every pooled block
+	uint32	mMaximum;		// Maximum number of free blocks
+	uint32	mOutstanding;	// Number of blocks in use
+	bool	mDestroyed;		// Owner has destroyed the pool
+
+	std::vector<uint8*> mFree;	// List of free blocks
+	pthread_mutex_t mMutex;		// Synchronization
+};
+
+#endif // BUFFER_H
@@ -0,0 +1,356 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "CRC32.h"
+#include "Bundle.h"
+
+#include <cstdio>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Orders indices by the name they refer to. </summary>
+
+class NameOrder
+{
+public:
+	NameOrder (const std::vector<std::string>& names) : Names (names) { }
+
+	bool operator() (uint32 a, uint32 b) const { return Names[a] < Names[b]; }
+
+	const std::vector<std::string>& Names;
+};
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                        Bundle //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new closed bundle. </summary>
+
+Bundle::Bundle (void)
+{
+	mData   = null;
+	mLength = 0;
+	mCount  = 0;
+	mIndex  = null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes the bundle. </summary>
+
+Bundle::~Bundle (void)
+{
+	Close();
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                             Bundle //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Maps a bundle file and validates its index. </summary>
+/// <remarks> This function closes the previous bundle. </remarks>
+
+Bundle::Error Bundle::Open (const std::string& filename)
+{
+	Close();
+
+	// Attempt to map the file
+	int32 descriptor = open (filename.c_str(), O_RDONLY);
+	if (descriptor < 0) return ERROR_FILE_OPEN;
+
+	struct stat info;
+	if (fstat (descriptor, &info) != 0)
+		{ close (descriptor); return ERROR_FILE_OPEN; }
+
+	if ((uint64) info.st_size < sizeof (Header))
+		{ close (descriptor); return ERROR_BAD_FORMAT; }
+
+	void* data = mmap (null, info.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+	close (descriptor);
+
+	if (data == MAP_FAILED)
+		return ERROR_FILE_MAP;
+
+	mData   = (uint8*) data;
+	mLength = info.st_size;
+
+	// Validate the header
+	const Header* header = (const Header*) mData;
+	uint64 count = le32toh (header->Count);
+
+	if (memcmp (header->Magic, BUNDLE_MAGIC, 4) != 0 ||
+		le16toh (header->Version) != BUNDLE_VERSION ||
+		sizeof (Header) + count * sizeof (Entry) > mLength)
+		{ Close(); return ERROR_BAD_FORMAT; }
+
+	// Validate the index
+	CRC32 crc;
+	crc.Add (count * sizeof (Entry), mData + sizeof (Header));
+	if (crc.Value != le32toh (header->Checksum))
+		{ Close(); return ERROR_CHECKSUM; }
+
+	mCount = (uint32) count;
+	mIndex = (const Entry*) (mData + sizeof (Header));
+	return ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Unmaps the bundle file. </summary>
+
+void Bundle::Close (void)
+{
+	if (mData != null)
+		munmap (mData, mLength);
+
+	mData   = null;
+	mLength = 0;
+	mCount  = 0;
+	mIndex  = null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of identities in the bundle. </summary>
+
+uint32 Bundle::GetCount (void) const
+{
+	return mCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the name of the identity at the index. </summary>
+
+std::string Bundle::GetName (uint32 index) const
+{
+	const char* name = mIndex[index].Name;
+	return std::string (name, strnlen (name, sizeof (mIndex[index].Name)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the key length in bytes of the identity at the index. </summary>
+
+uint32 Bundle::GetKeyLength (uint32 index) const
+{
+	return le16toh (mIndex[index].KeyLength);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if the identity at the index is signed. </summary>
+
+bool Bundle::IsSigned (uint32 index) const
+{
+	return mIndex[index].Signed != 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the index of the named identity or -1 if none exists. </summary>
+/// <remarks> The index is sorted by name, so this is a binary search. </remarks>
+
+int32 Bundle::Find (const std::string& name) const
+{
+	if (name.length() > MaxName)
+		return -1;
+
+	uint32 lower = 0;
+	uint32 upper = mCount;
+
+	while (lower < upper)
+	{
+		uint32 middle = lower + (upper - lower) / 2;
+		int32 order = strncmp (mIndex[middle].Name,
+			name.c_str(), sizeof (mIndex[middle].Name));
+
+		if (order == 0) return middle;
+		elif (order < 0) lower = middle + 1;
+		else upper = middle;
+	}
+
+	return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reads the identity at the index from the mapping. </summary>
+
+Identity::Error Bundle::Read (uint32 index, Identity& identity) const
+{
+	if (index >= mCount)
+		return Identity::ERROR_BAD_FORMAT;
+
+	uint64 offset = le64toh (mIndex[index].Offset);
+	uint64 length = le32toh (mIndex[index].Length);
+
+	// Make sure the identity lies within the file
+	if (offset > mLength || length > mLength - offset)
+		return Identity::ERROR_BAD_FORMAT;
+
+	return identity.Deserialize (length, mData + offset);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Static                                                              Bundle //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Writes named identities to a new bundle file. </summary>
+/// <remarks>
+///   The bundle is assembled in memory and written with a single write
+///   to a temporary file which then replaces the original, so an open
+///   mapping of the previous bundle stays valid.
+/// </remarks>
+
+Bundle::Error Bundle::Save (const std::string& filename,
+							const std::vector<std::string>& names,
+							const std::vector<Identity*>& identities)
+{
+	uint32 count = names.size();
+
+	Error error = CheckNames (names);
+	if (error != ERROR_NONE) return error;
+
+	// Sort the entries by name
+	std::vector<uint32> order (count);
+	for (uint32 i = 0; i < count; ++i) order[i] = i;
+	std::sort (order.begin(), order.end(), NameOrder (names));
+
+	// Compute the size of the file
+	uint64 length = sizeof (Header) + count * sizeof (Entry);
+	for (uint32 i = 0; i < count; ++i)
+		length += identities[i]->ComputeSize();
+
+	uint8* buffer = new uint8[length];
+	memset (buffer, 0, sizeof (Header) + count * sizeof (Entry));
+
+	Header* header = (Header*) buffer;
+	Entry*  index  = (Entry*) (buffer + sizeof (Header));
+	uint64  offset = sizeof (Header) + count * sizeof (Entry);
+
+	// Write every identity and its entry
+	for (uint32 i = 0; i < count; ++i)
+	{
+		const Identity* identity = identities[order[i]];
+		uint32 size = identity->ComputeSize();
+		identity->Serialize (size, buffer + offset);
+
+		memcpy (index[i].Name, names[order[i]].data(), names[order[i]].length());
+		index[i].Offset    = htole64 (offset);
+		index[i].Length    = htole32 (size);
+		index[i].KeyLength = htole16 ((uint16) identity->RsaState.len);
+		index[i].Signed    = identity->SignLength != 0;
+
+		offset += size;
+	}
+
+	// Write the header
+	CRC32 crc;
+	crc.Add (count * sizeof (Entry), (const uint8*) index);
+
+	memcpy (header->Magic, BUNDLE_MAGIC, 4);
+	header->Version  = htole16 (BUNDLE_VERSION);
+	header->Count    = htole32 (count);
+	header->Checksum = htole32 (crc.Value);
+
+	// Attempt to open the temporary file
+	std::string temporary = filename + ".tmp";
+	FILE* file = fopen (temporary.c_str(), "wb");
+	if (file == null) { delete[] buffer; return ERROR_FILE_OPEN; }
+
+	bool written = fwrite (buffer, 1, length, file) == length;
+	written = fclose (file) == 0 && written;
+	delete[] buffer;
+
+	// Replace the original file
+	if (!written || rename (temporary.c_str(), filename.c_str()) != 0)
+		{ unlink (temporary.c_str()); return ERROR_FILE_WRITE; }
+
+	return ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Verifies that every name fits the index and is unique. </summary>
+
+Bundle::Error Bundle::CheckNames (const std::vector<std::string>& names)
+{
+	std::vector<std::string> sorted (names);
+	std::sort (sorted.begin(), sorted.end());
+
+	for (uint32 i = 0; i < sorted.size(); ++i)
+	{
+		if (sorted[i].empty() || sorted[i].length() > MaxName)
+			return ERROR_NAME_LENGTH;
+
+		if (i > 0 && sorted[i] == sorted[i - 1])
+			return ERROR_NAME_DUPLICATE;
+	}
+
+	return ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if the file starts like a bundle. </summary>
+
+bool Bundle::IsBundle (const std::string& filename)
+{
+	char magic[4];
+
+	// Attempt to open the file
+	FILE* file = fopen (filename.c_str(), "rb");
+	if (file == null) return false;
+
+	bool result = fread (magic, 1, 4, file) == 4 &&
+				  memcmp (magic, BUNDLE_MAGIC, 4) == 0;
+
+	fclose (file);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the string representation of a specified error. </summary>
+
+std::string Bundle::ErrorString (Error error)
+{
+	switch (error)
+	{
+		case ERROR_NONE				: return "";
+		case ERROR_FILE_OPEN		: return "Failed to open file";
+		case ERROR_FILE_MAP			: return "Failed to map file";
+		case ERROR_FILE_WRITE		: return "Failed to write to file";
+		case ERROR_BAD_FORMAT		: return "The bundle file is malformed";
+		case ERROR_CHECKSUM			: return "The bundle index checksum does not match";
+		case ERROR_NAME_LENGTH		: return "Identity names must have 1 to 47 characters";
+		case ERROR_NAME_DUPLICATE	: return "Identity names must be unique";
+		case ERROR_NOT_FOUND		: return "The identity was not found in the bundle";
+		default						: return "Unknown error occurred";
+	}
+}
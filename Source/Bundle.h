@@ -0,0 +1,146 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include "Identity.h"
+
+#include <string>
+#include <vector>
+
+
+
+//----------------------------------------------------------------------------//
+// Constants                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Defines the magic and version of identity bundles. </summary>
+
+#define BUNDLE_MAGIC		"MACB"
+#define BUNDLE_VERSION		1
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Represents a single file holding many named identities. </summary>
+/// <remarks>
+///   The file starts with a header and an index of entries sorted by
+///   name, followed by every identity in the binary identity format.
+///   Bundles are opened with mmap so any identity can be read without
+///   reading the others. All integers are stored in little-endian.
+/// </remarks>
+
+class Bundle
+{
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of possible errors. </summary>
+
+	enum Error
+	{
+		ERROR_NONE = 0,
+		ERROR_FILE_OPEN,
+		ERROR_FILE_MAP,
+		ERROR_FILE_WRITE,
+		ERROR_BAD_FORMAT,
+		ERROR_CHECKSUM,
+		ERROR_NAME_LENGTH,
+		ERROR_NAME_DUPLICATE,
+		ERROR_NOT_FOUND,
+	};
+
+private:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents the header at the start of the file. </summary>
+
+	class Header
+	{
+	public:
+		// Properties
+		char		Magic[4];		// Always BUNDLE_MAGIC
+		uint16		Version;		// Always BUNDLE_VERSION
+		uint16		Reserved;		// Always zero
+		uint32		Count;			// Number of entries
+		uint32		Checksum;		// CRC32 of the index
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single entry of the index. </summary>
+
+	class Entry
+	{
+	public:
+		// Properties
+		char		Name[48];		// Null padded identity name
+		uint64		Offset;			// Offset of the identity
+		uint32		Length;			// Length of the identity
+		uint16		KeyLength;		// Length of the key in bytes
+		uint8		Signed;			// Whether the identity is signed
+		uint8		Reserved;		// Always zero
+	};
+
+public:
+	// Constructors
+	 Bundle					(void);
+	~Bundle					(void);
+
+private:
+	Bundle					(const Bundle& bundle) { }
+
+public:
+	// Methods
+	Error		Open		(const std::string& filename);
+	void		Close		(void);
+
+	uint32		GetCount	(void) const;
+	std::string	GetName		(uint32 index) const;
+	uint32		GetKeyLength(uint32 index) const;
+	bool		IsSigned	(uint32 index) const;
+
+	int32		Find		(const std::string& name) const;
+	Identity::Error Read	(uint32 index, Identity& identity) const;
+
+public:
+	// Static
+	static Error Save		(const std::string& filename,
+							 const std::vector<std::string>& names,
+							 const std::vector<Identity*>& identities);
+
+	static Error CheckNames	(const std::vector<std::string>& names);
+	static bool IsBundle	(const std::string& filename);
+	static std::string ErrorString (Error error);
+
+public:
+	// Constants
+	static const uint32 MaxName = 47;
+
+private:
+	// Fields
+	uint8*		mData;		// Mapped file
+	uint64		mLength;	// Length of the file
+	uint32		mCount;		// Number of entries
+
+	const Entry* mIndex;	// First index entry
+};
+
+#endif // BUNDLE_H
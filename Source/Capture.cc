@@ -0,0 +1,465 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Packet.h"
+#include "Capture.h"
+
+#include <ctime>
+#include <cstring>
+
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <byteswap.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Defines                                                                    //
+//----------------------------------------------------------------------------//
+
+#define PCAP_MICRO		0xA1B2C3D4		// Microsecond timestamps
+#define PCAP_NANO		0xA1B23C4D		// Nanosecond timestamps
+#define LINK_ETHERNET	1
+
+#define HEADER_LENGTH	24				// Length of the file header
+#define RECORD_LENGTH	16				// Length of a frame header
+#define TYPE_OFFSET		12				// Offset of the Ethernet type
+
+#define WRITE_BUFFER	(1 << 20)		// Size of the file buffer
+#define IDLE_SLEEP		1000			// Microseconds while the ring is empty
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Thread that writes captured frames to the file. </summary>
+
+void* WriterThread (void* parameters)
+{
+	// Retrieve the Capture instance
+	Capture* capture = (Capture*) parameters;
+
+	while (capture->mActive)
+	{
+		if (!capture->Write())
+		{
+			// Keep the trace readable while idle
+			fflush (capture->mFile);
+			usleep (IDLE_SLEEP);
+		}
+	}
+
+	// Write the remaining frames
+	while (capture->Write());
+	return null;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                       Capture //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new closed capture. </summary>
+
+Capture::Capture (void)
+{
+	mSlots   = null;
+	mHead    = 0;
+	mTail    = 0;
+
+	mFile    = null;
+	mActive  = false;
+
+	mWritten = 0;
+	mDropped = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes the capture and releases the ring. </summary>
+/// <remarks> No thread may still be adding frames. </remarks>
+
+Capture::~Capture (void)
+{
+	Close();
+	delete[] mSlots;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                            Capture //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Starts writing frames to a new pcap file. </summary>
+/// <remarks> This function closes the previous file. The ring is kept
+///           until destruction, so a late Add never touches freed memory. </remarks>
+
+Capture::Error Capture::Open (const std::string& filename)
+{
+	Close();
+
+	// Attempt to open the file
+	mFile = fopen (filename.c_str(), "wb");
+	if (mFile == null) return ERROR_FILE_OPEN;
+	setvbuf (mFile, null, _IOFBF, WRITE_BUFFER);
+
+	// Write the file header
+	uint32 header[HEADER_LENGTH / 4];
+	header[0] = PCAP_NANO;
+	header[1] = 2 | (4 << 16);		// Version 2.4
+	header[2] = 0;					// Timezone
+	header[3] = 0;					// Accuracy
+	header[4] = SnapLength;
+	header[5] = LINK_ETHERNET;
+
+	if (fwrite (header, 1, HEADER_LENGTH, mFile) != HEADER_LENGTH)
+		{ fclose (mFile); mFile = null; return ERROR_FILE_WRITE; }
+
+	// Create the ring once
+	if (mSlots == null)
+	{
+		mSlots = new Slot[SlotCount];
+		for (uint32 i = 0; i < SlotCount; ++i)
+			mSlots[i].Sequence = i;
+	}
+
+	// Drop frames claimed while closed
+	Discard();
+
+	mWritten = 0;
+	mDropped = 0;
+
+	mActive = true;
+	pthread_create (&mWriterThread, null, WriterThread, this);
+	return ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Writes the remaining frames and closes the file. </summary>
+/// <remarks> Frames claimed before the capture stopped but published
+///           after the writer finished are discarded, so they never
+///           appear in the next file. </remarks>
+
+void Capture::Close (void)
+{
+	if (mFile == null) return;
+
+	mActive = false;
+	pthread_join (mWriterThread, null);
+	Discard();
+
+	fclose (mFile);
+	mFile = null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true while frames are being captured. </summary>
+
+bool Capture::IsOpen (void) const
+{
+	return mActive;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Copies an ORP frame into the ring, other frames are ignored. </summary>
+/// <remarks>
+///   Any thread may call this function. A position is claimed with a
+///   compare and swap on the head and published through the sequence of
+///   its slot, returns false if the frame was dropped.
+/// </remarks>
+
+bool Capture::Add (uint32 length, const uint8* data)
+{
+	if (!mActive || length < TYPE_OFFSET + 2)
+		return false;
+
+	// Only keep onion routing frames
+	uint16 type;
+	memcpy (&type, data + TYPE_OFFSET, sizeof (uint16));
+
+	if (type != htons (Packet::TYPE_BEACON) &&
+		type != htons (Packet::TYPE_MESSAGE))
+		return false;
+
+	// Claim a position in the ring
+	uint64 position = __atomic_load_n (&mHead, __ATOMIC_RELAXED);
+	Slot* slot;
+
+	forever
+	{
+		slot = &mSlots[position % SlotCount];
+		uint64 sequence = __atomic_load_n (&slot->Sequence, __ATOMIC_ACQUIRE);
+
+		if (sequence == position)
+		{
+			if (__atomic_compare_exchange_n (&mHead, &position, position + 1,
+				true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		}
+
+		// The writer has not freed this slot yet
+		elif (sequence < position)
+		{
+			__atomic_fetch_add (&mDropped, 1, __ATOMIC_RELAXED);
+			return false;
+		}
+
+		else position = __atomic_load_n (&mHead, __ATOMIC_RELAXED);
+	}
+
+	timespec time;
+	clock_gettime (CLOCK_REALTIME, &time);
+
+	slot->Time     = (uint64) time.tv_sec * 1000000000 + time.tv_nsec;
+	slot->Original = length;
+	slot->Length   = length < SnapLength ? length : SnapLength;
+	memcpy (slot->Data, data, slot->Length);
+
+	// Hand the slot to the writer
+	__atomic_store_n (&slot->Sequence, position + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of frames written so far. </summary>
+
+uint64 Capture::GetWritten (void) const
+{
+	return __atomic_load_n (&mWritten, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of frames dropped by a full ring. </summary>
+
+uint64 Capture::GetDropped (void) const
+{
+	return __atomic_load_n (&mDropped, __ATOMIC_RELAXED);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Static                                                             Capture //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the string representation of a specified error. </summary>
+
+std::string Capture::ErrorString (Error error)
+{
+	switch (error)
+	{
+		case ERROR_NONE			: return "";
+		case ERROR_FILE_OPEN	: return "Failed to open file";
+		case ERROR_FILE_MAP		: return "Failed to map file";
+		case ERROR_FILE_WRITE	: return "Failed to write to file";
+		case ERROR_BAD_FORMAT	: return "The file is not an Ethernet pcap trace";
+		default					: return "Unknown error occurred";
+	}
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                           Capture //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Writes the oldest frame, returns false if the ring is empty. </summary>
+/// <remarks> Only called from the writer thread. </remarks>
+
+bool Capture::Write (void)
+{
+	Slot* slot = &mSlots[mTail % SlotCount];
+
+	if (__atomic_load_n (&slot->Sequence,
+		__ATOMIC_ACQUIRE) != mTail + 1)
+		return false;
+
+	uint32 record[RECORD_LENGTH / 4];
+	record[0] = (uint32) (slot->Time / 1000000000);
+	record[1] = (uint32) (slot->Time % 1000000000);
+	record[2] = slot->Length;
+	record[3] = slot->Original;
+
+	fwrite (record, 1, RECORD_LENGTH, mFile);
+	fwrite (slot->Data, 1, slot->Length, mFile);
+
+	// Hand the slot back to the producers
+	__atomic_store_n (&slot->Sequence, mTail + SlotCount, __ATOMIC_RELEASE);
+	__atomic_fetch_add (&mWritten, 1, __ATOMIC_RELAXED);
+
+	++mTail;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Waits for every claimed frame to be published and drops it. </summary>
+/// <remarks> Only called while the writer thread is stopped. </remarks>
+
+void Capture::Discard (void)
+{
+	while (mTail != __atomic_load_n (&mHead, __ATOMIC_ACQUIRE))
+	{
+		Slot* slot = &mSlots[mTail % SlotCount];
+
+		// The producer is still copying the frame
+		while (__atomic_load_n (&slot->Sequence,
+			__ATOMIC_ACQUIRE) != mTail + 1)
+			sched_yield();
+
+		__atomic_store_n (&slot->Sequence, mTail + SlotCount, __ATOMIC_RELEASE);
+		++mTail;
+	}
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                         Trace //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new closed trace. </summary>
+
+Trace::Trace (void)
+{
+	mData   = null;
+	mLength = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes the trace. </summary>
+
+Trace::~Trace (void)
+{
+	Close();
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                              Trace //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Maps a pcap file and indexes its frames. </summary>
+/// <remarks> A truncated last frame is ignored. </remarks>
+
+Capture::Error Trace::Open (const std::string& filename)
+{
+	Close();
+
+	// Attempt to map the file
+	int32 descriptor = open (filename.c_str(), O_RDONLY);
+	if (descriptor < 0) return Capture::ERROR_FILE_OPEN;
+
+	struct stat info;
+	if (fstat (descriptor, &info) != 0)
+		{ close (descriptor); return Capture::ERROR_FILE_OPEN; }
+
+	if (info.st_size < HEADER_LENGTH)
+		{ close (descriptor); return Capture::ERROR_BAD_FORMAT; }
+
+	void* data = mmap (null, info.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+	close (descriptor);
+
+	if (data == MAP_FAILED)
+		return Capture::ERROR_FILE_MAP;
+
+	mData   = (uint8*) data;
+	mLength = info.st_size;
+
+	// Validate the header
+	uint32 magic, link;
+	memcpy (&magic, mData, 4);
+	memcpy (&link, mData + 20, 4);
+
+	bool swapped = magic == bswap_32 (PCAP_MICRO) ||
+				   magic == bswap_32 (PCAP_NANO );
+
+	if (swapped) link = bswap_32 (link);
+
+	if ((!swapped && magic != PCAP_MICRO && magic != PCAP_NANO) ||
+		(link & 0xFFFF) != LINK_ETHERNET)
+		{ Close(); return Capture::ERROR_BAD_FORMAT; }
+
+	// Index every frame
+	for (uint64 offset = HEADER_LENGTH; offset + RECORD_LENGTH <= mLength;)
+	{
+		uint32 length;
+		memcpy (&length, mData + offset + 8, 4);
+		if (swapped) length = bswap_32 (length);
+
+		offset += RECORD_LENGTH;
+		if (length > mLength - offset) break;
+
+		mFrames .push_back (offset);
+		mLengths.push_back (length);
+		offset += length;
+	}
+
+	return Capture::ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Unmaps the trace file. </summary>
+
+void Trace::Close (void)
+{
+	if (mData != null)
+		munmap (mData, mLength);
+
+	mData   = null;
+	mLength = 0;
+
+	mFrames .clear();
+	mLengths.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of frames in the trace. </summary>
+
+uint32 Trace::GetCount (void) const
+{
+	return mFrames.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the captured length of the frame at the index. </summary>
+
+uint32 Trace::GetLength (uint32 index) const
+{
+	return mLengths[index];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the captured data of the frame at the index. </summary>
+
+const uint8* Trace::GetData (uint32 index) const
+{
+	return mData + mFrames[index];
+}
@@ -0,0 +1,157 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "Types.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Writes ORP frames to a pcap file in the background. </summary>
+/// <remarks>
+///   Frames are copied into a bounded lock-free ring by any number of
+///   threads and written to disk by a single writer thread, so the
+///   sender never waits for the disk. Frames arriving while the ring is
+///   full are dropped and counted. Traces use nanosecond timestamps and
+///   the Ethernet link type, so common tools are able to read them.
+/// </remarks>
+
+class Capture
+{
+	friend void* WriterThread (void* parameters);
+
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of possible errors. </summary>
+
+	enum Error
+	{
+		ERROR_NONE = 0,
+		ERROR_FILE_OPEN,
+		ERROR_FILE_MAP,
+		ERROR_FILE_WRITE,
+		ERROR_BAD_FORMAT,
+	};
+
+private:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single frame in the ring. </summary>
+
+	class Slot
+	{
+	public:
+		// Properties
+		uint64		Sequence;			// Position the slot is ready for
+		uint64		Time;				// Realtime in nanoseconds
+		uint32		Length;				// Captured length
+		uint32		Original;			// Length on the wire
+		uint8		Data[2048];			// Captured frame
+	};
+
+public:
+	// Constructors
+	 Capture				(void);
+	~Capture				(void);
+
+private:
+	Capture					(const Capture& capture) { }
+
+public:
+	// Methods
+	Error		Open		(const std::string& filename);
+	void		Close		(void);
+	bool		IsOpen		(void) const;
+
+	bool		Add			(uint32 length, const uint8* data);
+
+	uint64		GetWritten	(void) const;
+	uint64		GetDropped	(void) const;
+
+public:
+	// Constants
+	static const uint32 SlotCount  = 4096;	// Frames held by the ring
+	static const uint32 SnapLength = 2048;	// Largest captured frame
+
+public:
+	// Static
+	static std::string ErrorString (Error error);
+
+private:
+	// Internal
+	bool		Write		(void);
+	void		Discard		(void);
+
+private:
+	// Fields
+	Slot*			mSlots;			// Ring of frames
+	uint64			mHead;			// Next position to fill
+	uint64			mTail;			// Next position to write
+
+	FILE*			mFile;			// Trace being written
+	volatile bool	mActive;		// Currently capturing
+	pthread_t		mWriterThread;	// Writer thread ID
+
+	uint64			mWritten;		// Frames written
+	uint64			mDropped;		// Frames dropped by a full ring
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reads the frames of a pcap file. </summary>
+/// <remarks> The file is mapped and indexed once, so frames can be read
+///           repeatedly without any file I/O. Both byte orders and both
+///           timestamp resolutions are accepted. </remarks>
+
+class Trace
+{
+public:
+	// Constructors
+	 Trace					(void);
+	~Trace					(void);
+
+private:
+	Trace					(const Trace& trace) { }
+
+public:
+	// Methods
+	Capture::Error Open		(const std::string& filename);
+	void		Close		(void);
+
+	uint32		GetCount	(void) const;
+	uint32		GetLength	(uint32 index) const;
+	const uint8* GetData	(uint32 index) const;
+
+private:
+	// Fields
+	uint8*		mData;		// Mapped file
+	uint64		mLength;	// Length of the file
+
+	std::vector<uint64> mFrames;	// Offset of every frame
+	std::vector<uint32> mLengths;	// Length of every frame
+};
+
+#endif // CAPTURE_H
@@ -0,0 +1,57 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "Types.h"
+#include <ctime>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> A utility class to read the monotonic clock. </summary>
+/// <remarks> Reading the clock does not enter the kernel on Linux. </remarks>
+
+class Clock
+{
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Returns the monotonic time in nanoseconds. </summary>
+
+	static uint64 Now (void)
+	{
+		timespec time;
+		clock_gettime (CLOCK_MONOTONIC, &time);
+		return (uint64) time.tv_sec * 1000000000 + time.tv_nsec;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Returns the monotonic time in microseconds. </summary>
+
+	static uint64 Micro (void)
+	{
+		return Now() / 1000;
+	}
+};
+
+#endif // CLOCK_H
@@ -0,0 +1,555 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Control.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Defines                                                                    //
+//----------------------------------------------------------------------------//
+
+#define BACKLOG			16		// Pending connections
+#define SEND_TIMEOUT	1		// Seconds before a stalled client is dropped
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reads exactly length bytes from a socket. </summary>
+
+static bool RecvAll (int32 socket, uint32 length, uint8* data)
+{
+	while (length > 0)
+	{
+		ssize_t result = recv (socket, data, length, 0);
+		if (result <= 0) return false;
+
+		data   += result;
+		length -= result;
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Writes exactly length bytes to a socket. </summary>
+/// <remarks> A closed client must not raise SIGPIPE in the daemon. </remarks>
+
+static bool SendAll (int32 socket, uint32 length, const uint8* data, int32 flags)
+{
+	while (length > 0)
+	{
+		ssize_t result = send (socket, data, length, flags | MSG_NOSIGNAL);
+		if (result <= 0) return false;
+
+		data   += result;
+		length -= result;
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Serves the requests of a single client and writes the
+///           messages delivered to it. </summary>
+/// <remarks> Only this thread writes to the client, so a client which
+///           reads slowly only delays itself. </remarks>
+
+void* ClientThread (void* parameters)
+{
+	// Retrieve the Client instance
+	Control::Client* client = (Control::Client*) parameters;
+	Control* control = client->Owner;
+
+	uint8 type;
+	std::string payload;
+	std::deque<std::string> outbox;
+
+	pollfd events[2];
+	events[0].fd     = client->Socket;
+	events[0].events = POLLIN;
+	events[1].fd     = client->Event;
+	events[1].events = POLLIN;
+
+	forever
+	{
+		if (poll (events, 2, -1) < 0)
+		{
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		// Write every waiting message
+		if (events[1].revents & POLLIN)
+		{
+			uint64 value;
+			read (client->Event, &value, sizeof (uint64));
+
+			pthread_mutex_lock (&control->mMutex);
+			outbox.swap (client->Outbox);
+			pthread_mutex_unlock (&control->mMutex);
+
+			for (uint32 i = 0; i < outbox.size(); ++i)
+				control->Reply (client, Control::TYPE_MESSAGE, outbox[i].
+					length(), (const uint8*) outbox[i].data());
+
+			outbox.clear();
+		}
+
+		if (events[0].revents != 0)
+		{
+			if (!Control::ReadFrame (client->Socket, type, payload)) break;
+			control->Process (client, type, payload);
+		}
+	}
+
+	control->Remove (client);
+	return null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Accepts new clients until the listening socket is shut down. </summary>
+
+void* AcceptThread (void* parameters)
+{
+	// Retrieve the Control instance
+	Control* control = (Control*) parameters;
+
+	forever
+	{
+		int32 socket = accept (control->mSocket, null, null);
+		if (socket < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			break;
+		}
+
+		// Drop clients which stop reading
+		timeval timeout = { SEND_TIMEOUT, 0 };
+		setsockopt (socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof (timeout));
+
+		// Signals messages delivered to the client
+		int32 event = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (event < 0) { close (socket); continue; }
+
+		Control::Client* client = new Control::Client;
+		client->Socket     = socket;
+		client->Event      = event;
+		client->Subscribed = false;
+		client->Owner      = control;
+
+		pthread_mutex_lock (&control->mMutex);
+		control->mClients.push_back (client);
+		pthread_mutex_unlock (&control->mMutex);
+
+		pthread_t thread;
+		if (pthread_create (&thread, null, ClientThread, client) != 0)
+			control->Remove (client);
+		else pthread_detach (thread);
+	}
+
+	return null;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                       Control //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new uninitialized control server. </summary>
+
+Control::Control (void)
+{
+	mRouter      = null;
+	mSocket      = -1;
+	mSubscribers = 0;
+
+	pthread_mutex_init (&mMutex, null);
+	pthread_cond_init  (&mCond,  null);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Destroys the control server. </summary>
+
+Control::~Control (void)
+{
+	Destroy();
+
+	pthread_mutex_destroy (&mMutex);
+	pthread_cond_destroy  (&mCond );
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                            Control //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Listens for clients on a Unix socket at the path. </summary>
+/// <remarks> A stale socket file left by a previous run is replaced. </remarks>
+
+Control::Error Control::Create (const std::string& path, OnionRouter* router)
+{
+	Destroy();
+
+	sockaddr_un local;
+	memset (&local, 0, sizeof (sockaddr_un));
+	local.sun_family = AF_UNIX;
+
+	if (path.empty() || path.length() >= sizeof (local.sun_path))
+		return ERROR_PATH_LENGTH;
+
+	memcpy (local.sun_path, path.data(), path.length());
+
+	// Open a socket
+	mSocket = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (mSocket < 0) return ERROR_OPEN_SOCK;
+
+	unlink (path.c_str());
+
+	// Bind the socket
+	if (bind (mSocket, (sockaddr*) &local, sizeof (sockaddr_un)) != 0)
+		{ close (mSocket); mSocket = -1; return ERROR_BIND_SOCK; }
+
+	if (listen (mSocket, BACKLOG) != 0)
+	{
+		close (mSocket); mSocket = -1;
+		unlink (path.c_str()); return ERROR_LISTEN;
+	}
+
+	mPath   = path;
+	mRouter = router;
+
+	pthread_create (&mAcceptThread, null, AcceptThread, this);
+	return ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Disconnects every client and removes the socket. </summary>
+/// <remarks> Stop the router first, so no message is still being delivered. </remarks>
+
+void Control::Destroy (void)
+{
+	if (mSocket < 0) return;
+
+	// Stop accepting clients
+	shutdown (mSocket, SHUT_RDWR);
+	pthread_join (mAcceptThread, null);
+	close (mSocket);
+	unlink (mPath.c_str());
+
+	// Wait for every client thread to exit
+	pthread_mutex_lock (&mMutex);
+
+	for (std::list<Client*>::iterator i =
+		mClients.begin(); i != mClients.end(); ++i)
+		shutdown ((*i)->Socket, SHUT_RDWR);
+
+	while (!mClients.empty())
+		pthread_cond_wait (&mCond, &mMutex);
+
+	pthread_mutex_unlock (&mMutex);
+
+	mSocket = -1;
+	mRouter = null;
+	mPath.clear();
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Static                                                             Control //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the string representation of a specified error. </summary>
+
+std::string Control::ErrorString (Error error)
+{
+	switch (error)
+	{
+		case ERROR_NONE			: return "";
+		case ERROR_PATH_LENGTH	: return "The socket path is empty or too long";
+		case ERROR_OPEN_SOCK	: return "Failed to open control socket";
+		case ERROR_BIND_SOCK	: return "Failed to bind control socket";
+		case ERROR_LISTEN		: return "Failed to listen on control socket";
+		default					: return "Unknown error occurred";
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reads a single frame, returns false once the peer is gone. </summary>
+
+bool Control::ReadFrame (int32 socket, uint8& type, std::string& payload)
+{
+	uint8 header[HeaderLength];
+	if (!RecvAll (socket, HeaderLength, header))
+		return false;
+
+	uint32 length = le32toh (*(uint32*) header);
+	if (length < 1 || length > MaxFrame)
+		return false;
+
+	type = header[4];
+	payload.resize (length - 1);
+
+	return length == 1 || RecvAll (socket,
+		length - 1, (uint8*) &payload[0]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Writes a single frame, returns false if it could not be sent. </summary>
+
+bool Control::WriteFrame (int32 socket, uint8 type,
+						  uint32 length, const uint8* payload)
+{
+	if (length + 1 > MaxFrame)
+		return false;
+
+	uint8 header[HeaderLength];
+	*(uint32*) header = htole32 (length + 1);
+	header[4] = type;
+
+	return SendAll (socket, HeaderLength, header, length > 0 ? MSG_MORE : 0) &&
+		   SendAll (socket, length, payload, 0);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                           Control //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Handles a single request from a client. </summary>
+
+void Control::Process (Client* client, uint8 type, const std::string& payload)
+{
+	const uint8* data = (const uint8*) payload.data();
+	uint32 length = payload.length();
+
+	switch (type)
+	{
+		case TYPE_SEND:
+		{
+			if (length < 4 + Address::Length) break;
+
+			uint32 tag = le32toh (*(uint32*) data);
+
+			Address destination;
+			memcpy (destination.Data, data + 4, Address::Length);
+
+			Message message;
+			message.Create (length - 4 - Address::Length);
+			memcpy (message.GetData(), data + 4 + Address::Length, message.GetLength());
+
+			bool success = mRouter->Send (destination, message);
+
+			if (tag != 0)
+			{
+				uint8 reply[5];
+				*(uint32*) reply = htole32 (tag);
+				reply[4] = success ? 1 : 0;
+				Reply (client, TYPE_SEND | TYPE_REPLY, 5, reply);
+			}
+
+			return;
+		}
+
+		case TYPE_SUBSCRIBE:
+		{
+			if (length < 1) break;
+
+			Subscribe (client, data[0] != 0);
+			Reply (client, TYPE_SUBSCRIBE | TYPE_REPLY, 0, null);
+			return;
+		}
+
+		case TYPE_LIST:
+		{
+			std::string reply (4, 0);
+
+			mRouter->Lock();
+			for (std::list<OnionRouter::Node*>::iterator i = mRouter->
+				Network.begin(); i != mRouter->Network.end(); ++i)
+			{
+				uint16 hops = htole16 ((uint16) (*i)->Addresses.size());
+				reply.append ((const char*) (*i)->Addr.Data, Address::Length);
+				reply.append ((const char*) &hops, 2);
+			}
+			mRouter->Unlock();
+
+			uint32 count = (reply.length() - 4) / (Address::Length + 2);
+			*(uint32*) &reply[0] = htole32 (count);
+
+			Reply (client, TYPE_LIST | TYPE_REPLY,
+				reply.length(), (const uint8*) reply.data());
+			return;
+		}
+
+		case TYPE_STATS:
+		{
+			Statistics::Snapshot stats = mRouter->GetStats();
+
+			uint8 reply[4 + Statistics::COUNTER_COUNT * 8 + 28];
+			uint8* output = reply;
+
+			*(uint32*) output = htole32 (Statistics::COUNTER_COUNT); output += 4;
+
+			for (uint32 i = 0; i < Statistics::COUNTER_COUNT; ++i, output += 8)
+				*(uint64*) output = htole64 (stats.Counters[i]);
+
+			*(uint32*) output = htole32 (stats.Neighbors ); output += 4;
+			*(uint32*) output = htole32 (stats.InboxDepth); output += 4;
+			*(uint32*) output = htole32 (stats.SendQueue ); output += 4;
+			*(uint32*) output = htole32 (stats.Streams   ); output += 4;
+			*(uint32*) output = htole32 (stats.FrameRate ); output += 4;
+			*(uint64*) output = htole64 (stats.ByteRate  ); output += 8;
+
+			Reply (client, TYPE_STATS | TYPE_REPLY, sizeof (reply), reply);
+			return;
+		}
+
+		case TYPE_FLUSH:
+		{
+			mRouter->Flush();
+			Reply (client, TYPE_FLUSH | TYPE_REPLY, 0, null);
+			return;
+		}
+
+		case TYPE_RELOAD:
+		{
+			uint8 reply[5];
+			reply[0] = (uint8) mRouter->ReloadIgnoreList();
+			*(uint32*) (reply + 1) = htole32 (mRouter->GetIgnoreRuleCount());
+
+			Reply (client, TYPE_RELOAD | TYPE_REPLY, 5, reply);
+			return;
+		}
+	}
+
+	// The request was malformed or unknown
+	Reply (client, TYPE_ERROR, 1, &type);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Writes a frame to a client, disconnecting it on failure. </summary>
+/// <remarks> Only called from the thread of the client. </remarks>
+
+bool Control::Reply (Client* client, uint8 type,
+					 uint32 length, const uint8* payload)
+{
+	bool result = WriteFrame (client->Socket, type, length, payload);
+
+	// Wakes the client thread which removes it
+	if (!result) shutdown (client->Socket, SHUT_RDWR);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Adds or removes a client from the delivered message fan-out. </summary>
+/// <remarks> The router handler is only installed while someone subscribes,
+///           otherwise messages stay in the inbox for the FLUSH request. </remarks>
+
+void Control::Subscribe (Client* client, bool enable)
+{
+	pthread_mutex_lock (&mMutex);
+
+	if (client->Subscribed != enable)
+	{
+		client->Subscribed = enable;
+		mSubscribers += enable ? 1 : -1;
+
+		if (enable && mSubscribers == 1)
+			mRouter->SetReceiveHandler (Deliver, this);
+
+		if (!enable && mSubscribers == 0)
+			mRouter->SetReceiveHandler (null);
+	}
+
+	pthread_mutex_unlock (&mMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Disconnects and deletes a client. </summary>
+
+void Control::Remove (Client* client)
+{
+	Subscribe (client, false);
+
+	pthread_mutex_lock (&mMutex);
+	mClients.remove (client);
+	pthread_cond_broadcast (&mCond);
+	pthread_mutex_unlock (&mMutex);
+
+	close (client->Socket);
+	close (client->Event);
+	delete client;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Forwards a delivered message to every subscribed client. </summary>
+/// <remarks> The message is queued for the thread of every client, so a
+///           stalled client never delays the others. A client whose
+///           queue is full is disconnected. </remarks>
+
+void Control::Deliver (Buffer&& message, void* user)
+{
+	// Retrieve the Control instance
+	Control* control = (Control*) user;
+	pthread_mutex_lock (&control->mMutex);
+
+	for (std::list<Client*>::iterator i = control->
+		mClients.begin(); i != control->mClients.end(); ++i)
+	{
+		Client* client = *i;
+		if (!client->Subscribed) continue;
+
+		// Wakes the client thread which removes it
+		if (client->Outbox.size() >= MaxOutbox)
+		{
+			shutdown (client->Socket, SHUT_RDWR);
+			continue;
+		}
+
+		client->Outbox.push_back (std::string ((const char*)
+			message.GetData(), message.GetLength()));
+
+		uint64 value = 1;
+		write (client->Event, &value, sizeof (uint64));
+	}
+
+	pthread_mutex_unlock (&control->mMutex);
+}
@@ -0,0 +1,161 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "OnionRouter.h"
+
+#include <list>
+#include <deque>
+#include <string>
+#include <pthread.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Exposes a router to other processes over a Unix socket. </summary>
+/// <remarks>
+///   Every frame is a little-endian 32-bit length, followed by a type
+///   byte and a payload, the length counts the type and the payload.
+///   Requests and their replies (type | 0x80) are:
+///
+///     SEND       tag u32, address[6], data  -> SEND   tag u32, status u8
+///     SUBSCRIBE  enable u8                  -> SUBSCRIBE
+///     LIST                                  -> LIST   count u32, (address[6], hops u16) ...
+///     STATS                                 -> STATS  count u32, counter u64 ...,
+///                                                     neighbors, inbox, queue, streams,
+///                                                     frame rate u32, byte rate u64
+///     FLUSH                                 -> FLUSH
+///     RELOAD                                -> RELOAD status u8, rules u32
+///
+///   A SEND with a zero tag is not answered. RELOAD reads the ignore
+///   list again, its status is an AddressFilter::Error. Subscribed
+///   clients receive every delivered message as a MESSAGE frame holding
+///   its data. Every client is served by its own thread so clients never
+///   wait on each other, replies to one client arrive in request order.
+///   Delivered messages wait in a queue per client, a client falling
+///   MaxOutbox messages behind is disconnected.
+/// </remarks>
+
+class Control
+{
+	friend void* AcceptThread (void* parameters);
+	friend void* ClientThread (void* parameters);
+
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of possible errors. </summary>
+
+	enum Error
+	{
+		ERROR_NONE = 0,
+		ERROR_PATH_LENGTH,
+		ERROR_OPEN_SOCK,
+		ERROR_BIND_SOCK,
+		ERROR_LISTEN,
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of frame types. </summary>
+
+	enum Type
+	{
+		TYPE_SEND		= 0x01,
+		TYPE_SUBSCRIBE	= 0x02,
+		TYPE_LIST		= 0x03,
+		TYPE_STATS		= 0x04,
+		TYPE_FLUSH		= 0x05,
+		TYPE_RELOAD		= 0x06,
+
+		TYPE_REPLY		= 0x80,		// Set on every reply
+		TYPE_MESSAGE	= 0x82,		// Delivered message
+		TYPE_ERROR		= 0xFF,		// Malformed or unknown request
+	};
+
+private:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single connected client. </summary>
+
+	class Client
+	{
+	public:
+		// Properties
+		int32			Socket;		// Client socket
+		int32			Event;		// Readable while messages wait
+		bool			Subscribed;	// Receives delivered messages
+		Control*		Owner;		// Control server
+
+		// Delivered messages waiting to be written
+		std::deque<std::string> Outbox;
+	};
+
+public:
+	// Constructors
+	 Control					(void);
+	~Control					(void);
+
+private:
+	Control						(const Control& control) { }
+
+public:
+	// Methods
+	Error			Create		(const std::string& path, OnionRouter* router);
+	void			Destroy		(void);
+
+public:
+	// Constants
+	static const uint32 MaxFrame = 65536;
+	static const uint32 HeaderLength = 5;
+	static const uint32 MaxOutbox = 256;
+
+public:
+	// Static
+	static std::string ErrorString (Error error);
+
+	static bool		ReadFrame	(int32 socket, uint8& type, std::string& payload);
+	static bool		WriteFrame	(int32 socket, uint8 type,
+								 uint32 length, const uint8* payload);
+
+private:
+	// Internal
+	void			Process		(Client* client, uint8 type, const std::string& payload);
+	bool			Reply		(Client* client, uint8 type,
+								 uint32 length, const uint8* payload);
+	void			Subscribe	(Client* client, bool enable);
+	void			Remove		(Client* client);
+
+	static void		Deliver		(Buffer&& message, void* user);
+
+private:
+	// Fields
+	OnionRouter*	mRouter;		// Router being controlled
+	std::string		mPath;			// Socket path
+	int32			mSocket;		// Listening socket
+	pthread_t		mAcceptThread;	// Accept thread ID
+
+	std::list<Client*> mClients;	// Connected clients
+	uint32			mSubscribers;	// Number of subscribed clients
+	pthread_mutex_t	mMutex;			// Client and outbox synchronization
+	pthread_cond_t	mCond;			// Signals removed clients
+};
+
+#endif // CONTROL_H
@@ -0,0 +1,248 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "FrameScheduler.h"
+#include <utility>
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                         Frame //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new empty frame. </summary>
+
+FrameScheduler::Frame::Frame (void)
+{
+	Lent   = null;
+	Lender = null;
+	Length = 0;
+	Link   = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Moves the frame, leaving the other one empty. </summary>
+
+FrameScheduler::Frame::Frame (Frame&& frame)
+{
+	Lent   = null;
+	Lender = null;
+	*this  = std::move (frame);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the data of a frame which was never sent. </summary>
+
+FrameScheduler::Frame::~Frame (void)
+{
+	Release();
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                              Frame //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the data to its pool or its lender unsent. </summary>
+
+void FrameScheduler::Frame::Release (void)
+{
+	if (Lender != null)
+		Lender->Release (Lent);
+
+	Data.Release();
+	Lent   = null;
+	Lender = null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the serialized frame. </summary>
+
+uint8* FrameScheduler::Frame::GetData (void) const
+{
+	return Lender != null ? Lent : Data.GetData();
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Operators                                                            Frame //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Moves the frame, releasing the previous data. </summary>
+
+FrameScheduler::Frame& FrameScheduler::Frame::operator = (Frame&& frame)
+{
+	if (this == &frame) return *this;
+	Release();
+
+	Data   = std::move (frame.Data);
+	Lent   = frame.Lent;
+	Lender = frame.Lender;
+	Length = frame.Length;
+	Next   = frame.Next;
+	Link   = frame.Link;
+
+	frame.Lent   = null;
+	frame.Lender = null;
+	return *this;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                FrameScheduler //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new empty scheduler. </summary>
+/// <remarks> Control frames weigh twice as much as relayed or local
+///           frames, which share the rest equally. </remarks>
+
+FrameScheduler::FrameScheduler (void)
+{
+	for (uint32 i = 0; i < Packet::CLASS_COUNT; ++i)
+	{
+		mQueues[i].Weight  = 2;
+		mQueues[i].Deficit = 0;
+	}
+
+	mQueues[Packet::CLASS_CONTROL].Weight = 4;
+
+	mCurrent = 0;
+	mVisited = false;
+	mCount   = 0;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                     FrameScheduler //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the share of the transmitter of a class. </summary>
+/// <remarks> A weight of zero is raised to one, so no class starves. </remarks>
+
+void FrameScheduler::SetWeight (uint32 priority, uint32 weight)
+{
+	if (priority >= Packet::CLASS_COUNT) return;
+	mQueues[priority].Weight = weight > 0 ? weight : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the share of the transmitter of a class. </summary>
+
+uint32 FrameScheduler::GetWeight (uint32 priority) const
+{
+	return priority < Packet::CLASS_COUNT ? mQueues[priority].Weight : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Queues the frame in its class. </summary>
+/// <remarks> Returns false if its queue is full, the caller then keeps
+///           the frame. Unknown classes are queued as local frames. </remarks>
+
+bool FrameScheduler::Push (uint32 priority, Frame&& frame)
+{
+	if (priority >= Packet::CLASS_COUNT)
+		priority = Packet::CLASS_LOCAL;
+
+	Queue& queue = mQueues[priority];
+	if (queue.Frames.size() >= MaxQueue) return false;
+
+	queue.Frames.push_back (std::move (frame));
+	++mCount;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Takes the next frame to send. </summary>
+/// <remarks> Returns false if every queue is empty. </remarks>
+
+bool FrameScheduler::Pop (Frame& frame)
+{
+	if (mCount == 0) return false;
+
+	forever
+	{
+		Queue& queue = mQueues[mCurrent];
+
+		if (!queue.Frames.empty())
+		{
+			// Every turn adds the quanta of the class once
+			if (!mVisited)
+			{
+				queue.Deficit += queue.Weight * Quantum;
+				mVisited = true;
+			}
+
+			uint32 length = queue.Frames.front().Length;
+			if (length <= queue.Deficit)
+			{
+				queue.Deficit -= length;
+				frame = std::move (queue.Frames.front());
+				queue.Frames.pop_front();
+				--mCount;
+				return true;
+			}
+		}
+
+		// Idle classes may not save up for later
+		else queue.Deficit = 0;
+
+		mCurrent = (mCurrent + 1) % Packet::CLASS_COUNT;
+		mVisited = false;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Drops every queued frame. </summary>
+/// <remarks> Lent frames return to their transports, which must still
+///           be open. </remarks>
+
+void FrameScheduler::Clear (void)
+{
+	for (uint32 i = 0; i < Packet::CLASS_COUNT; ++i)
+	{
+		mQueues[i].Frames.clear();
+		mQueues[i].Deficit = 0;
+	}
+
+	mVisited = false;
+	mCount   = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of queued frames. </summary>
+
+uint32 FrameScheduler::GetCount (void) const
+{
+	return mCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of queued frames of a class. </summary>
+
+uint32 FrameScheduler::GetDepth (uint32 priority) const
+{
+	return priority < Packet::CLASS_COUNT ? mQueues[priority].Frames.size() : 0;
+}
@@ -0,0 +1,123 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include "Buffer.h"
+#include "Packet.h"
+#include "Address.h"
+#include "Transport.h"
+
+#include <deque>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Orders outgoing frames by traffic class. </summary>
+/// <remarks>
+///   Every class of Packet::Class has its own bounded queue, served by
+///   deficit round robin: each turn a class may send as many bytes as
+///   its weight times the quantum, plus whatever it left unused while
+///   it had frames waiting. Classes thus share the transmitter in the
+///   ratio of their weights whatever the size of their frames, and a
+///   frame waits at most one turn of the other classes. Frames may be
+///   serialized into buffers lent by the transport they leave through,
+///   which are returned to it when they are dropped. The scheduler is
+///   not synchronized, its owner must serialize every call.
+/// </remarks>
+
+class FrameScheduler
+{
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single queued frame. </summary>
+
+	class Frame
+	{
+	public:
+		// Constructors
+		 Frame					(void);
+		 Frame					(Frame&& frame);
+		~Frame					(void);
+
+	public:
+		// Methods
+		void		Release		(void);
+		uint8*		GetData		(void) const;
+
+	public:
+		// Operators
+		Frame& operator =		(Frame&& frame);
+
+	public:
+		// Properties
+		Buffer		Data;		// Serialized frame, unless lent
+		uint8*		Lent;		// Serialized frame lent by the lender
+		Transport*	Lender;		// Transport which lent the frame (if any)
+		uint32		Length;		// Frame length
+		Address		Next;		// Next hop
+		uint32		Link;		// Interface to send on, or every one
+	};
+
+private:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents the queue of a single class. </summary>
+
+	class Queue
+	{
+	public:
+		// Properties
+		std::deque<Frame> Frames;	// Waiting frames
+		uint32		Weight;			// Quanta per turn
+		uint32		Deficit;		// Bytes left to send this turn
+	};
+
+public:
+	// Constants
+	static const uint32 Quantum  = 1500;	// Bytes per weight per turn
+	static const uint32 MaxQueue = 1024;	// Frames per class
+
+public:
+	// Constructors
+	FrameScheduler				(void);
+
+public:
+	// Methods
+	void		SetWeight		(uint32 priority, uint32 weight);
+	uint32		GetWeight		(uint32 priority) const;
+
+	bool		Push			(uint32 priority, Frame&& frame);
+	bool		Pop				(Frame& frame);
+	void		Clear			(void);
+
+	uint32		GetCount		(void) const;
+	uint32		GetDepth		(uint32 priority) const;
+
+private:
+	// Fields
+	Queue		mQueues[Packet::CLASS_COUNT];	// Queue of every class
+	uint32		mCurrent;						// Class being served
+	bool		mVisited;						// Its turn has begun
+	uint32		mCount;							// Frames in every queue
+};
+
+#endif // FRAME_SCHEDULER_H
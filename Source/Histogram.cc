@@ -0,0 +1,163 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Histogram.h"
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                     Histogram //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new empty histogram. </summary>
+
+Histogram::Histogram (void)
+{
+	Reset();
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                          Histogram //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Records a single value. </summary>
+
+void Histogram::Record (uint64 value)
+{
+	__atomic_fetch_add (&mBuckets[GetIndex (value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add (&mCount, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add (&mSum, value, __ATOMIC_RELAXED);
+
+	// Raise the maximum, which rarely changes
+	uint64 max = __atomic_load_n (&mMax, __ATOMIC_RELAXED);
+	while (value > max && !__atomic_compare_exchange_n (&mMax,
+		&max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Removes every recorded value. </summary>
+
+void Histogram::Reset (void)
+{
+	for (uint32 i = 0; i < BucketCount; ++i)
+		__atomic_store_n (&mBuckets[i], 0, __ATOMIC_RELAXED);
+
+	__atomic_store_n (&mCount, 0, __ATOMIC_RELAXED);
+	__atomic_store_n (&mSum  , 0, __ATOMIC_RELAXED);
+	__atomic_store_n (&mMax  , 0, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of recorded values. </summary>
+
+uint64 Histogram::GetCount (void) const
+{
+	return __atomic_load_n (&mCount, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the largest recorded value. </summary>
+
+uint64 Histogram::GetMax (void) const
+{
+	return __atomic_load_n (&mMax, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the mean of the recorded values. </summary>
+
+real64 Histogram::GetMean (void) const
+{
+	uint64 count = GetCount();
+	return count == 0 ? 0 : (real64) __atomic_load_n
+		(&mSum, __ATOMIC_RELAXED) / count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the value below which the specified percentage of
+///           recorded values fall, for example 99.9 for the p999. </summary>
+/// <remarks> Returns zero if nothing has been recorded. </remarks>
+
+uint64 Histogram::GetPercentile (real64 percentile) const
+{
+	// Copy the buckets so the total matches
+	uint64 buckets[BucketCount];
+	uint64 total = 0;
+
+	for (uint32 i = 0; i < BucketCount; ++i)
+	{
+		buckets[i] = __atomic_load_n (&mBuckets[i], __ATOMIC_RELAXED);
+		total += buckets[i];
+	}
+
+	if (total == 0) return 0;
+
+	// Find the bucket containing the rank
+	uint64 rank = (uint64) (percentile / 100 * total + 0.5);
+	if (rank < 1) rank = 1;
+
+	uint64 seen = 0;
+	for (uint32 i = 0; i < BucketCount; ++i)
+	{
+		seen += buckets[i];
+		if (seen >= rank)
+		{
+			uint64 max = GetMax();
+			uint64 value = GetValue (i);
+			return max != 0 && value > max ? max : value;
+		}
+	}
+
+	return GetMax();
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                         Histogram //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the bucket that the value belongs to. </summary>
+
+uint32 Histogram::GetIndex (uint64 value)
+{
+	if (value < SubBuckets) return (uint32) value;
+
+	// Use the top five bits of the value
+	uint32 msb = 63 - __builtin_clzll (value);
+	uint32 sub = (uint32) (value >> (msb - 4)) - SubBuckets;
+	return (msb - 3) * SubBuckets + sub;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the largest value that belongs to the bucket. </summary>
+
+uint64 Histogram::GetValue (uint32 index)
+{
+	if (index < SubBuckets) return index;
+
+	uint32 msb = index / SubBuckets + 3;
+	uint64 sub = index % SubBuckets;
+	uint64 lower = (SubBuckets + sub) << (msb - 4);
+	return lower + (((uint64) 1 << (msb - 4)) - 1);
+}
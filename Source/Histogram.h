@@ -0,0 +1,75 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "Types.h"
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> A lock-free, log bucketed histogram of latencies. </summary>
+/// <remarks>
+///   Every power of two is split into 16 linear sub buckets, so any
+///   recorded value is reported within about 6% of its true value.
+///   Values may be recorded, read and reset from any thread.
+/// </remarks>
+
+class Histogram
+{
+public:
+	// Constants
+	static const uint32 SubBuckets  = 16;	// Sub buckets per power of two
+	static const uint32 BucketCount = 976;	// Buckets up to 2^64
+
+public:
+	// Constructors
+	Histogram				(void);
+
+private:
+	Histogram				(const Histogram& histogram) { }
+
+public:
+	// Methods
+	void	Record			(uint64 value);
+	void	Reset			(void);
+
+	uint64	GetCount		(void) const;
+	uint64	GetMax			(void) const;
+	real64	GetMean			(void) const;
+	uint64	GetPercentile	(real64 percentile) const;
+
+private:
+	// Internal
+	static uint32 GetIndex	(uint64 value);
+	static uint64 GetValue	(uint32 index);
+
+private:
+	// Fields
+	uint64	mBuckets[BucketCount];	// Recorded values per bucket
+	uint64	mCount;					// Number of recorded values
+	uint64	mSum;					// Sum of recorded values
+	uint64	mMax;					// Largest recorded value
+};
+
+#endif // HISTOGRAM_H
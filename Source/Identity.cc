@@ -16,8 +16,52 @@
 //----------------------------------------------------------------------------//
 
 #include <cstdio>
+#include "CRC32.h"
 #include "Identity.h"
 
+#include <fcntl.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Types                                                                      //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Number of fields in unsigned and signed binary identities. </summary>
+
+#define UNSIGNED_FIELDS	7
+#define SIGNED_FIELDS	9
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Length of the binary header and checksum. </summary>
+
+#define HEADER_LENGTH	8
+#define CHECKSUM_LENGTH	4
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Computes R^2 mod N the way mpi_exp_mod expects it cached. </summary>
+/// <remarks> mpi_exp_mod only computes this value when the cache is empty
+///           and uses R = 2^(limbs of N), so every later exponentiation
+///           with the same modulus skips the full-width reduction. </remarks>
+
+static bool ComputeRR (mpi* rr, const mpi* modulus)
+{
+	return mpi_lset    (rr, 1) == 0 &&
+		   mpi_shift_l (rr, modulus->n * 2 * sizeof (t_uint) * 8) == 0 &&
+		   mpi_mod_mpi (rr, rr, modulus) == 0;
+}
+
 
 
 //----------------------------------------------------------------------------//
@@ -30,6 +74,7 @@
 Identity::Identity (void)
 {
 	SignLength = 0;
+	FileFormat = FORMAT_TEXT;
 
 	mpi_init (&AuthKey);
 	mpi_init (&SignKey);
@@ -70,20 +115,55 @@ Identity::Error Identity::Create (uint16 length)
 	if (ctr_drbg_init (&ctr_drbg, entropy_func, &entropy, null, 0) != 0)
 		return ERROR_CTR_DRBG_INIT;
 
+	return Create (length, &ctr_drbg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Create a new unsigned identity token. </summary>
+/// <remarks> Uses an already seeded random number generator, which must
+///           not be shared with other threads during this call. </remarks>
+
+Identity::Error Identity::Create (uint16 length, ctr_drbg_context* random)
+{
 	// Generate an RSA key
-	if (rsa_gen_key (&RsaState, ctr_drbg_random, &ctr_drbg, length, EXPONENT) != 0)
+	if (rsa_gen_key (&RsaState, ctr_drbg_random, random, length, EXPONENT) != 0)
 		return ERROR_RSA_GEN_KEY;
 
 	SignLength = 0;
-	return ERROR_NONE;
+	return Precompute();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// <summary> Loads an identity token from a file. </summary>
-/// <remarks> This function Destroys the previous identity. </remarks>
+/// <remarks> This function Destroys the previous identity. The format
+///           is detected from the file and remembered for Save. </remarks>
 
 Identity::Error Identity::Load (const std::string& filename)
 {
+	// Attempt to map the file
+	int32 descriptor = open (filename.c_str(), O_RDONLY);
+	if (descriptor < 0) return ERROR_FILE_OPEN;
+
+	struct stat info;
+	if (fstat (descriptor, &info) != 0 || info.st_size == 0)
+		{ close (descriptor); return ERROR_FILE_OPEN; }
+
+	void* data = mmap (null, info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	close (descriptor);
+
+	if (data == MAP_FAILED)
+		return ERROR_FILE_MAP;
+
+	// Binary identities are read straight from the mapping
+	if (IsBinary (info.st_size, (const uint8*) data))
+	{
+		Error error = Deserialize (info.st_size, (const uint8*) data);
+		munmap (data, info.st_size);
+		return error;
+	}
+
+	munmap (data, info.st_size);
+
 	// Attempt to open the file
 	FILE* file = fopen (filename.c_str(), "rb");
 	if (file == null) return ERROR_FILE_OPEN;
@@ -108,15 +188,33 @@ Identity::Error Identity::Load (const std::string& filename)
 	RsaState.len = (mpi_msb (&RsaState.N) + 7) >> 3;
 	mpi_lset (&RsaState.E, EXPONENT);
 
+	FileFormat = FORMAT_TEXT;
 	fclose (file);
-	return ERROR_NONE;
+	return Precompute();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// <summary> Saves an identity token to a file. </summary>
+/// <summary> Saves an identity token to a file in the current format. </summary>
 
 Identity::Error Identity::Save (const std::string& filename) const
 {
+	if (FileFormat == FORMAT_BINARY)
+	{
+		uint32 length = ComputeSize();
+		uint8* buffer = new uint8[length];
+		Serialize (length, buffer);
+
+		// Attempt to open the file
+		FILE* file = fopen (filename.c_str(), "wb+");
+		if (file == null) { delete[] buffer; return ERROR_FILE_OPEN; }
+
+		bool written = fwrite (buffer, 1, length, file) == length;
+		written = fclose (file) == 0 && written;
+
+		delete[] buffer;
+		return written ? ERROR_NONE : ERROR_FILE_WRITE;
+	}
+
 	// Attempt to open the file
 	FILE* file = fopen (filename.c_str(), "wb+");
 	if (file == null) return ERROR_FILE_OPEN;
@@ -143,6 +241,140 @@ Identity::Error Identity::Save (const std::string& filename) const
 	return ERROR_NONE;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the length of this identity in the binary format. </summary>
+
+uint32 Identity::ComputeSize (void) const
+{
+	const mpi* fields[] =
+	{
+		&RsaState.N , &RsaState.D , &RsaState.P , &RsaState.Q,
+		&RsaState.DP, &RsaState.DQ, &RsaState.QP, &AuthKey, &SignKey
+	};
+
+	uint32 count = SignLength != 0 ? SIGNED_FIELDS : UNSIGNED_FIELDS;
+	uint32 length = HEADER_LENGTH + CHECKSUM_LENGTH;
+
+	for (uint32 i = 0; i < count; ++i)
+		length += sizeof (uint32) + mpi_size (fields[i]);
+
+	return length;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Serializes this identity in the binary format. </summary>
+/// <remarks> This function returns false if the length is too small. </remarks>
+
+bool Identity::Serialize (uint32 length, uint8* buffer) const
+{
+	// Is the buffer large enough
+	if (length < ComputeSize())
+		return false;
+
+	const mpi* fields[] =
+	{
+		&RsaState.N , &RsaState.D , &RsaState.P , &RsaState.Q,
+		&RsaState.DP, &RsaState.DQ, &RsaState.QP, &AuthKey, &SignKey
+	};
+
+	uint16 count = SignLength != 0 ? SIGNED_FIELDS : UNSIGNED_FIELDS;
+	uint16 version = htole16 (IDENTITY_VERSION);
+	uint16 fieldCount = htole16 (count);
+	uint8* start = buffer;
+
+	// Write the header
+	memcpy (buffer, IDENTITY_MAGIC, 4);	buffer += 4;
+	memcpy (buffer, &version,    sizeof (uint16)); buffer += sizeof (uint16);
+	memcpy (buffer, &fieldCount, sizeof (uint16)); buffer += sizeof (uint16);
+
+	// Write every length-prefixed field
+	for (uint32 i = 0; i < count; ++i)
+	{
+		uint32 size = mpi_size (fields[i]);
+		uint32 prefix = htole32 (size);
+
+		memcpy (buffer, &prefix, sizeof (uint32)); buffer += sizeof (uint32);
+		mpi_write_binary (fields[i], buffer, size); buffer += size;
+	}
+
+	// Append the checksum
+	CRC32 crc;
+	crc.Add (buffer - start, start);
+	uint32 checksum = htole32 (crc.Value);
+	memcpy (buffer, &checksum, sizeof (uint32));
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reads an identity in the binary format. </summary>
+/// <remarks> This function Destroys the previous identity. </remarks>
+
+Identity::Error Identity::Deserialize (uint32 length, const uint8* buffer)
+{
+	if (!IsBinary (length, buffer) ||
+		length < HEADER_LENGTH + CHECKSUM_LENGTH)
+		return ERROR_BAD_FORMAT;
+
+	// Verify the checksum first
+	uint32 checksum;
+	memcpy (&checksum, buffer + length - CHECKSUM_LENGTH, sizeof (uint32));
+
+	CRC32 crc;
+	crc.Add (length - CHECKSUM_LENGTH, buffer);
+	if (crc.Value != le32toh (checksum))
+		return ERROR_CHECKSUM;
+
+	// Read the header
+	uint16 version, count;
+	memcpy (&version, buffer + 4, sizeof (uint16));
+	memcpy (&count,   buffer + 6, sizeof (uint16));
+
+	version = le16toh (version);
+	count   = le16toh (count);
+
+	if (version != IDENTITY_VERSION ||
+		(count != UNSIGNED_FIELDS && count != SIGNED_FIELDS))
+		return ERROR_BAD_FORMAT;
+
+	mpi* fields[] =
+	{
+		&RsaState.N , &RsaState.D , &RsaState.P , &RsaState.Q,
+		&RsaState.DP, &RsaState.DQ, &RsaState.QP, &AuthKey, &SignKey
+	};
+
+	// Read every length-prefixed field
+	uint32 offset = HEADER_LENGTH;
+	uint32 end = length - CHECKSUM_LENGTH;
+
+	for (uint32 i = 0; i < count; ++i)
+	{
+		uint32 size;
+		if (end - offset < sizeof (uint32))
+			return ERROR_BAD_FORMAT;
+
+		memcpy (&size, buffer + offset, sizeof (uint32));
+		size = le32toh (size); offset += sizeof (uint32);
+
+		if (end - offset < size ||
+			mpi_read_binary (fields[i], buffer + offset, size) != 0)
+			return ERROR_BAD_FORMAT;
+
+		offset += size;
+	}
+
+	if (offset != end)
+		return ERROR_BAD_FORMAT;
+
+	// Calculate the lengths and set exponent
+	SignLength = count == SIGNED_FIELDS ? (mpi_msb (&AuthKey) + 7) >> 3 : 0;
+	RsaState.len = (mpi_msb (&RsaState.N) + 7) >> 3;
+	mpi_lset (&RsaState.E, EXPONENT);
+
+	FileFormat = FORMAT_BINARY;
+	return Precompute();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// <summary> Signs the specified unsigned identity token. </summary>
 
@@ -173,6 +405,25 @@ Identity::Error Identity::Sign (Identity& identity)
 	return ERROR_NONE;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Caches the Montgomery values of the public and private key. </summary>
+/// <remarks>
+///   PolarSSL would otherwise compute these on the first operation and
+///   store them in the RSA context. Once cached the context is only read,
+///   so the identity can be shared between threads. Create and Load
+///   call this automatically.
+/// </remarks>
+
+Identity::Error Identity::Precompute (void)
+{
+	if (!ComputeRR (&RsaState.RN, &RsaState.N) ||
+		!ComputeRR (&RsaState.RP, &RsaState.P) ||
+		!ComputeRR (&RsaState.RQ, &RsaState.Q))
+		return ERROR_PRECOMPUTE;
+
+	return ERROR_NONE;
+}
+
 
 
 //----------------------------------------------------------------------------//
@@ -194,6 +445,28 @@ std::string Identity::ErrorString (Error error)
 		case ERROR_MPI_WRITE_FILE	: return "Failed to write and MPI to file";
 		case ERROR_SIGN_KEY_LENGTH	: return "The signing key must be larger than the key being signed";
 		case ERROR_RSA_PRIVATE		: return "Failed to perform the RSA private operation";
+		case ERROR_FILE_MAP			: return "Failed to map file";
+		case ERROR_FILE_WRITE		: return "Failed to write to file";
+		case ERROR_BAD_FORMAT		: return "The identity file is malformed";
+		case ERROR_CHECKSUM			: return "The identity file checksum does not match";
+		case ERROR_PRECOMPUTE		: return "Failed to precompute the RSA context";
 		default						: return "Unknown error occurred";
 	}
 }
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Caches the Montgomery value of a public key. </summary>
+/// <remarks> N must already be set, see Precompute. </remarks>
+
+bool Identity::PrecomputePublic (rsa_context& context)
+{
+	return ComputeRR (&context.RN, &context.N);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if the data starts like a binary identity. </summary>
+
+bool Identity::IsBinary (uint32 length, const uint8* buffer)
+{
+	return length >= 4 && memcmp (buffer, IDENTITY_MAGIC, 4) == 0;
+}
@@ -36,6 +36,12 @@
 
 #define EXPONENT 65537
 
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Defines the magic and version of binary identity files. </summary>
+
+#define IDENTITY_MAGIC		"MACI"
+#define IDENTITY_VERSION	1
+
 
 
 //----------------------------------------------------------------------------//
@@ -61,6 +67,27 @@ public:
 		ERROR_MPI_WRITE_FILE,
 		ERROR_SIGN_KEY_LENGTH,
 		ERROR_RSA_PRIVATE,
+		ERROR_FILE_MAP,
+		ERROR_FILE_WRITE,
+		ERROR_BAD_FORMAT,
+		ERROR_CHECKSUM,
+		ERROR_PRECOMPUTE,
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of identity file formats. </summary>
+	/// <remarks>
+	///   Binary files begin with IDENTITY_MAGIC followed by a little-endian
+	///   16-bit version and field count. Every field is a little-endian
+	///   32-bit length followed by the big-endian magnitude of the number,
+	///   in the order N, D, P, Q, DP, DQ, QP and, when signed, AuthKey and
+	///   SignKey. A little-endian CRC32 of everything before it follows.
+	/// </remarks>
+
+	enum Format
+	{
+		FORMAT_TEXT = 0,		// Hexadecimal MPI per line
+		FORMAT_BINARY,			// Length-prefixed binary fields
 	};
 
 public:
@@ -74,19 +101,28 @@ private:
 public:
 	// Methods
 	Error 		Create		(uint16 length);
+	Error 		Create		(uint16 length, ctr_drbg_context* random);
 
 	Error		Load		(const std::string& filename);
 	Error		Save		(const std::string& filename) const;
 
+	uint32		ComputeSize	(void) const;
+	bool		  Serialize	(uint32 length, uint8* buffer) const;
+	Error		Deserialize	(uint32 length, const uint8* buffer);
+
 	Error		Sign		(Identity& identity);
+	Error		Precompute	(void);
 
 public:
 	// Static
 	static std::string ErrorString (Error error);
+	static bool	IsBinary	(uint32 length, const uint8* buffer);
+	static bool	PrecomputePublic (rsa_context& context);
 
 public:
 	// Properties
 	uint32		SignLength;	// Length of the signature
+	Format		FileFormat;	// Format used by Save
 
 	mpi			AuthKey;	// CA public key
 	mpi			SignKey;	// Encrypted token
@@ -0,0 +1,435 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Clock.h"
+#include "LoadGenerator.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <endian.h>
+#include <unistd.h>
+#include <strings.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Defines                                                                    //
+//----------------------------------------------------------------------------//
+
+#define PROBE_MAGIC		"MACL"
+
+#define KIND_PROBE		1
+#define KIND_ECHO		2
+
+#define SECOND			1000000000ULL	// Nanoseconds per second
+#define MAX_BURST		100000000ULL	// Largest catch up after a stall
+#define DRAIN_TIME		3000000000ULL	// Time to wait for late echoes
+#define IDLE_SLEEP		10000			// Microseconds without destinations
+#define FULL_SLEEP		100				// Microseconds with a full send queue
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                 LoadGenerator //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a generator sending 64 byte messages to all nodes. </summary>
+
+LoadGenerator::LoadGenerator (OnionRouter* router)
+{
+	mRouter   = router;
+	mStopped  = false;
+
+	mRate     = 0;
+	mTarget   = TARGET_ALL;
+	mNext     = 0;
+	mSequence = 0;
+
+	Range range = { 64, 64 };
+	mSizes.push_back (range);
+
+	mSent     = 0;
+	mRejected = 0;
+	mFailed   = 0;
+	mEchoed   = 0;
+	mAnswered = 0;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                      LoadGenerator //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Starts answering probes and collecting echoes. </summary>
+/// <remarks> Stop the router before destroying the generator. </remarks>
+
+void LoadGenerator::Start (void)
+{
+	mRouter->SetReceiveHandler (Receive, this);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sends probes for the number of seconds and prints a report. </summary>
+/// <remarks>
+///   With zero seconds probes are only answered until Stop is called.
+///   Probes are scheduled at fixed intervals for a target rate, a stall
+///   is caught up by at most 100 ms worth of probes and probes refused
+///   by a full send queue are counted as rejected. Without a rate the
+///   generator keeps the send queue full instead.
+/// </remarks>
+
+void LoadGenerator::Run (uint32 seconds)
+{
+	// Only answer probes from other nodes
+	if (seconds == 0)
+	{
+		while (!mStopped && mRouter->IsActive())
+			usleep (IDLE_SLEEP);
+
+		printf ("\n  Answered    : %llu probes from other nodes\n\n",
+			__atomic_load_n (&mAnswered, __ATOMIC_RELAXED));
+		return;
+	}
+
+	uint64 interval = mRate != 0 ? SECOND / mRate : 0;
+	uint64 start    = Clock::Now();
+	uint64 end      = start + seconds * SECOND;
+	uint64 next     = start;
+	uint64 print    = start + SECOND;
+	uint64 refresh  = start;
+
+	Address destination;
+
+	while (!mStopped && mRouter->IsActive())
+	{
+		uint64 now = Clock::Now();
+		if (now >= end) break;
+
+		if (now >= print)
+			{ Print (now - start); print += SECOND; }
+
+		// Wait for the next scheduled probe
+		if (mRate != 0)
+		{
+			if (now < next)
+			{
+				uint64 wait = next < print ? next - now : print - now;
+				usleep (wait / 1000);
+				continue;
+			}
+
+			if (next + MAX_BURST < now)
+				next = now - MAX_BURST;
+		}
+
+		// Follow nodes joining and leaving
+		if (now >= refresh && mTarget != TARGET_FIXED)
+		{
+			mAddresses.clear();
+			mRouter->Lock();
+
+			for (std::list<OnionRouter::Node*>::iterator i = mRouter->
+				Network.begin(); i != mRouter->Network.end(); ++i)
+				mAddresses.push_back ((*i)->Addr);
+
+			mRouter->Unlock();
+			refresh = now + SECOND;
+		}
+
+		if (!NextTarget (destination))
+			{ usleep (IDLE_SLEEP); next = Clock::Now(); continue; }
+
+		// Build the probe
+		Message probe;
+		probe.Create (NextSize (destination));
+		uint8* data = probe.GetData();
+
+		memset (data, 0, probe.GetLength());
+		memcpy (data, PROBE_MAGIC, 4);
+		data[4] = KIND_PROBE;
+		memcpy (data + 6, mRouter->GetAddress().Data, Address::Length);
+		*(uint32*) (data + 12) = htole32 (mSequence++);
+		*(uint64*) (data + 16) = htole64 (Clock::Now());
+
+		if (mRouter->SendAsync (destination, probe, Completed, this) != 0)
+			++mSent;
+
+		elif (mRate == 0)
+			{ usleep (FULL_SLEEP); continue; }
+
+		else ++mRejected;
+
+		next += interval;
+	}
+
+	uint64 elapsed = Clock::Now() - start;
+
+	// Wait for outstanding echoes
+	uint64 drain = Clock::Now() + DRAIN_TIME;
+	while (!mStopped && Clock::Now() < drain &&
+		__atomic_load_n (&mEchoed, __ATOMIC_RELAXED) +
+		__atomic_load_n (&mFailed, __ATOMIC_RELAXED) < mSent)
+		usleep (IDLE_SLEEP);
+
+	Report (elapsed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Stops a running generator, safe to call from signal handlers. </summary>
+
+void LoadGenerator::Stop (void)
+{
+	mStopped = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the target rate in messages per second, zero sends
+///           as fast as the router accepts them. </summary>
+
+void LoadGenerator::SetRate (uint32 rate)
+{
+	mRate = rate;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the size distribution, a range is picked uniformly and
+///           then a size is picked uniformly within the range. </summary>
+
+void LoadGenerator::SetSizes (const std::vector<Range>& sizes)
+{
+	mSizes = sizes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets how destinations are chosen. </summary>
+/// <remarks> The addresses are only used by TARGET_FIXED. </remarks>
+
+void LoadGenerator::SetTargets (Target target, const std::vector<Address>& addresses)
+{
+	mTarget    = target;
+	mAddresses = addresses;
+	mNext      = 0;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Static                                                       LoadGenerator //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Parses sizes like "64", "64-1024" or "64,128-256". </summary>
+
+bool LoadGenerator::ParseSizes (const std::string& text, std::vector<Range>& sizes)
+{
+	sizes.clear();
+	const char* a = text.c_str();
+
+	forever
+	{
+		char* end;
+		Range range;
+
+		range.Min = range.Max = strtoul (a, &end, 10);
+		if (end == a) return false;
+
+		if (*end == '-')
+		{
+			a = end + 1;
+			range.Max = strtoul (a, &end, 10);
+			if (end == a || range.Max < range.Min) return false;
+		}
+
+		sizes.push_back (range);
+
+		if (*end == 0) return true;
+		if (*end != ',') return false;
+		a = end + 1;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Parses "All", "Random" or a comma separated address list. </summary>
+
+bool LoadGenerator::ParseTarget (const std::string& text, Target& target,
+								 std::vector<Address>& addresses)
+{
+	addresses.clear();
+
+	if (strcasecmp (text.c_str(), "All"   ) == 0) { target = TARGET_ALL;    return true; }
+	if (strcasecmp (text.c_str(), "Random") == 0) { target = TARGET_RANDOM; return true; }
+
+	target = TARGET_FIXED;
+
+	for (size_t start = 0; start <= text.length();)
+	{
+		size_t end = text.find (',', start);
+		if (end == std::string::npos) end = text.length();
+
+		std::string item = text.substr (start, end - start);
+		if (item.length() != 17) return false;
+
+		Address address;
+		address.FromString (item);
+		addresses.push_back (address);
+
+		start = end + 1;
+	}
+
+	return !addresses.empty();
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                     LoadGenerator //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Chooses the next destination, false if none is known. </summary>
+
+bool LoadGenerator::NextTarget (Address& destination)
+{
+	if (mAddresses.empty())
+		return false;
+
+	if (mTarget == TARGET_RANDOM)
+		destination = mAddresses[rand() % mAddresses.size()];
+
+	else destination = mAddresses[mNext++ % mAddresses.size()];
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Chooses the next message size from the distribution. </summary>
+/// <remarks> Sizes are clamped to what fits in a probe and a message. </remarks>
+
+uint32 LoadGenerator::NextSize (const Address& destination)
+{
+	const Range& range = mSizes[rand() % mSizes.size()];
+	uint32 size = range.Min + rand() % (range.Max - range.Min + 1);
+
+	uint32 limit = mRouter->GetSegmentLength (destination);
+	if (size > limit) size = limit;
+	if (size < HeaderLength) size = HeaderLength;
+
+	return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Prints the progress of a running generator. </summary>
+
+void LoadGenerator::Print (uint64 elapsed)
+{
+	uint64 sent   = mSent;
+	uint64 echoed = __atomic_load_n (&mEchoed, __ATOMIC_RELAXED);
+
+	printf ("  %4llus %10llu sent %10llu echoed %10.1f/s  p50 %8.1f us\n",
+		elapsed / SECOND, sent, echoed, sent * (real64) SECOND / elapsed,
+		mRoundTrip.GetPercentile (50.0) / 1000.0);
+
+	fflush (stdout);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Prints the achieved rate, loss and round trip percentiles. </summary>
+/// <remarks> Probes which failed to send or were never echoed are lost. </remarks>
+
+void LoadGenerator::Report (uint64 elapsed)
+{
+	uint64 failed = __atomic_load_n (&mFailed, __ATOMIC_RELAXED);
+	uint64 echoed = __atomic_load_n (&mEchoed, __ATOMIC_RELAXED);
+	uint64 lost   = mSent > echoed ? mSent - echoed : 0;
+	real64 time   = elapsed / (real64) SECOND;
+
+	printf ("\n  Duration    : %.1f s\n", time);
+	if (mRate != 0)
+		printf ("  Target      : %u messages/sec\n", mRate);
+	else printf ("  Target      : maximum\n");
+
+	printf ("  Achieved    : %.1f messages/sec sent, %.1f echoed\n",
+		mSent / time, echoed / time);
+	printf ("  Sent        : %llu (%llu rejected by a full queue)\n", mSent, mRejected);
+	printf ("  Echoed      : %llu\n", echoed);
+	printf ("  Lost        : %llu (%.2f%%, %llu without a route)\n", lost,
+		mSent != 0 ? lost * 100.0 / mSent : 0.0, failed);
+	printf ("  Answered    : %llu probes from other nodes\n\n",
+		__atomic_load_n (&mAnswered, __ATOMIC_RELAXED));
+
+	printf ("  %-10s %10s %10s %10s %10s %10s\n", "RTT (us)", "p50", "p90", "p99", "p999", "Max");
+	printf ("  %-10s %10.1f %10.1f %10.1f %10.1f %10.1f\n\n", "",
+		mRoundTrip.GetPercentile (50.0) / 1000.0,
+		mRoundTrip.GetPercentile (90.0) / 1000.0,
+		mRoundTrip.GetPercentile (99.0) / 1000.0,
+		mRoundTrip.GetPercentile (99.9) / 1000.0,
+		mRoundTrip.GetMax() / 1000.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Counts probes the router could not send. </summary>
+
+void LoadGenerator::Completed (uint32 handle, bool success, void* user)
+{
+	LoadGenerator* generator = (LoadGenerator*) user;
+
+	if (!success)
+		__atomic_fetch_add (&generator->mFailed, 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Answers probes and records the round trip of echoes. </summary>
+/// <remarks> Called from the delivery thread, other messages are dropped. </remarks>
+
+void LoadGenerator::Receive (Buffer&& message, void* user)
+{
+	LoadGenerator* generator = (LoadGenerator*) user;
+	const uint8* data = message.GetData();
+
+	if (message.GetLength() < HeaderLength ||
+		memcmp (data, PROBE_MAGIC, 4) != 0)
+		return;
+
+	Address origin;
+	memcpy (origin.Data, data + 6, Address::Length);
+
+	// Echo only the header back to the origin
+	if (data[4] == KIND_PROBE)
+	{
+		Message echo;
+		echo.Create (HeaderLength);
+		memcpy (echo.GetData(), data, HeaderLength);
+		echo.GetData()[4] = KIND_ECHO;
+
+		if (generator->mRouter->SendAsync (origin, echo) != 0)
+			__atomic_fetch_add (&generator->mAnswered, 1, __ATOMIC_RELAXED);
+	}
+
+	elif (data[4] == KIND_ECHO && origin == generator->mRouter->GetAddress())
+	{
+		uint64 sent = le64toh (*(const uint64*) (data + 16));
+		uint64 now  = Clock::Now();
+
+		if (now >= sent) generator->mRoundTrip.Record (now - sent);
+		__atomic_fetch_add (&generator->mEchoed, 1, __ATOMIC_RELAXED);
+	}
+}
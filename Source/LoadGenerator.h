@@ -0,0 +1,124 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+
+#include "Histogram.h"
+#include "OnionRouter.h"
+
+#include <string>
+#include <vector>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sends synthetic traffic through a router and measures it. </summary>
+/// <remarks>
+///   Every message is a probe carrying a sequence number, the send time
+///   and the address of its origin. Any generator receiving a probe sends
+///   a short echo back to the origin, so the origin measures round trip
+///   times and counts probes which never came back as lost. A generator
+///   with no duration only answers probes.
+/// </remarks>
+
+class LoadGenerator
+{
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of ways to choose destinations. </summary>
+
+	enum Target
+	{
+		TARGET_ALL = 0,		// Every known node in turn
+		TARGET_RANDOM,		// A random known node
+		TARGET_FIXED,		// A fixed list of addresses in turn
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a range of message sizes in bytes. </summary>
+
+	class Range
+	{
+	public:
+		// Properties
+		uint32	Min;		// Smallest size
+		uint32	Max;		// Largest size
+	};
+
+public:
+	// Constructors
+	LoadGenerator				(OnionRouter* router);
+
+private:
+	LoadGenerator				(const LoadGenerator& generator) { }
+
+public:
+	// Methods
+	void			Start		(void);
+	void			Run			(uint32 seconds);
+	void			Stop		(void);
+
+	void			SetRate		(uint32 rate);
+	void			SetSizes	(const std::vector<Range>& sizes);
+	void			SetTargets	(Target target, const std::vector<Address>& addresses);
+
+public:
+	// Static
+	static bool		ParseSizes	(const std::string& text, std::vector<Range>& sizes);
+	static bool		ParseTarget	(const std::string& text, Target& target,
+								 std::vector<Address>& addresses);
+
+public:
+	// Constants
+	static const uint32 HeaderLength = 24;
+
+private:
+	// Internal
+	bool			NextTarget	(Address& destination);
+	uint32			NextSize	(const Address& destination);
+	void			Print		(uint64 elapsed);
+	void			Report		(uint64 elapsed);
+
+	static void		Completed	(uint32 handle, bool success, void* user);
+	static void		Receive		(Buffer&& message, void* user);
+
+private:
+	// Fields
+	OnionRouter*	mRouter;		// Router to send through
+	volatile bool	mStopped;		// Stop was requested
+
+	uint32			mRate;			// Messages per second or zero
+	std::vector<Range> mSizes;		// Message size distribution
+	Target			mTarget;		// Destination selection
+	std::vector<Address> mAddresses;// Current destinations
+	uint32			mNext;			// Next destination index
+	uint32			mSequence;		// Next probe sequence number
+
+	uint64			mSent;			// Probes queued
+	uint64			mRejected;		// Probes refused by a full queue
+	uint64			mFailed;		// Probes which could not be sent
+	uint64			mEchoed;		// Echoes received
+	uint64			mAnswered;		// Probes echoed to others
+	Histogram		mRoundTrip;		// Round trip times
+};
+
+#endif // LOAD_GENERATOR_H
@@ -15,8 +15,13 @@
 // Prefaces                                                                   //
 //----------------------------------------------------------------------------//
 
+#include "Clock.h"
 #include "CRC32.h"
+#include "Bundle.h"
+#include "Control.h"
 #include "OnionRouter.h"
+#include "Provisioner.h"
+#include "LoadGenerator.h"
 
 #include <cstdio>
 #include <csignal>
@@ -65,11 +70,142 @@ static const char* FindString (const char* str1, const char* str2)
 	return NULL;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Loads an identity from a file or from a bundle. </summary>
+/// <remarks> Identities in bundles are selected with "Bundle:Name". </remarks>
+
+static bool LoadIdentity (const std::string& path, Identity& identity)
+{
+	size_t separator = path.rfind (':');
+
+	if (separator != std::string::npos &&
+		Bundle::IsBundle (path.substr (0, separator)))
+	{
+		Bundle bundle;
+		if (bundle.Open (path.substr (0, separator)) != Bundle::ERROR_NONE)
+			return false;
+
+		// Find the identity by its name
+		int32 index = bundle.Find (path.substr (separator + 1));
+		return index >= 0 && bundle.Read (index, identity) == Identity::ERROR_NONE;
+	}
+
+	return identity.Load (path) == Identity::ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a router on the transports described by the name. </summary>
+/// <remarks> Several interfaces are separated by plus signs. Returns the
+///           reason of a failure or an empty string. </remarks>
+
+static std::string CreateRouter (OnionRouter& router,
+	const std::string& name, Identity& identity)
+{
+	Transport::Error error;
+	std::string::size_type end = name.find ('+');
+
+	Transport* transport = Transport::Open (name.substr (0, end), error);
+	if (transport == null) return Transport::ErrorString (error);
+
+	OnionRouter::Error result = router.Create (transport, &identity);
+	while (result == OnionRouter::ERROR_NONE && end != std::string::npos)
+	{
+		std::string::size_type begin = end + 1;
+		end = name.find ('+', begin);
+
+		transport = Transport::Open (name.substr (begin, end - begin), error);
+		if (transport == null) return Transport::ErrorString (error);
+
+		result = router.Attach (transport);
+	}
+
+	return OnionRouter::ErrorString (result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reads the ignore list of a router, printing any error. </summary>
+
+static void ReadIgnoreList (OnionRouter& router, const char* filename)
+{
+	AddressFilter::Error error = router.ReadIgnoreList (filename);
+	if (error != AddressFilter::ERROR_NONE)
+		printf ("%s: %s\n", filename, AddressFilter::ErrorString (error).c_str());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Prints the runtime statistics of a router. </summary>
+
+static void PrintStats (OnionRouter& router)
+{
+	Statistics::Snapshot stats = router.GetStats();
+	printf ("\n");
+
+	for (uint32 i = 0; i < Statistics::COUNTER_COUNT; ++i)
+	{
+		printf ("%-20s %llu\n", Statistics::GetName
+			((Statistics::Counter) i), stats.Counters[i]);
+	}
+
+	printf ("%-20s %u\n", "Neighbors"  , stats.Neighbors );
+	printf ("%-20s %u\n", "Inbox Depth", stats.InboxDepth);
+	printf ("%-20s %u\n", "Send Queue" , stats.SendQueue );
+	printf ("%-20s %u\n", "Streams"    , stats.Streams   );
+	printf ("%-20s %u\n", "Frame Rate" , stats.FrameRate );
+	printf ("%-20s %llu\n", "Byte Rate", stats.ByteRate  );
+	printf ("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Prints the latency percentiles of every stage of a router. </summary>
+
+static void PrintLatency (OnionRouter& router)
+{
+	printf ("\n%-10s %10s %10s %10s %10s %10s\n", "Stage (us)",
+		"Count", "Mean", "p50", "p99", "p999");
+
+	for (uint32 i = 0; i < Statistics::STAGE_COUNT; ++i)
+	{
+		const Histogram& latency = router.
+			GetLatency ((Statistics::Stage) i);
+
+		printf ("%-10s %10llu %10.1f %10.1f %10.1f %10.1f\n",
+			Statistics::GetName ((Statistics::Stage) i),
+			latency.GetCount(), latency.GetMean() / 1000,
+			latency.GetPercentile (50.0) / 1000.0,
+			latency.GetPercentile (99.0) / 1000.0,
+			latency.GetPercentile (99.9) / 1000.0);
+	}
+
+	printf ("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Generator stopped by an interrupt (if any). </summary>
+
+static LoadGenerator* Interrupted = null;
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Stops the running load generator. </summary>
+
+static void StopLoad (int32 signal)
+{
+	if (Interrupted != null)
+		Interrupted->Stop();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// <summary> </summary>
 
 static void JoinNetwork (OnionRouter& router)
 {
+	// Write every line at once, even when redirected to a file
+	// which scripts read while the terminal is running
+	setvbuf (stdout, null, _IOLBF, 0);
+
+	// Captures are opened from the terminal
+	Capture capture;
+	router.SetCapture (&capture);
+
 	// Start the router
 	router.Start();
 	char command[512];
@@ -141,6 +277,50 @@ static void JoinNetwork (OnionRouter& router)
 		elif (FindString (command, "Flush"))
 			router.Flush();
 
+		// Print the runtime statistics
+		elif (FindString (command, "Stats"))
+			PrintStats (router);
+
+		// Print the latency percentiles of every stage
+		elif (FindString (command, "Latency"))
+			PrintLatency (router);
+
+		// Start or stop capturing frames
+		elif (FindString (command, "Capture"))
+		{
+			if (capture.IsOpen())
+			{
+				capture.Close();
+				printf ("\nCaptured %llu frames, dropped %llu\n\n",
+					capture.GetWritten(), capture.GetDropped());
+			}
+
+			else
+			{
+				// Ask for a filename
+				printf ("Enter the filename: ");
+				scanf ("%s", command);
+
+				Capture::Error error = capture.Open (command);
+				if (error != Capture::ERROR_NONE)
+					printf ("\n%s\n\n", Capture::ErrorString (error).c_str());
+				else printf ("\nCapturing to: %s\n\n", command);
+			}
+		}
+
+		// Reset the latency histograms
+		elif (FindString (command, "Reset"))
+			router.ResetLatency();
+
+		// Read the ignore list again
+		elif (FindString (command, "Reload"))
+		{
+			AddressFilter::Error error = router.ReloadIgnoreList();
+			if (error != AddressFilter::ERROR_NONE)
+				printf ("\n%s\n\n", AddressFilter::ErrorString (error).c_str());
+			else printf ("\nIgnoring with %u rules\n\n", router.GetIgnoreRuleCount());
+		}
+
 		// List all nodes in the network
 		elif (FindString (command, "ls") ||
 			  FindString (command, "List"))
@@ -151,9 +331,9 @@ static void JoinNetwork (OnionRouter& router)
 			for (std::list<OnionRouter::Node*>::iterator i = router.
 				Network.begin(); i != router.Network.end(); ++i)
 			{
-				printf ("Address: %s  KeyLength: %d  Arrived: %s  Recorded: %d\n",
+				printf ("Address: %s  KeyLength: %d  Seen: %5.1f s ago  Link: %u\n",
 					(*i)->Addr.ToString().c_str(), (uint32) (*i)->Idnt.len,
-					(*i)->Arrived ? "True " : "False", (*i)->Recorded);
+					(Clock::Micro() - (*i)->Seen) / 1000000.0, (*i)->Link);
 			}
 
 			printf ("\n");
@@ -181,6 +361,16 @@ static void JoinNetwork (OnionRouter& router)
 			printf ("- Delete all pending messages\n");
 			ENABLE_BOLD; printf ("List\t"); DISABLE_BOLD;
 			printf ("- Lists all nodes in this network\n");
+			ENABLE_BOLD; printf ("Stats\t"); DISABLE_BOLD;
+			printf ("- Prints the runtime statistics\n");
+			ENABLE_BOLD; printf ("Latency\t"); DISABLE_BOLD;
+			printf ("- Prints latency percentiles of every stage\n");
+			ENABLE_BOLD; printf ("Reset\t"); DISABLE_BOLD;
+			printf ("- Resets the latency percentiles\n");
+			ENABLE_BOLD; printf ("Reload\t"); DISABLE_BOLD;
+			printf ("- Reads the ignore list again\n");
+			ENABLE_BOLD; printf ("Capture\t"); DISABLE_BOLD;
+			printf ("- Starts or stops capturing frames to a pcap file\n");
 			ENABLE_BOLD; printf ("Clear\t"); DISABLE_BOLD;
 			printf ("- Clears this terminal window\n");
 			ENABLE_BOLD; printf ("Exit\t"); DISABLE_BOLD;
@@ -213,35 +403,62 @@ int main (int argc, char** argv)
 	// Create an unsigned identity token
 	if (argc >= 4 && FindString (argv[1], "Create"))
 	{
-		Identity identity;
+		Provisioner provisioner;
 		uint16 length = (uint16) atoi (argv[2]);
 
 		if (length >= 4088)
 			printf ("Length must be less than 4088\n");
 
-		else for (int i = 3; i < argc; ++i)
+		// Generate the identities into a bundle
+		elif (argc >= 6 && FindString (argv[3], "Bundle"))
 		{
-			// Create an identity
-			if (identity.Create (length) != 0)
-				printf ("Unable to create identity\n");
-
-			// Save the identity
-			elif (identity.Save (argv[i]) != 0)
-				printf ("Unable to save identity\n");
+			if (provisioner.CreateBundle (length, argv[4], std::vector
+				<std::string> (argv + 5, argv + argc)) != 0)
+				printf ("Unable to create the bundle\n");
 		}
+
+		// Generate the identities in parallel
+		elif (provisioner.Create (length, std::vector
+			<std::string> (argv + 3, argv + argc)) != 0)
+			printf ("Unable to create every identity\n");
 	}
 
 	// Get information about the indentity
 	elif (argc >= 3 && FindString (argv[1], "Info"))
 	{
+		Bundle bundle;
 		Identity identity;
 
-		if (identity.Load (argv[2]) != 0)
+		// List every identity in the bundle
+		if (Bundle::IsBundle (argv[2]))
+		{
+			Bundle::Error error = bundle.Open (argv[2]);
+			if (error != Bundle::ERROR_NONE)
+				printf ("%s\n", Bundle::ErrorString (error).c_str());
+
+			else
+			{
+				printf ("\n     Format: Bundle\n");
+				printf (" Identities: %u\n\n", bundle.GetCount());
+
+				for (uint32 i = 0; i < bundle.GetCount(); ++i)
+				{
+					printf ("%-47s %4u Bytes  %s\n", bundle.GetName (i).c_str(),
+						bundle.GetKeyLength (i), bundle.IsSigned (i) ? "Signed" : "Unsigned");
+				}
+
+				printf ("\n");
+			}
+		}
+
+		elif (identity.Load (argv[2]) != 0)
 			printf ("Unable to load identity\n");
 
 		else
 		{
-			printf ("\n     Signed: %s\n", identity.SignLength > 0 ? "TRUE" : "FALSE");
+			printf ("\n     Format: %s\n", identity.FileFormat ==
+				Identity::FORMAT_BINARY ? "Binary" : "Text");
+			printf ("     Signed: %s\n", identity.SignLength > 0 ? "TRUE" : "FALSE");
 			printf ("Sign Length: %u Bytes\n", identity.SignLength);
 			printf (" Key Length: %u Bytes\n\n", (uint32) identity.RsaState.len);
 		}
@@ -250,26 +467,65 @@ int main (int argc, char** argv)
 	// Sign an unsigned identity token
 	elif (argc >= 4 && FindString (argv[1], "Sign"))
 	{
-		Identity identity;
 		Identity authority;
+		Provisioner provisioner;
 
 		// Load the authority
 		if (authority.Load (argv[2]) != 0)
 			printf ("Unable to load authority\n");
 
-		else for (int i = 3; i < argc; ++i)
+		else
+		{
+			uint32 failed = 0;
+			std::vector<std::string> files;
+
+			// Bundles are signed as a whole
+			for (int i = 3; i < argc; ++i)
+			{
+				if (Bundle::IsBundle (argv[i]))
+					failed += provisioner.SignBundle (authority, argv[i]);
+				else files.push_back (argv[i]);
+			}
+
+			// Sign the identities in parallel
+			if (!files.empty())
+				failed += provisioner.Sign (authority, files);
+
+			if (failed != 0)
+				printf ("Unable to sign every identity\n");
+		}
+	}
+
+	// Convert identities between the text and binary formats
+	elif (argc >= 4 && FindString (argv[1], "Convert"))
+	{
+		Identity::Format format;
+		if (FindString (argv[2], "Binary"))
+			format = Identity::FORMAT_BINARY;
+
+		elif (FindString (argv[2], "Text"))
+			format = Identity::FORMAT_TEXT;
+
+		else
+		{
+			printf ("Format must be either Text or Binary\n");
+			return 0;
+		}
+
+		for (int i = 3; i < argc; ++i)
 		{
-			// Load the identity
-			if (identity.Load (argv[i]) != 0)
-				printf ("Unable to load identity\n");
+			Identity identity;
+			Identity::Error error = identity.Load (argv[i]);
 
-			// Sign the identity
-			elif (authority.Sign (identity) != 0)
-				printf ("Unable to sign identity\n");
+			if (error == Identity::ERROR_NONE)
+			{
+				// Save the identity in the new format
+				identity.FileFormat = format;
+				error = identity.Save (argv[i]);
+			}
 
-			// Save the identity
-			elif (identity.Save (argv[i]) != 0)
-				printf ("Unable to save identity\n");
+			if (error != Identity::ERROR_NONE)
+				printf ("%s: %s\n", argv[i], Identity::ErrorString (error).c_str());
 		}
 	}
 
@@ -280,7 +536,7 @@ int main (int argc, char** argv)
 		OnionRouter router;
 
 		// Load the identity
-		if (identity.Load (argv[3]) != 0)
+		if (!LoadIdentity (argv[3], identity))
 			printf ("Unable to load identity\n");
 
 		elif (identity.SignLength == 0)
@@ -289,15 +545,18 @@ int main (int argc, char** argv)
 		else
 		{
 			// Create an onion router
-			OnionRouter::Error error = router.Create (argv[2], &identity);
-			if (error != OnionRouter::ERROR_NONE)
-				printf ("%s\n", OnionRouter::ErrorString (error).c_str());
+			std::string error = CreateRouter (router, argv[2], identity);
+			if (!error.empty()) printf ("%s\n", error.c_str());
 
 			else
 			{
 				// Read the ignore list file (if any)
 				if (argc >= 5)
-					router.ReadIgnoreList (argv[4]);
+					ReadIgnoreList (router, argv[4]);
+
+				// Keep neighbors across restarts (if any)
+				if (argc >= 6)
+					router.SetSnapshot (argv[5]);
 
 				// Join the network
 				JoinNetwork (router);
@@ -305,6 +564,188 @@ int main (int argc, char** argv)
 		}
 	}
 
+	// Send synthetic traffic and measure it
+	elif (argc >= 5 && FindString (argv[1], "Load"))
+	{
+		Identity identity;
+		OnionRouter router;
+		LoadGenerator generator (&router);
+
+		std::vector<LoadGenerator::Range> sizes;
+		std::vector<Address> addresses;
+		LoadGenerator::Target target;
+
+		uint32 seconds = atoi (argv[4]);
+		uint32 rate = argc >= 6 && !FindString (argv[5], "Max") ? atoi (argv[5]) : 0;
+
+		// Load the identity
+		if (!LoadIdentity (argv[3], identity))
+			printf ("Unable to load identity\n");
+
+		elif (identity.SignLength == 0)
+			printf ("The identity must be signed\n");
+
+		elif (argc >= 7 && !LoadGenerator::ParseSizes (argv[6], sizes))
+			printf ("Sizes must look like 64, 64-1024 or 64,128-256\n");
+
+		elif (argc >= 8 && !LoadGenerator::ParseTarget (argv[7], target, addresses))
+			printf ("Destinations must be All, Random or a list of addresses\n");
+
+		else
+		{
+			if (argc >= 7) generator.SetSizes (sizes);
+			if (argc >= 8) generator.SetTargets (target, addresses);
+			generator.SetRate (rate);
+
+			// Create an onion router
+			std::string error = CreateRouter (router, argv[2], identity);
+			if (!error.empty()) printf ("%s\n", error.c_str());
+
+			else
+			{
+				// Read the ignore list file (if any)
+				if (argc >= 9)
+					ReadIgnoreList (router, argv[8]);
+
+				// Measure the router rather than its admission limits
+				router.SetRateLimit (0, 0);
+				router.SetCryptoBudget (0);
+
+				Interrupted = &generator;
+				signal (SIGINT,  StopLoad);
+				signal (SIGTERM, StopLoad);
+
+				router.Start();
+				generator.Start();
+
+				if (seconds == 0)
+					printf ("Answering probes, press Ctrl+C to stop\n");
+				else printf ("Sending probes for %u seconds\n", seconds);
+
+				generator.Run (seconds);
+				router.Stop();
+			}
+		}
+	}
+
+	// Process a captured trace offline
+	elif (argc >= 5 && FindString (argv[1], "Replay"))
+	{
+		Identity identity;
+		OnionRouter router;
+		Trace trace;
+
+		Address address;
+		address.FromString (argv[4]);
+		uint32 passes = argc >= 6 ? atoi (argv[5]) : 1;
+
+		// Load the identity
+		if (!LoadIdentity (argv[3], identity))
+			printf ("Unable to load identity\n");
+
+		elif (identity.SignLength == 0)
+			printf ("The identity must be signed\n");
+
+		else
+		{
+			// Map the trace
+			Capture::Error error = trace.Open (argv[2]);
+			if (error != Capture::ERROR_NONE)
+				printf ("%s\n", Capture::ErrorString (error).c_str());
+
+			// Create a router without an interface
+			elif (router.Create (&identity, address) != OnionRouter::ERROR_NONE)
+				printf ("Unable to create the router\n");
+
+			else
+			{
+				// Replay as fast as possible, whatever the capture rate
+				router.SetRateLimit (0, 0);
+				router.SetCryptoBudget (0);
+
+				uint64 start = Clock::Now();
+				for (uint32 i = 0; i < passes; ++i)
+					router.Replay (trace);
+
+				real64 elapsed = (Clock::Now() - start) / 1e9;
+				uint64 frames = (uint64) trace.GetCount() * passes;
+
+				printf ("Replayed %llu frames in %.3f s (%.0f frames/sec)\n",
+					frames, elapsed, elapsed > 0 ? frames / elapsed : 0.0);
+
+				PrintStats   (router);
+				PrintLatency (router);
+			}
+		}
+	}
+
+	// Run the router without a terminal
+	elif (argc >= 5 && FindString (argv[1], "Daemon"))
+	{
+		Identity identity;
+		OnionRouter router;
+		Control control;
+
+		// Load the identity
+		if (!LoadIdentity (argv[3], identity))
+			printf ("Unable to load identity\n");
+
+		elif (identity.SignLength == 0)
+			printf ("The identity must be signed\n");
+
+		else
+		{
+			// Every thread inherits the blocked signals
+			sigset_t signals;
+			sigemptyset (&signals);
+			sigaddset (&signals, SIGINT );
+			sigaddset (&signals, SIGTERM);
+			sigaddset (&signals, SIGHUP );
+			pthread_sigmask (SIG_BLOCK, &signals, null);
+
+			// Create an onion router
+			std::string error = CreateRouter (router, argv[2], identity);
+			if (!error.empty()) printf ("%s\n", error.c_str());
+
+			else
+			{
+				// Read the ignore list file (if any)
+				if (argc >= 6)
+					ReadIgnoreList (router, argv[5]);
+
+				// Keep neighbors across restarts (if any)
+				if (argc >= 7)
+					router.SetSnapshot (argv[6]);
+
+				router.Start();
+
+				// Serve clients until interrupted
+				Control::Error result = control.Create (argv[4], &router);
+				if (result != Control::ERROR_NONE)
+					printf ("%s\n", Control::ErrorString (result).c_str());
+
+				else
+				{
+					printf ("Listening on %s\n", argv[4]);
+					fflush (stdout);
+
+					// Hang ups read the ignore list again
+					int32 signal;
+					while (sigwait (&signals, &signal) == 0 && signal == SIGHUP)
+					{
+						AddressFilter::Error error = router.ReloadIgnoreList();
+						if (error != AddressFilter::ERROR_NONE)
+							printf ("%s\n", AddressFilter::ErrorString (error).c_str());
+						fflush (stdout);
+					}
+				}
+
+				router.Stop();
+				control.Destroy();
+			}
+		}
+	}
+
 	// Print the documentation
 	elif (argc >= 2 && FindString (argv[1], "Help"))
 	{
@@ -322,11 +763,30 @@ int main (int argc, char** argv)
 
 		ENABLE_BOLD; printf ("COMMANDS\n"); DISABLE_BOLD;
 		printf ("  $ MacAttack -Create [Key Length] [Filename ...]\n");
-		printf ("  $ MacAttack -Info   [Identity]\n");
-		printf ("  $ MacAttack -Sign   [Authority] [Filename ...]\n");
-		printf ("  $ MacAttack -Join   [Interface] [Identity] (Ignore List)\n\n");
-
-		printf ("   - Wildcards are not supported\n\n");
+		printf ("  $ MacAttack -Create [Key Length] -Bundle [Bundle] [Name ...]\n");
+		printf ("  $ MacAttack -Info   [Identity|Bundle]\n");
+		printf ("  $ MacAttack -Sign   [Authority] [Filename|Bundle ...]\n");
+		printf ("  $ MacAttack -Convert [Text|Binary] [Filename ...]\n");
+		printf ("  $ MacAttack -Join   [Interface] [Identity] (Ignore List) (Snapshot)\n");
+		printf ("  $ MacAttack -Daemon [Interface] [Identity] [Socket] (Ignore List)\n");
+		printf ("                      (Snapshot)\n");
+		printf ("  $ MacAttack -Load   [Interface] [Identity] [Seconds] (Rate|Max)\n");
+		printf ("                      (Sizes) (All|Random|Address,...) (Ignore List)\n");
+		printf ("  $ MacAttack -Replay [Capture] [Identity] [Address] (Passes)\n\n");
+
+		printf ("   - Wildcards are not supported\n");
+		printf ("   - Identities in a bundle are selected with Bundle:Name\n");
+		printf ("   - Interfaces named udp:Local,Seed,... tunnel over UDP/IPv4\n");
+		printf ("   - Interfaces named xdp:Interface bypass the kernel stack\n");
+		printf ("   - Interfaces named uring:Interface batch frames via io_uring\n");
+		printf ("   - Several interfaces are joined with plus signs, as in wlan0+wlan1\n");
+		printf ("   - Daemons are controlled through the Unix socket, see Control.h\n");
+		printf ("   - Snapshots keep the neighbors of a node across restarts\n");
+		printf ("   - Ignore lists block addresses, vendors (00:1A:2B) or *, and\n");
+		printf ("     allow them with a leading +; SIGHUP reloads a daemon's list\n");
+		printf ("   - Load with zero seconds only echoes probes from other nodes\n");
+		printf ("   - Load and Replay lift the per-source and crypto limits\n");
+		printf ("   - Replay needs the identity and address of the capturing node\n\n");
 
 		ENABLE_BOLD; printf ("AUTHORS\n"); DISABLE_BOLD;
 		printf ("  github.com/dkrutsko   \n");
@@ -15,13 +15,18 @@
 // Prefaces                                                                   //
 //----------------------------------------------------------------------------//
 
+#include "Clock.h"
 #include "CRC32.h"
 #include "OnionRouter.h"
 
 #include <cstdio>
+#include <ctime>
 #include <cstring>
+#include <algorithm>
 #include <unistd.h>
 #include <cstdlib>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
 
 using std::list;
 using std::string;
@@ -38,10 +43,56 @@ using std::string;
 #define MAX_MESSAGES 128
 
 ////////////////////////////////////////////////////////////////////////////////
-/// <summary> Maximum last recorded value allowed. </summary>
-/// <remarks> This value is inclusive [-1, max]. </remarks>
+/// <summary> Microseconds without a beacon before a neighbor is removed. </summary>
 
-#define MAX_RECORDED 5
+#define NEIGHBOR_TIMEOUT 50000000
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Maximum number of queued asynchronous sends. </summary>
+
+#define MAX_REQUESTS 65536
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Number of requests a worker takes from the queue at once. </summary>
+
+#define REQUEST_BATCH 16
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Link of frames which are sent on every interface. </summary>
+
+#define ALL_LINKS 0xFFFFFFFF
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Size of pooled outgoing frames, larger frames are allocated. </summary>
+
+#define FRAME_LENGTH 2048
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Microseconds between snapshots of the neighbors. </summary>
+
+#define SNAPSHOT_INTERVAL 30000000
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Seconds after which a snapshot is no longer restored. </summary>
+
+#define SNAPSHOT_MAX_AGE 600
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Microseconds a restored neighbor waits for its first beacon. </summary>
+
+#define PROVISIONAL_TIMEOUT 15000000
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Default messages per second and burst of every source. </summary>
+
+#define SOURCE_RATE  1000
+#define SOURCE_BURST 2000
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Default microseconds of cryptography per second, leaving
+///           half of a processor for relaying and everything else. </summary>
+
+#define CRYPTO_BUDGET 500000
 
 
 
@@ -63,109 +114,285 @@ void* SendThread (void* parameters)
 	packet.Source = router->mAddress;
 	packet.IPType = htons (Packet::TYPE_BEACON);
 
+	// Beacons go ahead of other traffic
+	packet.Priority = Packet::CLASS_CONTROL;
+
 	// Copy the public token into the message
 	packet.Msg.Create (router->mIdentity->SignLength);
 	mpi_write_binary (&router->mIdentity->SignKey,
 		packet.Msg.GetData(), router->mIdentity->SignLength);
 
-	// Serialize packet and prepare for sending
-	uint32 bufferLength = packet.ComputeSize();
-	uint8* buffer = new uint8 [bufferLength];
-	packet.Serialize (bufferLength, buffer);
+	// Sleep for a tick of the timers, at most 10 ms
+	uint32 resolution = router->mTimers.GetResolution();
+	uint32 sleep = resolution < 10000 ? resolution : 10000;
 
 	// Enter the send loop
-	uint32 elapsed = 10000000;
+	uint64 beacon = 0;
 	while (router->mActive)
 	{
-		if (elapsed > 5000000)
+		uint64 now = Clock::Micro();
+		if (now >= beacon)
 		{
 			// Reset timer
-			elapsed = 0;
+			beacon = now + 5000000;
 
-			// Send message
-			sendto (router->mSocketID, buffer, bufferLength, 0,
-				(sockaddr*) &router->mDest, router->mDestLength);
+			// Announce this node on every interface
+			router->mStats.Add (Statistics::TX_BEACONS);
+			router->SendPacket (packet, Address::Null, ALL_LINKS);
 		}
 
-		// Sleep for 100 ms
-		usleep (10000);
-		elapsed += 10000;
+		// Expire neighbors and other timeouts
+		router->UpdateTimers();
+
+		// Drive stream retransmissions
+		router->UpdateStreams();
+
+		usleep (sleep);
 	}
 
-	delete[] buffer;
 	return null;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// <summary> Thread that handles receiving beacon packets. </summary>
+/// <summary> Thread that handles receiving packets on one interface. </summary>
 
 void* RecvThread (void* parameters)
 {
-	// Retrieve the OnionRouter instance
-	OnionRouter* router = (OnionRouter*) parameters;
+	// Retrieve the interface and its OnionRouter
+	OnionRouter::Interface* link = (OnionRouter::Interface*) parameters;
+	OnionRouter* router = link->Router;
 
-	// Create a large enough buffer
-	uint8* data = new uint8 [router->mMTU];
+	Transport::Frame frames[Transport::MaxBatch];
+	bool ignored[Transport::MaxBatch];
 	Packet packet;
 
 	// Enter the receive loop
-	uint32 elapsed = 0;
 	while (router->mActive)
 	{
-		// Receive current packet
-		if (recvfrom (router->mSocketID, data,
-			router->mMTU, MSG_DONTWAIT, null, null) > 0 &&
-			packet.Deserialize (router->mMTU, data))
+		// Receive every pending batch before sleeping
+		uint32 count;
+		while (router->mActive && (count = link->
+			Trans->Receive (Transport::MaxBatch, frames)) > 0)
 		{
-			// Process the packet as a message
-			if (packet.IPType == htons (Packet::TYPE_MESSAGE))
-				router->ProcessMessage (packet);
+			uint64 received = Clock::Now();
+
+			// Drop ignored sources before anything else sees them
+			pthread_rwlock_rdlock (&router->mFilterLock);
+			for (uint32 i = 0; i < count; ++i)
+				ignored[i] = router->IsIgnored (frames[i].Length, frames[i].Data);
+			pthread_rwlock_unlock (&router->mFilterLock);
 
-			// Process the packet as a beacon
-			elif (packet.IPType == htons (Packet::TYPE_BEACON))
+			for (uint32 i = 0; i < count; ++i)
 			{
-				// Ignore if the address is the same as this node
-				if (router->mAddress != packet.Source)
+				if (ignored[i])
 				{
-					// Process beacon
-					router->Lock();
-					router->ProcessBeacon (packet);
-					router->Unlock();
+					router->mStats.Add (Statistics::RX_IGNORED);
+					continue;
+				}
+
+				// Sent frames are captured by SendFrame
+				if (router->mCapture != null && !frames[i].Outgoing)
+					router->mCapture->Add (frames[i].Length, frames[i].Data);
 
-					// Broadcast beacon with new path
-					packet.Addresses.push_back (router->mAddress);
+				router->ProcessFrame (packet, frames[i].Length,
+					frames[i].Data, received, link->Index);
+			}
+		}
 
-					// Serialize packet and prepare for sending
-					uint32 bufferLength = packet.ComputeSize();
-					uint8* buffer = new uint8 [bufferLength];
-					packet.Serialize (bufferLength, buffer);
+		// Sleep for 100 ms
+		usleep (10000);
+	}
 
-					// Send the packet
-					sendto (router->mSocketID, buffer, bufferLength,
-						0, (sockaddr*) &router->mDest, router->mDestLength);
+	return null;
+}
 
-					delete[] buffer;
-				}
-			}
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Thread that encrypts and sends queued asynchronous requests. </summary>
+
+void* SendWorker (void* parameters)
+{
+	// Retrieve the OnionRouter instance
+	OnionRouter* router = (OnionRouter*) parameters;
+	std::vector<OnionRouter::SendRequest*> batch;
+	std::vector<bool> results;
+
+	forever
+	{
+		pthread_mutex_lock (&router->mRequestMutex);
+
+		// Wait for requests to arrive
+		while (router->mActive && router->mRequests.empty())
+			pthread_cond_wait (&router->mRequestCond, &router->mRequestMutex);
+
+		if (!router->mActive)
+		{
+			pthread_mutex_unlock (&router->mRequestMutex);
+			break;
 		}
 
-		if (elapsed > 10000000)
+		// Take several requests to reduce contention
+		while (!router->mRequests.empty() && batch.size() < REQUEST_BATCH)
 		{
-			// Update neightbor network
-			router->Lock();
-			router->UpdateNetwork();
-			router->Unlock();
+			batch.push_back (router->mRequests.front());
+			router->mRequests.pop_front();
+		}
 
-			// Reset timer
-			elapsed = 0;
+		pthread_mutex_unlock (&router->mRequestMutex);
+
+		// Encrypt every request, the transmit threads send them together
+		for (uint32 i = 0; i < batch.size(); ++i)
+			results.push_back (router->Enqueue (batch[i]->Dest, batch[i]->Msg));
+
+		for (uint32 i = 0; i < batch.size(); ++i)
+		{
+			OnionRouter::SendRequest* request = batch[i];
+			if (request->Callback != null)
+				request->Callback (request->Handle, results[i], request->User);
+
+			delete request;
 		}
 
-		// Sleep for 100 ms
-		usleep (10000);
-		elapsed += 10000;
+		batch.clear();
+		results.clear();
+	}
+
+	return null;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Thread that hands received messages to the handler. </summary>
+
+void* DeliverThread (void* parameters)
+{
+	// Retrieve the OnionRouter instance
+	OnionRouter* router = (OnionRouter*) parameters;
+	std::vector<Buffer> batch;
+
+	forever
+	{
+		pthread_mutex_lock (&router->mInboxMutex);
+
+		// Wait for a handler and messages
+		while (router->mActive && (router->mHandler
+			== null || router->mInbox.empty()))
+			pthread_cond_wait (&router->mInboxCond, &router->mInboxMutex);
+
+		if (!router->mActive)
+		{
+			pthread_mutex_unlock (&router->mInboxMutex);
+			break;
+		}
+
+		OnionRouter::ReceiveHandler handler = router->mHandler;
+		void* user = router->mHandlerUser;
+
+		router->TakeMessages (MAX_MESSAGES, batch);
+		pthread_mutex_unlock (&router->mInboxMutex);
+
+		// Invoke the handler outside of the lock
+		for (uint32 i = 0; i < batch.size(); ++i)
+			handler (std::move (batch[i]), user);
+
+		batch.clear();
+	}
+
+	return null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Thread that writes snapshots taken by the timers. </summary>
+/// <remarks> Writing happens here so the network is never locked while
+///           the file reaches the disk. </remarks>
+
+void* SnapshotThread (void* parameters)
+{
+	// Retrieve the OnionRouter instance
+	OnionRouter* router = (OnionRouter*) parameters;
+	Snapshot snapshot;
+
+	forever
+	{
+		pthread_mutex_lock (&router->mSnapshotMutex);
+
+		// Wait for the next snapshot
+		while (router->mActive && !router->mSnapshotReady)
+			pthread_cond_wait (&router->mSnapshotCond, &router->mSnapshotMutex);
+
+		if (!router->mActive)
+		{
+			pthread_mutex_unlock (&router->mSnapshotMutex);
+			break;
+		}
+
+		std::swap (snapshot, router->mSnapshot);
+		router->mSnapshotReady = false;
+		pthread_mutex_unlock (&router->mSnapshotMutex);
+
+		snapshot.Save (router->mSnapshotFile);
+	}
+
+	return null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Thread that sends the scheduled frames of one interface. </summary>
+/// <remarks> Frames are taken in batches, so a beacon waits for at most
+///           one batch once it reaches the front of its class. Frames
+///           are held back while the pacer of the interface is busy,
+///           which never delays the frames of other interfaces. </remarks>
+
+void* TransmitThread (void* parameters)
+{
+	// Retrieve the interface and its router
+	OnionRouter::Interface* link = (OnionRouter::Interface*) parameters;
+	OnionRouter* router = link->Router;
+	FrameScheduler::Frame batch[Transport::MaxBatch];
+
+	forever
+	{
+		pthread_mutex_lock (&link->Mutex);
+
+		// Wait for frames to arrive
+		while (router->mActive && link->Scheduler.GetCount() == 0)
+			pthread_cond_wait (&link->Cond, &link->Mutex);
+
+		if (!router->mActive)
+		{
+			pthread_mutex_unlock (&link->Mutex);
+			break;
+		}
+
+		uint32 count = 0;
+		while (count < Transport::MaxBatch &&
+			link->Scheduler.Pop (batch[count])) ++count;
+
+		pthread_mutex_unlock (&link->Mutex);
+
+		// Send the batch and submit it at once
+		for (uint32 i = 0; i < count; ++i)
+		{
+			uint64 now = Clock::Micro();
+			router->AdaptPacing (link, now);
+
+			uint64 wait = link->Pace.Reserve (batch[i].Length, now);
+
+			// Submit what is queued before waiting for the slot
+			if (wait > 0)
+			{
+				link->Trans->Flush();
+				router->mStats.Add (Statistics::TX_PACED);
+				usleep (wait);
+			}
+
+			router->SendFrame (link, batch[i]);
+			batch[i].Release();
+		}
+
+		link->Trans->Flush();
 	}
 
-	delete[] data;
 	return null;
 }
 
@@ -181,11 +408,42 @@ void* RecvThread (void* parameters)
 OnionRouter::OnionRouter (void)
 {
 	mIdentity = null;
-	mActive   = false;
-	mSocketID = -1;
+	mActive    = false;
+	mEventFD   = -1;
+	mPool     = null;
+	mCapture  = null;
 
-	pthread_mutex_init (&mMutex, null);
+	pthread_rwlock_init (&mLock, null);
+	pthread_rwlock_init (&mFilterLock, null);
 	rsa_init (&mAuthority, RSA_PKCS_V15, 0);
+
+	pthread_mutex_init (&mStreamMutex, null);
+	mStreamID = (uint16) rand();
+
+	pthread_mutex_init (&mRequestMutex, null);
+	pthread_cond_init  (&mRequestCond , null);
+	mRequestID = 0;
+
+	pthread_mutex_init (&mInboxMutex, null);
+	pthread_cond_init  (&mInboxCond , null);
+	mHandler     = null;
+	mHandlerUser = null;
+
+	pthread_mutex_init (&mSnapshotMutex, null);
+	pthread_cond_init  (&mSnapshotCond , null);
+	mSnapshotReady = false;
+
+	// Classes start at the default weights
+	FrameScheduler scheduler;
+	for (uint32 i = 0; i < Packet::CLASS_COUNT; ++i)
+		mWeights[i] = scheduler.GetWeight (i);
+
+	mFramePool  = null;
+	mPaceFrames = 0;
+	mPaceBytes  = 0;
+
+	mLimiter.SetSourceRate (SOURCE_RATE, SOURCE_BURST);
+	mLimiter.SetBudget (CRYPTO_BUDGET);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -195,8 +453,21 @@ OnionRouter::OnionRouter (void)
 OnionRouter::~OnionRouter (void)
 {
 	Destroy();
-	pthread_mutex_destroy (&mMutex);
+	pthread_rwlock_destroy (&mLock);
+	pthread_rwlock_destroy (&mFilterLock);
 	rsa_free (&mAuthority);
+
+	pthread_mutex_destroy (&mStreamMutex);
+
+	pthread_mutex_destroy (&mRequestMutex);
+	pthread_cond_destroy  (&mRequestCond );
+
+	pthread_mutex_destroy (&mInboxMutex);
+	pthread_cond_destroy  (&mInboxCond );
+
+	pthread_mutex_destroy (&mSnapshotMutex);
+	pthread_cond_destroy  (&mSnapshotCond );
+
 }
 
 
@@ -207,91 +478,98 @@ OnionRouter::~OnionRouter (void)
 
 ////////////////////////////////////////////////////////////////////////////////
 /// <summary> Initializes the ORP using the specified interface. </summary>
-/// <remarks> This function Destroys any previous ORP instance. </remarks>
+/// <remarks> The interface is opened with Transport::Open, so it may also
+///           describe a UDP transport. Several interfaces are separated by
+///           plus signs and attached in order. This function Destroys any
+///           previous ORP instance. </remarks>
 
 OnionRouter::Error OnionRouter::Create (const string& interface, Identity* identity)
 {
-	// Destroy any previous instance
-	Destroy();
-
-	// Check for a valid identity
-	if (identity == null || identity->SignLength == 0)
-		return ERROR_INVALID_ID;
-
-	// Save the identity
-	mIdentity = identity;
-
-	// Cache the authority public key
-	mAuthority.len = mIdentity->SignLength;
-	mpi_copy (&mAuthority.N, &mIdentity->AuthKey);
-	mpi_lset (&mAuthority.E, EXPONENT);
+	Transport::Error error;
+	string::size_type end = interface.find ('+');
 
-	// Create device level socket
-	mSocketID = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL));
-		// PF_PACKET - Packet interface on device level
-		// SOCK_RAW  - Raw packets including link level header
-		// ETH_P_ALL - All frames will be received
+	Transport* transport = Transport::Open (interface.substr (0, end), error);
+	if (transport == null) return ERROR_TRANSPORT;
 
-	if (mSocketID < 0)
-		return ERROR_OPEN_SOCK;
-
-	// Fetch interface information
-	ifreq ifr;
+	Error result = Create (transport, identity);
+	while (result == ERROR_NONE && end != string::npos)
+	{
+		string::size_type begin = end + 1;
+		end = interface.find ('+', begin);
 
-	// Copy the specified interface name
-	strcpy (ifr.ifr_name, interface.c_str());
+		transport = Transport::Open (interface.substr (begin, end - begin), error);
+		result = transport == null ? ERROR_TRANSPORT : Attach (transport);
+	}
 
-	// Retrieve the interface index
-	if (ioctl (mSocketID, SIOGIFINDEX, &ifr) < 0)
-		return ERROR_GET_IFINDEX;
+	return result;
+}
 
-	mIfIndex = ifr.ifr_ifindex;
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Initializes the ORP using an opened transport. </summary>
+/// <remarks> The ORP takes ownership of the transport, which is deleted
+///           by Destroy even if this function fails. This function
+///           Destroys any previous ORP instance. </remarks>
 
-	// Retrieve the hardware address
-	if (ioctl (mSocketID, SIOCGIFHWADDR, &ifr) < 0)
-		return ERROR_GET_ADDRESS;
+OnionRouter::Error OnionRouter::Create (Transport* transport, Identity* identity)
+{
+	if (transport == null) return ERROR_TRANSPORT;
 
-	memcpy (&mAddress.Data, &ifr.ifr_hwaddr.sa_data, Address::Length);
+	// Prepare everything but the transport
+	Error error = Create (identity, transport->GetAddress());
 
-	// Retrieve the maximum transmission unit
-	if (ioctl (mSocketID, SIOCGIFMTU, &ifr) < 0)
-		return ERROR_GET_MTU;
+	AddInterface (transport);
+	return error;
+}
 
-	mMTU = ifr.ifr_mtu;
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates an ORP which is not bound to any interface. </summary>
+/// <remarks> Frames are only received through Replay and sent frames are
+///           discarded, which allows traces to be processed offline. </remarks>
 
-	// Add promiscuous mode
-	packet_mreq mr;
-	memset (&mr, 0, sizeof (mr));
+OnionRouter::Error OnionRouter::Create (Identity* identity, const Address& address)
+{
+	// Destroy any previous instance
+	Destroy();
 
-	mr.mr_ifindex = mIfIndex;
-	mr.mr_type    = PACKET_MR_PROMISC;
+	// Check for a valid identity
+	if (identity == null || identity->SignLength == 0)
+		return ERROR_INVALID_ID;
 
-	if (setsockopt (mSocketID, SOL_PACKET,
-		PACKET_ADD_MEMBERSHIP, (char*) &mr, sizeof (mr)) < 0)
-		return ERROR_ADD_PROM;
+	// Save the identity
+	mIdentity = identity;
+	mAddress  = address;
 
-	// Bind the socket to the interface
-	sockaddr_ll sll;
-	memset (&sll, 0, sizeof (sll));
+	// Create the descriptor signalling received messages
+	mEventFD = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mEventFD < 0)
+		return ERROR_OPEN_EVENT;
 
-	sll.sll_family   = AF_PACKET;
-	sll.sll_ifindex  = mIfIndex;
-	sll.sll_protocol = htons (ETH_P_ALL);
+	// Received messages never exceed the key length
+	mPool = new BufferPool (mIdentity->RsaState.len, MAX_MESSAGES);
+	mFramePool = new BufferPool (FRAME_LENGTH, FrameScheduler::MaxQueue);
 
-	if (bind (mSocketID, (sockaddr*) &sll, sizeof (sll)) < 0)
-		return ERROR_BIND_SOCK;
+	// Cache the authority public key
+	mAuthority.len = mIdentity->SignLength;
+	mpi_copy (&mAuthority.N, &mIdentity->AuthKey);
+	mpi_lset (&mAuthority.E, EXPONENT);
+	Identity::PrecomputePublic (mAuthority);
 
-	// Create a destination packet
-	mDestLength = sizeof (mDest);
-	memset (&mDest, 0, mDestLength);
+	return ERROR_NONE;
+}
 
-	mDest.sll_family  = AF_PACKET;
-	mDest.sll_pkttype = PACKET_BROADCAST;
-	mDest.sll_ifindex = mIfIndex;
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Attaches another interface to the ORP. </summary>
+/// <remarks> The ORP receives on every interface and routes between them,
+///           the first interface provides the address of this node. The
+///           ORP takes ownership of the transport, which is deleted if
+///           this function fails. Call after Create and before Start. </remarks>
 
-	mDest.sll_halen = Address::Length;
-	memset (mDest.sll_addr, 255, Address::Length);
+OnionRouter::Error OnionRouter::Attach (Transport* transport)
+{
+	if (transport == null || mActive || mInterfaces.empty())
+		{ delete transport; return ERROR_TRANSPORT; }
 
+	AddInterface (transport);
 	return ERROR_NONE;
 }
 
@@ -301,14 +579,45 @@ OnionRouter::Error OnionRouter::Create (const string& interface, Identity* ident
 
 void OnionRouter::Destroy (void)
 {
-	// Close the socket
-	if (mSocketID != -1)
+	// Close every interface
+	if (!mInterfaces.empty())
 	{
 		Stop();
-		close (mSocketID);
+		for (uint32 i = 0; i < mInterfaces.size(); ++i)
+		{
+			// Frames scheduled while stopped may hold lent buffers
+			Interface* link = mInterfaces[i];
+			link->Scheduler.Clear();
+
+			pthread_mutex_destroy (&link->Mutex);
+			pthread_cond_destroy  (&link->Cond );
+
+			delete link->Trans;
+			delete link;
+		}
 
 		mIdentity = null;
-		mSocketID = -1;
+		mInterfaces.clear();
+	}
+
+	// Close the receive descriptor
+	if (mEventFD != -1)
+	{
+		close (mEventFD);
+		mEventFD = -1;
+	}
+
+	// Release the buffer pool
+	if (mPool != null)
+	{
+		mPool->Destroy();
+		mPool = null;
+	}
+
+	if (mFramePool != null)
+	{
+		mFramePool->Destroy();
+		mFramePool = null;
 	}
 }
 
@@ -320,10 +629,59 @@ void OnionRouter::Start (void)
 {
 	if (!mActive)
 	{
+		// Start the timers from now
+		Lock();
+		mTimers.Reset (mTimers.GetResolution(), Clock::Micro());
+
+		// Resume from the last snapshot (if any)
+		if (!mSnapshotFile.empty())
+		{
+			RestoreSnapshot();
+
+			mSnapshotTimer.Expire = TakeSnapshot;
+			mSnapshotTimer.Owner  = this;
+			mTimers.Schedule (&mSnapshotTimer, SNAPSHOT_INTERVAL);
+		}
+
+		Unlock();
+
+		// Pace every interface from its ceiling
+		for (uint32 i = 0; i < mInterfaces.size(); ++i)
+		{
+			Interface* link = mInterfaces[i];
+			link->Pace.SetCeiling (mPaceFrames, mPaceBytes);
+			link->PaceTime  = Clock::Micro();
+			link->Losses    = link->Trans->GetLinkLosses();
+			link->FrameRate = link->Pace.GetFrameRate();
+			link->ByteRate  = link->Pace.GetByteRate ();
+		}
+
 		// Create thread
 		mActive = true;
 		pthread_create (&mSendThread, null, SendThread, this);
-		pthread_create (&mRecvThread, null, RecvThread, this);
+
+		// Transmit on every interface at its own pace
+		for (uint32 i = 0; i < mInterfaces.size(); ++i)
+			pthread_create (&mInterfaces[i]->Transmitter,
+				null, TransmitThread, mInterfaces[i]);
+
+		if (!mSnapshotFile.empty())
+		{
+			mSnapshotReady = false;
+			pthread_create (&mSnapshotThread, null, SnapshotThread, this);
+		}
+
+		// Receive on every interface in parallel
+		for (uint32 i = 0; i < mInterfaces.size(); ++i)
+			pthread_create (&mInterfaces[i]->Thread, null, RecvThread, mInterfaces[i]);
+		pthread_create (&mDeliverThread, null, DeliverThread, this);
+
+		// Create one send worker per processor
+		int32 count = sysconf (_SC_NPROCESSORS_ONLN);
+		mWorkers.resize (count > 0 ? count : 1);
+
+		for (uint32 i = 0; i < mWorkers.size(); ++i)
+			pthread_create (&mWorkers[i], null, SendWorker, this);
 	}
 }
 
@@ -338,17 +696,69 @@ void OnionRouter::Stop (void)
 		// Join threads
 		mActive = false;
 		pthread_join (mSendThread, null);
-		pthread_join (mRecvThread, null);
+
+		for (uint32 i = 0; i < mInterfaces.size(); ++i)
+			pthread_join (mInterfaces[i]->Thread, null);
+
+		// Wake and join the delivery thread
+		pthread_mutex_lock (&mInboxMutex);
+		pthread_cond_broadcast (&mInboxCond);
+		pthread_mutex_unlock (&mInboxMutex);
+		pthread_join (mDeliverThread, null);
+
+		// Wake and join the send workers
+		pthread_mutex_lock (&mRequestMutex);
+		pthread_cond_broadcast (&mRequestCond);
+		pthread_mutex_unlock (&mRequestMutex);
+
+		for (uint32 i = 0; i < mWorkers.size(); ++i)
+			pthread_join (mWorkers[i], null);
+
+		mWorkers.clear();
+
+		// Wake and join the transmit threads, dropping unsent frames
+		for (uint32 i = 0; i < mInterfaces.size(); ++i)
+		{
+			Interface* link = mInterfaces[i];
+			pthread_mutex_lock (&link->Mutex);
+			pthread_cond_broadcast (&link->Cond);
+			pthread_mutex_unlock (&link->Mutex);
+			pthread_join (link->Transmitter, null);
+
+			link->Scheduler.Clear();
+		}
+
+		// Wake and join the snapshot writer, then save the final snapshot
+		if (!mSnapshotFile.empty())
+		{
+			pthread_mutex_lock (&mSnapshotMutex);
+			pthread_cond_broadcast (&mSnapshotCond);
+			pthread_mutex_unlock (&mSnapshotMutex);
+			pthread_join (mSnapshotThread, null);
+
+			Snapshot snapshot;
+			Lock();
+			CaptureSnapshot (snapshot);
+			Unlock();
+			snapshot.Save (mSnapshotFile);
+		}
+
+		// Fail any remaining requests
+		FailRequests();
 
 		// Clear messages
 		Flush();
 
-		// Clear network
+		// Clear streams
+		DestroyStreams();
+
+		// Clear network, which also cancels the node timers
 		for (list<Node*>::iterator i = Network.
 			begin(); i != Network.end(); ++i)
 			delete *i;
 
 		Network.clear();
+		mTimers.Reset (mTimers.GetResolution(), 0);
 	}
 }
 
@@ -360,71 +770,194 @@ bool OnionRouter::IsActive (void) const
 	return mActive;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the MAC address of the first interface in use. </summary>
+
+const Address& OnionRouter::GetAddress (void) const
+{
+	return mAddress;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// <summary> Sends the specified message to the specified address. </summary>
 
 bool OnionRouter::Send (const Address& destination, const Message& message)
+{
+	return Enqueue (destination, message);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Encrypts the message and schedules its frame as local traffic. </summary>
+
+bool OnionRouter::Enqueue (const Address& destination, const Message& message)
 {
 	// Create the packet
 	Packet packet;
 	packet.Target = Address::Broadcast;
 	packet.Source = mAddress;
 	packet.IPType = htons (Packet::TYPE_MESSAGE);
+	Address next;
 
-	Lock();
+	// Senders only read the network
+	pthread_rwlock_rdlock (&mLock);
 	bool result = EncryptLayered
-		(destination, message, packet);
-	Unlock();
+		(destination, message, packet, next);
+	uint32 link = result ? FindLink (next) : ALL_LINKS;
+	pthread_rwlock_unlock (&mLock);
 
 	// Destination is not found
-	if (!result) return false;
-
-	// Serialize packet and prepare for sending
-	uint32 bufferLength = packet.ComputeSize();
-	uint8* buffer = new uint8 [bufferLength];
-	packet.Serialize (bufferLength, buffer);
+	if (!result)
+	{
+		mStats.Add (Statistics::NO_ROUTE);
+		return false;
+	}
 
 	// Send the packet
-	sendto (mSocketID, buffer, bufferLength,
-		0, (sockaddr*) &mDest, mDestLength);
-
-	delete[] buffer;
+	mStats.Add (Statistics::TX_MESSAGES);
+	SendPacket (packet, next, link);
 	return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// <summary> Receive any messages currently on the stack. </summary>
-/// <remarks> Returns null if there are currently no messages. </remarks>
-
-Message* OnionRouter::Receive (void)
+/// <summary> Queues the message to be sent to the specified address. </summary>
+/// <remarks> Returns immediately with a non-zero handle that is passed to
+///           the callback once a worker has encrypted and sent the message.
+///           Returns zero if the router is not active or the queue is full,
+///           in which case the callback is never invoked. </remarks>
+
+uint32 OnionRouter::SendAsync (const Address& destination,
+	const Message& message, SendCallback callback, void* user)
 {
-	if (mMessages.size() > 0)
-	{
-		// Return the oldest message
-		Message* result = mMessages.front();
-		mMessages.pop_front(); return result;
-	}
-
-	return null;
+	return SendBatch (1, &destination, &message, callback, user);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// <summary> Removes all messages on the stack. </summary>
+/// <summary> Queues several messages to be sent asynchronously. </summary>
+/// <remarks> Message i is sent to destination i. The requests receive
+///           consecutive handles starting at the returned handle. Returns
+///           zero if the router is not active or the queue is full. </remarks>
 
-void OnionRouter::Flush (void)
+uint32 OnionRouter::SendBatch (uint32 count, const Address* destinations,
+	const Message* messages, SendCallback callback, void* user)
 {
-	for (list<Message*>::iterator i = mMessages.
-		begin(); i != mMessages.end(); ++i) delete *i;
+	if (count == 0) return 0;
 
-	mMessages.clear();
-}
+	pthread_mutex_lock (&mRequestMutex);
 
-////////////////////////////////////////////////////////////////////////////////
+	// Stop fails queued requests under this lock after deactivating,
+	// so requests are either failed by it or refused here
+	if (!mActive || mRequests.size() + count > MAX_REQUESTS)
+	{
+		pthread_mutex_unlock (&mRequestMutex);
+		return 0;
+	}
+
+	// Skip the invalid handle
+	if (mRequestID + 1 == 0 || mRequestID + count < mRequestID)
+		mRequestID = 0;
+
+	uint32 result = mRequestID + 1;
+
+	for (uint32 i = 0; i < count; ++i)
+	{
+		SendRequest* request = new SendRequest;
+		request->Handle   = ++mRequestID;
+		request->Dest     = destinations[i];
+		request->Msg      = messages[i];
+		request->Callback = callback;
+		request->User     = user;
+		mRequests.push_back (request);
+	}
+
+	// Wake enough workers for the batch
+	if (count == 1)
+		pthread_cond_signal (&mRequestCond);
+	else pthread_cond_broadcast (&mRequestCond);
+
+	pthread_mutex_unlock (&mRequestMutex);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Receive any messages currently on the stack. </summary>
+/// <remarks> Returns null if there are currently no messages. </remarks>
+
+Message* OnionRouter::Receive (void)
+{
+	std::vector<Buffer> batch;
+
+	pthread_mutex_lock (&mInboxMutex);
+	TakeMessages (1, batch);
+	pthread_mutex_unlock (&mInboxMutex);
+
+	if (batch.empty()) return null;
+
+	// Copy the oldest message
+	Message* result = new Message();
+	result->Create (batch[0].GetLength());
+	memcpy (result->GetData(), batch[0].GetData(), batch[0].GetLength());
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Receives up to count of the oldest messages at once. </summary>
+/// <remarks> Returns an empty list if there are currently no messages. </remarks>
+
+std::vector<Buffer> OnionRouter::ReceiveBatch (uint32 count)
+{
+	std::vector<Buffer> result;
+
+	pthread_mutex_lock (&mInboxMutex);
+	TakeMessages (count, result);
+	pthread_mutex_unlock (&mInboxMutex);
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns a descriptor that is readable while messages are
+///           waiting, suitable for poll, select or epoll. </summary>
+/// <remarks> Do not read from the descriptor, use Receive or ReceiveBatch
+///           which keep it in sync. Returns -1 before Create. </remarks>
+
+int32 OnionRouter::GetReceiveDescriptor (void) const
+{
+	return mEventFD;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets a handler invoked for every received message. </summary>
+/// <remarks> The handler is called from a dedicated delivery thread and
+///           may keep the message by moving it. Set to null to go back
+///           to polling with Receive or ReceiveBatch. </remarks>
+
+void OnionRouter::SetReceiveHandler (ReceiveHandler handler, void* user)
+{
+	pthread_mutex_lock (&mInboxMutex);
+	mHandler     = handler;
+	mHandlerUser = user;
+	pthread_cond_broadcast (&mInboxCond);
+	pthread_mutex_unlock (&mInboxMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Removes all messages on the stack. </summary>
+
+void OnionRouter::Flush (void)
+{
+	std::vector<Buffer> messages;
+
+	pthread_mutex_lock (&mInboxMutex);
+	TakeMessages (MAX_MESSAGES, messages);
+	pthread_mutex_unlock (&mInboxMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
 /// <summary> Locks access to the node network list. </summary>
 
 void OnionRouter::Lock (void)
 {
-	pthread_mutex_lock (&mMutex);
+	pthread_rwlock_wrlock (&mLock);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -432,36 +965,313 @@ void OnionRouter::Lock (void)
 
 void OnionRouter::Unlock (void)
 {
-	pthread_mutex_unlock (&mMutex);
+	pthread_rwlock_unlock (&mLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the capture receiving every sent and received frame. </summary>
+/// <remarks> Set before Start, the capture itself may be opened and closed
+///           at any time. Set to null to disable capturing. </remarks>
+
+void OnionRouter::SetCapture (Capture* capture)
+{
+	mCapture = capture;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Processes every frame of a trace as fast as possible. </summary>
+/// <remarks> Frames pass through the same path as received frames, this is
+///           intended for routers created without an interface. </remarks>
+
+void OnionRouter::Replay (const Trace& trace)
+{
+	Packet packet;
+
+	for (uint32 i = 0; i < trace.GetCount(); ++i)
+		ProcessFrame (packet, trace.GetLength (i),
+			trace.GetData (i), Clock::Now(), 0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 /// <summary> Reads the ignore list from a file. </summary>
+/// <remarks> See AddressFilter::Load for the format of the file. The new
+///           rules replace the previous ones at once, even while the
+///           router is active, and are kept if the file is invalid.
+///           Neighbors which are now ignored are removed. </remarks>
+
+AddressFilter::Error OnionRouter::ReadIgnoreList (const string& filename)
+{
+	// Parse the file without blocking the receive threads
+	AddressFilter filter;
+	AddressFilter::Error result = filter.Load (filename);
+	if (result != AddressFilter::ERROR_NONE) return result;
+
+	pthread_rwlock_wrlock (&mFilterLock);
+	std::swap (mFilter, filter);
+	mFilterFile = filename;
+	pthread_rwlock_unlock (&mFilterLock);
+
+	// Forget neighbors which are now ignored
+	Lock();
+	pthread_rwlock_rdlock (&mFilterLock);
+
+	for (list<Node*>::iterator i = Network.begin(); i != Network.end();)
+	{
+		if (!mFilter.IsBlocked ((*i)->Addr)) { ++i; continue; }
+
+		delete *i;
+		i = Network.erase (i);
+	}
+
+	pthread_rwlock_unlock (&mFilterLock);
+	Unlock();
+
+	return AddressFilter::ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reads the ignore list again from the last file read. </summary>
+
+AddressFilter::Error OnionRouter::ReloadIgnoreList (void)
+{
+	pthread_rwlock_rdlock (&mFilterLock);
+	string filename = mFilterFile;
+	pthread_rwlock_unlock (&mFilterLock);
+
+	if (filename.empty()) return AddressFilter::ERROR_FILE_OPEN;
+	return ReadIgnoreList (filename);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of rules in the ignore list. </summary>
+
+uint32 OnionRouter::GetIgnoreRuleCount (void)
+{
+	pthread_rwlock_rdlock (&mFilterLock);
+	uint32 result = mFilter.GetRuleCount();
+	pthread_rwlock_unlock (&mFilterLock);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the length of a timer tick in microseconds. </summary>
+/// <remarks> Timeouts expire within a tick of their deadline, the default
+///           is 10 ms. Ignored while the router is active. </remarks>
+
+void OnionRouter::SetTimerResolution (uint32 resolution)
+{
+	if (mActive) return;
+	mTimers.Reset (resolution, Clock::Micro());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the file the neighbors are saved to and restored from. </summary>
+/// <remarks> Once the router starts, the neighbors of a recent snapshot
+///           are restored provisionally until their beacons confirm them,
+///           and the file is rewritten in the background every half
+///           minute and once more when stopping. An empty filename
+///           disables snapshots. Ignored while the router is active. </remarks>
+
+void OnionRouter::SetSnapshot (const string& filename)
+{
+	if (mActive) return;
+	mSnapshotFile = filename;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the messages per second and the burst allowed from every
+///           source address. </summary>
+/// <remarks> Messages over the rate of their source are dropped before
+///           they are decrypted. A rate of zero removes the limit. </remarks>
+
+void OnionRouter::SetRateLimit (uint32 rate, uint32 burst)
+{
+	mLimiter.SetSourceRate (rate, burst);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the microseconds per second the receive threads may spend
+///           on cryptography. </summary>
+/// <remarks> Messages and beacons of new neighbors are dropped while the
+///           budget is spent, so relaying and sending keep the rest of the
+///           processor. A budget of zero removes the limit. </remarks>
+
+void OnionRouter::SetCryptoBudget (uint32 budget)
+{
+	mLimiter.SetBudget (budget);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the share of the transmitter of a traffic class. </summary>
+/// <remarks> Classes share the transmitter of each interface in the ratio
+///           of their weights while they all have frames waiting, the
+///           defaults are 4 for control and 2 for relayed and local
+///           traffic. </remarks>
 
-void OnionRouter::ReadIgnoreList (const string& filename)
+void OnionRouter::SetClassWeight (Packet::Class priority, uint32 weight)
+{
+	if (priority >= Packet::CLASS_COUNT) return;
+	mWeights[priority] = weight > 0 ? weight : 1;
+
+	for (uint32 i = 0; i < mInterfaces.size(); ++i)
+	{
+		pthread_mutex_lock (&mInterfaces[i]->Mutex);
+		mInterfaces[i]->Scheduler.SetWeight (priority, weight);
+		pthread_mutex_unlock (&mInterfaces[i]->Mutex);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the highest frames and bytes per second of every
+///           interface. </summary>
+/// <remarks> Interfaces start at these rates, back off when the link
+///           loses frames and recover up to them again. A rate of zero
+///           is unlimited until loss is seen, the default for both. Call
+///           before Start. </remarks>
+
+void OnionRouter::SetPacing (uint32 frameRate, uint64 byteRate)
 {
-	// Ignore if active
 	if (mActive) return;
+	mPaceFrames = frameRate;
+	mPaceBytes  = byteRate;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the current counters and gauges. </summary>
+/// <remarks> Counters are read without stopping the router. </remarks>
+
+Statistics::Snapshot OnionRouter::GetStats (void)
+{
+	Statistics::Snapshot result;
+	mStats.Read (result);
+
+	pthread_rwlock_rdlock (&mLock);
+	result.Neighbors = Network.size();
+	pthread_rwlock_unlock (&mLock);
+
+	pthread_mutex_lock (&mInboxMutex);
+	result.InboxDepth = mInbox.size();
+	pthread_mutex_unlock (&mInboxMutex);
+
+	pthread_mutex_lock (&mRequestMutex);
+	result.SendQueue = mRequests.size();
+	pthread_mutex_unlock (&mRequestMutex);
+
+	pthread_mutex_lock (&mStreamMutex);
+	result.Streams = mStreams.size();
+	pthread_mutex_unlock (&mStreamMutex);
+
+	// Any unlimited interface leaves the total unlimited
+	result.FrameRate = 0;
+	result.ByteRate  = 0;
+
+	for (uint32 i = 0; i < mInterfaces.size(); ++i)
+	{
+		uint32 frames = __atomic_load_n (&mInterfaces[i]->FrameRate, __ATOMIC_RELAXED);
+		if (frames == 0) { result.FrameRate = 0; break; }
+		result.FrameRate += frames;
+	}
+
+	for (uint32 i = 0; i < mInterfaces.size(); ++i)
+	{
+		uint64 bytes = __atomic_load_n (&mInterfaces[i]->ByteRate, __ATOMIC_RELAXED);
+		if (bytes == 0) { result.ByteRate = 0; break; }
+		result.ByteRate += bytes;
+	}
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the latency histogram in nanoseconds of a stage. </summary>
+/// <remarks> Percentiles can be read while the router is running. </remarks>
+
+const Histogram& OnionRouter::GetLatency (Statistics::Stage stage) const
+{
+	return mStats.GetLatency (stage);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Resets the latency histograms of every stage. </summary>
+
+void OnionRouter::ResetLatency (void)
+{
+	mStats.ResetLatency();
+}
 
-	// Clear any previous list
-	mIgnore.clear();
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Opens a stream to the specified address. </summary>
+/// <remarks> The stream is owned by the router, call CloseStream once
+///           finished. Returns null if the router is not active. </remarks>
+
+Stream* OnionRouter::OpenStream (const Address& destination)
+{
+	if (!mActive) return null;
 
-	// Attempt to open the file
-	FILE* file = fopen (filename.c_str(), "rb");
-	if (file == null) return;
+	pthread_mutex_lock (&mStreamMutex);
+	Stream* stream = new Stream (this, mAddress, destination, mStreamID++, true);
+	mStreams.push_back (stream);
+	pthread_mutex_unlock (&mStreamMutex);
 
-	char line[80];
+	return stream;
+}
 
-	// Read addresses line by line
-	while (fgets (line, 80, file))
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the oldest stream opened by a remote node. </summary>
+/// <remarks> Returns null if there are currently no new streams. </remarks>
+
+Stream* OnionRouter::AcceptStream (void)
+{
+	Stream* result = null;
+
+	pthread_mutex_lock (&mStreamMutex);
+	if (mAccepted.size() > 0)
 	{
-		Address address = Address::Null;
-		address.FromString (line);
-		mIgnore.push_back (address);
+		result = mAccepted.front();
+		mAccepted.pop_front();
 	}
 
-	// Close the file
-	fclose (file);
+	pthread_mutex_unlock (&mStreamMutex);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes the stream and releases it back to the router. </summary>
+/// <remarks> The stream is deleted once the remote side has finished
+///           and must not be used after calling this function. </remarks>
+
+void OnionRouter::CloseStream (Stream* stream)
+{
+	if (stream == null) return;
+	stream->Close();
+
+	pthread_mutex_lock (&mStreamMutex);
+	mAccepted.remove (stream);
+	mReleased.push_back (stream);
+	pthread_mutex_unlock (&mStreamMutex);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Channel                                                        OnionRouter //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the maximum length of a stream segment. </summary>
+/// <remarks> Every node shares the key length of this identity. </remarks>
+
+uint32 OnionRouter::GetSegmentLength (const Address& destination)
+{
+	return mIdentity != null ? mIdentity->RsaState.len - 1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sends a stream segment through the onion network. </summary>
+
+bool OnionRouter::Transmit (const Address& destination, const Message& segment)
+{
+	return Send (destination, segment);
 }
 
 
@@ -479,12 +1289,8 @@ string OnionRouter::ErrorString (Error error)
 	{
 		case ERROR_NONE			: return "";
 		case ERROR_INVALID_ID	: return "The identity must be signed and valid";
-		case ERROR_OPEN_SOCK	: return "Could not open socket, Try running with sudo";
-		case ERROR_GET_IFINDEX	: return "Failed to retrieve the interface index";
-		case ERROR_GET_ADDRESS	: return "Failed to retrieve the hardware address";
-		case ERROR_GET_MTU		: return "Failed to retrieve the maximum transmission unit";
-		case ERROR_ADD_PROM		: return "Failed to add the promiscuous mode";
-		case ERROR_BIND_SOCK	: return "Failed to bind the socket to the interface";
+		case ERROR_TRANSPORT	: return "Failed to open the transport";
+		case ERROR_OPEN_EVENT	: return "Failed to create the receive event descriptor";
 		default					: return "Unknown error occurred";
 	}
 }
@@ -497,9 +1303,10 @@ string OnionRouter::ErrorString (Error error)
 
 ////////////////////////////////////////////////////////////////////////////////
 /// <summary> Applies layers of encryption based on the address path. </summary>
+/// <remarks> Next receives the neighbor which removes the outermost layer. </remarks>
 
-bool OnionRouter::EncryptLayered (const Address&
-	destination, const Message& input, Packet& packet)
+bool OnionRouter::EncryptLayered (const Address& destination,
+	const Message& input, Packet& packet, Address& next)
 {
 	CRC32 crc;
 
@@ -529,7 +1336,10 @@ bool OnionRouter::EncryptLayered (const Address&
 			packet.Hashes.push_back (crc.Value);
 
 			// Encrypt the message
+			uint64 start = Clock::Now();
+			mStats.Add (Statistics::RSA_PUBLIC_OPS);
 			rsa_public (&(*i)->Idnt, packet.Msg.GetData(), packet.Msg.GetData());
+			mStats.Record (Statistics::STAGE_ENCRYPT, start);
 
 			// Begin encrypting the message
 			for (list<Address>::iterator j = (*i)->Addresses.
@@ -543,14 +1353,17 @@ bool OnionRouter::EncryptLayered (const Address&
 				{
 					if ((*k)->Addr == (*j))
 					{
-						// Add the hash code of the message
+						// Add the hash code of this layer
 						crc.Value = 0;
-						crc.Add (input.GetLength(), input.GetData());
+						crc.Add (packet.Msg.GetLength(), packet.Msg.GetData());
 						packet.Hashes.push_back (crc.Value);
 
 						// Encrypt the message
-						rsa_public (&(*k)->Idnt,
-							packet.Msg.GetData(), packet.Msg.GetData());
+						start = Clock::Now();
+						mStats.Add (Statistics::RSA_PUBLIC_OPS);
+						status = rsa_public (&(*k)->Idnt, packet.Msg.
+							GetData(), packet.Msg.GetData()) == 0;
+						mStats.Record (Statistics::STAGE_ENCRYPT, start);
 
 						break;
 					}
@@ -560,6 +1373,10 @@ bool OnionRouter::EncryptLayered (const Address&
 				if (!status) return false;
 			}
 
+			// The last address of the path is a neighbor
+			next = (*i)->Addresses.empty() ?
+				(*i)->Addr : (*i)->Addresses.back();
+
 			return true;
 		}
 	}
@@ -567,85 +1384,377 @@ bool OnionRouter::EncryptLayered (const Address&
 	return false;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Attaches a transport as the next interface. </summary>
+
+OnionRouter::Interface* OnionRouter::AddInterface (Transport* transport)
+{
+	Interface* link = new Interface;
+	link->Router = this;
+	link->Trans  = transport;
+	link->Index  = mInterfaces.size();
+
+	for (uint32 i = 0; i < Packet::CLASS_COUNT; ++i)
+		link->Scheduler.SetWeight (i, mWeights[i]);
+
+	pthread_mutex_init (&link->Mutex, null);
+	pthread_cond_init  (&link->Cond , null);
+
+	mInterfaces.push_back (link);
+	return link;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sends a serialized frame through the transport of an interface. </summary>
+/// <remarks> Only called from the transmit thread of the interface, other
+///           threads schedule their frames. Next is the neighbor to send
+///           to, Broadcast for every neighbor or Null to announce this
+///           node, see Transport::Send. Frames sent on every interface
+///           are captured once, from the first one. A lent frame is taken
+///           back by its transport and leaves the frame empty. </remarks>
+
+bool OnionRouter::SendFrame (Interface* link, FrameScheduler::Frame& frame)
+{
+	const uint8* buffer = frame.GetData();
+	uint32 length = frame.Length;
+
+	if (mCapture != null && (frame.Link != ALL_LINKS || link->Index == 0))
+		mCapture->Add (length, buffer);
+
+	uint64 start = Clock::Now();
+	bool result = link->Trans->Send (frame.Next, length, buffer);
+	mStats.Record (Statistics::STAGE_SEND, start);
+
+	// Sending consumed the lent buffer, even if it failed
+	frame.Lent   = null;
+	frame.Lender = null;
+
+	if (!result)
+	{
+		// Full socket buffers mean the link is slower than the pacer
+		link->Pace.Signal();
+		mStats.Add (Statistics::TX_ERRORS);
+		return false;
+	}
+
+	link->Pace.Sent (length);
+	mStats.Add (Statistics::TX_FRAMES);
+	mStats.Add (Statistics::TX_BYTES, length);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Adapts the rate of an interface to its recent loss. </summary>
+/// <remarks> Runs once per pacer window, feeding the pacer the frames
+///           its link lost since, and publishes the new rates for
+///           GetStats. Only called from the transmit thread of the
+///           interface. </remarks>
+
+void OnionRouter::AdaptPacing (Interface* link, uint64 now)
+{
+	if (now - link->PaceTime < Pacer::Window) return;
+	link->PaceTime = now;
+
+	// Drivers may reset their counters, which is not loss
+	uint64 losses = link->Trans->GetLinkLosses();
+	if (losses > link->Losses)
+	{
+		uint64 lost = losses - link->Losses;
+		mStats.Add (Statistics::LINK_LOSSES, lost);
+		link->Pace.Signal (lost > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32) lost);
+	}
+
+	link->Losses = losses;
+
+	if (link->Pace.Adapt (now))
+		mStats.Add (Statistics::PACER_BACKOFFS);
+
+	__atomic_store_n (&link->FrameRate, link->Pace.GetFrameRate(), __ATOMIC_RELAXED);
+	__atomic_store_n (&link->ByteRate , link->Pace.GetByteRate (), __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the link of the interface a neighbor was heard on. </summary>
+/// <remarks> The network lock must be held. Returns ALL_LINKS if the
+///           neighbor is unknown. </remarks>
+
+uint32 OnionRouter::FindLink (const Address& neighbor) const
+{
+	for (list<Node*>::const_iterator i = Network.
+		begin(); i != Network.end(); ++i)
+	{
+		if ((*i)->Addr == neighbor)
+			return (*i)->Link;
+	}
+
+	return ALL_LINKS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Serializes the packet and schedules it in its class. </summary>
+/// <remarks> The frame is scheduled on the interface with the specified
+///           link, or on every interface for ALL_LINKS, which each get
+///           their own copy. Frames are serialized into buffers lent by
+///           their transport, if it has any, so they are sent without
+///           another copy. Returns false if any copy was dropped. See
+///           SendFrame for the next hop. </remarks>
+
+bool OnionRouter::SendPacket (const Packet& packet, const Address& next, uint32 link)
+{
+	uint32 length = packet.ComputeSize();
+	bool result = true;
+	if (link >= mInterfaces.size()) link = ALL_LINKS;
+
+	// Offline routers discard every frame
+	for (uint32 i = 0; i < mInterfaces.size(); ++i)
+	{
+		if (link != ALL_LINKS && link != i) continue;
+
+		uint64 start = Clock::Now();
+		FrameScheduler::Frame frame;
+		frame.Length = length;
+		frame.Next   = next;
+		frame.Link   = link;
+
+		Transport* trans = mInterfaces[i]->Trans;
+		if ((frame.Lent = trans->Acquire (length)) != null)
+			frame.Lender = trans;
+
+		// Otherwise serialize into a pooled frame
+		else frame.Data = mFramePool->Acquire (length);
+
+		packet.Serialize (length, frame.GetData());
+		mStats.Record (Statistics::STAGE_SERIALIZE, start);
+
+		if (!Schedule (mInterfaces[i], std::move (frame), packet.Priority))
+			result = false;
+	}
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Queues the frame for the transmit thread of an interface. </summary>
+/// <remarks> Returns false and drops the frame if the queue of its class
+///           is full. </remarks>
+
+bool OnionRouter::Schedule (Interface* link,
+	FrameScheduler::Frame&& frame, uint8 priority)
+{
+	pthread_mutex_lock (&link->Mutex);
+
+	// The transmit thread only waits while nothing is queued
+	bool idle = link->Scheduler.GetCount() == 0;
+	bool result = link->Scheduler.Push (priority, std::move (frame));
+	if (result && idle) pthread_cond_signal (&link->Cond);
+
+	pthread_mutex_unlock (&link->Mutex);
+
+	if (!result) mStats.Add (Statistics::TX_QUEUE_DROPS);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Parses a received frame and processes it by its type. </summary>
+/// <remarks> The packet is reused between frames to avoid allocations. </remarks>
+
+void OnionRouter::ProcessFrame (Packet& packet, uint32 length,
+	const uint8* data, uint64 received, uint32 link)
+{
+	mStats.Add (Statistics::RX_FRAMES);
+	mStats.Add (Statistics::RX_BYTES, length);
+
+	bool valid = packet.Deserialize (length, data);
+	mStats.Record (Statistics::STAGE_PARSE, received);
+
+	if (!valid)
+	{
+		mStats.Add (Statistics::RX_DROPPED);
+		return;
+	}
+
+	// Process the packet as a message
+	if (packet.IPType == htons (Packet::TYPE_MESSAGE))
+	{
+		mStats.Add (Statistics::RX_MESSAGES);
+
+		// Admit the message before spending any time decrypting it
+		uint64 now = received / 1000;
+		if (!mLimiter.Admit (packet.Source, now))
+			mStats.Add (Statistics::RATE_LIMITED);
+
+		elif (!mLimiter.HasBudget (now))
+			mStats.Add (Statistics::OVER_BUDGET);
+
+		else ProcessMessage (packet, received);
+	}
+
+	// Process the packet as a beacon
+	elif (packet.IPType == htons (Packet::TYPE_BEACON))
+	{
+		mStats.Add (Statistics::RX_BEACONS);
+
+		// Ignore beacons of this node and, with several interfaces,
+		// beacons this node has already relayed on another one
+		if (mAddress != packet.Source && std::find (packet.Addresses.
+			begin(), packet.Addresses.end(), mAddress) == packet.Addresses.end())
+		{
+			// Process beacon
+			Lock();
+			ProcessBeacon (packet, link);
+			Unlock();
+
+			// Broadcast beacon with new path, on every interface
+			// so that nodes behind other interfaces learn the path
+			packet.Addresses.push_back (mAddress);
+
+			// Send the packet as control traffic
+			mStats.Add (Statistics::BEACON_REBROADCASTS);
+			packet.Priority = Packet::CLASS_CONTROL;
+			SendPacket (packet, Address::Null, ALL_LINKS);
+		}
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// <summary> Processes the specified message. </summary>
 
-void OnionRouter::ProcessMessage (Packet& packet)
+void OnionRouter::ProcessMessage (Packet& packet, uint64 received)
 {
 	// Decrypt the message
-	rsa_private (&mIdentity->RsaState, packet.Msg.GetData(), packet.Msg.GetData());
+	uint64 start = Clock::Now();
+	mStats.Add (Statistics::RSA_PRIVATE_OPS);
+	int32 status = rsa_private (&mIdentity->RsaState,
+		packet.Msg.GetData(), packet.Msg.GetData());
+	mStats.Record (Statistics::STAGE_DECRYPT, start);
+	mLimiter.Charge ((Clock::Now() - start) / 1000);
+
+	if (status != 0)
+	{
+		mStats.Add (Statistics::DECRYPT_FAILURES);
+		return;
+	}
 
 	// Verify that the data is correct
+	start = Clock::Now();
 	CRC32 crc;
 	crc.Add (packet.Msg.GetLength(), packet.Msg.GetData());
+	mStats.Record (Statistics::STAGE_VERIFY, start);
 
 	// Hash is incorrect, ignore message
-	if (crc.Value != packet.Hashes.back()) return;
+	if (packet.Hashes.empty() || crc.Value != packet.Hashes.back())
+	{
+		mStats.Add (Statistics::CRC_REJECTS);
+		return;
+	}
 
-	// Rebroadcast if the message is not the destination
+	// Rebroadcast if the message is not the destination, the next
+	// hop is hidden by the onion so every neighbor on every interface
+	// receives it
 	if (packet.Hashes.size() != 1)
 	{
 		// Broadcast message with new path
 		packet.Hashes.pop_back();
 
-		// Serialize packet and prepare for sending
-		uint32 bufferLength = packet.ComputeSize();
-		uint8* buffer = new uint8 [bufferLength];
-		packet.Serialize (bufferLength, buffer);
-
-		// Send the packet
-		sendto (mSocketID, buffer, bufferLength,
-			0, (sockaddr*) &mDest, mDestLength);
-
-		delete[] buffer;
+		// Send the packet as relayed traffic
+		mStats.Add (Statistics::RELAYED);
+		packet.Priority = Packet::CLASS_RELAY;
+		SendPacket (packet, Address::Broadcast, ALL_LINKS);
+		mStats.Record (Statistics::STAGE_FORWARD, received);
 		return;
 	}
 
-	Message* message = new Message();
-
 	// Strip the leading zeroes
-	for (uint32 i = 0; i < packet.Msg.GetLength(); ++i)
+	uint32 offset = 0;
+	while (offset < packet.Msg.GetLength() &&
+		packet.Msg.GetData()[offset] == 0) ++offset;
+
+	uint32 length = packet.Msg.GetLength() - offset;
+	const uint8* data = packet.Msg.GetData() + offset;
+
+	// Hand stream segments to their stream
+	if (Stream::IsSegment (length, data))
 	{
-		if (packet.Msg.GetData()[i] != 0)
-		{
-			uint32 msgLength = packet.Msg.GetLength() - i;
-			message->Create (msgLength);
-			memcpy (message->GetData(), packet.Msg.GetData() + i, msgLength);
-			break;
-		}
+		mStats.Add (Statistics::SEGMENTS);
+		ProcessSegment (length, data);
+		return;
 	}
 
+	// Copy the message into a pooled buffer
+	Buffer message = mPool->Acquire (length);
+	memcpy (message.GetData(), data, length);
+
+	pthread_mutex_lock (&mInboxMutex);
+
 	// Add the message to the stack
-	mMessages.push_back (message);
+	mInbox.push_back (std::move (message));
 
 	// Delete old messages
-	if (mMessages.size() >= MAX_MESSAGES)
+	if (mInbox.size() >= MAX_MESSAGES)
 	{
-		delete mMessages.front();
-		mMessages.pop_front();
+		mStats.Add (Statistics::INBOX_DROPS);
+		mInbox.pop_front();
 	}
+
+	mStats.Add (Statistics::DELIVERED);
+
+	// Wake the delivery thread and any pollers
+	uint64 signal = 1;
+	write (mEventFD, &signal, sizeof (signal));
+	pthread_cond_signal (&mInboxCond);
+
+	pthread_mutex_unlock (&mInboxMutex);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// <summary> Processes the specified beacon. </summary>
+/// <summary> Returns true if the source of the frame is ignored. </summary>
+/// <remarks> Called with the filter locked, before the frame is parsed. </remarks>
 
-void OnionRouter::ProcessBeacon (const Packet& packet)
+bool OnionRouter::IsIgnored (uint32 length, const uint8* data) const
 {
-	// Ignore if part of ignore list
-	for (list<Address>::iterator i = mIgnore.
-		begin(); i != mIgnore.end(); ++i)
-	{
-		if ((*i) == packet.Source)
-			return;
-	}
+	if (length < 2 * Address::Length || mFilter.IsEmpty()) return false;
+
+	Address source;
+	memcpy (source.Data, data + Address::Length, Address::Length);
+	return mFilter.IsBlocked (source);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Processes the specified beacon. </summary>
+/// <remarks> The link of the receiving interface is kept with the node,
+///           frames for the node are then only sent on that interface. </remarks>
 
+void OnionRouter::ProcessBeacon (const Packet& packet, uint32 link)
+{
 	// Find the node matching packet source
 	for (list<Node*>::iterator i = Network.
 		begin(); i != Network.end(); ++i)
 	{
 		if ((*i)->Addr == packet.Source)
 		{
-			(*i)->Arrived = true;
+			// Restored nodes are confirmed by the token they were saved with
+			if ((*i)->Provisional)
+			{
+				CRC32 crc;
+				crc.Add (packet.Msg.GetLength(), packet.Msg.GetData());
+
+				if (crc.Value != (*i)->Token)
+				{
+					// Forget the node and verify the new token
+					Node* node = *i;
+					Network.erase (i);
+					delete node;
+					break;
+				}
+
+				(*i)->Provisional = false;
+			}
+
+			// Only the timer of this node is moved
+			(*i)->Seen = Clock::Micro();
+			(*i)->Link = link;
+			mTimers.Schedule (&(*i)->Expiry, NEIGHBOR_TIMEOUT);
+
 			CopyAddressPath (*i, packet);
 			return;
 		}
@@ -657,13 +1766,24 @@ void OnionRouter::ProcessBeacon (const Packet& packet)
 	uint8* buffer = new uint8 [length];
 	memcpy (buffer, packet.Msg.GetData(), length);
 
-	if (rsa_public (&mAuthority, packet.Msg.GetData(), buffer) != 0)
-		{ delete[] buffer; return; }
+	// Unknown sources cost a verification, which the budget must allow
+	uint64 start = Clock::Micro();
+	if (!mLimiter.HasBudget (start))
+	{
+		mStats.Add (Statistics::OVER_BUDGET);
+		delete[] buffer; return;
+	}
+
+	mStats.Add (Statistics::RSA_PUBLIC_OPS);
+	int32 status = rsa_public (&mAuthority, packet.Msg.GetData(), buffer);
+	mLimiter.Charge (Clock::Micro() - start);
+
+	if (status != 0) { delete[] buffer; return; }
 
 	// Add a new node
 	Node* node = new Node;
-	node->Arrived  = true;
-	node->Recorded = -1;
+	node->Seen     = Clock::Micro();
+	node->Link     = link;
 	node->Addr     = packet.Source;
 
 	// Copy public key information
@@ -673,47 +1793,172 @@ void OnionRouter::ProcessBeacon (const Packet& packet)
 
 	// Check for key compatability
 	if (node->Idnt.len != mIdentity->RsaState.len)
-		{ delete[] buffer; return; }
+		{ delete node; delete[] buffer; return; }
+
+	// Cache R^2 mod N now, concurrent senders then only read the context
+	if (!Identity::PrecomputePublic (node->Idnt))
+		{ delete node; delete[] buffer; return; }
+
+	// Remember the token to confirm the node after a restart
+	CRC32 crc;
+	crc.Add (length, packet.Msg.GetData());
+	node->Token = crc.Value;
 
 	// Copy address path
 	CopyAddressPath (node, packet);
 
 	delete[] buffer;
-	Network.push_back (node);
+	node->Entry = Network.insert (Network.end(), node);
+
+	// Remove the node unless another beacon arrives in time
+	node->Expiry.Expire = ExpireNode;
+	node->Expiry.Owner  = this;
+	node->Expiry.User   = node;
+	mTimers.Schedule (&node->Expiry, NEIGHBOR_TIMEOUT);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Expires every timer which is due. </summary>
+/// <remarks> Callbacks run with the network locked. </remarks>
+
+void OnionRouter::UpdateTimers (void)
+{
+	Lock();
+	mTimers.Advance (Clock::Micro());
+	Unlock();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Removes a neighbor whose beacons have stopped. </summary>
+/// <remarks> Called by the timers with the network locked. </remarks>
+
+void OnionRouter::ExpireNode (void* router, void* node)
+{
+	OnionRouter* owner = (OnionRouter*) router;
+	Node* expired = (Node*) node;
+
+	owner->mStats.Add (Statistics::NEIGHBORS_EXPIRED);
+	owner->Network.erase (expired->Entry);
+	delete expired;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-/// <summary> Updates the neighbor table. </summary>
+/// <summary> Adds the neighbors of the snapshot file as provisional nodes. </summary>
+/// <remarks> The keys were verified by the authority before they were
+///           saved, so they are used right away. Nodes are removed unless
+///           a beacon with the same token arrives soon. Called with the
+///           network locked. </remarks>
 
-void OnionRouter::UpdateNetwork (void)
+void OnionRouter::RestoreSnapshot (void)
 {
-	list<Node*>::iterator i = Network.begin();
-	while (i != Network.end())
+	Snapshot snapshot;
+	if (snapshot.Load (mSnapshotFile, GetAuthorityCRC(),
+		mIdentity->RsaState.len, SNAPSHOT_MAX_AGE) != Snapshot::ERROR_NONE)
+		return;
+
+	uint64 now = Clock::Micro();
+	for (uint32 i = 0; i < snapshot.Entries.size(); ++i)
 	{
-		// Check if we recieved a beacon
-		if ((*i)->Arrived == false)
-		{
-			// Remove disconnected neighbors
-			if (++(*i)->Recorded >= MAX_RECORDED)
-			{
-				// Deallocate and remove entry
-				delete (*i);
-				i = Network.erase(i);
-			}
+		const Snapshot::Entry& entry = snapshot.Entries[i];
 
-			else ++i;
-		}
+		// Skip ignored addresses and ourselves
+		pthread_rwlock_rdlock (&mFilterLock);
+		bool ignored = mFilter.IsBlocked (entry.Addr);
+		pthread_rwlock_unlock (&mFilterLock);
 
-		else
-		{
-			// Reset arrival state
-			(*i)->Arrived  = false;
-			(*i)->Recorded = 0;
-			++i;
-		}
+		if (ignored || entry.Addr == mAddress) continue;
+
+		Node* node = new Node;
+		node->Addr        = entry.Addr;
+		node->Seen        = now;
+		node->Link        = entry.Link < mInterfaces.size() ? entry.Link : 0;
+		node->Token       = entry.Token;
+		node->Provisional = true;
+		node->Addresses   = entry.Addresses;
+
+		// Copy public key information
+		mpi_read_binary (&node->Idnt.N, &entry.Key[0], entry.Key.size());
+		node->Idnt.len = (mpi_msb (&node->Idnt.N) + 7) >> 3;
+		mpi_lset (&node->Idnt.E, EXPONENT);
+
+		if (node->Idnt.len != mIdentity->RsaState.len ||
+			!Identity::PrecomputePublic (node->Idnt))
+			{ delete node; continue; }
+
+		node->Entry = Network.insert (Network.end(), node);
+
+		node->Expiry.Expire = ExpireNode;
+		node->Expiry.Owner  = this;
+		node->Expiry.User   = node;
+		mTimers.Schedule (&node->Expiry, PROVISIONAL_TIMEOUT);
+
+		mStats.Add (Statistics::NEIGHBORS_RESTORED);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Copies every confirmed neighbor into the snapshot. </summary>
+/// <remarks> Called with the network locked. </remarks>
+
+void OnionRouter::CaptureSnapshot (Snapshot& snapshot) const
+{
+	uint32 length = mIdentity->RsaState.len;
+
+	snapshot.Authority = GetAuthorityCRC();
+	snapshot.KeyLength = length;
+	snapshot.Created   = time (null);
+	snapshot.Entries.clear();
+
+	for (list<Node*>::const_iterator i = Network.
+		begin(); i != Network.end(); ++i)
+	{
+		// Unconfirmed nodes would otherwise never age out
+		if ((*i)->Provisional) continue;
+
+		snapshot.Entries.push_back (Snapshot::Entry());
+		Snapshot::Entry& entry = snapshot.Entries.back();
+
+		entry.Addr      = (*i)->Addr;
+		entry.Link      = (*i)->Link;
+		entry.Token     = (*i)->Token;
+		entry.Addresses = (*i)->Addresses;
+
+		entry.Key.resize (length);
+		mpi_write_binary (&(*i)->Idnt.N, &entry.Key[0], length);
 	}
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the CRC32 of the authority public key. </summary>
+
+uint32 OnionRouter::GetAuthorityCRC (void) const
+{
+	uint32 length = mIdentity->SignLength;
+	std::vector<uint8> key (length);
+	mpi_write_binary (&mIdentity->AuthKey, &key[0], length);
+
+	CRC32 crc;
+	crc.Add (length, &key[0]);
+	return crc.Value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Hands a new snapshot to the writer and schedules the next. </summary>
+/// <remarks> Called by the timers with the network locked. </remarks>
+
+void OnionRouter::TakeSnapshot (void* router, void* user)
+{
+	OnionRouter* owner = (OnionRouter*) router;
+
+	pthread_mutex_lock (&owner->mSnapshotMutex);
+	owner->CaptureSnapshot (owner->mSnapshot);
+	owner->mSnapshotReady = true;
+	pthread_cond_signal (&owner->mSnapshotCond);
+	pthread_mutex_unlock (&owner->mSnapshotMutex);
+
+	owner->mTimers.Schedule (&owner->mSnapshotTimer, SNAPSHOT_INTERVAL);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 /// <summary> Copies the packet's address path to the node. </summary>
 
@@ -725,3 +1970,131 @@ void OnionRouter::CopyAddressPath (Node* node, const Packet& packet)
 		Addresses.begin(); iter != packet.Addresses.end(); ++iter)
 		node->Addresses.push_back (*iter);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Delivers a stream segment to its stream. </summary>
+/// <remarks> A SYN segment for an unknown stream creates a new stream. </remarks>
+
+void OnionRouter::ProcessSegment (uint32 length, const uint8* data)
+{
+	Stream::Header header;
+	if (!header.Read (length, data)) return;
+
+	// Segments from the opener belong to accepted streams
+	bool remote = (header.Flags & Stream::FLAG_INIT) != 0;
+
+	pthread_mutex_lock (&mStreamMutex);
+
+	Stream* stream = null;
+	for (list<Stream*>::iterator i = mStreams.
+		begin(); i != mStreams.end(); ++i)
+	{
+		if ((*i)->GetID() == header.ID && (*i)->IsInitiator()
+			!= remote && (*i)->GetRemote() == header.Reply)
+			{ stream = *i; break; }
+	}
+
+	// Create a stream for the remote opener
+	if (stream == null && remote && (header.Flags & Stream::FLAG_SYN))
+	{
+		stream = new Stream (this, mAddress, header.Reply, header.ID, false);
+		mStreams .push_back (stream);
+		mAccepted.push_back (stream);
+	}
+
+	if (stream != null)
+	{
+		stream->Deliver (header, length - Stream::Header::
+			Length, data + Stream::Header::Length);
+	}
+
+	pthread_mutex_unlock (&mStreamMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Drives stream timers and deletes finished streams. </summary>
+
+void OnionRouter::UpdateStreams (void)
+{
+	pthread_mutex_lock (&mStreamMutex);
+
+	for (list<Stream*>::iterator i = mStreams.
+		begin(); i != mStreams.end(); ++i)
+		(*i)->Update();
+
+	// Delete released streams that have finished
+	list<Stream*>::iterator i = mReleased.begin();
+	while (i != mReleased.end())
+	{
+		Stream::State state = (*i)->GetState();
+		if (state == Stream::STATE_CLOSED ||
+			state == Stream::STATE_FAILED)
+		{
+			mStreams.remove (*i);
+			delete (*i);
+			i = mReleased.erase (i);
+		}
+
+		else ++i;
+	}
+
+	pthread_mutex_unlock (&mStreamMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Deletes every stream. </summary>
+
+void OnionRouter::DestroyStreams (void)
+{
+	pthread_mutex_lock (&mStreamMutex);
+
+	for (list<Stream*>::iterator i = mStreams.
+		begin(); i != mStreams.end(); ++i)
+		delete *i;
+
+	mStreams .clear();
+	mAccepted.clear();
+	mReleased.clear();
+
+	pthread_mutex_unlock (&mStreamMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Completes every queued request as failed. </summary>
+
+void OnionRouter::FailRequests (void)
+{
+	pthread_mutex_lock (&mRequestMutex);
+	std::deque<SendRequest*> requests;
+	requests.swap (mRequests);
+	pthread_mutex_unlock (&mRequestMutex);
+
+	for (std::deque<SendRequest*>::iterator i = requests.
+		begin(); i != requests.end(); ++i)
+	{
+		if ((*i)->Callback != null)
+			(*i)->Callback ((*i)->Handle, false, (*i)->User);
+
+		delete *i;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Moves up to count of the oldest messages to the output. </summary>
+/// <remarks> The inbox lock must be held, resets the receive descriptor
+///           once every message was taken. </remarks>
+
+void OnionRouter::TakeMessages (uint32 count, std::vector<Buffer>& output)
+{
+	while (count-- > 0 && !mInbox.empty())
+	{
+		output.push_back (std::move (mInbox.front()));
+		mInbox.pop_front();
+	}
+
+	if (mInbox.empty() && mEventFD != -1)
+	{
+		uint64 value;
+		read (mEventFD, &value, sizeof (value));
+	}
+}
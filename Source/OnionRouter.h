@@ -18,21 +18,27 @@
 #ifndef ONION_ROUTER_H
 #define ONION_ROUTER_H
 
+#include "Buffer.h"
 #include "Packet.h"
+#include "Capture.h"
+#include "AddressFilter.h"
+#include "Stream.h"
 #include "Address.h"
 #include "Message.h"
 #include "Identity.h"
+#include "Pacer.h"
+#include "Snapshot.h"
+#include "Transport.h"
+#include "Statistics.h"
+#include "RateLimiter.h"
+#include "TimerWheel.h"
+#include "FrameScheduler.h"
 
 #include <list>
+#include <deque>
+#include <vector>
 #include <pthread.h>
 
-#include <netinet/in.h>
-#include <netpacket/packet.h>
-#include <net/ethernet.h>
-
-#include <linux/if.h>
-#include <sys/ioctl.h>
-
 
 
 //----------------------------------------------------------------------------//
@@ -42,10 +48,15 @@
 ////////////////////////////////////////////////////////////////////////////////
 /// <summary> Represents a single ORP instance. </summary>
 
-class OnionRouter
+class OnionRouter : public Stream::Channel
 {
 	friend void* SendThread (void* parameters);
 	friend void* RecvThread (void* parameters);
+	friend void* SendWorker (void* parameters);
+	friend void* DeliverThread (void* parameters);
+	friend void* SnapshotThread (void* parameters);
+	friend void* TransmitThread (void* parameters);
+	friend class RouterBench;
 
 public:
 	////////////////////////////////////////////////////////////////////////////////
@@ -55,12 +66,8 @@ public:
 	{
 		ERROR_NONE = 0,
 		ERROR_INVALID_ID,
-		ERROR_OPEN_SOCK,
-		ERROR_GET_IFINDEX,
-		ERROR_GET_ADDRESS,
-		ERROR_GET_MTU,
-		ERROR_ADD_PROM,
-		ERROR_BIND_SOCK,
+		ERROR_TRANSPORT,
+		ERROR_OPEN_EVENT,
 	};
 
 public:
@@ -71,7 +78,8 @@ public:
 	{
 	public:
 		// Constructors
-		 Node (void) { rsa_init (&Idnt, RSA_PKCS_V15, 0);	}
+		 Node (void) : Token (0), Provisional (false)
+					 { rsa_init (&Idnt, RSA_PKCS_V15, 0);	}
 		~Node (void) { rsa_free (&Idnt);					}
 
 	public:
@@ -79,11 +87,72 @@ public:
 		Address		Addr;			// Node address
 		rsa_context	Idnt;			// Node identity
 
-		bool		Arrived;		// Has arrived
-		int8		Recorded;		// Last recorded
+		uint64		Seen;			// Time of the last beacon
+		uint32		Link;			// Interface it was heard on
+		uint32		Token;			// CRC32 of its signed token
+		bool		Provisional;	// Restored and not yet heard
 
 		// List of addresses in path
 		std::list<Address> Addresses;
+
+		// Removes the node once its beacons stop
+		TimerWheel::Timer Expiry;
+
+		// Position of the node in the network
+		std::list<Node*>::iterator Entry;
+	};
+
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Called once an asynchronous send has completed. </summary>
+	/// <remarks> Invoked from a worker thread, success is false if the
+	///           message could not be encrypted for the destination or
+	///           the router was stopped before it was sent. </remarks>
+
+	typedef void (*SendCallback) (uint32 handle, bool success, void* user);
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Called from the delivery thread for every received message. </summary>
+
+	typedef void (*ReceiveHandler) (Buffer&& message, void* user);
+
+private:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single attached interface. </summary>
+
+	class Interface
+	{
+	public:
+		// Properties
+		OnionRouter*	Router;		// Owning router
+		Transport*		Trans;		// Frame transport
+		uint32			Index;		// Position in the interface list
+		pthread_t		Thread;		// Receive thread ID
+
+		FrameScheduler	Scheduler;	// Frames waiting to be sent
+		pthread_t		Transmitter;// Transmit thread ID
+		pthread_mutex_t	Mutex;		// Scheduler synchronization
+		pthread_cond_t	Cond;		// Signals scheduled frames
+
+		Pacer			Pace;		// Transmit rates, used by the transmit thread
+		uint64			PaceTime;	// Microsecond of the last adaptation
+		uint64			Losses;		// Link losses at the last adaptation
+		uint32			FrameRate;	// Published frame rate, zero is unlimited
+		uint64			ByteRate;	// Published byte rate, zero is unlimited
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single queued asynchronous send. </summary>
+
+	class SendRequest
+	{
+	public:
+		// Properties
+		uint32			Handle;		// Request handle
+		Address			Dest;		// Destination address
+		Message			Msg;		// Message to send
+		SendCallback	Callback;	// Completion callback
+		void*			User;		// Callback parameter
 	};
 
 public:
@@ -94,20 +163,57 @@ public:
 public:
 	// Methods
 	Error			Create			(const std::string& interface, Identity* identity);
+	Error			Create			(Transport* transport, Identity* identity);
+	Error			Create			(Identity* identity, const Address& address);
+	Error			Attach			(Transport* transport);
 	void			Destroy			(void);
 
 	void			Start			(void);
 	void			Stop			(void);
 	bool			IsActive		(void) const;
+	const Address&	GetAddress		(void) const;
 
 	bool			Send			(const Address& destination, const Message& message);
+	uint32			SendAsync		(const Address& destination, const Message& message,
+									 SendCallback callback = null, void* user = null);
+	uint32			SendBatch		(uint32 count, const Address* destinations,
+									 const Message* messages, SendCallback
+									 callback = null, void* user = null);
 	Message*		Receive			(void);
+	std::vector<Buffer> ReceiveBatch (uint32 count);
 	void			Flush			(void);
 
+	int32			GetReceiveDescriptor (void) const;
+	void			SetReceiveHandler	 (ReceiveHandler handler, void* user = null);
+
 	void			Lock			(void);
 	void			Unlock			(void);
 
-	void			ReadIgnoreList	(const std::string& filename);
+	AddressFilter::Error ReadIgnoreList	(const std::string& filename);
+	AddressFilter::Error ReloadIgnoreList	(void);
+	uint32			GetIgnoreRuleCount	(void);
+	void			SetTimerResolution (uint32 resolution);
+	void			SetSnapshot		(const std::string& filename);
+	void			SetRateLimit	(uint32 rate, uint32 burst);
+	void			SetCryptoBudget	(uint32 budget);
+	void			SetClassWeight	(Packet::Class priority, uint32 weight);
+	void			SetPacing		(uint32 frameRate, uint64 byteRate);
+
+	void			SetCapture		(Capture* capture);
+	void			Replay			(const Trace& trace);
+
+	Statistics::Snapshot GetStats	(void);
+	const Histogram& GetLatency		(Statistics::Stage stage) const;
+	void			ResetLatency	(void);
+
+	Stream*			OpenStream		(const Address& destination);
+	Stream*			AcceptStream	(void);
+	void			CloseStream		(Stream* stream);
+
+public:
+	// Channel
+	uint32			GetSegmentLength(const Address& destination);
+	bool			Transmit		(const Address& destination, const Message& segment);
 
 public:
 	// Static
@@ -115,14 +221,38 @@ public:
 
 private:
 	// Internal
-	bool			EncryptLayered	(const Address& destination,
-									 const Message& input, Packet& packet);
-
-	void			ProcessMessage	(      Packet& packet);
-	void			ProcessBeacon	(const Packet& packet);
-	void			UpdateNetwork	(void);
+	bool			Enqueue			(const Address& destination, const Message& message);
+	bool			EncryptLayered	(const Address& destination, const Message&
+									 input, Packet& packet, Address& next);
+	Interface*		AddInterface	(Transport* transport);
+	bool			SendFrame		(Interface* link, FrameScheduler::Frame& frame);
+	bool			SendPacket		(const Packet& packet,
+									 const Address& next, uint32 link);
+	bool			Schedule		(Interface* link, FrameScheduler::Frame&&
+									 frame, uint8 priority);
+	void			AdaptPacing		(Interface* link, uint64 now);
+	uint32			FindLink		(const Address& neighbor) const;
+
+	bool			IsIgnored		(uint32 length, const uint8* data) const;
+	void			ProcessFrame	(Packet& packet, uint32 length, const
+									 uint8* data, uint64 received, uint32 link);
+	void			ProcessMessage	(      Packet& packet, uint64 received);
+	void			ProcessBeacon	(const Packet& packet, uint32 link);
+	void			UpdateTimers	(void);
+	static void		ExpireNode		(void* router, void* node);
+
+	void			RestoreSnapshot	(void);
+	void			CaptureSnapshot	(Snapshot& snapshot) const;
+	uint32			GetAuthorityCRC	(void) const;
+	static void		TakeSnapshot	(void* router, void* user);
 
 	void			CopyAddressPath	(Node* node, const Packet& packet);
+	void			FailRequests	(void);
+
+	void			ProcessSegment	(uint32 length, const uint8* data);
+	void			TakeMessages	(uint32 count, std::vector<Buffer>& output);
+	void			UpdateStreams	(void);
+	void			DestroyStreams	(void);
 
 public:
 	// Properties
@@ -134,22 +264,56 @@ private:
 	rsa_context		mAuthority;		// Authority public key
 
 	Identity*		mIdentity;		// Identity to use
-	Address			mAddress;		// Local MAC address
-
-	int32			mMTU;			// Socket MTU
-	int32			mSocketID;		// Socket descriptor
-	int32			mIfIndex;		// Interface index
-
-	sockaddr_ll		mDest;			// Destination
-	uint8			mDestLength;	// Destination length
+	Address			mAddress;		// Local address
+	std::vector<Interface*> mInterfaces;// Attached interfaces (if any)
 
 	pthread_t		mSendThread;	// Send thread ID
-	pthread_t		mRecvThread;	// Recv thread ID
-	pthread_mutex_t	mMutex;			// Synchronization
+	pthread_rwlock_t mLock;			// Network synchronization
 	volatile bool	mActive;		// Currently active
-
-	std::list<Message*> mMessages;	// List of queued messages
-	std::list<Address > mIgnore;	// List of addresses to ignore
+	TimerWheel		mTimers;		// Protocol timers, guarded by mLock
+
+	std::deque<Buffer> mInbox;		// List of queued messages
+	BufferPool*		mPool;			// Pool of message buffers
+	BufferPool*		mFramePool;		// Pool of outgoing frames
+	int32			mEventFD;		// Readable while messages wait
+	pthread_mutex_t	mInboxMutex;	// Inbox synchronization
+	pthread_cond_t	mInboxCond;		// Signals received messages
+	ReceiveHandler	mHandler;		// Message handler (if any)
+	void*			mHandlerUser;	// Handler parameter
+	pthread_t		mDeliverThread;	// Delivery thread ID
+
+	Statistics		mStats;			// Runtime counters
+	Capture*		mCapture;		// Frame capture (if any)
+
+	RateLimiter		mLimiter;		// Admission of received frames
+
+	uint32			mWeights[Packet::CLASS_COUNT];	// Class weights of every interface
+	uint32			mPaceFrames;	// Frames per second per interface, zero is unlimited
+	uint64			mPaceBytes;		// Bytes per second per interface, zero is unlimited
+
+	AddressFilter	mFilter;		// Addresses to ignore
+	std::string		mFilterFile;	// File the filter was read from
+	pthread_rwlock_t mFilterLock;	// Filter synchronization
+
+	std::string		mSnapshotFile;	// Neighbor snapshot file (if any)
+	Snapshot		mSnapshot;		// Snapshot waiting to be written
+	bool			mSnapshotReady;	// The snapshot waits for the writer
+	pthread_t		mSnapshotThread;// Snapshot writer thread ID
+	pthread_mutex_t	mSnapshotMutex;	// Snapshot synchronization
+	pthread_cond_t	mSnapshotCond;	// Signals taken snapshots
+	TimerWheel::Timer mSnapshotTimer;// Takes the next snapshot
+
+	std::list<Stream* > mStreams;	// List of open streams
+	std::list<Stream* > mAccepted;	// Streams waiting to be accepted
+	std::list<Stream* > mReleased;	// Streams closed by the application
+	pthread_mutex_t	mStreamMutex;	// Stream synchronization
+	uint16			mStreamID;		// Next stream identifier
+
+	std::deque<SendRequest*> mRequests;	// Queued asynchronous sends
+	std::vector<pthread_t> mWorkers;	// Send worker threads
+	pthread_mutex_t	mRequestMutex;	// Request synchronization
+	pthread_cond_t	mRequestCond;	// Signals queued requests
+	uint32			mRequestID;		// Next request handle
 };
 
 #endif // ONION_ROUTER_H
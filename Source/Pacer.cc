@@ -0,0 +1,214 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Pacer.h"
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                         Pacer //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new pacer which sends at any rate. </summary>
+
+Pacer::Pacer (void)
+{
+	mCeilFrames = 0;
+	mCeilBytes  = 0;
+	mFrameRate  = 0;
+	mByteRate   = 0;
+
+	mNext    = 0;
+	mStart   = 0;
+	mFrames  = 0;
+	mBytes   = 0;
+	mLosses  = 0;
+	mDelayed = false;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                              Pacer //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the highest frames and bytes per second. </summary>
+/// <remarks> A ceiling of zero is unlimited. The current rates restart
+///           at the ceilings. </remarks>
+
+void Pacer::SetCeiling (uint32 frameRate, uint64 byteRate)
+{
+	mCeilFrames = frameRate;
+	mCeilBytes  = byteRate;
+	mFrameRate  = frameRate;
+	mByteRate   = byteRate;
+	mNext       = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reserves the slot of a frame of the given length. </summary>
+/// <remarks> Returns the microseconds to wait before sending the frame,
+///           zero if it may leave now. The time is the current monotonic
+///           time in microseconds. </remarks>
+
+uint64 Pacer::Reserve (uint32 length, uint64 now)
+{
+	if (mFrameRate == 0 && mByteRate == 0) return 0;
+
+	// A slot lasts as long as the slower of both rates takes
+	uint64 slot = 0;
+	if (mFrameRate > 0) slot = 1000000000ULL / mFrameRate;
+
+	if (mByteRate > 0)
+	{
+		uint64 bytes = length * 1000000000ULL / mByteRate;
+		if (slot < bytes) slot = bytes;
+	}
+
+	// An idle interface saves up a few slots, but no more
+	uint64 time = now * 1000;
+	if (mNext + Burst * 1000ULL < time)
+		mNext = time - Burst * 1000ULL;
+
+	uint64 start = mNext;
+	mNext += slot;
+
+	if (start <= time) return 0;
+
+	mDelayed = true;
+	return (start - time + 999) / 1000;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reports a frame the interface accepted. </summary>
+/// <remarks> Refused frames are signalled instead, so a backoff starts
+///           from what actually got through. </remarks>
+
+void Pacer::Sent (uint32 length)
+{
+	++mFrames;
+	mBytes += length;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reports frames lost or refused by the interface. </summary>
+
+void Pacer::Signal (uint32 losses)
+{
+	mLosses += losses;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Adapts the rates to the window that passed. </summary>
+/// <remarks> Returns true if the rates were cut because of loss. Does
+///           nothing until a full window passed and restarts the window
+///           if the transmitter was idle for long. </remarks>
+
+bool Pacer::Adapt (uint64 now)
+{
+	if (mStart == 0) { mStart = now; return false; }
+
+	uint64 elapsed = now - mStart;
+	if (elapsed < Window) return false;
+
+	// An idle transmitter says nothing about the link
+	if (elapsed > Window * 10)
+	{
+		mStart   = now;
+		mFrames  = 0;
+		mBytes   = 0;
+		mLosses  = 0;
+		mDelayed = false;
+		return false;
+	}
+
+	// Rates actually sent during the window
+	uint64 frames = mFrames * 1000000ULL / elapsed;
+	uint64 bytes  = mBytes  * 1000000ULL / elapsed;
+	bool backoff  = mLosses > 0;
+
+	if (backoff)
+	{
+		// Back off from what got through, not from what was allowed
+		if (mFrameRate == 0 || mFrameRate > frames) mFrameRate = (uint32) frames;
+		if (mByteRate  == 0 || mByteRate  > bytes ) mByteRate  = bytes;
+
+		mFrameRate -= mFrameRate / 4;
+		mByteRate  -= mByteRate  / 4;
+
+		if (mFrameRate < MinFrames) mFrameRate = MinFrames;
+		if (mByteRate  < MinBytes ) mByteRate  = MinBytes;
+
+		if (mCeilFrames > 0 && mFrameRate > mCeilFrames) mFrameRate = mCeilFrames;
+		if (mCeilBytes  > 0 && mByteRate  > mCeilBytes ) mByteRate  = mCeilBytes;
+	}
+
+	else
+	{
+		if (mFrameRate > 0)
+		{
+			mFrameRate += mFrameRate / 16 + 1;
+			if (mCeilFrames > 0)
+			{
+				if (mFrameRate > mCeilFrames)
+					mFrameRate = mCeilFrames;
+			}
+
+			// Drop a limit that no longer holds anything back
+			elif (!mDelayed && mFrameRate > frames * 2)
+				mFrameRate = 0;
+		}
+
+		if (mByteRate > 0)
+		{
+			mByteRate += mByteRate / 16 + 1;
+			if (mCeilBytes > 0)
+			{
+				if (mByteRate > mCeilBytes)
+					mByteRate = mCeilBytes;
+			}
+
+			elif (!mDelayed && mByteRate > bytes * 2)
+				mByteRate = 0;
+		}
+	}
+
+	mStart   = now;
+	mFrames  = 0;
+	mBytes   = 0;
+	mLosses  = 0;
+	mDelayed = false;
+	return backoff;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the current frames per second, zero if unlimited. </summary>
+
+uint32 Pacer::GetFrameRate (void) const
+{
+	return mFrameRate;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the current bytes per second, zero if unlimited. </summary>
+
+uint64 Pacer::GetByteRate (void) const
+{
+	return mByteRate;
+}
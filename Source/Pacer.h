@@ -0,0 +1,83 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef PACER_H
+#define PACER_H
+
+#include "Types.h"
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Spaces the frames sent on one interface. </summary>
+/// <remarks>
+///   Every frame reserves the next free slot of the interface, which is
+///   as long as the frame takes at the current frame and byte rates, so
+///   frames leave evenly instead of in bursts the medium cannot carry.
+///   Once every window the rates adapt: loss signalled during the window
+///   cuts them to three quarters of what was reported Sent, and a window
+///   without loss raises them by a sixteenth up to the ceilings. Without
+///   a ceiling a rate starts unlimited and returns to unlimited once it
+///   no longer holds frames back. The pacer is not synchronized, only
+///   the transmit thread may use it.
+/// </remarks>
+
+class Pacer
+{
+public:
+	// Constants
+	static const uint32 Window    = 100000;	// Microseconds between adaptations
+	static const uint32 Burst     = 1000;	// Microseconds of slots saved up
+	static const uint32 MinFrames = 100;	// Lowest frame rate after loss
+	static const uint32 MinBytes  = 16384;	// Lowest byte rate after loss
+
+public:
+	// Constructors
+	Pacer						(void);
+
+public:
+	// Methods
+	void		SetCeiling		(uint32 frameRate, uint64 byteRate);
+
+	uint64		Reserve			(uint32 length, uint64 now);
+	void		Sent			(uint32 length);
+	void		Signal			(uint32 losses = 1);
+	bool		Adapt			(uint64 now);
+
+	uint32		GetFrameRate	(void) const;
+	uint64		GetByteRate		(void) const;
+
+private:
+	// Fields
+	uint32		mCeilFrames;	// Highest frame rate, zero is unlimited
+	uint64		mCeilBytes;		// Highest byte rate, zero is unlimited
+	uint32		mFrameRate;		// Current frames per second
+	uint64		mByteRate;		// Current bytes per second
+
+	uint64		mNext;			// Nanosecond of the next free slot
+	uint64		mStart;			// Microsecond the window began
+	uint32		mFrames;		// Frames sent during the window
+	uint64		mBytes;			// Bytes sent during the window
+	uint32		mLosses;		// Loss signalled during the window
+	bool		mDelayed;		// Frames were held back this window
+};
+
+#endif // PACER_H
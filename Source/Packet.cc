@@ -88,7 +88,8 @@ bool Packet::Serialize (uint32 length, uint8* buffer) const
 
 ////////////////////////////////////////////////////////////////////////////////
 /// <summary> Deserializes the specified data into this packet. </summary>
-/// <remarks> Any previous packet information will be destroyed. </remarks>
+/// <remarks> Any previous packet information will be destroyed. Returns
+///           false if the fields do not fit in the buffer. </remarks>
 
 bool Packet::Deserialize (uint32 length, const uint8* buffer)
 {
@@ -99,6 +100,10 @@ bool Packet::Deserialize (uint32 length, const uint8* buffer)
 	uint32 addressLength;
 	uint32 hashesLength;
 
+	// Make sure the fixed fields are present
+	uint32 headerLength = sizeof (Address) * 2 + sizeof (uint16) + sizeof (uint32) * 3;
+	if (length < headerLength) return false;
+
 	// Retrieve the source and target address from the buffer
 	memcpy (Target.Data, buffer, sizeof (Address)); buffer += sizeof (Address);
 	memcpy (Source.Data, buffer, sizeof (Address)); buffer += sizeof (Address);
@@ -116,6 +121,11 @@ bool Packet::Deserialize (uint32 length, const uint8* buffer)
 	memcpy (&addressLength, buffer, sizeof (uint32)); buffer += sizeof (uint32);
 	memcpy (&hashesLength , buffer, sizeof (uint32)); buffer += sizeof (uint32);
 
+	// Make sure the variable fields fit in the buffer
+	if ((uint64) messageLength + (uint64) addressLength * sizeof (Address) +
+		(uint64) hashesLength * sizeof (uint32) > length - headerLength)
+		return false;
+
 	// Retrieve the message from the buffer
 	Msg.Create (messageLength);
 	memcpy (Msg.GetData(), buffer, messageLength); buffer += messageLength;
@@ -44,9 +44,20 @@ public:
 		TYPE_MESSAGE = 0x3960,
 	};
 
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of traffic classes, which share the transmitter. </summary>
+
+	enum Class
+	{
+		CLASS_CONTROL = 0,	// Beacons, which keep this node known
+		CLASS_RELAY,		// Messages relayed for other nodes
+		CLASS_LOCAL,		// Messages originated by this node
+		CLASS_COUNT
+	};
+
 public:
 	// Constructors
-	 Packet (void) { }
+	 Packet (void) { Priority = CLASS_LOCAL; }
 	~Packet (void) { }
 
 private:
@@ -65,6 +76,7 @@ public:
 	Address	Source;		// Source address
 	uint16	IPType;		// IP Packet Type
 	Message	Msg;		// Message data
+	uint8	Priority;	// Traffic class, never serialized
 
 	// List of addresses in path
 	std::list<Address> Addresses;
@@ -0,0 +1,491 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Clock.h"
+#include "Provisioner.h"
+
+#include <cstdio>
+#include <unistd.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Types                                                                      //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Maximum number of identities loaded ahead of the signers. </summary>
+
+#define MAX_LOADED 256
+
+
+
+//----------------------------------------------------------------------------//
+// Threading                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Thread that generates and saves identities. </summary>
+
+void* CreateWorker (void* parameters)
+{
+	// Retrieve the Provisioner instance
+	Provisioner* provisioner = (Provisioner*) parameters;
+
+	// Seed a private generator, the thread ID personalizes it
+	pthread_t self = pthread_self();
+	ctr_drbg_context random;
+
+	bool seeded = ctr_drbg_init (&random, Provisioner::SharedEntropy,
+		provisioner, (const uint8*) &self, sizeof (self)) == 0;
+
+	uint32 job;
+	while (provisioner->NextJob (job))
+	{
+		uint64 start = Clock::Now();
+		Identity* identity = new Identity;
+
+		// Generate the identity
+		Identity::Error error = seeded ? identity->Create
+			(provisioner->mLength, &random) : Identity::ERROR_CTR_DRBG_INIT;
+
+		// Keep it for the bundle or save it to its file
+		if (error == Identity::ERROR_NONE && provisioner->mCreated != null)
+			{ (*provisioner->mCreated)[job] = identity; identity = null; }
+
+		elif (error == Identity::ERROR_NONE)
+			error = identity->Save ((*provisioner->mFiles)[job]);
+
+		delete identity;
+
+		provisioner->Report (job, Clock::Now() - start, error ==
+			Identity::ERROR_NONE ? null : Identity::ErrorString (error).c_str());
+	}
+
+	return null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Thread that signs loaded identities with the authority. </summary>
+/// <remarks> Loading precomputes the authority, rsa_private then only
+///           reads it and every temporary lives on this thread. </remarks>
+
+void* SignWorker (void* parameters)
+{
+	// Retrieve the Provisioner instance
+	Provisioner* provisioner = (Provisioner*) parameters;
+
+	forever
+	{
+		pthread_mutex_lock (&provisioner->mMutex);
+
+		// Wait for an identity to sign
+		while (provisioner->mReading && provisioner->mLoaded.empty())
+			pthread_cond_wait (&provisioner->mLoadedCond, &provisioner->mMutex);
+
+		if (provisioner->mLoaded.empty())
+		{
+			pthread_mutex_unlock (&provisioner->mMutex);
+			break;
+		}
+
+		Provisioner::Job* job = provisioner->mLoaded.front();
+		provisioner->mLoaded.pop_front();
+
+		pthread_cond_signal (&provisioner->mSpaceCond);
+		pthread_mutex_unlock (&provisioner->mMutex);
+
+		// Sign the identity
+		uint64 start = Clock::Now();
+		job->Error = provisioner->mAuthority->Sign (job->Idnt);
+		job->Elapsed = Clock::Now() - start;
+
+		// Hand it to the writer
+		pthread_mutex_lock (&provisioner->mMutex);
+		provisioner->mSigned.push_back (job);
+		pthread_cond_signal (&provisioner->mSignedCond);
+		pthread_mutex_unlock (&provisioner->mMutex);
+	}
+
+	return null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Thread that loads identities ahead of the signers. </summary>
+
+void* ReadThread (void* parameters)
+{
+	// Retrieve the Provisioner instance
+	Provisioner* provisioner = (Provisioner*) parameters;
+	const std::vector<std::string>& files = *provisioner->mFiles;
+
+	for (uint32 i = 0; i < files.size(); ++i)
+	{
+		Provisioner::Job* job = new Provisioner::Job;
+		job->Index   = i;
+		job->Elapsed = 0;
+		job->Error   = provisioner->mBundle != null ? provisioner->
+			mBundle->Read (i, job->Idnt) : job->Idnt.Load (files[i]);
+
+		pthread_mutex_lock (&provisioner->mMutex);
+
+		// Failed loads skip the signers
+		if (job->Error != Identity::ERROR_NONE)
+		{
+			provisioner->mSigned.push_back (job);
+			pthread_cond_signal (&provisioner->mSignedCond);
+		}
+
+		else
+		{
+			// Limit the number of identities in memory
+			while (provisioner->mLoaded.size() >= MAX_LOADED)
+				pthread_cond_wait (&provisioner->mSpaceCond, &provisioner->mMutex);
+
+			provisioner->mLoaded.push_back (job);
+			pthread_cond_signal (&provisioner->mLoadedCond);
+		}
+
+		pthread_mutex_unlock (&provisioner->mMutex);
+	}
+
+	// Release the signers once the queue drains
+	pthread_mutex_lock (&provisioner->mMutex);
+	provisioner->mReading = false;
+	pthread_cond_broadcast (&provisioner->mLoadedCond);
+	pthread_mutex_unlock (&provisioner->mMutex);
+
+	return null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Thread that saves signed identities and reports progress. </summary>
+
+void* WriteThread (void* parameters)
+{
+	// Retrieve the Provisioner instance
+	Provisioner* provisioner = (Provisioner*) parameters;
+	const std::vector<std::string>& files = *provisioner->mFiles;
+
+	for (uint32 i = 0; i < files.size(); ++i)
+	{
+		pthread_mutex_lock (&provisioner->mMutex);
+
+		while (provisioner->mSigned.empty())
+			pthread_cond_wait (&provisioner->mSignedCond, &provisioner->mMutex);
+
+		Provisioner::Job* job = provisioner->mSigned.front();
+		provisioner->mSigned.pop_front();
+
+		pthread_mutex_unlock (&provisioner->mMutex);
+
+		// Save the identity in place
+		if (job->Error == Identity::ERROR_NONE && provisioner->mBundle == null)
+			job->Error = job->Idnt.Save (files[job->Index]);
+
+		provisioner->Report (job->Index, job->Elapsed, job->Error == Identity::
+			ERROR_NONE ? null : Identity::ErrorString (job->Error).c_str());
+
+		// Bundles are written once every identity is signed
+		if (provisioner->mBundle != null)
+			provisioner->mFinished[job->Index] = job;
+		else delete job;
+	}
+
+	return null;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                   Provisioner //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new provisioner using one thread per core. </summary>
+
+Provisioner::Provisioner (void)
+{
+	int32 count = sysconf (_SC_NPROCESSORS_ONLN);
+	mThreads = count > 0 ? count : 1;
+	mLength  = 0;
+
+	mFiles  = null;
+	mNext   = 0;
+	mDone   = 0;
+	mFailed = 0;
+
+	mCreated   = null;
+	mBundle    = null;
+	mAuthority = null;
+	mReading   = false;
+
+	entropy_init (&mEntropy);
+	pthread_mutex_init (&mEntropyMutex, null);
+	pthread_mutex_init (&mMutex, null);
+
+	pthread_cond_init (&mLoadedCond, null);
+	pthread_cond_init (&mSignedCond, null);
+	pthread_cond_init (&mSpaceCond,  null);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Deletes the provisioner. </summary>
+
+Provisioner::~Provisioner (void)
+{
+	pthread_mutex_destroy (&mEntropyMutex);
+	pthread_mutex_destroy (&mMutex);
+
+	pthread_cond_destroy (&mLoadedCond);
+	pthread_cond_destroy (&mSignedCond);
+	pthread_cond_destroy (&mSpaceCond);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                        Provisioner //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates an unsigned identity for every file. </summary>
+/// <returns> Number of identities which could not be created. </returns>
+
+uint32 Provisioner::Create (uint16 length, const std::vector<std::string>& filenames)
+{
+	mLength = length;
+	mFiles  = &filenames;
+	mNext   = 0;
+	mDone   = 0;
+	mFailed = 0;
+
+	uint64 start = Clock::Now();
+	uint32 threads = StartWorkers (CreateWorker, filenames.size());
+	real64 elapsed = (Clock::Now() - start) / 1000000000.0;
+
+	printf ("\nCreated %u of %u identities in %.2f s using %u threads\n",
+		mDone - mFailed, mDone, elapsed, threads);
+
+	mFiles = null;
+	return mFailed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Signs the identity stored in every file and saves it in place. </summary>
+/// <returns> Number of identities which could not be signed. </returns>
+
+uint32 Provisioner::Sign (Identity& authority, const std::vector<std::string>& filenames)
+{
+	mAuthority = &authority;
+	mFiles     = &filenames;
+	mReading   = true;
+	mDone      = 0;
+	mFailed    = 0;
+
+	uint64 start = Clock::Now();
+
+	// Start the file threads
+	pthread_t reader, writer;
+	pthread_create (&reader, null, ReadThread,  this);
+	pthread_create (&writer, null, WriteThread, this);
+
+	uint32 threads = StartWorkers (SignWorker, filenames.size());
+
+	pthread_join (reader, null);
+	pthread_join (writer, null);
+
+	real64 elapsed = (Clock::Now() - start) / 1000000000.0;
+	printf ("\nSigned %u of %u identities in %.2f s using %u threads\n",
+		mDone - mFailed, mDone, elapsed, threads);
+
+	mAuthority = null;
+	mFiles     = null;
+	return mFailed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates unsigned identities and stores them in a new bundle. </summary>
+/// <returns> Number of identities which could not be created. </returns>
+
+uint32 Provisioner::CreateBundle (uint16 length, const std::string& filename,
+								  const std::vector<std::string>& names)
+{
+	// Check the names before generating any keys
+	Bundle::Error error = Bundle::CheckNames (names);
+	if (error != Bundle::ERROR_NONE)
+	{
+		printf ("%s\n", Bundle::ErrorString (error).c_str());
+		return names.size();
+	}
+
+	std::vector<Identity*> created (names.size(), null);
+	mCreated = &created;
+	uint32 failed = Create (length, names);
+	mCreated = null;
+
+	// Write the bundle only if it is complete
+	if (failed == 0)
+	{
+		error = Bundle::Save (filename, names, created);
+		if (error != Bundle::ERROR_NONE)
+		{
+			printf ("%s: %s\n", filename.c_str(),
+				Bundle::ErrorString (error).c_str());
+			failed = names.size();
+		}
+	}
+
+	for (uint32 i = 0; i < created.size(); ++i)
+		delete created[i];
+
+	return failed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Signs every identity of a bundle and rewrites the bundle. </summary>
+/// <returns> Number of identities which could not be signed. </returns>
+
+uint32 Provisioner::SignBundle (Identity& authority, const std::string& filename)
+{
+	Bundle bundle;
+	Bundle::Error error = bundle.Open (filename);
+	if (error != Bundle::ERROR_NONE)
+	{
+		printf ("%s: %s\n", filename.c_str(),
+			Bundle::ErrorString (error).c_str());
+		return 1;
+	}
+
+	std::vector<std::string> names (bundle.GetCount());
+	for (uint32 i = 0; i < names.size(); ++i)
+		names[i] = bundle.GetName (i);
+
+	mBundle = &bundle;
+	mFinished.assign (names.size(), null);
+	uint32 failed = Sign (authority, names);
+	mBundle = null;
+
+	// Write the bundle only if every identity was signed
+	if (failed == 0)
+	{
+		std::vector<Identity*> identities (names.size());
+		for (uint32 i = 0; i < names.size(); ++i)
+			identities[i] = &mFinished[i]->Idnt;
+
+		error = Bundle::Save (filename, names, identities);
+		if (error != Bundle::ERROR_NONE)
+		{
+			printf ("%s: %s\n", filename.c_str(),
+				Bundle::ErrorString (error).c_str());
+			failed = names.size();
+		}
+	}
+
+	else printf ("%s: The bundle was not modified\n", filename.c_str());
+
+	for (uint32 i = 0; i < mFinished.size(); ++i)
+		delete mFinished[i];
+
+	mFinished.clear();
+	return failed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the maximum number of worker threads. </summary>
+
+uint32 Provisioner::GetThreads (void) const
+{
+	return mThreads;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the maximum number of worker threads. </summary>
+
+void Provisioner::SetThreads (uint32 threads)
+{
+	mThreads = threads > 0 ? threads : 1;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                       Provisioner //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Runs workers until every job has been taken. </summary>
+/// <returns> Number of threads that were used. </returns>
+
+uint32 Provisioner::StartWorkers (void* (*worker) (void*), uint32 jobs)
+{
+	// Never start more threads than jobs
+	std::vector<pthread_t> threads (mThreads < jobs ? mThreads : jobs);
+
+	for (uint32 i = 0; i < threads.size(); ++i)
+		pthread_create (&threads[i], null, worker, this);
+
+	for (uint32 i = 0; i < threads.size(); ++i)
+		pthread_join (threads[i], null);
+
+	return threads.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Takes the next job, returns false once none remain. </summary>
+
+bool Provisioner::NextJob (uint32& job)
+{
+	pthread_mutex_lock (&mMutex);
+	bool result = mNext < mFiles->size();
+	if (result) job = mNext++;
+	pthread_mutex_unlock (&mMutex);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Prints the progress after a job has finished. </summary>
+
+void Provisioner::Report (uint32 job, uint64 elapsed, const char* error)
+{
+	pthread_mutex_lock (&mMutex);
+
+	++mDone;
+	if (error != null) ++mFailed;
+
+	printf ("[%u/%u] %s: %.1f ms%s%s\n", mDone, (uint32) mFiles->size(),
+		(*mFiles)[job].c_str(), elapsed / 1000000.0, error != null ?
+		" - " : "", error != null ? error : "");
+
+	fflush (stdout);
+	pthread_mutex_unlock (&mMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Entropy callback shared by the generator of every worker. </summary>
+/// <remarks> The PolarSSL entropy pool is not thread safe by itself. </remarks>
+
+int Provisioner::SharedEntropy (void* parameters, uint8* output, size_t length)
+{
+	Provisioner* provisioner = (Provisioner*) parameters;
+
+	pthread_mutex_lock (&provisioner->mEntropyMutex);
+	int result = entropy_func (&provisioner->mEntropy, output, length);
+	pthread_mutex_unlock (&provisioner->mEntropyMutex);
+
+	return result;
+}
@@ -0,0 +1,124 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef PROVISIONER_H
+#define PROVISIONER_H
+
+#include "Bundle.h"
+#include "Identity.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates and signs identities for many files on a pool of threads. </summary>
+/// <remarks>
+///   Every worker owns a CTR_DRBG which is seeded from one shared entropy
+///   source, so the expensive prime generation runs without any locking.
+///   When signing, one thread reads and one thread writes files while the
+///   workers share the authority key read-only. Bundles are processed
+///   the same way but read from the mapping and written back at once.
+///   Progress and the time spent on every key are printed as they finish.
+/// </remarks>
+
+class Provisioner
+{
+	friend void* CreateWorker (void* parameters);
+	friend void* SignWorker   (void* parameters);
+	friend void* ReadThread   (void* parameters);
+	friend void* WriteThread  (void* parameters);
+
+private:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents an identity moving between the signing threads. </summary>
+
+	class Job
+	{
+	public:
+		// Properties
+		uint32			Index;		// Index of the file
+		Identity		Idnt;		// Loaded identity
+		Identity::Error	Error;		// First error that occurred
+		uint64			Elapsed;	// Time spent signing
+	};
+
+public:
+	// Constructors
+	 Provisioner				(void);
+	~Provisioner				(void);
+
+private:
+	Provisioner					(const Provisioner& provisioner) { }
+
+public:
+	// Methods
+	uint32		Create			(uint16 length,
+								 const std::vector<std::string>& filenames);
+	uint32		Sign			(Identity& authority,
+								 const std::vector<std::string>& filenames);
+
+	uint32		CreateBundle	(uint16 length, const std::string& filename,
+								 const std::vector<std::string>& names);
+	uint32		SignBundle		(Identity& authority, const std::string& filename);
+
+	uint32		GetThreads		(void) const;
+	void		SetThreads		(uint32 threads);
+
+private:
+	// Internal
+	uint32		StartWorkers	(void* (*worker) (void*), uint32 jobs);
+	bool		NextJob			(uint32& job);
+	void		Report			(uint32 job, uint64 elapsed, const char* error);
+
+	static int	SharedEntropy	(void* parameters, uint8* output, size_t length);
+
+private:
+	// Fields
+	uint32		mThreads;		// Number of worker threads
+	uint16		mLength;		// Key length in bits
+
+	const std::vector<std::string>* mFiles;	// Files being processed
+	uint32		mNext;			// Next file to process
+	uint32		mDone;			// Number of files processed
+	uint32		mFailed;		// Number of files which failed
+
+	std::vector<Identity*>* mCreated;	// Identities created for a bundle
+	Bundle*		mBundle;		// Bundle being signed
+	std::vector<Job*> mFinished;	// Signed bundle identities
+
+	Identity*	mAuthority;		// Signing identity
+	std::deque<Job*> mLoaded;	// Identities waiting to be signed
+	std::deque<Job*> mSigned;	// Identities waiting to be saved
+	bool		mReading;		// Files are still being read
+	pthread_cond_t	mLoadedCond;	// Signals loaded identities
+	pthread_cond_t	mSignedCond;	// Signals signed identities
+	pthread_cond_t	mSpaceCond;		// Signals room to load more
+
+	entropy_context	mEntropy;		// Shared entropy source
+	pthread_mutex_t	mEntropyMutex;	// Entropy synchronization
+	pthread_mutex_t	mMutex;			// Job and output synchronization
+};
+
+#endif // PROVISIONER_H
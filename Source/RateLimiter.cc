@@ -0,0 +1,211 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "RateLimiter.h"
+
+#include <cstdlib>
+#include <cstring>
+
+
+
+//----------------------------------------------------------------------------//
+// Types                                                                      //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Largest burst, so a full bucket fits its 32-bit counter. </summary>
+
+#define MAX_BURST 4000000
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                   RateLimiter //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new limiter which admits everything. </summary>
+
+RateLimiter::RateLimiter (void)
+{
+	uint32 length = sizeof (Bucket) * TableSize;
+
+	// Align the buckets to cache lines
+	void* table = null;
+	if (posix_memalign (&table, 64, length) != 0)
+		table = malloc (length);
+
+	memset (table, 0, length);
+	mTable = (Bucket*) table;
+
+	mRate  = 0;
+	mBurst = 0;
+
+	mBudget     = 0;
+	mBudgetTime = 0;
+	mBudgetRate = 0;
+
+	pthread_mutex_init (&mMutex, null);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Deletes the limiter. </summary>
+
+RateLimiter::~RateLimiter (void)
+{
+	pthread_mutex_destroy (&mMutex);
+	free (mTable);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                        RateLimiter //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the tokens per second and the burst of every source. </summary>
+/// <remarks> A rate of zero admits every source. Buckets start full and
+///           existing buckets keep their tokens. </remarks>
+
+void RateLimiter::SetSourceRate (uint32 rate, uint32 burst)
+{
+	pthread_mutex_lock (&mMutex);
+
+	mRate  = rate;
+	mBurst = burst == 0 ? 1 : burst > MAX_BURST ? MAX_BURST : burst;
+
+	pthread_mutex_unlock (&mMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sets the microseconds of cryptography allowed per second. </summary>
+/// <remarks> A tenth of a second of the budget may be spent at once, a
+///           budget of zero is unlimited. </remarks>
+
+void RateLimiter::SetBudget (uint32 budget)
+{
+	pthread_mutex_lock (&mMutex);
+
+	mBudgetRate = budget;
+	mBudget     = budget / 10;
+	mBudgetTime = 0;
+
+	pthread_mutex_unlock (&mMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Takes a token from the bucket of the source. </summary>
+/// <remarks> Returns false if the source is over its rate. The time is
+///           the current monotonic time in microseconds. </remarks>
+
+bool RateLimiter::Admit (const Address& source, uint64 now)
+{
+	if (mRate == 0) return true;
+
+	const uint8* d = source.Data;
+	uint64 key = (uint64) d[0] << 40 | (uint64) d[1] << 32 |
+				 (uint64) d[2] << 24 | (uint64) d[3] << 16 |
+				 (uint64) d[4] <<  8 | (uint64) d[5] | 1ULL << 63;
+
+	// Probe the buckets of one group, starting at its beginning
+	uint32 group = (uint32) ((key * 0x9E3779B97F4A7C15ULL) >> 55);
+	Bucket* first = mTable + (group * ProbeLength) % TableSize;
+	uint32 stamp = (uint32) (now / 1000);
+
+	pthread_mutex_lock (&mMutex);
+
+	Bucket* bucket = null;
+	Bucket* oldest = first;
+
+	for (uint32 i = 0; i < ProbeLength; ++i)
+	{
+		if (first[i].Key == key) { bucket = &first[i]; break; }
+
+		// Buckets are never freed, so the source is not further on
+		if (first[i].Key == 0) { oldest = &first[i]; break; }
+
+		if ((int32) (first[i].Stamp - oldest->Stamp) < 0)
+			oldest = &first[i];
+	}
+
+	// Give new sources a full bucket, replacing the longest idle
+	if (bucket == null)
+	{
+		bucket = oldest;
+		bucket->Key    = key;
+		bucket->Tokens = mBurst * 1000;
+		bucket->Stamp  = stamp;
+	}
+
+	// Refill a thousandth of a token per millisecond for every token per second
+	uint64 tokens = bucket->Tokens + (uint64) (stamp - bucket->Stamp) * mRate;
+	if (tokens > mBurst * 1000) tokens = mBurst * 1000;
+	bucket->Stamp = stamp;
+
+	bool result = tokens >= 1000;
+	bucket->Tokens = (uint32) (result ? tokens - 1000 : tokens);
+
+	pthread_mutex_unlock (&mMutex);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if the crypto budget is not exhausted. </summary>
+/// <remarks> The time is the current monotonic time in microseconds. </remarks>
+
+bool RateLimiter::HasBudget (uint64 now)
+{
+	if (mBudgetRate == 0) return true;
+
+	pthread_mutex_lock (&mMutex);
+
+	// Refill at most a second worth of budget
+	if (now - mBudgetTime > 1000000)
+		mBudgetTime = now - 1000000;
+
+	// Leave the time of a partial microsecond for the next refill
+	uint64 gained = (now - mBudgetTime) * mBudgetRate / 1000000;
+	mBudgetTime += gained * 1000000 / mBudgetRate;
+
+	mBudget += (int64) gained;
+	if (mBudget > mBudgetRate / 10)
+		mBudget = mBudgetRate / 10;
+
+	bool result = mBudget > 0;
+
+	pthread_mutex_unlock (&mMutex);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Charges the microseconds an operation took to the budget. </summary>
+/// <remarks> The budget may run a second into debt, which later
+///           operations then wait out. </remarks>
+
+void RateLimiter::Charge (uint64 cost)
+{
+	if (mBudgetRate == 0) return;
+
+	pthread_mutex_lock (&mMutex);
+
+	mBudget -= (int64) cost;
+	if (mBudget < -(int64) mBudgetRate)
+		mBudget = -(int64) mBudgetRate;
+
+	pthread_mutex_unlock (&mMutex);
+}
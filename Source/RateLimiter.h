@@ -0,0 +1,93 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include "Address.h"
+#include <pthread.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Limits the rate of frames per source and the time spent on
+///           cryptography. </summary>
+/// <remarks>
+///   Every source owns a token bucket in a fixed table of 16-byte
+///   buckets, found by hashing the address and probing a few adjacent
+///   buckets which share a cache line or two. When the probed buckets
+///   are all taken the one idle the longest is reused, so the table
+///   never grows however many sources are seen. The crypto budget is a
+///   single bucket of microseconds which operations are charged after
+///   they ran. Every method is thread safe.
+/// </remarks>
+
+class RateLimiter
+{
+private:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents the token bucket of a single source. </summary>
+
+	class Bucket
+	{
+	public:
+		// Properties
+		uint64		Key;		// Packed address, zero when unused
+		uint32		Tokens;		// Thousandths of a token left
+		uint32		Stamp;		// Millisecond of the last refill
+	};
+
+public:
+	// Constants
+	static const uint32 TableSize   = 4096;	// Buckets in the table
+	static const uint32 ProbeLength = 8;	// Buckets probed per source
+
+public:
+	// Constructors
+	 RateLimiter				(void);
+	~RateLimiter				(void);
+
+private:
+	RateLimiter					(const RateLimiter& limiter) { }
+
+public:
+	// Methods
+	void		SetSourceRate	(uint32 rate, uint32 burst);
+	void		SetBudget		(uint32 budget);
+
+	bool		Admit			(const Address& source, uint64 now);
+	bool		HasBudget		(uint64 now);
+	void		Charge			(uint64 cost);
+
+private:
+	// Fields
+	Bucket*		mTable;			// Buckets of every source
+	uint32		mRate;			// Tokens per second, zero is unlimited
+	uint32		mBurst;			// Tokens a bucket holds at most
+
+	int64		mBudget;		// Microseconds of cryptography left
+	uint64		mBudgetTime;	// Microsecond of the last refill
+	uint32		mBudgetRate;	// Microseconds per second, zero is unlimited
+
+	pthread_mutex_t	mMutex;		// Table and budget synchronization
+};
+
+#endif // RATE_LIMITER_H
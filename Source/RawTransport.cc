@@ -0,0 +1,246 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "RawTransport.h"
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                  RawTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new closed transport. </summary>
+
+RawTransport::RawTransport (void)
+{
+	mMTU         = 0;
+	mSocketID    = -1;
+	mIfIndex     = 0;
+	mDestLength  = 0;
+
+	mBuffers     = null;
+	mFrameLength = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes the transport. </summary>
+
+RawTransport::~RawTransport (void)
+{
+	Close();
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                       RawTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Binds a promiscuous raw socket to the interface. </summary>
+
+Transport::Error RawTransport::Open (const std::string& interface)
+{
+	Close();
+
+	// Create device level socket
+	mSocketID = socket (PF_PACKET, SOCK_RAW, htons (ETH_P_ALL));
+		// PF_PACKET - Packet interface on device level
+		// SOCK_RAW  - Raw packets including link level header
+		// ETH_P_ALL - All frames will be received
+
+	if (mSocketID < 0)
+		return ERROR_OPEN_SOCK;
+
+	// Fetch interface information
+	ifreq ifr;
+
+	// Copy the specified interface name
+	strncpy (ifr.ifr_name, interface.c_str(), IFNAMSIZ - 1);
+	ifr.ifr_name[IFNAMSIZ - 1] = 0;
+
+	// Retrieve the interface index
+	if (ioctl (mSocketID, SIOGIFINDEX, &ifr) < 0)
+		return ERROR_GET_IFINDEX;
+
+	mIfIndex   = ifr.ifr_ifindex;
+	mInterface = ifr.ifr_name;
+
+	// Retrieve the hardware address
+	if (ioctl (mSocketID, SIOCGIFHWADDR, &ifr) < 0)
+		return ERROR_GET_ADDRESS;
+
+	memcpy (&mAddress.Data, &ifr.ifr_hwaddr.sa_data, Address::Length);
+
+	// Retrieve the maximum transmission unit
+	if (ioctl (mSocketID, SIOCGIFMTU, &ifr) < 0)
+		return ERROR_GET_MTU;
+
+	mMTU = ifr.ifr_mtu;
+
+	// Add promiscuous mode
+	packet_mreq mr;
+	memset (&mr, 0, sizeof (mr));
+
+	mr.mr_ifindex = mIfIndex;
+	mr.mr_type    = PACKET_MR_PROMISC;
+
+	if (setsockopt (mSocketID, SOL_PACKET,
+		PACKET_ADD_MEMBERSHIP, (char*) &mr, sizeof (mr)) < 0)
+		return ERROR_ADD_PROM;
+
+	// Bind the socket to the interface
+	sockaddr_ll sll;
+	memset (&sll, 0, sizeof (sll));
+
+	sll.sll_family   = AF_PACKET;
+	sll.sll_ifindex  = mIfIndex;
+	sll.sll_protocol = htons (ETH_P_ALL);
+
+	if (bind (mSocketID, (sockaddr*) &sll, sizeof (sll)) < 0)
+		return ERROR_BIND_SOCK;
+
+	// Create a destination packet
+	mDestLength = sizeof (mDest);
+	memset (&mDest, 0, mDestLength);
+
+	mDest.sll_family  = AF_PACKET;
+	mDest.sll_pkttype = PACKET_BROADCAST;
+	mDest.sll_ifindex = mIfIndex;
+
+	mDest.sll_halen = Address::Length;
+	memset (mDest.sll_addr, 255, Address::Length);
+
+	// Frames carry the link header on top of the MTU
+	mFrameLength = mMTU + sizeof (ether_header);
+	mBuffers = new uint8[mFrameLength * MaxBatch];
+
+	return ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes the socket and releases the receive buffers. </summary>
+
+void RawTransport::Close (void)
+{
+	if (mSocketID != -1)
+		close (mSocketID);
+
+	delete[] mBuffers;
+
+	mSocketID    = -1;
+	mBuffers     = null;
+	mFrameLength = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Receives up to count pending frames without blocking. </summary>
+
+uint32 RawTransport::Receive (uint32 count, Frame* frames)
+{
+	if (count > MaxBatch) count = MaxBatch;
+
+	mmsghdr messages[MaxBatch];
+	iovec   vectors [MaxBatch];
+	sockaddr_ll from[MaxBatch];
+
+	for (uint32 i = 0; i < count; ++i)
+	{
+		vectors[i].iov_base = mBuffers + i * mFrameLength;
+		vectors[i].iov_len  = mFrameLength;
+
+		memset (&messages[i], 0, sizeof (mmsghdr));
+		messages[i].msg_hdr.msg_iov     = &vectors[i];
+		messages[i].msg_hdr.msg_iovlen  = 1;
+		messages[i].msg_hdr.msg_name    = &from[i];
+		messages[i].msg_hdr.msg_namelen = sizeof (sockaddr_ll);
+	}
+
+	int32 result = recvmmsg (mSocketID, messages, count, MSG_DONTWAIT, null);
+	if (result <= 0) return 0;
+
+	for (int32 i = 0; i < result; ++i)
+	{
+		frames[i].Data     = mBuffers + i * mFrameLength;
+		frames[i].Length   = messages[i].msg_len;
+		frames[i].Outgoing = from[i].sll_pkttype == PACKET_OUTGOING;
+	}
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Broadcasts the frame on the interface. </summary>
+/// <remarks> Every neighbor shares the medium, so the next hop is ignored. </remarks>
+
+bool RawTransport::Send (const Address& next, uint32 length, const uint8* buffer)
+{
+	return sendto (mSocketID, buffer, length, 0,
+		(sockaddr*) &mDest, mDestLength) >= 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the frames the wireless link failed to deliver. </summary>
+/// <remarks> Sums the retry and miscellaneous failures the driver counts
+///           in /proc/net/wireless since it loaded. Wired interfaces are
+///           not listed there and report no loss. </remarks>
+
+uint64 RawTransport::GetLinkLosses (void)
+{
+	FILE* file = fopen ("/proc/net/wireless", "r");
+	if (file == null) return 0;
+
+	uint64 result = 0;
+	char line[256];
+
+	// Lines look like "wlan0: 0000 70. -40. -256 0 0 0 12 34 0"
+	while (fgets (line, sizeof (line), file) != null)
+	{
+		char* name = line;
+		while (*name == ' ') ++name;
+
+		char* colon = strchr (name, ':');
+		if (colon == null) continue;
+		*colon = 0;
+
+		if (mInterface != name) continue;
+
+		char status[16], link[16], level[16], noise[16];
+		unsigned long long nwid, crypt, frag, retry, misc;
+
+		if (sscanf (colon + 1, "%15s %15s %15s %15s %llu %llu %llu %llu %llu",
+			status, link, level, noise, &nwid, &crypt, &frag, &retry, &misc) == 9)
+			result = retry + misc;
+		break;
+	}
+
+	fclose (file);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the MAC address of the interface. </summary>
+
+const Address& RawTransport::GetAddress (void) const
+{
+	return mAddress;
+}
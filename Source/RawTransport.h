@@ -0,0 +1,82 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef RAW_TRANSPORT_H
+#define RAW_TRANSPORT_H
+
+#include "Transport.h"
+
+#include <netinet/in.h>
+#include <netpacket/packet.h>
+#include <net/ethernet.h>
+#include <sys/socket.h>
+
+#include <linux/if.h>
+#include <sys/ioctl.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sends and receives Ethernet frames on a single interface. </summary>
+/// <remarks> Every frame is broadcast, the interface is promiscuous so
+///           frames sent by this host are received as well. Requires
+///           root privileges. </remarks>
+
+class RawTransport : public Transport
+{
+public:
+	// Constructors
+	 RawTransport				(void);
+	~RawTransport				(void);
+
+private:
+	RawTransport				(const RawTransport& transport) { }
+
+public:
+	// Methods
+	Error			Open		(const std::string& interface);
+	void			Close		(void);
+
+	uint32			Receive		(uint32 count, Frame* frames);
+	bool			Send		(const Address& next,
+								 uint32 length, const uint8* buffer);
+
+	uint64			GetLinkLosses	(void);
+
+	const Address&	GetAddress	(void) const;
+
+protected:
+	// Fields
+	std::string		mInterface;		// Interface name
+	Address			mAddress;		// Local MAC address
+
+	int32			mMTU;			// Socket MTU
+	int32			mSocketID;		// Socket descriptor
+	int32			mIfIndex;		// Interface index
+
+	sockaddr_ll		mDest;			// Destination
+	uint8			mDestLength;	// Destination length
+
+	uint8*			mBuffers;		// Receive buffers
+	uint32			mFrameLength;	// Length of every receive buffer
+};
+
+#endif // RAW_TRANSPORT_H
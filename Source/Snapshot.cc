@@ -0,0 +1,270 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "CRC32.h"
+#include "Snapshot.h"
+
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <endian.h>
+#include <unistd.h>
+
+using std::string;
+
+
+
+//----------------------------------------------------------------------------//
+// Types                                                                      //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Magic and version at the start of every snapshot. </summary>
+
+#define SNAPSHOT_MAGIC "ORPS"
+#define SNAPSHOT_VERSION 1
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Length of the fixed header. </summary>
+
+#define HEADER_LENGTH (4 + 2 + 4 + 4 + 8 + 4)
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Appends a little-endian 32-bit value. </summary>
+
+static void Write32 (string& output, uint32 value)
+{
+	value = htole32 (value);
+	output.append ((const char*) &value, sizeof (uint32));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reads a little-endian 32-bit value and advances the offset. </summary>
+
+static uint32 Read32 (const uint8* data, uint32& offset)
+{
+	uint32 value;
+	memcpy (&value, data + offset, sizeof (uint32));
+	offset += sizeof (uint32);
+	return le32toh (value);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                      Snapshot //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new empty snapshot. </summary>
+
+Snapshot::Snapshot (void)
+{
+	Authority = 0;
+	KeyLength = 0;
+	Created   = 0;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                           Snapshot //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Loads the snapshot from the file. </summary>
+/// <remarks> Fails unless the snapshot was taken under the same authority
+///           and key length, or if it is older than maxAge seconds. </remarks>
+
+Snapshot::Error Snapshot::Load (const string& filename,
+	uint32 authority, uint32 keyLength, uint32 maxAge)
+{
+	Entries.clear();
+
+	// Read the whole file
+	FILE* file = fopen (filename.c_str(), "rb");
+	if (file == null) return ERROR_FILE_OPEN;
+
+	string buffer;
+	char chunk[4096];
+	size_t read;
+
+	while ((read = fread (chunk, 1, sizeof (chunk), file)) > 0)
+		buffer.append (chunk, read);
+
+	fclose (file);
+
+	const uint8* data = (const uint8*) buffer.data();
+	uint32 length = buffer.length();
+
+	if (length < HEADER_LENGTH + sizeof (uint32) ||
+		memcmp (data, SNAPSHOT_MAGIC, 4) != 0)
+		return ERROR_BAD_FORMAT;
+
+	// Verify the trailing checksum
+	length -= sizeof (uint32);
+	uint32 offset = length;
+
+	CRC32 crc;
+	crc.Add (length, data);
+	if (crc.Value != Read32 (data, offset))
+		return ERROR_CHECKSUM;
+
+	uint16 version;
+	memcpy (&version, data + 4, sizeof (uint16));
+	if (le16toh (version) != SNAPSHOT_VERSION)
+		return ERROR_BAD_FORMAT;
+
+	offset = 6;
+	Authority = Read32 (data, offset);
+	KeyLength = Read32 (data, offset);
+
+	uint64 created;
+	memcpy (&created, data + offset, sizeof (uint64));
+	Created = le64toh (created); offset += sizeof (uint64);
+
+	uint32 count = Read32 (data, offset);
+
+	if (Authority != authority || KeyLength != keyLength)
+		return ERROR_MISMATCH;
+
+	if (Created + maxAge < (uint64) time (null))
+		return ERROR_EXPIRED;
+
+	// Read every entry, checking each fits the file
+	for (uint32 i = 0; i < count; ++i)
+	{
+		if (length - offset < Address::Length + 3 * sizeof (uint32))
+			{ Entries.clear(); return ERROR_BAD_FORMAT; }
+
+		Entry entry;
+		memcpy (entry.Addr.Data, data + offset, Address::Length);
+		offset += Address::Length;
+
+		entry.Link  = Read32 (data, offset);
+		entry.Token = Read32 (data, offset);
+		uint32 path = Read32 (data, offset);
+
+		if ((uint64) path * Address::Length + KeyLength > length - offset)
+			{ Entries.clear(); return ERROR_BAD_FORMAT; }
+
+		Address address;
+		for (uint32 j = 0; j < path; ++j)
+		{
+			memcpy (address.Data, data + offset, Address::Length);
+			entry.Addresses.push_back (address);
+			offset += Address::Length;
+		}
+
+		entry.Key.assign (data + offset, data + offset + KeyLength);
+		offset += KeyLength;
+
+		Entries.push_back (entry);
+	}
+
+	return ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Saves the snapshot to the file. </summary>
+/// <remarks> The snapshot is written to a temporary file which then
+///           replaces the file, so readers never see a partial one. </remarks>
+
+Snapshot::Error Snapshot::Save (const string& filename) const
+{
+	string buffer (SNAPSHOT_MAGIC);
+
+	uint16 version = htole16 (SNAPSHOT_VERSION);
+	buffer.append ((const char*) &version, sizeof (uint16));
+
+	Write32 (buffer, Authority);
+	Write32 (buffer, KeyLength);
+
+	uint64 created = htole64 (Created);
+	buffer.append ((const char*) &created, sizeof (uint64));
+	Write32 (buffer, Entries.size());
+
+	for (uint32 i = 0; i < Entries.size(); ++i)
+	{
+		const Entry& entry = Entries[i];
+		buffer.append ((const char*) entry.Addr.Data, Address::Length);
+
+		Write32 (buffer, entry.Link);
+		Write32 (buffer, entry.Token);
+		Write32 (buffer, entry.Addresses.size());
+
+		for (std::list<Address>::const_iterator j = entry.
+			Addresses.begin(); j != entry.Addresses.end(); ++j)
+			buffer.append ((const char*) j->Data, Address::Length);
+
+		// Keys are padded to the common length
+		string key (KeyLength, 0);
+		if (entry.Key.size() <= KeyLength && !entry.Key.empty())
+			memcpy (&key[KeyLength - entry.Key.size()], &entry.Key[0], entry.Key.size());
+
+		buffer.append (key);
+	}
+
+	CRC32 crc;
+	crc.Add (buffer.length(), (const uint8*) buffer.data());
+	Write32 (buffer, crc.Value);
+
+	// Attempt to open the temporary file
+	string temporary = filename + ".tmp";
+	FILE* file = fopen (temporary.c_str(), "wb");
+	if (file == null) return ERROR_FILE_OPEN;
+
+	// Reach the disk before replacing the original file
+	bool written = fwrite (buffer.data(), 1, buffer.length(), file) == buffer.length();
+	written = fflush (file) == 0 && fsync (fileno (file)) == 0 && written;
+	written = fclose (file) == 0 && written;
+
+	if (!written || rename (temporary.c_str(), filename.c_str()) != 0)
+		{ unlink (temporary.c_str()); return ERROR_FILE_WRITE; }
+
+	return ERROR_NONE;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Static                                                            Snapshot //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the string representation of a specified error. </summary>
+
+string Snapshot::ErrorString (Error error)
+{
+	switch (error)
+	{
+		case ERROR_NONE			: return "";
+		case ERROR_FILE_OPEN	: return "Failed to open the snapshot";
+		case ERROR_FILE_WRITE	: return "Failed to write the snapshot";
+		case ERROR_BAD_FORMAT	: return "The snapshot is malformed";
+		case ERROR_CHECKSUM		: return "The snapshot checksum does not match";
+		case ERROR_MISMATCH		: return "The snapshot belongs to another authority";
+		case ERROR_EXPIRED		: return "The snapshot is too old";
+		default					: return "Unknown error occurred";
+	}
+}
@@ -0,0 +1,101 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "Address.h"
+
+#include <list>
+#include <string>
+#include <vector>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> A saved copy of the neighbor table of a router. </summary>
+/// <remarks>
+///   Files begin with SNAPSHOT_MAGIC followed by a little-endian 16-bit
+///   version, the CRC32 of the authority key, the key length, the time
+///   of the snapshot in seconds since the epoch and the entry count.
+///   Every entry is the address, link, token checksum, path length and
+///   path of a node followed by its public key. A little-endian CRC32 of
+///   everything before it follows. Keys were verified by the authority
+///   before they were saved, so they are trusted when loaded.
+/// </remarks>
+
+class Snapshot
+{
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of possible errors. </summary>
+
+	enum Error
+	{
+		ERROR_NONE = 0,
+		ERROR_FILE_OPEN,
+		ERROR_FILE_WRITE,
+		ERROR_BAD_FORMAT,
+		ERROR_CHECKSUM,
+		ERROR_MISMATCH,
+		ERROR_EXPIRED,
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single saved node. </summary>
+
+	class Entry
+	{
+	public:
+		// Properties
+		Address		Addr;			// Node address
+		uint32		Link;			// Interface it was heard on
+		uint32		Token;			// CRC32 of its signed token
+		std::vector<uint8> Key;		// Public modulus, big-endian
+
+		// List of addresses in path
+		std::list<Address> Addresses;
+	};
+
+public:
+	// Constructors
+	Snapshot				(void);
+
+public:
+	// Methods
+	Error		Load		(const std::string& filename, uint32 authority,
+							 uint32 keyLength, uint32 maxAge);
+	Error		Save		(const std::string& filename) const;
+
+public:
+	// Static
+	static std::string ErrorString (Error error);
+
+public:
+	// Properties
+	uint32		Authority;		// CRC32 of the authority key
+	uint32		KeyLength;		// Length of every key
+	uint64		Created;		// Seconds since the epoch
+
+	std::vector<Entry> Entries;	// Saved nodes
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,315 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Clock.h"
+#include "Statistics.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <pthread.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Types                                                                      //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Number of slots owned by a single thread. </summary>
+/// <remarks> One more slot is shared by any remaining threads. </remarks>
+
+#define MAX_SLOTS 64
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Number of values in a slot, padded to whole cache lines. </summary>
+
+#define SLOT_LENGTH ((Statistics::COUNTER_COUNT + 7) & ~7)
+
+
+
+//----------------------------------------------------------------------------//
+// Threading                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Number of indices that have ever been assigned. </summary>
+
+static uint32 ThreadCount = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Index of the calling thread, zero if not yet assigned. </summary>
+
+static __thread uint32 ThreadIndex = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Indices given back by exited threads. </summary>
+
+static uint32 FreeSlots[MAX_SLOTS];
+static uint32 FreeCount = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Every live set of counters, so exiting threads can retire
+///           their slot in each of them. </summary>
+
+static Statistics* Instances = null;
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Guards the indices, the instances and retiring slots. </summary>
+
+static pthread_mutex_t SlotMutex = PTHREAD_MUTEX_INITIALIZER;
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Calls RetireSlot when a thread holding a slot exits. </summary>
+
+static pthread_key_t  SlotKey;
+static pthread_once_t SlotOnce = PTHREAD_ONCE_INIT;
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Folds the slot of an exiting thread into the shared slot of
+///           every set of counters and frees it for the next thread. </summary>
+
+void RetireSlot (void* slot)
+{
+	uint32 index = (uint32) (uintptr_t) slot;
+
+	pthread_mutex_lock (&SlotMutex);
+
+	for (Statistics* i = Instances; i != null; i = i->mNext)
+	{
+		uint64* owned  = i->mSlots + (index - 1) * SLOT_LENGTH;
+		uint64* shared = i->mSlots + MAX_SLOTS   * SLOT_LENGTH;
+
+		for (uint32 c = 0; c < Statistics::COUNTER_COUNT; ++c)
+		{
+			__atomic_fetch_add (shared + c, owned[c], __ATOMIC_RELAXED);
+			__atomic_store_n   (owned  + c, 0,        __ATOMIC_RELAXED);
+		}
+	}
+
+	FreeSlots[FreeCount++] = index;
+	pthread_mutex_unlock (&SlotMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates the key which retires the slot of exiting threads. </summary>
+
+static void CreateSlotKey (void)
+{
+	pthread_key_create (&SlotKey, RetireSlot);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                    Statistics //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new set of counters initialized to zero. </summary>
+
+Statistics::Statistics (void)
+{
+	uint32 length = sizeof (uint64) * SLOT_LENGTH * (MAX_SLOTS + 1);
+
+	// Align the slots to cache lines
+	void* slots = null;
+	if (posix_memalign (&slots, 64, length) != 0)
+		slots = malloc (length);
+
+	memset (slots, 0, length);
+
+	mSlots = (uint64*) slots;
+
+	pthread_mutex_lock (&SlotMutex);
+	mNext = Instances;
+	Instances = this;
+	pthread_mutex_unlock (&SlotMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Deletes the counters. </summary>
+
+Statistics::~Statistics (void)
+{
+	pthread_mutex_lock (&SlotMutex);
+
+	Statistics** link = &Instances;
+	while (*link != this) link = &(*link)->mNext;
+	*link = mNext;
+
+	pthread_mutex_unlock (&SlotMutex);
+	free (mSlots);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                         Statistics //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Adds the value to the specified counter. </summary>
+
+void Statistics::Add (Counter counter, uint64 value)
+{
+	// Assign an index to new threads, reusing those of exited threads
+	if (ThreadIndex == 0)
+	{
+		pthread_once (&SlotOnce, CreateSlotKey);
+		pthread_mutex_lock (&SlotMutex);
+
+		ThreadIndex = FreeCount > 0 ?
+			FreeSlots[--FreeCount] : ++ThreadCount;
+
+		pthread_mutex_unlock (&SlotMutex);
+
+		if (ThreadIndex <= MAX_SLOTS)
+			pthread_setspecific (SlotKey, (void*) (uintptr_t) ThreadIndex);
+	}
+
+	if (ThreadIndex <= MAX_SLOTS)
+	{
+		// Only this thread writes to the slot
+		uint64* slot = mSlots + (ThreadIndex - 1) * SLOT_LENGTH + counter;
+		__atomic_store_n (slot, __atomic_load_n
+			(slot, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+	}
+
+	else
+	{
+		// Shared by every remaining thread
+		uint64* slot = mSlots + MAX_SLOTS * SLOT_LENGTH + counter;
+		__atomic_fetch_add (slot, value, __ATOMIC_RELAXED);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sums the counters of every slot into the snapshot. </summary>
+/// <remarks> Gauges of the snapshot are left untouched. </remarks>
+
+void Statistics::Read (Snapshot& snapshot) const
+{
+	// Slots being retired would be counted twice or not at all
+	pthread_mutex_lock (&SlotMutex);
+
+	for (uint32 c = 0; c < COUNTER_COUNT; ++c)
+	{
+		uint64 total = 0;
+
+		for (uint32 i = 0; i <= MAX_SLOTS; ++i)
+			total += __atomic_load_n (mSlots + i *
+				SLOT_LENGTH + c, __ATOMIC_RELAXED);
+
+		snapshot.Counters[c] = total;
+	}
+
+	pthread_mutex_unlock (&SlotMutex);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Records the time elapsed since start for the stage. </summary>
+/// <remarks> The start time must be taken with Clock::Now. </remarks>
+
+void Statistics::Record (Stage stage, uint64 start)
+{
+	mLatency[stage].Record (Clock::Now() - start);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Resets the latency histograms of every stage. </summary>
+
+void Statistics::ResetLatency (void)
+{
+	for (uint32 i = 0; i < STAGE_COUNT; ++i)
+		mLatency[i].Reset();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the latency histogram in nanoseconds of a stage. </summary>
+
+const Histogram& Statistics::GetLatency (Stage stage) const
+{
+	return mLatency[stage];
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Static                                                          Statistics //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the display name of a specified counter. </summary>
+
+const char* Statistics::GetName (Counter counter)
+{
+	switch (counter)
+	{
+		case RX_FRAMES				: return "RX Frames";
+		case RX_BYTES				: return "RX Bytes";
+		case RX_DROPPED				: return "RX Dropped";
+		case RX_BEACONS				: return "RX Beacons";
+		case RX_MESSAGES			: return "RX Messages";
+		case TX_FRAMES				: return "TX Frames";
+		case TX_BYTES				: return "TX Bytes";
+		case TX_ERRORS				: return "TX Errors";
+		case TX_BEACONS				: return "TX Beacons";
+		case TX_MESSAGES			: return "TX Messages";
+		case RSA_PUBLIC_OPS			: return "RSA Public";
+		case RSA_PRIVATE_OPS		: return "RSA Private";
+		case DECRYPT_FAILURES		: return "Decrypt Failures";
+		case CRC_REJECTS			: return "CRC Rejects";
+		case RELAYED				: return "Relayed";
+		case DELIVERED				: return "Delivered";
+		case SEGMENTS				: return "Stream Segments";
+		case INBOX_DROPS			: return "Inbox Drops";
+		case NO_ROUTE				: return "No Route";
+		case BEACON_REBROADCASTS	: return "Beacon Rebroadcasts";
+		case RX_IGNORED				: return "Frames Ignored";
+		case NEIGHBORS_EXPIRED		: return "Neighbors Expired";
+		case NEIGHBORS_RESTORED		: return "Neighbors Restored";
+		case RATE_LIMITED			: return "Rate Limited";
+		case OVER_BUDGET			: return "Over Crypto Budget";
+		case TX_QUEUE_DROPS			: return "Transmit Queue Drops";
+		case TX_PACED				: return "Frames Paced";
+		case PACER_BACKOFFS			: return "Pacer Backoffs";
+		case LINK_LOSSES			: return "Link Losses";
+		default						: return "Unknown";
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the display name of a specified stage. </summary>
+
+const char* Statistics::GetName (Stage stage)
+{
+	switch (stage)
+	{
+		case STAGE_PARSE			: return "Parse";
+		case STAGE_DECRYPT			: return "Decrypt";
+		case STAGE_VERIFY			: return "Verify";
+		case STAGE_ENCRYPT			: return "Encrypt";
+		case STAGE_SERIALIZE		: return "Serialize";
+		case STAGE_SEND				: return "Send";
+		case STAGE_FORWARD			: return "Forward";
+		default						: return "Unknown";
+	}
+}
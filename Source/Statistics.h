@@ -0,0 +1,153 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include "Types.h"
+#include "Histogram.h"
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Lock-free runtime counters of a router. </summary>
+/// <remarks>
+///   Every thread increments counters in its own cache line padded slot,
+///   so the hot path never contends or takes a lock. Slots are summed
+///   when the counters are read. Threads beyond the number of slots
+///   share a final slot using atomic additions. When a thread exits its
+///   counts are folded into the final slot and its slot is given to the
+///   next new thread, so short lived threads never use up the slots.
+/// </remarks>
+
+class Statistics
+{
+	friend void RetireSlot (void* slot);
+
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of counters. </summary>
+
+	enum Counter
+	{
+		RX_FRAMES = 0,			// Frames received
+		RX_BYTES,				// Bytes received
+		RX_DROPPED,				// Frames rejected by Deserialize
+		RX_BEACONS,				// Beacons received
+		RX_MESSAGES,			// Messages received
+
+		TX_FRAMES,				// Frames transmitted
+		TX_BYTES,				// Bytes transmitted
+		TX_ERRORS,				// Frames the socket failed to send
+		TX_BEACONS,				// Beacons originated
+		TX_MESSAGES,			// Messages originated
+
+		RSA_PUBLIC_OPS,			// RSA public operations
+		RSA_PRIVATE_OPS,		// RSA private operations
+		DECRYPT_FAILURES,		// Failed RSA private operations
+		CRC_REJECTS,			// Messages failing the CRC check
+
+		RELAYED,				// Messages relayed to the next hop
+		DELIVERED,				// Messages delivered to the inbox
+		SEGMENTS,				// Stream segments received
+		INBOX_DROPS,			// Messages lost to the inbox limit
+		NO_ROUTE,				// Sends without a path to the destination
+
+		BEACON_REBROADCASTS,	// Beacons forwarded with a longer path
+		RX_IGNORED,				// Frames from ignored addresses
+		NEIGHBORS_EXPIRED,		// Neighbors removed after their beacons stopped
+		NEIGHBORS_RESTORED,		// Neighbors loaded from a snapshot
+		RATE_LIMITED,			// Messages over the rate of their source
+		OVER_BUDGET,			// Frames dropped over the crypto budget
+		TX_QUEUE_DROPS,			// Frames lost to a full transmit queue
+		TX_PACED,				// Frames held back by the pacer
+		PACER_BACKOFFS,			// Transmit rate cuts after loss
+		LINK_LOSSES,			// Frames the link failed to deliver
+
+		COUNTER_COUNT
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of timed processing stages. </summary>
+
+	enum Stage
+	{
+		STAGE_PARSE = 0,		// Packet::Deserialize of a received frame
+		STAGE_DECRYPT,			// RSA private operation in ProcessMessage
+		STAGE_VERIFY,			// CRC check of a decrypted layer
+		STAGE_ENCRYPT,			// RSA public operation in EncryptLayered
+		STAGE_SERIALIZE,		// Packet::Serialize of an outgoing frame
+		STAGE_SEND,				// Transmission of a frame by the socket
+		STAGE_FORWARD,			// Receipt of a message until it is relayed
+
+		STAGE_COUNT
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents the counters and gauges at one point in time. </summary>
+
+	class Snapshot
+	{
+	public:
+		// Properties
+		uint64	Counters[COUNTER_COUNT];	// Summed counters
+
+		uint32	Neighbors;		// Nodes in the network
+		uint32	InboxDepth;		// Messages waiting to be received
+		uint32	SendQueue;		// Asynchronous sends waiting
+		uint32	Streams;		// Open streams
+		uint32	FrameRate;		// Paced frames per second, zero is unlimited
+		uint64	ByteRate;		// Paced bytes per second, zero is unlimited
+	};
+
+public:
+	// Constructors
+	 Statistics				(void);
+	~Statistics				(void);
+
+private:
+	Statistics				(const Statistics& statistics) { }
+
+public:
+	// Methods
+	void	Add				(Counter counter, uint64 value = 1);
+	void	Read			(Snapshot& snapshot) const;
+
+	void	Record			(Stage stage, uint64 start);
+	void	ResetLatency	(void);
+
+	const Histogram& GetLatency (Stage stage) const;
+
+public:
+	// Static
+	static const char* GetName (Counter counter);
+	static const char* GetName (Stage   stage  );
+
+private:
+	// Fields
+	uint64*	mSlots;			// Cache line aligned counter slots
+	Statistics* mNext;		// Next live set of counters
+
+	Histogram mLatency[STAGE_COUNT];	// Latency of each stage
+};
+
+#endif // STATISTICS_H
@@ -0,0 +1,844 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Clock.h"
+#include "CRC32.h"
+#include "Stream.h"
+
+#include <cstring>
+#include <netinet/in.h>
+
+using std::map;
+using std::deque;
+using std::vector;
+
+
+
+//----------------------------------------------------------------------------//
+// Types                                                                      //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> First four bytes of every stream segment. </summary>
+/// <remarks> Must not start with zero, leading zeroes are stripped on
+///           delivery. Together with the header checksum it keeps user
+///           messages from being taken for segments. </remarks>
+
+#define STREAM_MAGIC 0xA7534547
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Offset of the header checksum, which covers every byte before
+///           it. </summary>
+
+#define CHECKSUM_OFFSET 31
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Maximum number of segments in flight. </summary>
+
+#define MAX_WINDOW 256
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Maximum number of segments buffered by the sender. </summary>
+
+#define MAX_BUFFER 1024
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Retransmission timeout bounds in microseconds. </summary>
+
+#define MIN_RTO   20000
+#define MAX_RTO 4000000
+#define INIT_RTO 500000
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Maximum delay of an acknowledgement in microseconds. </summary>
+
+#define ACK_DELAY 5000
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Number of retransmissions before the stream fails. </summary>
+
+#define MAX_RETRIES 12
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Segments acknowledged after a hole to consider it lost, until
+///           reordering is measured. </summary>
+
+#define DUP_THRESHOLD 3
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Highest threshold raised by measured reordering. </summary>
+
+#define MAX_REORDER 64
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the signed distance between two sequence numbers. </summary>
+
+static int32 SeqDiff (uint32 a, uint32 b)
+{
+	return (int32) (a - b);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                     Stream::Header //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reads the header from the start of the segment. </summary>
+/// <remarks> Returns false if the message is not a stream segment. </remarks>
+
+bool Stream::Header::Read (uint32 length, const uint8* buffer)
+{
+	if (!IsSegment (length, buffer)) return false;
+
+	uint16 value16;
+	uint32 value32;
+	uint32 high;
+
+	Flags = buffer[4];
+	memcpy (&value16, buffer +  5, 2); ID     = ntohs (value16);
+	memcpy (&value32, buffer +  7, 4); Seq    = ntohl (value32);
+	memcpy (&value32, buffer + 11, 4); Ack    = ntohl (value32);
+	memcpy (&high   , buffer + 15, 4);
+	memcpy (&value32, buffer + 19, 4);
+	Sack = ((uint64) ntohl (high) << 32) | ntohl (value32);
+	memcpy (&value16, buffer + 23, 2); Window = ntohs (value16);
+	memcpy (Reply.Data, buffer + 25, Address::Length);
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Writes the header to the buffer. </summary>
+/// <remarks> The buffer must be at least Header::Length bytes. </remarks>
+
+void Stream::Header::Write (uint8* buffer) const
+{
+	uint16 value16;
+	uint32 value32;
+
+	value32 = htonl (STREAM_MAGIC); memcpy (buffer, &value32, 4);
+	buffer[4] = Flags;
+	value16 = htons (ID    ); memcpy (buffer +  5, &value16, 2);
+	value32 = htonl (Seq   ); memcpy (buffer +  7, &value32, 4);
+	value32 = htonl (Ack   ); memcpy (buffer + 11, &value32, 4);
+	value32 = htonl ((uint32) (Sack >> 32)); memcpy (buffer + 15, &value32, 4);
+	value32 = htonl ((uint32)  Sack       ); memcpy (buffer + 19, &value32, 4);
+	value16 = htons (Window); memcpy (buffer + 23, &value16, 2);
+	memcpy (buffer + 25, Reply.Data, Address::Length);
+
+	// Checksum the header so user data is not mistaken for it
+	CRC32 crc;
+	crc.Add (CHECKSUM_OFFSET, buffer);
+	value32 = htonl (crc.Value); memcpy (buffer + CHECKSUM_OFFSET, &value32, 4);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                        Stream //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new stream between the local and remote address. </summary>
+/// <remarks> The initiator immediately queues a SYN segment. </remarks>
+
+Stream::Stream (Channel* channel, const Address& local,
+				const Address& remote, uint16 id, bool initiator)
+{
+	mChannel   = channel;
+	mLocal     = local;
+	mRemote    = remote;
+	mID        = id;
+	mInitiator = initiator;
+	mState     = initiator ? STATE_CONNECTING : STATE_OPEN;
+
+	// Compute the payload length of a segment
+	uint32 length  = mChannel->GetSegmentLength (remote);
+	mSegmentLength = length > Header::Length ? length - Header::Length : 1;
+
+	mSendBase   = 0;
+	mSendNext   = 0;
+	mSendTail   = 0;
+	mRecover    = 0;
+	mPeerWindow = 1;
+	mCwnd       = 4;
+	mSsthresh   = MAX_WINDOW;
+	mReorder    = DUP_THRESHOLD;
+	mLocalFin   = false;
+
+	mUndoCwnd     = 0;
+	mUndoSsthresh = 0;
+	mUndoCount    = 0;
+
+	mSRTT        = 0;
+	mRTTVar      = 0;
+	mRTO         = INIT_RTO;
+	mClosed      = 0;
+	mRetransmits = 0;
+
+	mReadOffset = 0;
+	mRecvNext   = 0;
+	mAckPending = 0;
+	mAckTime    = 0;
+	mLastWindow = MAX_WINDOW;
+	mAckNow     = false;
+	mRemoteFin  = false;
+
+	pthread_mutex_init (&mMutex, null);
+
+	if (initiator)
+	{
+		// Queue the SYN segment
+		Segment* segment = new Segment;
+		segment->Seq   = mSendTail++;
+		segment->Flags = FLAG_SYN | FLAG_DATA;
+		mSendQueue.push_back (segment);
+
+		vector<Message*> output;
+		Pump (Clock::Micro(), output);
+		Transmit (output);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Deletes this stream and deallocates all data. </summary>
+
+Stream::~Stream (void)
+{
+	for (deque<Segment*>::iterator i = mSendQueue.
+		begin(); i != mSendQueue.end(); ++i) delete *i;
+
+	for (map<uint32, Segment*>::iterator i = mOutOfOrder.
+		begin(); i != mOutOfOrder.end(); ++i) delete i->second;
+
+	for (deque<Message*>::iterator i = mReadable.
+		begin(); i != mReadable.end(); ++i) delete *i;
+
+	pthread_mutex_destroy (&mMutex);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                             Stream //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Queues bytes to be sent on this stream. </summary>
+/// <remarks> Returns the number of bytes accepted, which may be less than
+///           the length if the send buffer is full. Does not block. </remarks>
+
+uint32 Stream::Write (uint32 length, const uint8* data)
+{
+	vector<Message*> output;
+	uint32 accepted = 0;
+
+	pthread_mutex_lock (&mMutex);
+
+	if (mState == STATE_CONNECTING || mState == STATE_OPEN)
+	{
+		// Split the data into segments
+		while (length > 0 && mSendQueue.size() < MAX_BUFFER)
+		{
+			uint32 chunk = length < mSegmentLength ? length : mSegmentLength;
+
+			Segment* segment = new Segment;
+			segment->Seq   = mSendTail++;
+			segment->Flags = FLAG_DATA;
+			segment->Data  = new Message();
+			segment->Data->Create (chunk);
+			memcpy (segment->Data->GetData(), data, chunk);
+			mSendQueue.push_back (segment);
+
+			data     += chunk;
+			length   -= chunk;
+			accepted += chunk;
+		}
+
+		Pump (Clock::Micro(), output);
+	}
+
+	pthread_mutex_unlock (&mMutex);
+
+	Transmit (output);
+	return accepted;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Reads received bytes in order from this stream. </summary>
+/// <remarks> Returns the number of bytes read, zero if none are available.
+///           Use IsEof to check whether the remote side has finished. </remarks>
+
+uint32 Stream::Read (uint32 length, uint8* data)
+{
+	vector<Message*> output;
+	uint32 result = 0;
+
+	pthread_mutex_lock (&mMutex);
+
+	while (length > 0 && !mReadable.empty())
+	{
+		Message* message = mReadable.front();
+		uint32 available = message->GetLength() - mReadOffset;
+		uint32 chunk = length < available ? length : available;
+
+		memcpy (data, message->GetData() + mReadOffset, chunk);
+		data        += chunk;
+		length      -= chunk;
+		result      += chunk;
+		mReadOffset += chunk;
+
+		// Release the consumed payload
+		if (mReadOffset == message->GetLength())
+		{
+			delete message;
+			mReadable.pop_front();
+			mReadOffset = 0;
+		}
+	}
+
+	// Let the sender know the window reopened
+	if (mLastWindow < MAX_WINDOW / 4 &&
+		GetRecvWindow() >= MAX_WINDOW / 2)
+		output.push_back (Build (0, mSendNext, null));
+
+	pthread_mutex_unlock (&mMutex);
+
+	Transmit (output);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Finishes writing, the remote side receives an end of file. </summary>
+/// <remarks> Data that was already written will still be delivered. </remarks>
+
+void Stream::Close (void)
+{
+	vector<Message*> output;
+
+	pthread_mutex_lock (&mMutex);
+
+	if (!mLocalFin && mState != STATE_FAILED)
+	{
+		// Queue the FIN segment
+		Segment* segment = new Segment;
+		segment->Seq   = mSendTail++;
+		segment->Flags = FLAG_FIN | FLAG_DATA;
+		mSendQueue.push_back (segment);
+
+		mLocalFin = true;
+		if (mState != STATE_CLOSED)
+			mState = STATE_CLOSING;
+
+		Pump (Clock::Micro(), output);
+	}
+
+	pthread_mutex_unlock (&mMutex);
+	Transmit (output);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Processes a segment received for this stream. </summary>
+
+void Stream::Deliver (const Header& header, uint32 length, const uint8* payload)
+{
+	vector<Message*> output;
+	uint64 now = Clock::Micro();
+
+	pthread_mutex_lock (&mMutex);
+
+	if (mState != STATE_FAILED)
+	{
+		ProcessAck (header, now, output);
+
+		if (header.Flags & FLAG_DATA)
+			ProcessData (header, length, payload, now);
+
+		// More of the window may have opened
+		Pump (now, output);
+
+		// Acknowledge now or let the acknowledgement be delayed
+		if (mAckNow || mAckPending >= 2)
+			output.push_back (Build (0, mSendNext, null));
+
+		UpdateState (now);
+	}
+
+	pthread_mutex_unlock (&mMutex);
+	Transmit (output);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Handles retransmission and acknowledgement timers. </summary>
+/// <remarks> Should be called periodically, every few milliseconds. </remarks>
+
+void Stream::Update (void)
+{
+	vector<Message*> output;
+	uint64 now = Clock::Micro();
+
+	pthread_mutex_lock (&mMutex);
+
+	if (mState != STATE_FAILED)
+	{
+		// Retransmit expired segments, at most one window at a time
+		uint32 budget = mCwnd < 1 ? 1 : (uint32) mCwnd;
+		uint32 inflight = mSendNext - mSendBase;
+
+		for (uint32 i = 0; i < inflight && budget > 0; ++i)
+		{
+			Segment* segment = mSendQueue[i];
+			if (segment->Sacked) continue;
+
+			uint32 shift = segment->Retries < 6 ? segment->Retries : 6;
+			uint64 timeout = mRTO << shift;
+			if (timeout > MAX_RTO) timeout = MAX_RTO;
+
+			if (now - segment->Sent < timeout) continue;
+
+			if (segment->Retries >= MAX_RETRIES)
+			{
+				mState = STATE_FAILED;
+				break;
+			}
+
+			// Collapse the window once per loss event
+			if (SeqDiff (segment->Seq, mRecover) >= 0)
+			{
+				mSsthresh = mCwnd / 2 < 2 ? 2 : mCwnd / 2;
+				mCwnd     = 1;
+				mRecover  = mSendNext;
+			}
+
+			// Timeouts are never undone
+			mUndoCwnd  = 0;
+			mUndoCount = 0;
+
+			Resend (now, segment, output);
+			--budget;
+		}
+
+		// Send any delayed acknowledgement
+		if (mAckPending > 0 && now - mAckTime >= ACK_DELAY)
+			output.push_back (Build (0, mSendNext, null));
+
+		Pump (now, output);
+		UpdateState (now);
+	}
+
+	pthread_mutex_unlock (&mMutex);
+	Transmit (output);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the current state of this stream. </summary>
+
+Stream::State Stream::GetState (void)
+{
+	pthread_mutex_lock (&mMutex);
+	State result = mState;
+	pthread_mutex_unlock (&mMutex);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns whether the remote side has finished and
+///           every received byte has been read. </summary>
+
+bool Stream::IsEof (void)
+{
+	pthread_mutex_lock (&mMutex);
+	bool result = mRemoteFin && mReadable.empty();
+	pthread_mutex_unlock (&mMutex);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of segments not yet acknowledged. </summary>
+
+uint32 Stream::GetPending (void)
+{
+	pthread_mutex_lock (&mMutex);
+	uint32 result = mSendTail - mSendBase;
+	pthread_mutex_unlock (&mMutex);
+	return result;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Static                                                              Stream //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns whether the data is a stream segment. </summary>
+/// <remarks> Segments start with a magic number and carry a checksum of
+///           their header, a user message matches both only by chance. </remarks>
+
+bool Stream::IsSegment (uint32 length, const uint8* data)
+{
+	if (length < Header::Length) return false;
+
+	uint32 value32;
+	memcpy (&value32, data, 4);
+	if (ntohl (value32) != STREAM_MAGIC) return false;
+
+	CRC32 crc;
+	crc.Add (CHECKSUM_OFFSET, data);
+	memcpy (&value32, data + CHECKSUM_OFFSET, 4);
+	return ntohl (value32) == crc.Value;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                            Stream //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Builds a segment carrying the current acknowledgement. </summary>
+
+Message* Stream::Build (uint8 flags, uint32 seq, const Message* data)
+{
+	uint32 length = data != null ? data->GetLength() : 0;
+
+	Header header;
+	header.Flags  = flags | (mInitiator ? FLAG_INIT : 0);
+	header.ID     = mID;
+	header.Seq    = seq;
+	header.Ack    = mRecvNext;
+	header.Sack   = GetSack();
+	header.Window = GetRecvWindow();
+	header.Reply  = mLocal;
+
+	Message* result = new Message();
+	result->Create (Header::Length + length);
+	header.Write (result->GetData());
+
+	if (length > 0)
+		memcpy (result->GetData() + Header::Length, data->GetData(), length);
+
+	// Every segment carries the acknowledgement
+	mLastWindow = header.Window;
+	mAckPending = 0;
+	mAckNow     = false;
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Transmits new segments while the window allows. </summary>
+
+void Stream::Pump (uint64 now, vector<Message*>& output)
+{
+	uint32 window = (uint32) mCwnd;
+	if (window > mPeerWindow) window = mPeerWindow;
+	if (window > MAX_WINDOW ) window = MAX_WINDOW;
+	if (window < 1 || mState == STATE_CONNECTING) window = 1;
+
+	while (mSendNext != mSendTail && mSendNext - mSendBase < window)
+	{
+		Segment* segment = mSendQueue[mSendNext - mSendBase];
+		segment->Sent = now;
+		output.push_back (Build (segment->Flags, segment->Seq, segment->Data));
+		++mSendNext;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Retransmits a segment that is considered lost. </summary>
+
+void Stream::Resend (uint64 now, Segment* segment, vector<Message*>& output)
+{
+	segment->Sent = now;
+	++segment->Retries;
+	++mRetransmits;
+	output.push_back (Build (segment->Flags, segment->Seq, segment->Data));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Processes the acknowledgement fields of a header. </summary>
+
+void Stream::ProcessAck (const Header& header, uint64 now, vector<Message*>& output)
+{
+	// Ignore acknowledgements for segments never sent, and stale ones
+	// overtaken by later acknowledgements, whose bitmaps are outdated
+	if (SeqDiff (header.Ack, mSendNext) > 0 ||
+		SeqDiff (header.Ack, mSendBase) < 0) return;
+
+	mPeerWindow = header.Window;
+	MeasureReorder (header, now);
+
+	// Release cumulatively acknowledged segments
+	int32 advance = SeqDiff (header.Ack, mSendBase);
+	if (advance > 0)
+	{
+		for (int32 i = 0; i < advance; ++i)
+		{
+			Segment* segment = mSendQueue.front();
+
+			// Karn's algorithm, ignore retransmitted segments
+			if (segment->Retries == 0)
+				SampleRTT (now - segment->Sent);
+
+			// Grow the congestion window
+			if (mCwnd < mSsthresh) mCwnd += 1;
+			else mCwnd += 1 / mCwnd;
+
+			delete segment;
+			mSendQueue.pop_front();
+		}
+
+		if (mCwnd > MAX_WINDOW) mCwnd = MAX_WINDOW;
+
+		mSendBase = header.Ack;
+		if (mState == STATE_CONNECTING)
+			mState = STATE_OPEN;
+	}
+
+	// Apply selective acknowledgements, bit i is sequence Ack + 1 + i
+	uint32 inflight = mSendNext - mSendBase;
+	uint32 first    = header.Ack - mSendBase + 1;
+
+	for (uint32 i = 0; i < 64 && first + i < inflight; ++i)
+		if (header.Sack & ((uint64) 1 << i))
+			mSendQueue[first + i]->Sacked = true;
+
+	// Fast retransmit holes followed by enough acknowledged segments
+	uint32 above = 0;
+	for (uint32 i = inflight; i-- > 0; )
+	{
+		Segment* segment = mSendQueue[i];
+		if (segment->Sacked) { ++above; continue; }
+		if (above < mReorder || segment->Resent) continue;
+
+		if (SeqDiff (segment->Seq, mRecover) >= 0)
+		{
+			// Remember the window in case the loss was only reordering
+			mUndoCwnd     = mCwnd;
+			mUndoSsthresh = mSsthresh;
+			mUndoCount    = 0;
+
+			mSsthresh = mCwnd / 2 < 2 ? 2 : mCwnd / 2;
+			mCwnd     = mSsthresh;
+			mRecover  = mSendNext;
+		}
+
+		if (mUndoCwnd > 0) ++mUndoCount;
+		segment->Resent = true;
+		Resend (now, segment, output);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Raises the loss threshold to the reordering the header shows. </summary>
+/// <remarks> A hole filled by its original segment after later segments
+///           were acknowledged was reordered rather than lost, and so was
+///           one acknowledged sooner than half a round trip after it was
+///           retransmitted. The window cut for a loss event is undone
+///           once all its fast retransmissions turn out spurious. Called
+///           before the header is applied. </remarks>
+
+void Stream::MeasureReorder (const Header& header, uint64 now)
+{
+	uint32 inflight = mSendNext - mSendBase;
+	uint32 first    = header.Ack - mSendBase + 1;
+
+	uint32 above = 0;
+	for (uint32 i = inflight; i-- > 0; )
+	{
+		Segment* segment = mSendQueue[i];
+		if (segment->Sacked) { ++above; continue; }
+		if (above == 0) continue;
+
+		// Whether this header acknowledges the segment for the first time
+		bool acked = i + 1 < first || (i >= first && i - first < 64 &&
+			(header.Sack & ((uint64) 1 << (i - first))));
+
+		if (!acked) continue;
+		if (segment->Retries > 0 && now - segment->Sent >= mSRTT / 2) continue;
+
+		if (mReorder < above + 1)
+			mReorder = above + 1 < MAX_REORDER ? above + 1 : MAX_REORDER;
+
+		// Restore the window once the whole loss event was reordering
+		if (segment->Resent && mUndoCount > 0 && --mUndoCount == 0)
+		{
+			if (mCwnd     < mUndoCwnd    ) mCwnd     = mUndoCwnd;
+			if (mSsthresh < mUndoSsthresh) mSsthresh = mUndoSsthresh;
+			mUndoCwnd = 0;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Processes a segment that consumes a sequence number. </summary>
+
+void Stream::ProcessData (const Header& header,
+	uint32 length, const uint8* payload, uint64 now)
+{
+	int32 offset = SeqDiff (header.Seq, mRecvNext);
+
+	// Duplicate, the acknowledgement was probably lost
+	if (offset < 0) { mAckNow = true; return; }
+
+	// Beyond the receive window
+	if (offset >= MAX_WINDOW) return;
+
+	Message* data = new Message();
+	data->Create (length);
+	if (length > 0) memcpy (data->GetData(), payload, length);
+
+	if (offset > 0)
+	{
+		// Buffer the segment until the hole is filled
+		if (mOutOfOrder.find (header.Seq) == mOutOfOrder.end())
+		{
+			Segment* segment = new Segment;
+			segment->Seq   = header.Seq;
+			segment->Flags = header.Flags;
+			segment->Data  = data;
+			mOutOfOrder[header.Seq] = segment;
+		}
+
+		else delete data;
+
+		mAckNow = true;
+		return;
+	}
+
+	Accept (header.Flags, data);
+
+	// Drain segments that are now in order
+	map<uint32, Segment*>::iterator i;
+	while ((i = mOutOfOrder.find (mRecvNext)) != mOutOfOrder.end())
+	{
+		Accept (i->second->Flags, i->second->Data);
+		i->second->Data = null;
+		delete i->second;
+		mOutOfOrder.erase (i);
+	}
+
+	// Acknowledge immediately while holes remain
+	if (!mOutOfOrder.empty() || mRemoteFin) mAckNow = true;
+	if (mAckPending++ == 0) mAckTime = now;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Appends an in order segment to the readable data. </summary>
+
+void Stream::Accept (uint8 flags, Message* data)
+{
+	++mRecvNext;
+
+	if (data->GetLength() > 0)
+		mReadable.push_back (data);
+	else delete data;
+
+	if (flags & FLAG_FIN)
+		mRemoteFin = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Updates the retransmission timeout using an RTT sample. </summary>
+
+void Stream::SampleRTT (uint64 rtt)
+{
+	if (mSRTT == 0)
+	{
+		mSRTT   = rtt;
+		mRTTVar = rtt / 2;
+	}
+
+	else
+	{
+		uint64 delta = mSRTT > rtt ? mSRTT - rtt : rtt - mSRTT;
+		mRTTVar = (3 * mRTTVar + delta) / 4;
+		mSRTT   = (7 * mSRTT   + rtt  ) / 8;
+	}
+
+	mRTO = mSRTT + 4 * mRTTVar;
+	if (mRTO < MIN_RTO) mRTO = MIN_RTO;
+	if (mRTO > MAX_RTO) mRTO = MAX_RTO;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of segments the receiver can buffer. </summary>
+
+uint16 Stream::GetRecvWindow (void) const
+{
+	uint32 used = mReadable.size() + mOutOfOrder.size();
+	return used >= MAX_WINDOW ? 0 : (uint16) (MAX_WINDOW - used);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the bitmap of segments received after a hole. </summary>
+/// <remarks> Bit i represents the segment with sequence Ack + 1 + i. </remarks>
+
+uint64 Stream::GetSack (void) const
+{
+	uint64 result = 0;
+
+	for (map<uint32, Segment*>::const_iterator i = mOutOfOrder.
+		lower_bound (mRecvNext + 1); i != mOutOfOrder.end(); ++i)
+	{
+		uint32 bit = i->first - mRecvNext - 1;
+		if (bit >= 64) break;
+		result |= (uint64) 1 << bit;
+	}
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes the stream once both sides have finished. </summary>
+
+void Stream::UpdateState (uint64 now)
+{
+	if (mState == STATE_CLOSED || mState == STATE_FAILED) return;
+
+	if (mLocalFin && mRemoteFin && mSendBase == mSendTail)
+	{
+		// Linger to acknowledge retransmitted FIN segments
+		if (mClosed == 0) mClosed = now;
+		elif (now - mClosed >= 2 * mRTO)
+			mState = STATE_CLOSED;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sends and deallocates the specified segments. </summary>
+/// <remarks> Must be called without holding the stream lock. </remarks>
+
+void Stream::Transmit (vector<Message*>& output)
+{
+	for (vector<Message*>::iterator i = output.
+		begin(); i != output.end(); ++i)
+	{
+		mChannel->Transmit (mRemote, **i);
+		delete *i;
+	}
+
+	output.clear();
+}
@@ -0,0 +1,234 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "Address.h"
+#include "Message.h"
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Represents a reliable, ordered byte stream to an address. </summary>
+/// <remarks>
+///   Bytes are split into numbered segments which are sent through a
+///   channel (usually the onion router) using a sliding window. The
+///   receiver acknowledges segments cumulatively and selectively over
+///   the reverse path and lost segments are retransmitted.
+/// </remarks>
+
+class Stream
+{
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of segment flags. </summary>
+
+	enum Flag
+	{
+		FLAG_SYN  = 0x01,			// First segment of a stream
+		FLAG_DATA = 0x02,			// Segment consumes a sequence number
+		FLAG_FIN  = 0x04,			// Last segment of a stream
+		FLAG_INIT = 0x08,			// Sent by the side that opened the stream
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of possible stream states. </summary>
+
+	enum State
+	{
+		STATE_CONNECTING = 0,		// Waiting for the first acknowledgement
+		STATE_OPEN,					// Data can be written and read
+		STATE_CLOSING,				// Local side has finished writing
+		STATE_CLOSED,				// Both sides have finished
+		STATE_FAILED,				// Too many retransmissions
+	};
+
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Transports stream segments to a remote address. </summary>
+
+	class Channel
+	{
+	public:
+		virtual ~Channel (void) { }
+
+		// Maximum length of a single segment including the header
+		virtual uint32	GetSegmentLength	(const Address& destination) = 0;
+
+		// Sends a segment to the destination, returns false on failure
+		virtual bool	Transmit			(const Address& destination,
+											 const Message& segment) = 0;
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents the header at the start of every segment. </summary>
+
+	class Header
+	{
+	public:
+		// Methods
+		bool	Read	(uint32 length, const uint8* buffer);
+		void	Write	(uint8* buffer) const;
+
+	public:
+		// Constants
+		static const uint32 Length = 35;
+
+	public:
+		// Properties
+		uint8	Flags;		// Segment flags
+		uint16	ID;			// Stream identifier
+		uint32	Seq;		// Segment sequence number
+		uint32	Ack;		// Next expected sequence number
+		uint64	Sack;		// Received segments after Ack
+		uint16	Window;		// Receive window in segments
+		Address	Reply;		// Address of the sender
+	};
+
+private:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single buffered segment. </summary>
+
+	class Segment
+	{
+	public:
+		// Constructors
+		 Segment (void) { Data = null; Sent = 0; Retries = 0; Sacked = false; Resent = false; }
+		~Segment (void) { delete Data; }
+
+	public:
+		// Properties
+		uint32		Seq;		// Sequence number
+		uint8		Flags;		// Segment flags
+		Message*	Data;		// Segment payload
+
+		uint64		Sent;		// Last transmission time
+		uint32		Retries;	// Number of retransmissions
+		bool		Sacked;		// Selectively acknowledged
+		bool		Resent;		// Fast retransmitted
+	};
+
+public:
+	// Constructors
+	 Stream					(Channel* channel, const Address& local,
+							 const Address& remote, uint16 id, bool initiator);
+	~Stream					(void);
+
+private:
+	Stream					(const Stream& stream) { }
+
+public:
+	// Methods
+	uint32		Write		(uint32 length, const uint8* data);
+	uint32		Read		(uint32 length,       uint8* data);
+	void		Close		(void);
+
+	void		Deliver		(const Header& header,
+							 uint32 length, const uint8* payload);
+	void		Update		(void);
+
+	State		GetState	(void);
+	bool		IsEof		(void);
+	uint32		GetPending	(void);
+
+	const Address& GetRemote (void) const { return mRemote;    }
+	uint16		GetID		(void) const { return mID;        }
+	bool		IsInitiator	(void) const { return mInitiator; }
+
+	uint64		GetRTT		(void) const { return mSRTT;        }
+	uint32		GetWindow	(void) const { return (uint32) mCwnd; }
+	uint32		GetRetransmits (void) const { return mRetransmits; }
+
+public:
+	// Static
+	static bool IsSegment	(uint32 length, const uint8* data);
+
+private:
+	// Internal
+	Message*	Build		(uint8 flags, uint32 seq, const Message* data);
+	void		Pump		(uint64 now, std::vector<Message*>& output);
+	void		Resend		(uint64 now, Segment* segment, std::vector<Message*>& output);
+
+	void		ProcessAck	(const Header& header, uint64 now, std::vector<Message*>& output);
+	void		ProcessData	(const Header& header, uint32 length, const uint8* payload, uint64 now);
+	void		Accept		(uint8 flags, Message* data);
+
+	void		MeasureReorder (const Header& header, uint64 now);
+	void		SampleRTT	(uint64 rtt);
+	uint16		GetRecvWindow (void) const;
+	uint64		GetSack		(void) const;
+	void		UpdateState	(uint64 now);
+
+	void		Transmit	(std::vector<Message*>& output);
+
+private:
+	// Fields
+	Channel*	mChannel;		// Segment transport
+	Address		mLocal;			// Local address
+	Address		mRemote;		// Remote address
+	uint16		mID;			// Stream identifier
+	bool		mInitiator;		// Opened locally
+	State		mState;			// Current state
+	uint32		mSegmentLength;	// Maximum payload per segment
+
+	// Sender
+	std::deque<Segment*> mSendQueue;	// Unacknowledged segments
+	uint32		mSendBase;		// Oldest unacknowledged sequence
+	uint32		mSendNext;		// Next sequence to transmit
+	uint32		mSendTail;		// Next sequence to allocate
+	uint32		mRecover;		// End of the current loss event
+	uint32		mPeerWindow;	// Window advertised by the peer
+	real32		mCwnd;			// Congestion window
+	real32		mSsthresh;		// Slow start threshold
+	uint32		mReorder;		// Acknowledged segments after a lost hole
+	real32		mUndoCwnd;		// Window before the last fast retransmit cut
+	real32		mUndoSsthresh;	// Threshold before the last fast retransmit cut
+	uint32		mUndoCount;		// Fast retransmissions not yet found spurious
+	bool		mLocalFin;		// FIN has been queued
+
+	// Timing
+	uint64		mSRTT;			// Smoothed round trip time
+	uint64		mRTTVar;		// Round trip time variance
+	uint64		mRTO;			// Retransmission timeout
+	uint64		mClosed;		// Time both sides finished
+	uint32		mRetransmits;	// Number of retransmissions
+
+	// Receiver
+	std::map<uint32, Segment*> mOutOfOrder;	// Segments after a gap
+	std::deque<Message*> mReadable;	// In order payloads
+	uint32		mReadOffset;	// Offset into the first payload
+	uint32		mRecvNext;		// Next expected sequence
+	uint32		mAckPending;	// Segments not yet acknowledged
+	uint64		mAckTime;		// Time of first unacknowledged
+	uint16		mLastWindow;	// Last advertised window
+	bool		mAckNow;		// Send an acknowledgement now
+	bool		mRemoteFin;		// FIN has been received
+
+	pthread_mutex_t	mMutex;		// Synchronization
+};
+
+#endif // STREAM_H
@@ -0,0 +1,244 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "TimerWheel.h"
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                         Timer //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new timer which is not scheduled. </summary>
+
+TimerWheel::Timer::Timer (void)
+{
+	Expire = null;
+	Owner  = null;
+	User   = null;
+
+	mPrev   = this;
+	mNext   = this;
+	mRounds = 0;
+	mWheel  = null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Cancels the timer if it is still scheduled. </summary>
+
+TimerWheel::Timer::~Timer (void)
+{
+	if (mWheel != null)
+		mWheel->Cancel (this);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                              Timer //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if the timer is scheduled on a wheel. </summary>
+
+bool TimerWheel::Timer::IsPending (void) const
+{
+	return mWheel != null;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                    TimerWheel //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new empty wheel with a resolution of 10 ms. </summary>
+
+TimerWheel::TimerWheel (void)
+{
+	mCurrent    = 0;
+	mResolution = 10000;
+	mCount      = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Cancels every timer still scheduled. </summary>
+
+TimerWheel::~TimerWheel (void)
+{
+	Reset (mResolution, 0);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                         TimerWheel //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Cancels every timer and restarts the wheel at the time. </summary>
+/// <remarks> The resolution is the length of a tick in microseconds and the
+///           time is the current monotonic time in microseconds. </remarks>
+
+void TimerWheel::Reset (uint32 resolution, uint64 now)
+{
+	for (uint32 i = 0; i < SlotCount; ++i)
+	{
+		while (mSlots[i].mNext != &mSlots[i])
+		{
+			Timer* timer = mSlots[i].mNext;
+			Unlink (timer);
+			timer->mWheel = null;
+		}
+	}
+
+	mResolution = resolution > 0 ? resolution : 1;
+	mCurrent    = now / mResolution;
+	mCount      = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Schedules the timer to expire after the delay. </summary>
+/// <remarks> The delay is in microseconds and rounded up to whole ticks.
+///           A timer which is already scheduled is moved. </remarks>
+
+void TimerWheel::Schedule (Timer* timer, uint64 delay)
+{
+	if (timer->mWheel != null)
+		timer->mWheel->Cancel (timer);
+
+	// Expire one tick from now at the earliest
+	uint64 ticks = (delay + mResolution - 1) / mResolution;
+	if (ticks == 0) ticks = 1;
+
+	// The slot is visited once every turn before the timer expires
+	timer->mRounds = (ticks - 1) / SlotCount;
+	timer->mWheel  = this;
+
+	Link (&mSlots[(mCurrent + ticks) % SlotCount], timer);
+	++mCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Cancels the timer if it is scheduled on this wheel. </summary>
+
+void TimerWheel::Cancel (Timer* timer)
+{
+	if (timer->mWheel != this) return;
+
+	Unlink (timer);
+	timer->mWheel = null;
+	--mCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Expires every timer due at the time, in microseconds. </summary>
+/// <remarks> Callbacks run from this function, which returns the number
+///           of expired timers. </remarks>
+
+uint32 TimerWheel::Advance (uint64 now)
+{
+	uint64 target = now / mResolution;
+	uint32 result = 0;
+
+	while (mCurrent < target)
+	{
+		// Nothing can expire on an empty wheel
+		if (mCount == 0) { mCurrent = target; break; }
+
+		Timer* slot = &mSlots[++mCurrent % SlotCount];
+		if (slot->mNext == slot) continue;
+
+		// Detach the slot, so callbacks may schedule and cancel freely
+		Timer pending;
+		pending.mNext = slot->mNext;
+		pending.mPrev = slot->mPrev;
+		pending.mNext->mPrev = &pending;
+		pending.mPrev->mNext = &pending;
+		slot->mNext = slot;
+		slot->mPrev = slot;
+
+		while (pending.mNext != &pending)
+		{
+			Timer* timer = pending.mNext;
+			Unlink (timer);
+
+			// Wait for another turn of the wheel
+			if (timer->mRounds > 0)
+			{
+				--timer->mRounds;
+				Link (slot, timer);
+				continue;
+			}
+
+			timer->mWheel = null;
+			--mCount;
+			++result;
+
+			if (timer->Expire != null)
+				timer->Expire (timer->Owner, timer->User);
+		}
+	}
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of scheduled timers. </summary>
+
+uint32 TimerWheel::GetCount (void) const
+{
+	return mCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the length of a tick in microseconds. </summary>
+
+uint32 TimerWheel::GetResolution (void) const
+{
+	return mResolution;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                        TimerWheel //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Appends the timer to the slot. </summary>
+
+void TimerWheel::Link (Timer* slot, Timer* timer)
+{
+	timer->mPrev = slot->mPrev;
+	timer->mNext = slot;
+	slot->mPrev->mNext = timer;
+	slot->mPrev = timer;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Removes the timer from its slot. </summary>
+
+void TimerWheel::Unlink (Timer* timer)
+{
+	timer->mPrev->mNext = timer->mNext;
+	timer->mNext->mPrev = timer->mPrev;
+	timer->mPrev = timer;
+	timer->mNext = timer;
+}
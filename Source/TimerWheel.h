@@ -0,0 +1,119 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "Types.h"
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> A hashed wheel of timers with constant time operations. </summary>
+/// <remarks>
+///   Time is split into ticks of a configurable resolution and every
+///   timer hangs in the slot of the tick it expires on, counting the
+///   turns of the wheel it still has to wait. Scheduling and cancelling
+///   link or unlink a timer, and advancing only visits the slots of the
+///   ticks which passed. The wheel is not synchronized, its owner must
+///   serialize every call.
+/// </remarks>
+
+class TimerWheel
+{
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Called once a timer expires. </summary>
+	/// <remarks> The timer may be scheduled again from the callback. </remarks>
+
+	typedef void (*Callback) (void* owner, void* user);
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single timer, usually embedded in its owner. </summary>
+	/// <remarks> A timer cancels itself when it is destroyed. </remarks>
+
+	class Timer
+	{
+		friend class TimerWheel;
+
+	public:
+		// Constructors
+		 Timer					(void);
+		~Timer					(void);
+
+	private:
+		Timer					(const Timer& timer) { }
+
+	public:
+		// Methods
+		bool		IsPending	(void) const;
+
+	public:
+		// Properties
+		Callback	Expire;		// Called once the timer expires
+		void*		Owner;		// First parameter of the callback
+		void*		User;		// Second parameter of the callback
+
+	private:
+		// Fields
+		Timer*		mPrev;		// Previous timer of the slot
+		Timer*		mNext;		// Next timer of the slot
+		uint64		mRounds;	// Turns of the wheel left to wait
+		TimerWheel*	mWheel;		// Wheel the timer is scheduled on
+	};
+
+public:
+	// Constants
+	static const uint32 SlotCount = 512;	// Slots of the wheel
+
+public:
+	// Constructors
+	 TimerWheel					(void);
+	~TimerWheel					(void);
+
+private:
+	TimerWheel					(const TimerWheel& wheel) { }
+
+public:
+	// Methods
+	void		Reset			(uint32 resolution, uint64 now);
+
+	void		Schedule		(Timer* timer, uint64 delay);
+	void		Cancel			(Timer* timer);
+	uint32		Advance			(uint64 now);
+
+	uint32		GetCount		(void) const;
+	uint32		GetResolution	(void) const;
+
+private:
+	// Internal
+	static void	Link			(Timer* slot, Timer* timer);
+	static void	Unlink			(Timer* timer);
+
+private:
+	// Fields
+	Timer		mSlots[SlotCount];	// Sentinels of every slot
+	uint64		mCurrent;			// Last tick advanced to
+	uint32		mResolution;		// Length of a tick in microseconds
+	uint32		mCount;				// Number of scheduled timers
+};
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Transport.h"
+#include "RawTransport.h"
+#include "UdpTransport.h"
+#include "XdpTransport.h"
+#include "UringTransport.h"
+
+
+
+//----------------------------------------------------------------------------//
+// Static                                                           Transport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Opens the transport described by the name. </summary>
+/// <remarks>
+///   "udp:Local,Seed,..." opens a UDP transport bound to the local IPv4
+///   endpoint which also unicasts to the seed endpoints, "xdp:Interface"
+///   opens an interface with AF_XDP and "uring:Interface" drives it with
+///   io_uring, both falling back to a raw socket, and any other name is
+///   an interface opened with a raw socket. Returns null on failure.
+/// </remarks>
+
+Transport* Transport::Open (const std::string& name, Error& error)
+{
+	if (name.compare (0, 4, "udp:") == 0)
+	{
+		UdpTransport* transport = new UdpTransport;
+		error = transport->Open (name.substr (4));
+
+		if (error == ERROR_NONE) return transport;
+		delete transport; return null;
+	}
+
+	if (name.compare (0, 4, "xdp:") == 0)
+	{
+		XdpTransport* transport = new XdpTransport;
+		error = transport->Open (name.substr (4));
+
+		if (error == ERROR_NONE) return transport;
+		delete transport; return null;
+	}
+
+	if (name.compare (0, 6, "uring:") == 0)
+	{
+		UringTransport* transport = new UringTransport;
+		error = transport->Open (name.substr (6));
+
+		if (error == ERROR_NONE) return transport;
+		delete transport; return null;
+	}
+
+	RawTransport* transport = new RawTransport;
+	error = transport->Open (name);
+
+	if (error == ERROR_NONE) return transport;
+	delete transport; return null;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the string representation of a specified error. </summary>
+
+std::string Transport::ErrorString (Error error)
+{
+	switch (error)
+	{
+		case ERROR_NONE			: return "";
+		case ERROR_OPEN_SOCK	: return "Could not open socket, Try running with sudo";
+		case ERROR_GET_IFINDEX	: return "Failed to retrieve the interface index";
+		case ERROR_GET_ADDRESS	: return "Failed to retrieve the hardware address";
+		case ERROR_GET_MTU		: return "Failed to retrieve the maximum transmission unit";
+		case ERROR_ADD_PROM		: return "Failed to add the promiscuous mode";
+		case ERROR_BIND_SOCK	: return "Failed to bind the socket";
+		case ERROR_BAD_ENDPOINT	: return "Endpoints must look like 10.0.0.1:3950";
+		case ERROR_JOIN_GROUP	: return "Failed to join the discovery group";
+		default					: return "Unknown error occurred";
+	}
+}
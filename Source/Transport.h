@@ -0,0 +1,107 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "Address.h"
+#include <string>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Moves serialized packets between a router and its neighbors. </summary>
+/// <remarks>
+///   Frames always use the Packet wire format. A frame is sent to one of
+///   three kinds of next hops: Address::Null announces the frame to any
+///   node which may be listening for discovery, Address::Broadcast sends
+///   it to every current neighbor and any other address sends it to that
+///   neighbor alone. Transports without unicast treat all three alike.
+///   Receive is only called from one thread, Send from any thread.
+///   Transports may lend send buffers through Acquire, so frames are
+///   serialized where they are sent from. Send consumes such buffers
+///   and Release returns one which will not be sent. Sends may also be
+///   queued until the next Flush, which the router calls after bursts.
+///   Links which count their own retransmissions and dropped frames
+///   report the total through GetLinkLosses, so senders may slow down.
+/// </remarks>
+
+class Transport
+{
+public:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> List of possible errors. </summary>
+
+	enum Error
+	{
+		ERROR_NONE = 0,
+		ERROR_OPEN_SOCK,
+		ERROR_GET_IFINDEX,
+		ERROR_GET_ADDRESS,
+		ERROR_GET_MTU,
+		ERROR_ADD_PROM,
+		ERROR_BIND_SOCK,
+		ERROR_BAD_ENDPOINT,
+		ERROR_JOIN_GROUP,
+	};
+
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single received frame. </summary>
+
+	class Frame
+	{
+	public:
+		// Properties
+		uint8*		Data;		// Frame data, owned by the transport
+		uint32		Length;		// Frame length
+		bool		Outgoing;	// Copy of a frame sent by this host
+	};
+
+public:
+	// Constructors
+	virtual ~Transport			(void) { }
+
+public:
+	// Methods
+	virtual uint32	Receive		(uint32 count, Frame* frames) = 0;
+	virtual bool	Send		(const Address& next,
+								 uint32 length, const uint8* buffer) = 0;
+
+	virtual void	Flush		(void) { }
+
+	virtual uint8*	Acquire		(uint32 length) { return null; }
+	virtual void	Release		(uint8* buffer) { }
+
+	virtual uint64	GetLinkLosses	(void) { return 0; }
+
+	virtual const Address& GetAddress (void) const = 0;
+
+public:
+	// Constants
+	static const uint32 MaxBatch = 32;	// Frames per Receive call
+
+public:
+	// Static
+	static Transport*	Open		(const std::string& name, Error& error);
+	static std::string	ErrorString	(Error error);
+};
+
+#endif // TRANSPORT_H
@@ -0,0 +1,450 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Clock.h"
+#include "UdpTransport.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Defines                                                                    //
+//----------------------------------------------------------------------------//
+
+#define GROUP_ADDRESS	"239.255.57.80"		// Discovery multicast group
+#define PEER_TIMEOUT	30000000000ULL		// Nanoseconds before a peer is forgotten
+#define EXPIRE_PERIOD	1000000000ULL		// Nanoseconds between expiry scans
+#define MAX_SEND		64					// Datagrams per sendmmsg call
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if both endpoints are the same. </summary>
+
+static inline bool SameEndpoint (const sockaddr_in& a, const sockaddr_in& b)
+{
+	return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                  UdpTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new closed transport. </summary>
+
+UdpTransport::UdpTransport (void)
+{
+	mSocket      = -1;
+	mGroupSocket = -1;
+	mBuffers     = null;
+	mExpired     = 0;
+
+	pthread_mutex_init (&mPeerMutex, null);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes the transport. </summary>
+
+UdpTransport::~UdpTransport (void)
+{
+	Close();
+	pthread_mutex_destroy (&mPeerMutex);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                       UdpTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Binds the local endpoint and joins the discovery group. </summary>
+/// <remarks> Endpoints are comma separated, the first one is local and
+///           every other one is a seed peer. The local endpoint is not
+///           a peer, so every node may be given the same seed list. </remarks>
+
+Transport::Error UdpTransport::Open (const std::string& endpoints)
+{
+	Close();
+
+	// Parse the local endpoint and seeds
+	uint64 now = Clock::Now();
+	for (size_t start = 0; start <= endpoints.length();)
+	{
+		size_t end = endpoints.find (',', start);
+		if (end == std::string::npos) end = endpoints.length();
+
+		sockaddr_in endpoint;
+		if (!ParseEndpoint (endpoints.substr (start, end - start), endpoint))
+			{ mPeers.clear(); return ERROR_BAD_ENDPOINT; }
+
+		if (start == 0) mLocal = endpoint;
+		elif (!SameEndpoint (endpoint, mLocal))
+		{
+			Peer peer = { endpoint, now, true, false };
+			mPeers.push_back (peer);
+		}
+
+		start = end + 1;
+	}
+
+	// The address must identify this node
+	if (mLocal.sin_addr.s_addr == htonl (INADDR_ANY))
+		{ mPeers.clear(); return ERROR_BAD_ENDPOINT; }
+
+	mAddress = ToAddress (mLocal);
+
+	memset (&mGroup, 0, sizeof (sockaddr_in));
+	mGroup.sin_family = AF_INET;
+	mGroup.sin_port   = htons (GroupPort);
+	inet_pton (AF_INET, GROUP_ADDRESS, &mGroup.sin_addr);
+
+	int32 enable = 1;
+
+	// Open the unicast socket
+	mSocket = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (mSocket < 0) { Close(); return ERROR_OPEN_SOCK; }
+
+	setsockopt (mSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof (enable));
+
+	if (bind (mSocket, (sockaddr*) &mLocal, sizeof (sockaddr_in)) != 0)
+		{ Close(); return ERROR_BIND_SOCK; }
+
+	// Announce through the interface of the local endpoint
+	setsockopt (mSocket, IPPROTO_IP, IP_MULTICAST_IF,
+		&mLocal.sin_addr, sizeof (in_addr));
+
+	// Open the discovery socket, shared by every node on this host
+	mGroupSocket = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (mGroupSocket < 0) { Close(); return ERROR_OPEN_SOCK; }
+
+	setsockopt (mGroupSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof (enable));
+
+	sockaddr_in any;
+	memset (&any, 0, sizeof (sockaddr_in));
+	any.sin_family      = AF_INET;
+	any.sin_port        = htons (GroupPort);
+	any.sin_addr.s_addr = htonl (INADDR_ANY);
+
+	if (bind (mGroupSocket, (sockaddr*) &any, sizeof (sockaddr_in)) != 0)
+		{ Close(); return ERROR_BIND_SOCK; }
+
+	ip_mreq membership;
+	membership.imr_multiaddr = mGroup.sin_addr;
+	membership.imr_interface = mLocal.sin_addr;
+
+	if (setsockopt (mGroupSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+		&membership, sizeof (membership)) != 0)
+		{ Close(); return ERROR_JOIN_GROUP; }
+
+	mBuffers = new uint8[(uint64) MaxDatagram * MaxBatch];
+	mExpired = now;
+	return ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes both sockets and forgets every peer. </summary>
+
+void UdpTransport::Close (void)
+{
+	if (mSocket      != -1) close (mSocket     );
+	if (mGroupSocket != -1) close (mGroupSocket);
+
+	delete[] mBuffers;
+
+	mSocket      = -1;
+	mGroupSocket = -1;
+	mBuffers     = null;
+	mPeers.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Receives up to count pending frames without blocking. </summary>
+/// <remarks> Unicast frames are received before announcements. </remarks>
+
+uint32 UdpTransport::Receive (uint32 count, Frame* frames)
+{
+	if (count > MaxBatch) count = MaxBatch;
+
+	// Dropped datagrams still use up their buffers
+	uint32 used = 0;
+	uint32 result = ReceiveFrom (mSocket, false, count, frames, used);
+	result += ReceiveFrom (mGroupSocket, true, count - result, frames + result, used);
+
+	uint64 now = Clock::Now();
+	if (now - mExpired >= EXPIRE_PERIOD)
+		{ Expire (now); mExpired = now; }
+
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sends the frame to the next hop, every peer or the group. </summary>
+
+bool UdpTransport::Send (const Address& next, uint32 length, const uint8* buffer)
+{
+	// Unicast to a single neighbor
+	if (next != Address::Null && next != Address::Broadcast)
+	{
+		sockaddr_in endpoint;
+		ToEndpoint (next, endpoint);
+		return SendTo (1, &endpoint, length, buffer);
+	}
+
+	bool announce = next == Address::Null;
+	std::vector<sockaddr_in> endpoints;
+
+	// Announcements reach local peers through the group
+	if (announce) endpoints.push_back (mGroup);
+
+	pthread_mutex_lock (&mPeerMutex);
+	endpoints.reserve (endpoints.size() + mPeers.size());
+
+	for (uint32 i = 0; i < mPeers.size(); ++i)
+	{
+		if (!announce || !mPeers[i].Local)
+			endpoints.push_back (mPeers[i].Endpoint);
+	}
+
+	pthread_mutex_unlock (&mPeerMutex);
+
+	return endpoints.empty() || SendTo (endpoints.size(),
+		&endpoints[0], length, buffer);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the address made of the local endpoint. </summary>
+
+const Address& UdpTransport::GetAddress (void) const
+{
+	return mAddress;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of current peers. </summary>
+
+uint32 UdpTransport::GetPeerCount (void)
+{
+	pthread_mutex_lock (&mPeerMutex);
+	uint32 count = mPeers.size();
+	pthread_mutex_unlock (&mPeerMutex);
+	return count;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Static                                                        UdpTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Parses an IPv4 endpoint like "10.0.0.1:3950". </summary>
+
+bool UdpTransport::ParseEndpoint (const std::string& text, sockaddr_in& endpoint)
+{
+	size_t separator = text.rfind (':');
+	if (separator == std::string::npos) return false;
+
+	memset (&endpoint, 0, sizeof (sockaddr_in));
+	endpoint.sin_family = AF_INET;
+
+	char* end;
+	const char* port = text.c_str() + separator + 1;
+	uint32 value = strtoul (port, &end, 10);
+
+	if (end == port || *end != 0 || value == 0 || value > 65535)
+		return false;
+
+	endpoint.sin_port = htons ((uint16) value);
+	return inet_pton (AF_INET, text.substr (0, separator).c_str(), &endpoint.sin_addr) == 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the address of an endpoint, its IPv4 address and port. </summary>
+
+Address UdpTransport::ToAddress (const sockaddr_in& endpoint)
+{
+	Address address;
+	memcpy (address.Data,     &endpoint.sin_addr.s_addr, 4);
+	memcpy (address.Data + 4, &endpoint.sin_port,        2);
+	return address;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the endpoint of an address. </summary>
+
+void UdpTransport::ToEndpoint (const Address& address, sockaddr_in& endpoint)
+{
+	memset (&endpoint, 0, sizeof (sockaddr_in));
+	endpoint.sin_family = AF_INET;
+
+	memcpy (&endpoint.sin_addr.s_addr, address.Data,     4);
+	memcpy (&endpoint.sin_port,        address.Data + 4, 2);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                      UdpTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Receives pending datagrams from a socket and learns their senders. </summary>
+/// <remarks> Datagrams sent by this node come back through the group and
+///           are dropped here. Used counts the buffers taken so far and
+///           grows by every datagram received, whether it is kept or not. </remarks>
+
+uint32 UdpTransport::ReceiveFrom (int32 socket, bool local,
+	uint32 count, Frame* frames, uint32& used)
+{
+	if (count > MaxBatch - used) count = MaxBatch - used;
+	if (count == 0) return 0;
+
+	// Continue filling the buffers after earlier datagrams
+	uint8* buffers = mBuffers + (uint64) used * MaxDatagram;
+
+	mmsghdr     messages[MaxBatch];
+	iovec       vectors [MaxBatch];
+	sockaddr_in from    [MaxBatch];
+
+	for (uint32 i = 0; i < count; ++i)
+	{
+		vectors[i].iov_base = buffers + (uint64) i * MaxDatagram;
+		vectors[i].iov_len  = MaxDatagram;
+
+		memset (&messages[i], 0, sizeof (mmsghdr));
+		messages[i].msg_hdr.msg_iov     = &vectors[i];
+		messages[i].msg_hdr.msg_iovlen  = 1;
+		messages[i].msg_hdr.msg_name    = &from[i];
+		messages[i].msg_hdr.msg_namelen = sizeof (sockaddr_in);
+	}
+
+	int32 result = recvmmsg (socket, messages, count, MSG_DONTWAIT, null);
+	if (result <= 0) return 0;
+
+	used += result;
+	uint64 now = Clock::Now();
+	uint32 kept = 0;
+
+	for (int32 i = 0; i < result; ++i)
+	{
+		if (SameEndpoint (from[i], mLocal)) continue;
+
+		Learn (from[i], local, now);
+
+		frames[kept].Data     = (uint8*) vectors[i].iov_base;
+		frames[kept].Length   = messages[i].msg_len;
+		frames[kept].Outgoing = false;
+		++kept;
+	}
+
+	return kept;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Adds or refreshes the peer at the endpoint. </summary>
+
+void UdpTransport::Learn (const sockaddr_in& endpoint, bool local, uint64 now)
+{
+	pthread_mutex_lock (&mPeerMutex);
+
+	for (uint32 i = 0; i < mPeers.size(); ++i)
+	{
+		if (SameEndpoint (mPeers[i].Endpoint, endpoint))
+		{
+			mPeers[i].Seen   = now;
+			mPeers[i].Local |= local;
+			pthread_mutex_unlock (&mPeerMutex);
+			return;
+		}
+	}
+
+	Peer peer = { endpoint, now, false, local };
+	mPeers.push_back (peer);
+
+	pthread_mutex_unlock (&mPeerMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Forgets learned peers which have been silent for too long. </summary>
+
+void UdpTransport::Expire (uint64 now)
+{
+	pthread_mutex_lock (&mPeerMutex);
+
+	for (uint32 i = 0; i < mPeers.size();)
+	{
+		if (!mPeers[i].Seed && now - mPeers[i].Seen > PEER_TIMEOUT)
+		{
+			mPeers[i] = mPeers.back();
+			mPeers.pop_back();
+		}
+
+		else ++i;
+	}
+
+	pthread_mutex_unlock (&mPeerMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sends the frame to every endpoint with as few calls as possible. </summary>
+/// <remarks> Returns false if the frame could not be sent to some endpoint. </remarks>
+
+bool UdpTransport::SendTo (uint32 count, const sockaddr_in* endpoints,
+						   uint32 length, const uint8* buffer)
+{
+	mmsghdr messages[MAX_SEND];
+	iovec vector = { (void*) buffer, length };
+	bool result = true;
+
+	while (count > 0)
+	{
+		uint32 batch = count < MAX_SEND ? count : MAX_SEND;
+
+		for (uint32 i = 0; i < batch; ++i)
+		{
+			memset (&messages[i], 0, sizeof (mmsghdr));
+			messages[i].msg_hdr.msg_iov     = &vector;
+			messages[i].msg_hdr.msg_iovlen  = 1;
+			messages[i].msg_hdr.msg_name    = (void*) &endpoints[i];
+			messages[i].msg_hdr.msg_namelen = sizeof (sockaddr_in);
+		}
+
+		int32 sent = sendmmsg (mSocket, messages, batch, 0);
+
+		// Skip an endpoint which fails, the others may still work
+		if (sent <= 0) { result = false; sent = 1; }
+
+		endpoints += sent;
+		count     -= sent;
+	}
+
+	return result;
+}
@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef UDP_TRANSPORT_H
+#define UDP_TRANSPORT_H
+
+#include "Transport.h"
+
+#include <vector>
+#include <pthread.h>
+#include <netinet/in.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Carries frames in UDP datagrams so the overlay spans IP networks. </summary>
+/// <remarks>
+///   The address of a node is its IPv4 address followed by its port, so
+///   the endpoint of any node is known from its address alone. Frames
+///   are unicast to peers, which are seed endpoints given at Open and
+///   any endpoint a datagram was received from. Announcements are also
+///   sent to a multicast group, so nodes on the same network discover
+///   each other without seeds. Peers which stay silent are forgotten.
+///   No privileges are required.
+/// </remarks>
+
+class UdpTransport : public Transport
+{
+private:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single peer. </summary>
+
+	class Peer
+	{
+	public:
+		// Properties
+		sockaddr_in	Endpoint;	// Peer endpoint
+		uint64		Seen;		// Time of the last datagram
+		bool		Seed;		// Never forgotten
+		bool		Local;		// Reached through the multicast group
+	};
+
+public:
+	// Constructors
+	 UdpTransport				(void);
+	~UdpTransport				(void);
+
+private:
+	UdpTransport				(const UdpTransport& transport) { }
+
+public:
+	// Methods
+	Error			Open		(const std::string& endpoints);
+	void			Close		(void);
+
+	uint32			Receive		(uint32 count, Frame* frames);
+	bool			Send		(const Address& next,
+								 uint32 length, const uint8* buffer);
+
+	const Address&	GetAddress	(void) const;
+	uint32			GetPeerCount(void);
+
+public:
+	// Constants
+	static const uint16 GroupPort   = 3950;		// Discovery port
+	static const uint32 MaxDatagram = 65536;	// Largest received frame
+
+public:
+	// Static
+	static bool		ParseEndpoint	(const std::string& text, sockaddr_in& endpoint);
+	static Address	ToAddress		(const sockaddr_in& endpoint);
+	static void		ToEndpoint		(const Address& address, sockaddr_in& endpoint);
+
+private:
+	// Internal
+	uint32			ReceiveFrom	(int32 socket, bool local, uint32 count,
+								 Frame* frames, uint32& used);
+	void			Learn		(const sockaddr_in& endpoint, bool local, uint64 now);
+	void			Expire		(uint64 now);
+	bool			SendTo		(uint32 count, const sockaddr_in* endpoints,
+								 uint32 length, const uint8* buffer);
+
+private:
+	// Fields
+	Address			mAddress;		// Address of the local endpoint
+	sockaddr_in		mLocal;			// Local endpoint
+	sockaddr_in		mGroup;			// Discovery group endpoint
+
+	int32			mSocket;		// Unicast socket
+	int32			mGroupSocket;	// Discovery socket
+	uint8*			mBuffers;		// Receive buffers
+
+	std::vector<Peer> mPeers;		// Current peers
+	pthread_mutex_t	mPeerMutex;		// Peer synchronization
+	uint64			mExpired;		// Time peers were last expired
+};
+
+#endif // UDP_TRANSPORT_H
@@ -0,0 +1,534 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "UringTransport.h"
+
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                UringTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new closed transport. </summary>
+
+UringTransport::UringTransport (void)
+{
+	memset (&mRecv, 0, sizeof (Ring)); mRecv.FD = -1;
+	memset (&mSend, 0, sizeof (Ring)); mSend.FD = -1;
+
+	mProvided       = null;
+	mProvidedLength = 0;
+	mRecvBuffers    = null;
+	mRecvLength     = 0;
+	mEnabled        = false;
+	mArmed          = false;
+	mHeldCount      = 0;
+	mSendBuffers    = null;
+	mRefused        = 0;
+
+	pthread_mutex_init (&mSendMutex, null);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes the transport. </summary>
+
+UringTransport::~UringTransport (void)
+{
+	Close();
+	pthread_mutex_destroy (&mSendMutex);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                     UringTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Opens the interface, with io_uring if it is available. </summary>
+/// <remarks> Fails only if the raw socket could not be opened. </remarks>
+
+Transport::Error UringTransport::Open (const std::string& interface)
+{
+	Close();
+
+	Error error = RawTransport::Open (interface);
+	if (error != ERROR_NONE) return error;
+
+	if (!OpenUring())
+		CloseUring();
+
+	return ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes both rings and the socket. </summary>
+
+void UringTransport::Close (void)
+{
+	CloseUring();
+	RawTransport::Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Receives up to count pending frames without blocking. </summary>
+/// <remarks> Frames stay valid until the next call, when their buffers
+///           are provided to the kernel again. </remarks>
+
+uint32 UringTransport::Receive (uint32 count, Frame* frames)
+{
+	if (mRecv.FD < 0) return RawTransport::Receive (count, frames);
+	if (count > MaxBatch) count = MaxBatch;
+
+	for (uint32 i = 0; i < mHeldCount; ++i)
+		Provide (mHeld[i]);
+
+	mHeldCount = 0;
+
+	// Only the thread enabling the ring may submit to it
+	if (!mEnabled)
+	{
+		if (syscall (__NR_io_uring_register, mRecv.FD, IORING_REGISTER_ENABLE_RINGS, null, 0) != 0)
+		{
+			CloseRing (mRecv);
+			return RawTransport::Receive (count, frames);
+		}
+
+		mEnabled = true;
+	}
+
+	// Rearm once the kernel ended the receive, such as out of buffers
+	if (!mArmed && !Arm()) return 0;
+
+	uint32 head = *mRecv.CqHead;
+	uint32 tail = __atomic_load_n (mRecv.CqTail, __ATOMIC_ACQUIRE);
+
+	// Frames are only received once this thread enters the kernel
+	if (tail - head < count)
+	{
+		Submit (mRecv, 0);
+		tail = __atomic_load_n (mRecv.CqTail, __ATOMIC_ACQUIRE);
+	}
+
+	uint32 result = 0;
+	while (head != tail && mHeldCount < count)
+	{
+		const io_uring_cqe& cqe = mRecv.Cqes[head++ & mRecv.CqMask];
+		if ((cqe.flags & IORING_CQE_F_MORE) == 0) mArmed = false;
+
+		// Failures carry no buffer
+		if (cqe.res < 0 || (cqe.flags & IORING_CQE_F_BUFFER) == 0) continue;
+
+		uint16 id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+		mHeld[mHeldCount++] = id;
+
+		// Buffers start with the message header and sender address
+		uint8* data = mRecvBuffers + (uint64) id * mRecvLength;
+		const io_uring_recvmsg_out* out = (io_uring_recvmsg_out*) data;
+		const sockaddr_ll* from = (sockaddr_ll*) (out + 1);
+
+		if (out->flags & MSG_TRUNC) continue;
+
+		frames[result].Data     = data + sizeof (io_uring_recvmsg_out) + sizeof (sockaddr_ll);
+		frames[result].Length   = out->payloadlen;
+		frames[result].Outgoing = from->sll_pkttype == PACKET_OUTGOING;
+		++result;
+	}
+
+	__atomic_store_n (mRecv.CqHead, head, __ATOMIC_RELEASE);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Queues the frame to be broadcast on the interface. </summary>
+/// <remarks> Queued frames are submitted once a batch is full or on Flush.
+///           Frames are sent directly when every buffer is in flight. </remarks>
+
+bool UringTransport::Send (const Address& next, uint32 length, const uint8* buffer)
+{
+	bool owned = Owns (buffer);
+	if (!owned && (mSend.FD < 0 || length > mFrameLength))
+		return RawTransport::Send (next, length, buffer);
+
+	pthread_mutex_lock (&mSendMutex);
+	Complete();
+
+	uint32 id;
+	if (owned) id = (buffer - mSendBuffers) / mFrameLength;
+
+	else
+	{
+		// Buffers of unsubmitted frames only return once submitted
+		if (mFree.empty() && mSend.Pending > 0)
+			{ Submit (mSend, 0); Complete(); }
+
+		if (mFree.empty())
+		{
+			pthread_mutex_unlock (&mSendMutex);
+			return RawTransport::Send (next, length, buffer);
+		}
+
+		id = mFree.back();
+		mFree.pop_back();
+		memcpy (mSendBuffers + (uint64) id * mFrameLength, buffer, length);
+	}
+
+	// Every buffer has an entry, so the ring never overflows
+	io_uring_sqe* sqe = NextEntry (mSend);
+	sqe->opcode    = IORING_OP_SEND;
+	sqe->fd        = 0;
+	sqe->flags     = IOSQE_FIXED_FILE;
+	sqe->addr      = (uint64) (mSendBuffers + (uint64) id * mFrameLength);
+	sqe->len       = length;
+	sqe->user_data = id;
+
+	if (mSend.Pending >= MaxBatch)
+		Submit (mSend, 0);
+
+	pthread_mutex_unlock (&mSendMutex);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Submits every queued frame with a single system call. </summary>
+
+void UringTransport::Flush (void)
+{
+	if (mSend.FD < 0) return;
+
+	pthread_mutex_lock (&mSendMutex);
+	if (mSend.Pending > 0) Submit (mSend, 0);
+	pthread_mutex_unlock (&mSendMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Lends a free send buffer to serialize a frame into. </summary>
+/// <remarks> Returns null without io_uring, for long frames or when every
+///           buffer is in flight. </remarks>
+
+uint8* UringTransport::Acquire (uint32 length)
+{
+	if (mSend.FD < 0 || length > mFrameLength) return null;
+
+	pthread_mutex_lock (&mSendMutex);
+	Complete();
+
+	uint8* result = null;
+	if (!mFree.empty())
+	{
+		result = mSendBuffers + (uint64) mFree.back() * mFrameLength;
+		mFree.pop_back();
+	}
+
+	pthread_mutex_unlock (&mSendMutex);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns a lent buffer which will not be sent. </summary>
+
+void UringTransport::Release (uint8* buffer)
+{
+	if (!Owns (buffer)) return;
+
+	pthread_mutex_lock (&mSendMutex);
+	mFree.push_back ((buffer - mSendBuffers) / mFrameLength);
+	pthread_mutex_unlock (&mSendMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the frames the link failed to deliver. </summary>
+/// <remarks> Adds the queued frames the socket refused, such as when
+///           its buffer was full, to the losses of the wireless link. </remarks>
+
+uint64 UringTransport::GetLinkLosses (void)
+{
+	if (mSend.FD < 0) return RawTransport::GetLinkLosses();
+
+	pthread_mutex_lock (&mSendMutex);
+	Complete();
+	uint64 refused = mRefused;
+	pthread_mutex_unlock (&mSendMutex);
+
+	return RawTransport::GetLinkLosses() + refused;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if frames are moved through io_uring. </summary>
+
+bool UringTransport::IsAccelerated (void) const
+{
+	return mRecv.FD >= 0;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                    UringTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates both rings and provides the receive buffers. </summary>
+/// <remarks> Returns false if any step fails, CloseUring then cleans up. </remarks>
+
+bool UringTransport::OpenUring (void)
+{
+	// The receive ring holds a single request and defers its work
+	// to the receiving thread, which then collects frames in batches
+	// rather than being woken for every single one. That thread is
+	// not this one, so the ring starts disabled until it enables it
+	if (!OpenRing (mRecv, 8, RecvCount * 2, IORING_SETUP_R_DISABLED |
+			IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN) || !OpenRing (mSend, SendCount,
+			SendCount * 2, IORING_SETUP_COOP_TASKRUN))
+		return false;
+
+	// Register the socket as fixed file zero of both rings
+	if (syscall (__NR_io_uring_register, mRecv.FD, IORING_REGISTER_FILES, &mSocketID, 1) != 0 ||
+		syscall (__NR_io_uring_register, mSend.FD, IORING_REGISTER_FILES, &mSocketID, 1) != 0)
+		return false;
+
+	// Register the ring of provided buffers
+	mProvidedLength = RecvCount * sizeof (io_uring_buf);
+	void* provided  = mmap (null, mProvidedLength, PROT_READ |
+		PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (provided == MAP_FAILED) return false;
+	mProvided = (io_uring_buf_ring*) provided;
+
+	io_uring_buf_reg reg;
+	memset (&reg, 0, sizeof (reg));
+	reg.ring_addr    = (uint64) mProvided;
+	reg.ring_entries = RecvCount;
+	reg.bgid         = 0;
+
+	if (syscall (__NR_io_uring_register, mRecv.FD, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+		return false;
+
+	// Buffers hold the message header, sender address and frame
+	mRecvLength  = sizeof (io_uring_recvmsg_out) + sizeof (sockaddr_ll) + mFrameLength;
+	mRecvBuffers = new uint8[(uint64) RecvCount * mRecvLength];
+
+	for (uint32 i = 0; i < RecvCount; ++i)
+		Provide (i);
+
+	memset (&mRecvHeader, 0, sizeof (msghdr));
+	mRecvHeader.msg_namelen = sizeof (sockaddr_ll);
+
+	mSendBuffers = new uint8[(uint64) SendCount * mFrameLength];
+	for (uint32 i = 0; i < SendCount; ++i)
+		mFree.push_back (i);
+
+	mEnabled   = false;
+	mArmed     = false;
+	mHeldCount = 0;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes both rings, cancelling the receive, and frees the buffers. </summary>
+
+void UringTransport::CloseUring (void)
+{
+	CloseRing (mRecv);
+	CloseRing (mSend);
+
+	if (mProvided != null)
+		munmap (mProvided, mProvidedLength);
+
+	delete[] mRecvBuffers;
+	delete[] mSendBuffers;
+
+	mProvided    = null;
+	mRecvBuffers = null;
+	mSendBuffers = null;
+	mEnabled     = false;
+	mArmed       = false;
+	mHeldCount   = 0;
+	mFree.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a ring and maps its queues into memory. </summary>
+
+bool UringTransport::OpenRing (Ring& ring, uint32 entries,
+							   uint32 completions, uint32 flags)
+{
+	io_uring_params params;
+	memset (&params, 0, sizeof (params));
+
+	params.flags      = IORING_SETUP_CQSIZE | flags;
+	params.cq_entries = completions;
+
+	ring.FD = syscall (__NR_io_uring_setup, entries, &params);
+	if (ring.FD < 0) return false;
+
+	ring.SqMapLength = params.sq_off.array + params.sq_entries * sizeof (uint32);
+	ring.CqMapLength = params.cq_off.cqes  + params.cq_entries * sizeof (io_uring_cqe);
+	ring.SqesLength  = params.sq_entries * sizeof (io_uring_sqe);
+
+	void* sq   = mmap (null, ring.SqMapLength, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring.FD, IORING_OFF_SQ_RING);
+	void* cq   = mmap (null, ring.CqMapLength, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring.FD, IORING_OFF_CQ_RING);
+	void* sqes = mmap (null, ring.SqesLength,  PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ring.FD, IORING_OFF_SQES);
+
+	ring.SqMap = sq   == MAP_FAILED ? null : sq;
+	ring.CqMap = cq   == MAP_FAILED ? null : cq;
+	ring.Sqes  = sqes == MAP_FAILED ? null : (io_uring_sqe*) sqes;
+
+	if (ring.SqMap == null || ring.CqMap == null || ring.Sqes == null)
+		return false;
+
+	uint8* base  = (uint8*) ring.SqMap;
+	ring.SqHead  = (uint32*) (base + params.sq_off.head );
+	ring.SqTail  = (uint32*) (base + params.sq_off.tail );
+	ring.SqMask  = *(uint32*) (base + params.sq_off.ring_mask);
+
+	// Entries are always submitted in order
+	uint32* array = (uint32*) (base + params.sq_off.array);
+	for (uint32 i = 0; i < params.sq_entries; ++i) array[i] = i;
+
+	base = (uint8*) ring.CqMap;
+	ring.CqHead = (uint32*) (base + params.cq_off.head);
+	ring.CqTail = (uint32*) (base + params.cq_off.tail);
+	ring.CqMask = *(uint32*) (base + params.cq_off.ring_mask);
+	ring.Cqes   = (io_uring_cqe*) (base + params.cq_off.cqes);
+
+	ring.Pending = 0;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Unmaps and closes a ring. </summary>
+
+void UringTransport::CloseRing (Ring& ring)
+{
+	if (ring.SqMap != null) munmap (ring.SqMap, ring.SqMapLength);
+	if (ring.CqMap != null) munmap (ring.CqMap, ring.CqMapLength);
+	if (ring.Sqes  != null) munmap (ring.Sqes,  ring.SqesLength );
+	if (ring.FD    != -1  ) close  (ring.FD);
+
+	memset (&ring, 0, sizeof (Ring));
+	ring.FD = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns a cleared submission entry, queued until Submit. </summary>
+/// <remarks> Returns null if the submission queue is full. </remarks>
+
+io_uring_sqe* UringTransport::NextEntry (Ring& ring)
+{
+	uint32 tail = *ring.SqTail + ring.Pending;
+	if (tail - __atomic_load_n (ring.SqHead, __ATOMIC_ACQUIRE) > ring.SqMask)
+		return null;
+
+	io_uring_sqe* sqe = &ring.Sqes[tail & ring.SqMask];
+	memset (sqe, 0, sizeof (io_uring_sqe));
+
+	++ring.Pending;
+	return sqe;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Submits every queued entry and runs pending completions. </summary>
+/// <remarks> Waits for at least wait completions. </remarks>
+
+int32 UringTransport::Submit (Ring& ring, uint32 wait)
+{
+	uint32 count = ring.Pending;
+	__atomic_store_n (ring.SqTail, *ring.SqTail + count, __ATOMIC_RELEASE);
+	ring.Pending = 0;
+
+	return syscall (__NR_io_uring_enter, ring.FD, count,
+		wait, IORING_ENTER_GETEVENTS, null, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Provides a receive buffer to the kernel. </summary>
+
+void UringTransport::Provide (uint16 id)
+{
+	uint16 tail = mProvided->tail;
+
+	// Entries start at the ring itself, the tail overlays the
+	// reserved field of the first entry
+	io_uring_buf& buffer = ((io_uring_buf*) mProvided)[tail & (RecvCount - 1)];
+
+	buffer.addr = (uint64) (mRecvBuffers + (uint64) id * mRecvLength);
+	buffer.len  = mRecvLength;
+	buffer.bid  = id;
+
+	__atomic_store_n (&mProvided->tail, (uint16) (tail + 1), __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Starts the multishot receive into provided buffers. </summary>
+/// <remarks> Only called by the receiving thread, which then posts the
+///           completions. </remarks>
+
+bool UringTransport::Arm (void)
+{
+	io_uring_sqe* sqe = NextEntry (mRecv);
+	if (sqe == null) return false;
+
+	sqe->opcode    = IORING_OP_RECVMSG;
+	sqe->fd        = 0;
+	sqe->flags     = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+	sqe->ioprio    = IORING_RECV_MULTISHOT;
+	sqe->addr      = (uint64) &mRecvHeader;
+	sqe->len       = 1;
+	sqe->buf_group = 0;
+
+	mArmed = Submit (mRecv, 0) >= 0;
+	return mArmed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Frees the buffers of every completed send and counts those
+///           the socket refused. </summary>
+/// <remarks> The send lock must be held. </remarks>
+
+void UringTransport::Complete (void)
+{
+	uint32 head = *mSend.CqHead;
+	uint32 tail = __atomic_load_n (mSend.CqTail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; ++head)
+	{
+		const io_uring_cqe& cqe = mSend.Cqes[head & mSend.CqMask];
+		if (cqe.res < 0) ++mRefused;
+		mFree.push_back ((uint32) cqe.user_data);
+	}
+
+	__atomic_store_n (mSend.CqHead, head, __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if the buffer is a send buffer of this transport. </summary>
+
+bool UringTransport::Owns (const uint8* buffer) const
+{
+	return mSendBuffers != null && buffer >= mSendBuffers &&
+		buffer < mSendBuffers + (uint64) SendCount * mFrameLength;
+}
@@ -0,0 +1,143 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef URING_TRANSPORT_H
+#define URING_TRANSPORT_H
+
+#include "RawTransport.h"
+
+#include <vector>
+#include <pthread.h>
+#include <linux/io_uring.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Drives the raw socket of an interface through io_uring. </summary>
+/// <remarks>
+///   A single multishot receive keeps filling buffers provided to the
+///   kernel, so received frames cost no system calls. Sends are queued
+///   and submitted together once a batch is full or on Flush, so they
+///   succeed at once and the frames the socket refuses later are counted
+///   as link losses instead. Receives and sends use separate rings, the
+///   receive ring is only used by the receiving thread, which enables
+///   it on its first Receive. When io_uring is unavailable the raw
+///   socket is used directly. Requires root privileges.
+/// </remarks>
+
+class UringTransport : public RawTransport
+{
+private:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a single io_uring instance. </summary>
+
+	class Ring
+	{
+	public:
+		// Properties
+		int32			FD;			// Ring descriptor
+		uint32			Pending;	// Queued submissions
+
+		uint32*			SqHead;		// Submission head
+		uint32*			SqTail;		// Submission tail
+		uint32			SqMask;		// Submission index mask
+		io_uring_sqe*	Sqes;		// Submission entries
+
+		uint32*			CqHead;		// Completion head
+		uint32*			CqTail;		// Completion tail
+		uint32			CqMask;		// Completion index mask
+		io_uring_cqe*	Cqes;		// Completion entries
+
+		void*			SqMap;		// Mapped submission ring
+		uint64			SqMapLength;
+		void*			CqMap;		// Mapped completion ring
+		uint64			CqMapLength;
+		uint64			SqesLength;	// Length of the mapped entries
+	};
+
+public:
+	// Constructors
+	 UringTransport				(void);
+	~UringTransport				(void);
+
+private:
+	UringTransport				(const UringTransport& transport) { }
+
+public:
+	// Methods
+	Error			Open		(const std::string& interface);
+	void			Close		(void);
+
+	uint32			Receive		(uint32 count, Frame* frames);
+	bool			Send		(const Address& next,
+								 uint32 length, const uint8* buffer);
+	void			Flush		(void);
+
+	uint8*			Acquire		(uint32 length);
+	void			Release		(uint8* buffer);
+
+	uint64			GetLinkLosses	(void);
+	bool			IsAccelerated	(void) const;
+
+public:
+	// Constants
+	static const uint32 RecvCount = 256;	// Buffers provided for receiving
+	static const uint32 SendCount = 256;	// Buffers for queued sends
+
+private:
+	// Internal
+	bool			OpenUring	(void);
+	void			CloseUring	(void);
+
+	bool			OpenRing	(Ring& ring, uint32 entries,
+								 uint32 completions, uint32 flags);
+	void			CloseRing	(Ring& ring);
+	io_uring_sqe*	NextEntry	(Ring& ring);
+	int32			Submit		(Ring& ring, uint32 wait);
+
+	void			Provide		(uint16 id);
+	bool			Arm			(void);
+	void			Complete	(void);
+	bool			Owns		(const uint8* buffer) const;
+
+private:
+	// Fields
+	Ring			mRecv;			// Receive ring
+	Ring			mSend;			// Send ring
+
+	io_uring_buf_ring* mProvided;	// Buffers provided to the kernel
+	uint64			mProvidedLength;// Length of the mapped ring
+	uint8*			mRecvBuffers;	// Memory of the provided buffers
+	uint32			mRecvLength;	// Length of every provided buffer
+	msghdr			mRecvHeader;	// Layout of every received buffer
+	bool			mEnabled;		// Receive ring was enabled
+	bool			mArmed;			// Multishot receive is active
+
+	uint16			mHeld[MaxBatch];// Buffers lent out by Receive
+	uint32			mHeldCount;		// Number of buffers lent out
+
+	uint8*			mSendBuffers;	// Memory of the send buffers
+	std::vector<uint32> mFree;		// Free send buffers
+	uint64			mRefused;		// Queued frames the socket refused
+	pthread_mutex_t	mSendMutex;		// Send synchronization
+};
+
+#endif // URING_TRANSPORT_H
@@ -0,0 +1,576 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#include "Packet.h"
+#include "XdpTransport.h"
+
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/bpf.h>
+#include <linux/filter.h>
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Defines                                                                    //
+//----------------------------------------------------------------------------//
+
+#ifndef AF_XDP
+	#define AF_XDP 44
+#endif
+
+#ifndef SOL_XDP
+	#define SOL_XDP 283
+#endif
+
+#define MAX_QUEUES 64		// Entries in the socket map
+
+
+
+//----------------------------------------------------------------------------//
+// Functions                                                                  //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Performs a BPF system call. </summary>
+
+static int32 Bpf (int32 command, bpf_attr& attr)
+{
+	return syscall (__NR_bpf, command, &attr, sizeof (bpf_attr));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns a single BPF instruction. </summary>
+
+static bpf_insn Insn (uint8 code, uint8 dst, uint8 src, int16 off, int32 imm)
+{
+	bpf_insn insn;
+	insn.code    = code;
+	insn.dst_reg = dst;
+	insn.src_reg = src;
+	insn.off     = off;
+	insn.imm     = imm;
+	return insn;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Loads the program redirecting ORP frames to the socket map. </summary>
+/// <remarks> Returns the program descriptor or -1 on failure. </remarks>
+
+static int32 LoadProgram (int32 map)
+{
+	bpf_insn program[] =
+	{
+		// Keep the context, r2 = data, r3 = data end
+		Insn (BPF_ALU64 | BPF_MOV | BPF_X, 6, 1,  0, 0),
+		Insn (BPF_LDX   | BPF_MEM | BPF_W, 2, 6,  0, 0),
+		Insn (BPF_LDX   | BPF_MEM | BPF_W, 3, 6,  4, 0),
+
+		// Pass frames shorter than the link header
+		Insn (BPF_ALU64 | BPF_MOV | BPF_X, 4, 2,  0, 0),
+		Insn (BPF_ALU64 | BPF_ADD | BPF_K, 4, 0,  0, sizeof (ether_header)),
+		Insn (BPF_JMP   | BPF_JGT | BPF_X, 4, 3,  9, 0),
+
+		// Pass frames which are neither beacons nor messages
+		Insn (BPF_LDX   | BPF_MEM | BPF_H, 4, 2, 12, 0),
+		Insn (BPF_JMP   | BPF_JEQ | BPF_K, 4, 0,  1, htons (Packet::TYPE_BEACON )),
+		Insn (BPF_JMP   | BPF_JNE | BPF_K, 4, 0,  6, htons (Packet::TYPE_MESSAGE)),
+
+		// Redirect to the socket of the receive queue
+		Insn (BPF_LDX   | BPF_MEM | BPF_W, 2, 6, 16, 0),
+		Insn (BPF_LD    | BPF_DW  | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map),
+		Insn (0, 0, 0, 0, 0),
+		Insn (BPF_ALU64 | BPF_MOV | BPF_K, 3, 0,  0, XDP_PASS),
+		Insn (BPF_JMP   | BPF_CALL,        0, 0,  0, BPF_FUNC_redirect_map),
+		Insn (BPF_JMP   | BPF_EXIT,        0, 0,  0, 0),
+
+		// Hand the frame to the network stack
+		Insn (BPF_ALU64 | BPF_MOV | BPF_K, 0, 0,  0, XDP_PASS),
+		Insn (BPF_JMP   | BPF_EXIT,        0, 0,  0, 0),
+	};
+
+	bpf_attr attr;
+	memset (&attr, 0, sizeof (bpf_attr));
+
+	attr.prog_type            = BPF_PROG_TYPE_XDP;
+	attr.expected_attach_type = BPF_XDP;
+	attr.insns                = (uint64) program;
+	attr.insn_cnt             = sizeof (program) / sizeof (bpf_insn);
+	attr.license              = (uint64) "GPL";
+
+	return Bpf (BPF_PROG_LOAD, attr);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Constructors                                                  XdpTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates a new closed transport. </summary>
+
+XdpTransport::XdpTransport (void)
+{
+	mXskID     = -1;
+	mMapID     = -1;
+	mProgID    = -1;
+	mLinkID    = -1;
+	mUmem      = null;
+	mHeldCount = 0;
+
+	mRawReceive = false;
+
+	memset (&mFill, 0, sizeof (Ring));
+	memset (&mDone, 0, sizeof (Ring));
+	memset (&mRx,   0, sizeof (Ring));
+	memset (&mTx,   0, sizeof (Ring));
+
+	pthread_mutex_init (&mTxMutex, null);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Closes the transport. </summary>
+
+XdpTransport::~XdpTransport (void)
+{
+	Close();
+	pthread_mutex_destroy (&mTxMutex);
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Methods                                                       XdpTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Opens the interface, with XDP if it is available. </summary>
+/// <remarks> Fails only if the raw socket could not be opened. </remarks>
+
+Transport::Error XdpTransport::Open (const std::string& interface)
+{
+	Close();
+
+	// The raw socket provides the interface details and the fallback
+	Error error = RawTransport::Open (interface);
+	if (error != ERROR_NONE) return error;
+
+	if (!OpenXdp())
+		CloseXdp();
+
+	return ERROR_NONE;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Detaches the program and closes both sockets. </summary>
+
+void XdpTransport::Close (void)
+{
+	CloseXdp();
+	RawTransport::Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Receives up to count pending frames without blocking. </summary>
+/// <remarks> Frames stay valid until the next call, when they are given
+///           back to the kernel. Frames of the other queues follow. </remarks>
+
+uint32 XdpTransport::Receive (uint32 count, Frame* frames)
+{
+	if (mXskID < 0) return RawTransport::Receive (count, frames);
+	if (count > MaxBatch) count = MaxBatch;
+	uint32 limit = count;
+
+	// Give the previous frames back, the fill ring holds every frame
+	uint32 fill = *mFill.Producer;
+	for (uint32 i = 0; i < mHeldCount; ++i)
+		((uint64*) mFill.Entries)[(fill + i) & (mFill.Size - 1)] = mHeld[i];
+
+	__atomic_store_n (mFill.Producer, fill + mHeldCount, __ATOMIC_RELEASE);
+	mHeldCount = 0;
+
+	uint32 consumer = *mRx.Consumer;
+	uint32 pending  = __atomic_load_n (mRx.Producer, __ATOMIC_ACQUIRE) - consumer;
+	if (pending < count) count = pending;
+
+	for (uint32 i = 0; i < count; ++i)
+	{
+		const xdp_desc& desc = ((xdp_desc*)
+			mRx.Entries)[(consumer + i) & (mRx.Size - 1)];
+
+		frames[i].Data     = mUmem + desc.addr;
+		frames[i].Length   = desc.len;
+		frames[i].Outgoing = false;
+
+		// Frames may start after some headroom
+		mHeld[i] = desc.addr & ~(uint64) (FrameSize - 1);
+	}
+
+	__atomic_store_n (mRx.Consumer, consumer + count, __ATOMIC_RELEASE);
+	mHeldCount = count;
+
+	// The kernel may wait for a wakeup to refill
+	if (count == 0 && (*mFill.Flags & XDP_RING_NEED_WAKEUP))
+		recvfrom (mXskID, null, 0, MSG_DONTWAIT, null, null);
+
+	// Frames passed on by the other queues reach the raw socket
+	if (mRawReceive && count < limit)
+		count += RawTransport::Receive (limit - count, frames + count);
+
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Broadcasts the frame on the interface. </summary>
+/// <remarks> Acquired buffers are sent in place, any other buffer is copied
+///           into a free frame. Frames too long for the UMEM are sent on
+///           the raw socket. </remarks>
+
+bool XdpTransport::Send (const Address& next, uint32 length, const uint8* buffer)
+{
+	bool owned = Owns (buffer);
+	if (!owned && (mXskID < 0 || length > FrameSize))
+		return RawTransport::Send (next, length, buffer);
+
+	pthread_mutex_lock (&mTxMutex);
+	Complete();
+
+	uint64 frame;
+	if (owned) frame = buffer - mUmem;
+
+	elif (!mFree.empty())
+	{
+		frame = mFree.back();
+		mFree.pop_back();
+		memcpy (mUmem + frame, buffer, length);
+	}
+
+	else
+	{
+		pthread_mutex_unlock (&mTxMutex);
+		return false;
+	}
+
+	// Every free frame has a slot, so the ring never overflows
+	uint32 producer = *mTx.Producer;
+	xdp_desc& desc = ((xdp_desc*) mTx.Entries)[producer & (mTx.Size - 1)];
+
+	desc.addr    = frame;
+	desc.len     = length;
+	desc.options = 0;
+
+	__atomic_store_n (mTx.Producer, producer + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock (&mTxMutex);
+
+	// Copy mode only sends once woken
+	if (*mTx.Flags & XDP_RING_NEED_WAKEUP)
+		sendto (mXskID, null, 0, MSG_DONTWAIT, null, 0);
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Lends a free frame to serialize a frame into. </summary>
+/// <remarks> Returns null without XDP, for long frames or when every
+///           frame is in use. </remarks>
+
+uint8* XdpTransport::Acquire (uint32 length)
+{
+	if (mXskID < 0 || length > FrameSize) return null;
+
+	pthread_mutex_lock (&mTxMutex);
+	Complete();
+
+	uint8* result = null;
+	if (!mFree.empty())
+	{
+		result = mUmem + mFree.back();
+		mFree.pop_back();
+	}
+
+	pthread_mutex_unlock (&mTxMutex);
+	return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns a lent frame which will not be sent. </summary>
+
+void XdpTransport::Release (uint8* buffer)
+{
+	if (!Owns (buffer)) return;
+
+	pthread_mutex_lock (&mTxMutex);
+	mFree.push_back (buffer - mUmem);
+	pthread_mutex_unlock (&mTxMutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if frames bypass the network stack. </summary>
+
+bool XdpTransport::IsAccelerated (void) const
+{
+	return mXskID >= 0;
+}
+
+
+
+//----------------------------------------------------------------------------//
+// Internal                                                      XdpTransport //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Creates the socket, its rings and attaches the program. </summary>
+/// <remarks> Returns false if any step fails, CloseXdp then cleans up. </remarks>
+
+bool XdpTransport::OpenXdp (void)
+{
+	mXskID = socket (AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (mXskID < 0) return false;
+
+	// Register the frame memory
+	uint64 length = (uint64) FrameSize * FrameCount;
+	mUmem = (uint8*) mmap (null, length, PROT_READ |
+		PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (mUmem == MAP_FAILED) { mUmem = null; return false; }
+
+	xdp_umem_reg reg;
+	memset (&reg, 0, sizeof (reg));
+	reg.addr       = (uint64) mUmem;
+	reg.len        = length;
+	reg.chunk_size = FrameSize;
+
+	if (setsockopt (mXskID, SOL_XDP, XDP_UMEM_REG, &reg, sizeof (reg)) != 0)
+		return false;
+
+	// Size and map every ring
+	uint32 size = RingSize;
+	if (setsockopt (mXskID, SOL_XDP, XDP_UMEM_FILL_RING,       &size, sizeof (size)) != 0 ||
+		setsockopt (mXskID, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof (size)) != 0 ||
+		setsockopt (mXskID, SOL_XDP, XDP_RX_RING,              &size, sizeof (size)) != 0 ||
+		setsockopt (mXskID, SOL_XDP, XDP_TX_RING,              &size, sizeof (size)) != 0)
+		return false;
+
+	xdp_mmap_offsets off;
+	socklen_t offLength = sizeof (off);
+	if (getsockopt (mXskID, SOL_XDP, XDP_MMAP_OFFSETS, &off, &offLength) != 0)
+		return false;
+
+	if (!MapRing (mFill, XDP_UMEM_PGOFF_FILL_RING, sizeof (uint64),
+			off.fr.producer, off.fr.consumer, off.fr.flags, off.fr.desc) ||
+		!MapRing (mDone, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof (uint64),
+			off.cr.producer, off.cr.consumer, off.cr.flags, off.cr.desc) ||
+		!MapRing (mRx, XDP_PGOFF_RX_RING, sizeof (xdp_desc),
+			off.rx.producer, off.rx.consumer, off.rx.flags, off.rx.desc) ||
+		!MapRing (mTx, XDP_PGOFF_TX_RING, sizeof (xdp_desc),
+			off.tx.producer, off.tx.consumer, off.tx.flags, off.tx.desc))
+		return false;
+
+	// The first half receives, the second half sends
+	uint32 receive = FrameCount / 2;
+	for (uint32 i = 0; i < receive; ++i)
+		((uint64*) mFill.Entries)[i] = (uint64) i * FrameSize;
+
+	__atomic_store_n (mFill.Producer, receive, __ATOMIC_RELEASE);
+
+	mFree.clear();
+	for (uint32 i = receive; i < FrameCount; ++i)
+		mFree.push_back ((uint64) i * FrameSize);
+
+	// Bind to the first queue, without copies if the driver allows
+	sockaddr_xdp sxdp;
+	memset (&sxdp, 0, sizeof (sxdp));
+	sxdp.sxdp_family   = AF_XDP;
+	sxdp.sxdp_ifindex  = mIfIndex;
+	sxdp.sxdp_queue_id = 0;
+	sxdp.sxdp_flags    = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+
+	if (bind (mXskID, (sockaddr*) &sxdp, sizeof (sxdp)) != 0)
+	{
+		sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+		if (bind (mXskID, (sockaddr*) &sxdp, sizeof (sxdp)) != 0)
+			return false;
+	}
+
+	// Create the socket map
+	bpf_attr attr;
+	memset (&attr, 0, sizeof (bpf_attr));
+	attr.map_type    = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size    = sizeof (uint32);
+	attr.value_size  = sizeof (uint32);
+	attr.max_entries = MAX_QUEUES;
+
+	mMapID = Bpf (BPF_MAP_CREATE, attr);
+	if (mMapID < 0) return false;
+
+	uint32 queue = 0;
+	memset (&attr, 0, sizeof (bpf_attr));
+	attr.map_fd = mMapID;
+	attr.key    = (uint64) &queue;
+	attr.value  = (uint64) &mXskID;
+	attr.flags  = BPF_ANY;
+
+	if (Bpf (BPF_MAP_UPDATE_ELEM, attr) != 0)
+		return false;
+
+	mProgID = LoadProgram (mMapID);
+	if (mProgID < 0) return false;
+
+	// Attach in driver mode, or generic mode as on veth
+	memset (&attr, 0, sizeof (bpf_attr));
+	attr.link_create.prog_fd        = mProgID;
+	attr.link_create.target_ifindex = mIfIndex;
+	attr.link_create.attach_type    = BPF_XDP;
+	attr.link_create.flags          = XDP_FLAGS_DRV_MODE;
+
+	mLinkID = Bpf (BPF_LINK_CREATE, attr);
+	if (mLinkID < 0)
+	{
+		attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+		mLinkID = Bpf (BPF_LINK_CREATE, attr);
+		if (mLinkID < 0) return false;
+	}
+
+	// Only the first queue is redirected, frames of any other queue pass
+	// on to the raw socket which must keep receiving them
+	mRawReceive = CountQueues() != 1;
+
+	// Otherwise stop the raw socket from queueing frames nobody reads
+	if (!mRawReceive)
+	{
+		sock_filter drop = { BPF_RET | BPF_K, 0, 0, 0 };
+		sock_fprog filter = { 1, &drop };
+		setsockopt (mSocketID, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof (filter));
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Detaches the program and releases the socket and its memory. </summary>
+
+void XdpTransport::CloseXdp (void)
+{
+	// Closing the link detaches the program
+	if (mLinkID != -1) close (mLinkID);
+	if (mProgID != -1) close (mProgID);
+	if (mMapID  != -1) close (mMapID );
+	if (mXskID  != -1) close (mXskID );
+
+	Ring* rings[] = { &mFill, &mDone, &mRx, &mTx };
+	for (uint32 i = 0; i < 4; ++i)
+	{
+		if (rings[i]->Map != null)
+			munmap (rings[i]->Map, rings[i]->MapLength);
+
+		memset (rings[i], 0, sizeof (Ring));
+	}
+
+	if (mUmem != null)
+		munmap (mUmem, (uint64) FrameSize * FrameCount);
+
+	// Let the raw socket receive again
+	if (mSocketID != -1)
+	{
+		int32 unused = 0;
+		setsockopt (mSocketID, SOL_SOCKET,
+			SO_DETACH_FILTER, &unused, sizeof (unused));
+	}
+
+	mXskID     = -1;
+	mMapID     = -1;
+	mProgID    = -1;
+	mLinkID    = -1;
+	mUmem      = null;
+	mHeldCount = 0;
+
+	mRawReceive = false;
+	mFree.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Maps a ring of the socket into memory. </summary>
+
+bool XdpTransport::MapRing (Ring& ring, uint64 offset, uint32 entry,
+	uint64 producer, uint64 consumer, uint64 flags, uint64 entries)
+{
+	ring.MapLength = entries + (uint64) RingSize * entry;
+	ring.Map = mmap (null, ring.MapLength, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, mXskID, offset);
+
+	if (ring.Map == MAP_FAILED)
+		{ ring.Map = null; return false; }
+
+	uint8* base   = (uint8*) ring.Map;
+	ring.Producer = (uint32*) (base + producer);
+	ring.Consumer = (uint32*) (base + consumer);
+	ring.Flags    = (uint32*) (base + flags   );
+	ring.Entries  = base + entries;
+	ring.Size     = RingSize;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns true if the buffer is a send frame in the UMEM. </summary>
+
+bool XdpTransport::Owns (const uint8* buffer) const
+{
+	return mUmem != null && buffer >= mUmem + (uint64) FrameSize *
+		(FrameCount / 2) && buffer < mUmem + (uint64) FrameSize * FrameCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Frees every frame the kernel has finished sending. </summary>
+/// <remarks> The send lock must be held. </remarks>
+
+void XdpTransport::Complete (void)
+{
+	uint32 consumer = *mDone.Consumer;
+	uint32 done = __atomic_load_n (mDone.Producer, __ATOMIC_ACQUIRE);
+
+	for (; consumer != done; ++consumer)
+		mFree.push_back (((uint64*) mDone.Entries)[consumer & (mDone.Size - 1)]);
+
+	__atomic_store_n (mDone.Consumer, consumer, __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Returns the number of receive queues of the interface. </summary>
+/// <remarks> Returns zero if the number is unknown. </remarks>
+
+uint32 XdpTransport::CountQueues (void) const
+{
+	DIR* queues = opendir (("/sys/class/net/" + mInterface + "/queues").c_str());
+	if (queues == null) return 0;
+
+	uint32 result = 0;
+	dirent* entry;
+
+	while ((entry = readdir (queues)) != null)
+		if (strncmp (entry->d_name, "rx-", 3) == 0) ++result;
+
+	closedir (queues);
+	return result;
+}
@@ -0,0 +1,127 @@
+////////////////////////////////////////////////////////////////////////////////
+// -------------------------------------------------------------------------- //
+//                                                                            //
+//                          Copyright (C) 2012-2013                           //
+//                            github.com/dkrutsko                             //
+//                            github.com/Harrold                              //
+//                            github.com/AbsMechanik                          //
+//                                                                            //
+//                        See LICENSE.md for copyright                        //
+//                                                                            //
+// -------------------------------------------------------------------------- //
+////////////////////////////////////////////////////////////////////////////////
+
+//----------------------------------------------------------------------------//
+// Prefaces                                                                   //
+//----------------------------------------------------------------------------//
+
+#ifndef XDP_TRANSPORT_H
+#define XDP_TRANSPORT_H
+
+#include "RawTransport.h"
+
+#include <vector>
+#include <pthread.h>
+
+
+
+//----------------------------------------------------------------------------//
+// Classes                                                                    //
+//----------------------------------------------------------------------------//
+
+////////////////////////////////////////////////////////////////////////////////
+/// <summary> Sends and receives Ethernet frames through an AF_XDP socket. </summary>
+/// <remarks>
+///   A small XDP program redirects ORP frames arriving on the first
+///   queue of the interface into the socket, bypassing the network stack,
+///   and passes every other frame on. On interfaces with more queues the
+///   raw socket keeps receiving the frames of the other queues, which
+///   are returned after those of the socket. Received and sent frames
+///   live in one UMEM, and buffers lent by Acquire are sent without a
+///   copy. The program is attached in driver mode when supported and in
+///   generic mode otherwise, such as on veth. When XDP is unavailable
+///   the raw socket is used instead. Requires root privileges.
+/// </remarks>
+
+class XdpTransport : public RawTransport
+{
+private:
+	////////////////////////////////////////////////////////////////////////////////
+	/// <summary> Represents a ring shared with the kernel. </summary>
+
+	class Ring
+	{
+	public:
+		// Properties
+		uint32*		Producer;	// Producer index
+		uint32*		Consumer;	// Consumer index
+		uint32*		Flags;		// Ring flags
+		void*		Entries;	// Ring entries
+		uint32		Size;		// Number of entries
+
+		void*		Map;		// Mapped memory
+		uint64		MapLength;	// Length of the mapped memory
+	};
+
+public:
+	// Constructors
+	 XdpTransport				(void);
+	~XdpTransport				(void);
+
+private:
+	XdpTransport				(const XdpTransport& transport) { }
+
+public:
+	// Methods
+	Error			Open		(const std::string& interface);
+	void			Close		(void);
+
+	uint32			Receive		(uint32 count, Frame* frames);
+	bool			Send		(const Address& next,
+								 uint32 length, const uint8* buffer);
+
+	uint8*			Acquire		(uint32 length);
+	void			Release		(uint8* buffer);
+
+	bool			IsAccelerated (void) const;
+
+public:
+	// Constants
+	static const uint32 FrameSize  = 2048;	// Length of a UMEM frame
+	static const uint32 FrameCount = 4096;	// Number of UMEM frames
+	static const uint32 RingSize   = 2048;	// Entries in every ring
+
+private:
+	// Internal
+	bool			OpenXdp		(void);
+	void			CloseXdp	(void);
+	bool			MapRing		(Ring& ring, uint64 offset, uint32 entry,
+								 uint64 producer, uint64 consumer,
+								 uint64 flags, uint64 entries);
+
+	bool			Owns		(const uint8* buffer) const;
+	void			Complete	(void);
+	uint32			CountQueues	(void) const;
+
+private:
+	// Fields
+	int32			mXskID;			// XDP socket descriptor
+	int32			mMapID;			// Socket map descriptor
+	int32			mProgID;		// Program descriptor
+	int32			mLinkID;		// Program attachment descriptor
+	bool			mRawReceive;	// Other queues arrive on the raw socket
+
+	uint8*			mUmem;			// Frames shared by every ring
+	Ring			mFill;			// Frames given to the kernel to receive
+	Ring			mDone;			// Frames the kernel has finished sending
+	Ring			mRx;			// Received frames
+	Ring			mTx;			// Frames to send
+
+	uint64			mHeld[MaxBatch];// Frames lent out by Receive
+	uint32			mHeldCount;		// Number of frames lent out
+
+	std::vector<uint64> mFree;		// Frames free for sending
+	pthread_mutex_t	mTxMutex;		// Send synchronization
+};
+
+#endif // XDP_TRANSPORT_H